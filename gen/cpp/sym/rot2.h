@@ -40,6 +40,12 @@ class Rot2 {
   // This ensures numerical stability as this constructor is called after each codegen operation.
   explicit Rot2(const DataVec& data) : data_(data.normalized()) {}
 
+  // Construct from data vec that is already normalized, such as the storage of a
+  // Rot2, without normalizing it again
+  static Rot2 FromNormalizedData(const DataVec& data) {
+    return Rot2(data, NormalizedTag{});
+  }
+
   // Default construct to identity
   Rot2() : Rot2(GroupOps<Self>::Identity()) {}
 
@@ -194,6 +200,10 @@ class Rot2 {
   }
 
  protected:
+  struct NormalizedTag {};
+
+  Rot2(const DataVec& data, NormalizedTag) : data_(data) {}
+
   DataVec data_;
 };
 
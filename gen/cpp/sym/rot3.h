@@ -40,6 +40,12 @@ class Rot3 {
   // This ensures numerical stability as this constructor is called after each codegen operation.
   explicit Rot3(const DataVec& data) : data_(data.normalized()) {}
 
+  // Construct from data vec that is already normalized, such as the storage of a
+  // Rot3, without normalizing it again
+  static Rot3 FromNormalizedData(const DataVec& data) {
+    return Rot3(data, NormalizedTag{});
+  }
+
   // Default construct to identity
   Rot3() : Rot3(GroupOps<Self>::Identity()) {}
 
@@ -245,6 +251,10 @@ class Rot3 {
   }
 
  protected:
+  struct NormalizedTag {};
+
+  Rot3(const DataVec& data, NormalizedTag) : data_(data) {}
+
   DataVec data_;
 };
 
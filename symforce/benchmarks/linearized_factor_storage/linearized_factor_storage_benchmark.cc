@@ -0,0 +1,170 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+///
+/// Compares the two ways the Linearizer stores linearized dense factors, on a pose graph with many
+/// loop closures:
+///
+///   - heap: each factor has its own dynamically allocated residual, jacobian, hessian, and rhs,
+///     which is what happens for factors created from dynamic size functions
+///   - arena: fixed size factors are evaluated directly into one contiguous, cache line aligned
+///     buffer
+///
+/// Run with:
+///
+///     build/bin/benchmarks/linearized_factor_storage_benchmark
+///
+/// The heap memory held by each Linearizer is logged (on glibc), and the
+/// linearized_factor_storage/relinearize_{heap,arena} entries in the timing results compare
+/// throughput.
+///
+
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <catch2/catch_template_test_macros.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <spdlog/spdlog.h>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/internal/factor_utils.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/tic_toc.h>
+#include <symforce/opt/values.h>
+
+// ----------------------------------------------------------------------------
+// Heap accounting
+// ----------------------------------------------------------------------------
+
+/**
+ * Bytes currently allocated on the heap, or 0 if this is not supported on this platform.  This
+ * uses the allocator's statistics rather than counting calls to operator new, because Eigen
+ * allocates matrix storage with malloc directly.
+ */
+size_t HeapBytesInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// Problem
+// ----------------------------------------------------------------------------
+
+static constexpr const int kNumPoses = 5000;
+static constexpr const int kLoopClosuresPerPose = 10;
+static constexpr const int kNumRelinearizations = 20;
+
+/**
+ * Create a factor that evaluates the given fixed size hessian function, but which the Linearizer
+ * can only store in a separate LinearizedDenseFactor
+ */
+template <typename Scalar, typename Functor>
+sym::Factor<Scalar> HeapBackedFactor(Functor&& func, const std::vector<sym::Key>& keys,
+                                     const std::vector<sym::Key>& keys_to_optimize) {
+  return sym::Factor<Scalar>(
+      [func = std::forward<Functor>(func)](
+          const sym::Values<Scalar>& values, const std::vector<sym::index_entry_t>& keys_to_func,
+          sym::VectorX<Scalar>* residual, sym::MatrixX<Scalar>* jacobian,
+          sym::MatrixX<Scalar>* hessian, sym::VectorX<Scalar>* rhs) {
+        sym::internal::LinearizeHessianFixedDense(func, values, keys_to_func, residual, jacobian,
+                                                  hessian, rhs);
+      },
+      keys, keys_to_optimize);
+}
+
+template <typename Scalar, typename Functor>
+sym::Factor<Scalar> MakeFactor(const bool heap_backed, Functor&& func,
+                               const std::vector<sym::Key>& keys,
+                               const std::vector<sym::Key>& keys_to_optimize) {
+  if (heap_backed) {
+    return HeapBackedFactor<Scalar>(std::forward<Functor>(func), keys, keys_to_optimize);
+  } else {
+    return sym::Factor<Scalar>::Hessian(std::forward<Functor>(func), keys, keys_to_optimize);
+  }
+}
+
+template <typename Scalar>
+std::vector<sym::Factor<Scalar>> BuildFactors(const bool heap_backed, std::mt19937& gen) {
+  std::vector<sym::Factor<Scalar>> factors;
+
+  factors.push_back(MakeFactor<Scalar>(heap_backed, sym::PriorFactorPose3<Scalar>,
+                                       {{'P', 0}, {'T', 0, 0}, 'S', 'e'}, {{'P', 0}}));
+
+  std::uniform_int_distribution<int> offset_distribution(2, 50);
+  for (int i = 0; i < kNumPoses; ++i) {
+    for (int k = 0; k <= kLoopClosuresPerPose; ++k) {
+      // The first factor for each pose is odometry, the rest are loop closures to nearby poses
+      const int j = i + (k == 0 ? 1 : offset_distribution(gen));
+      if (j >= kNumPoses) {
+        continue;
+      }
+
+      factors.push_back(MakeFactor<Scalar>(heap_backed, sym::BetweenFactorPose3<Scalar>,
+                                           {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                           {{'P', i}, {'P', j}}));
+    }
+  }
+
+  return factors;
+}
+
+template <typename Scalar>
+sym::Values<Scalar> BuildValues(const std::vector<sym::Factor<Scalar>>& factors,
+                                std::mt19937& gen) {
+  sym::Values<Scalar> values;
+  for (const auto& factor : factors) {
+    for (const auto& key : factor.AllKeys()) {
+      if ((key.Letter() == 'P' || key.Letter() == 'T') && !values.Has(key)) {
+        values.template Set<sym::Pose3<Scalar>>(key, sym::Random<sym::Pose3<Scalar>>(gen));
+      }
+    }
+  }
+
+  values.template Set<Eigen::Matrix<Scalar, 6, 6>>('S', Eigen::Matrix<Scalar, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilon<Scalar>);
+  return values;
+}
+
+TEMPLATE_TEST_CASE("linearized_factor_storage", "", double, float) {
+  using Scalar = TestType;
+
+  for (const bool heap_backed : {true, false}) {
+    const char* const storage = heap_backed ? "heap" : "arena";
+
+    std::mt19937 gen(42);
+    const std::vector<sym::Factor<Scalar>> factors = BuildFactors<Scalar>(heap_backed, gen);
+    const sym::Values<Scalar> values = BuildValues(factors, gen);
+
+    // Initialize outside of the timed section, and count everything the Linearizer and the
+    // Linearization hold on to afterwards
+    const size_t bytes_before = HeapBytesInUse();
+    sym::Linearizer<Scalar> linearizer("linearized_factor_storage", factors);
+    sym::Linearization<Scalar> linearization;
+    linearizer.Relinearize(values, &linearization);
+
+    spdlog::info("{} ({}): {} factors, {:.1f} MB of heap held by the linearizer", storage,
+                 typeid(Scalar).name(), factors.size(),
+                 (static_cast<double>(HeapBytesInUse()) - bytes_before) / 1e6);
+
+    {
+      SYM_TIME_SCOPE("linearized_factor_storage_{}/relinearize_{}", typeid(Scalar).name(),
+                     storage);
+      for (int i = 0; i < kNumRelinearizations; ++i) {
+        linearizer.Relinearize(values, &linearization);
+      }
+    }
+  }
+}
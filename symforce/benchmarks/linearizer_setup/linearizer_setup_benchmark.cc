@@ -0,0 +1,120 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+///
+/// Measures the time to set up a Linearizer, i.e. to construct it and run the first Relinearize,
+/// which computes the sparsity pattern of the combined problem and the storage offsets of every
+/// factor, on bundle adjustment problems with up to 10M nonzeros in the jacobian.
+///
+/// Run with:
+///
+///     build/bin/benchmarks/linearizer_setup_benchmark
+///
+/// and compare the linearizer_setup/setup_<N>_jacobian_nonzeros entries in the timing results.
+/// The later Relinearize calls are timed separately, as relinearize_<N>_jacobian_nonzeros.
+///
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+#include <spdlog/spdlog.h>
+
+#include <sym/pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/tic_toc.h>
+#include <symforce/opt/values.h>
+
+static constexpr const int kPointsPerCamera = 100;
+static constexpr const int kObservationsPerPoint = 8;
+
+/**
+ * A reprojection-like factor on a camera pose and a point.  The setup time only depends on the
+ * sizes of the keys and the residual, so this uses a simple projection with a first order
+ * jacobian.
+ */
+void ReprojectionFactor(const sym::Pose3d& camera, const Eigen::Vector3d& point,
+                        const Eigen::Vector2d& pixel, Eigen::Vector2d* const res,
+                        Eigen::Matrix<double, 2, 9>* const jac,
+                        Eigen::Matrix<double, 9, 9>* const hess,
+                        Eigen::Matrix<double, 9, 1>* const rhs) {
+  const Eigen::Vector3d point_cam = camera.InverseCompose(point);
+  const double inverse_depth = 1.0 / point_cam.z();
+  *res = point_cam.head<2>() * inverse_depth - pixel;
+
+  Eigen::Matrix<double, 2, 3> projection_jacobian;
+  projection_jacobian << inverse_depth, 0, -point_cam.x() * inverse_depth * inverse_depth, 0,
+      inverse_depth, -point_cam.y() * inverse_depth * inverse_depth;
+  const Eigen::Matrix3d rotation = camera.Rotation().ToRotationMatrix().transpose();
+  Eigen::Matrix3d point_cam_hat;
+  point_cam_hat << 0, -point_cam.z(), point_cam.y(), point_cam.z(), 0, -point_cam.x(),
+      -point_cam.y(), point_cam.x(), 0;
+
+  jac->leftCols<3>() = projection_jacobian * point_cam_hat;
+  jac->middleCols<3>(3) = -projection_jacobian;
+  jac->rightCols<3>() = projection_jacobian * rotation;
+  *hess = jac->transpose() * *jac;
+  *rhs = jac->transpose() * *res;
+}
+
+struct Problem {
+  std::vector<sym::Factord> factors;
+  sym::Valuesd values;
+};
+
+Problem BuildProblem(const int num_cameras, std::mt19937& gen) {
+  const int num_points = num_cameras * kPointsPerCamera / kObservationsPerPoint;
+
+  Problem problem;
+  for (int camera = 0; camera < num_cameras; ++camera) {
+    problem.values.Set<sym::Pose3d>({'C', camera}, sym::Pose3d(sym::Rot3d::Random(gen),
+                                                               Eigen::Vector3d::Zero()));
+  }
+
+  std::uniform_int_distribution<int> camera_distribution(0, num_cameras - 1);
+  for (int point = 0; point < num_points; ++point) {
+    problem.values.Set<Eigen::Vector3d>({'P', point}, Eigen::Vector3d(0, 0, 10));
+    for (int k = 0; k < kObservationsPerPoint; ++k) {
+      const int camera = camera_distribution(gen);
+      const sym::Key pixel_key('x', point, k);
+      problem.values.Set<Eigen::Vector2d>(pixel_key, Eigen::Vector2d::Zero());
+      problem.factors.push_back(sym::Factord::Hessian(ReprojectionFactor,
+                                                      {{'C', camera}, {'P', point}, pixel_key},
+                                                      {{'C', camera}, {'P', point}}));
+    }
+  }
+
+  return problem;
+}
+
+TEST_CASE("linearizer_setup", "") {
+  std::mt19937 gen(42);
+
+  // kPointsPerCamera factors per camera with 18 jacobian nonzeros each, so up to ~10M nonzeros
+  for (const int num_cameras : {50, 500, 5500}) {
+    const Problem problem = BuildProblem(num_cameras, gen);
+    const int jacobian_nonzeros = 18 * static_cast<int>(problem.factors.size());
+    spdlog::info("Setting up {} factors on {} cameras, with {} jacobian nonzeros",
+                 problem.factors.size(), num_cameras, jacobian_nonzeros);
+
+    std::unique_ptr<sym::Linearizer<double>> linearizer;
+    sym::Linearization<double> linearization;
+    {
+      SYM_TIME_SCOPE("linearizer_setup/setup_{}_jacobian_nonzeros", jacobian_nonzeros);
+      linearizer = std::make_unique<sym::Linearizer<double>>("linearizer_setup", problem.factors);
+      linearizer->Relinearize(problem.values, &linearization);
+    }
+
+    {
+      SYM_TIME_SCOPE("linearizer_setup/relinearize_{}_jacobian_nonzeros", jacobian_nonzeros);
+      linearizer->Relinearize(problem.values, &linearization);
+    }
+
+    spdlog::info("Hessian has {} nonzeros in the lower triangle",
+                 linearization.hessian_lower.nonZeros());
+  }
+}
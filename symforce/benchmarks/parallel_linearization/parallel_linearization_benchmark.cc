@@ -0,0 +1,110 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+///
+/// Measures how Linearizer::Relinearize scales with the number of threads used to evaluate
+/// factors, on a pose graph with many loop closures.
+///
+/// Run with:
+///
+///     build/bin/benchmarks/parallel_linearization_benchmark
+///
+/// and compare the parallel_linearization/relinearize_<N>_threads entries in the timing results.
+///
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_template_test_macros.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <spdlog/spdlog.h>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/tic_toc.h>
+#include <symforce/opt/values.h>
+
+static constexpr const int kNumPoses = 5000;
+static constexpr const int kLoopClosuresPerPose = 10;
+static constexpr const int kNumRelinearizations = 20;
+
+template <typename Scalar>
+std::vector<sym::Factor<Scalar>> BuildFactors(std::mt19937& gen) {
+  std::vector<sym::Factor<Scalar>> factors;
+
+  factors.push_back(sym::Factor<Scalar>::Hessian(sym::PriorFactorPose3<Scalar>,
+                                                 {{'P', 0}, {'T', 0, 0}, 'S', 'e'}, {{'P', 0}}));
+
+  std::uniform_int_distribution<int> offset_distribution(2, 50);
+  for (int i = 0; i < kNumPoses; ++i) {
+    for (int k = 0; k <= kLoopClosuresPerPose; ++k) {
+      // The first factor for each pose is odometry, the rest are loop closures to nearby poses
+      const int j = i + (k == 0 ? 1 : offset_distribution(gen));
+      if (j >= kNumPoses) {
+        continue;
+      }
+
+      factors.push_back(sym::Factor<Scalar>::Hessian(sym::BetweenFactorPose3<Scalar>,
+                                                     {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                                     {{'P', i}, {'P', j}}));
+    }
+  }
+
+  return factors;
+}
+
+template <typename Scalar>
+sym::Values<Scalar> BuildValues(const std::vector<sym::Factor<Scalar>>& factors,
+                                std::mt19937& gen) {
+  sym::Values<Scalar> values;
+  for (const auto& factor : factors) {
+    for (const auto& key : factor.AllKeys()) {
+      if ((key.Letter() == 'P' || key.Letter() == 'T') && !values.Has(key)) {
+        values.template Set<sym::Pose3<Scalar>>(key, sym::Random<sym::Pose3<Scalar>>(gen));
+      }
+    }
+  }
+
+  values.template Set<Eigen::Matrix<Scalar, 6, 6>>('S', Eigen::Matrix<Scalar, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilon<Scalar>);
+  return values;
+}
+
+TEMPLATE_TEST_CASE("parallel_linearization", "", double, float) {
+  using Scalar = TestType;
+
+  std::mt19937 gen(42);
+  const std::vector<sym::Factor<Scalar>> factors = BuildFactors<Scalar>(gen);
+  const sym::Values<Scalar> values = BuildValues(factors, gen);
+
+  const int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  spdlog::info("Linearizing {} factors, with up to {} threads", factors.size(), max_threads);
+
+  std::vector<int> thread_counts;
+  for (int num_threads = 1; num_threads < max_threads; num_threads *= 2) {
+    thread_counts.push_back(num_threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  for (const int num_threads : thread_counts) {
+    sym::Linearizer<Scalar> linearizer("parallel_linearization", factors, {}, num_threads);
+    sym::Linearization<Scalar> linearization;
+
+    // Initialize outside of the timed section
+    linearizer.Relinearize(values, &linearization);
+
+    {
+      SYM_TIME_SCOPE("parallel_linearization_{}/relinearize_{}_threads", typeid(Scalar).name(),
+                     num_threads);
+      for (int i = 0; i < kNumRelinearizations; ++i) {
+        linearizer.Relinearize(values, &linearization);
+      }
+    }
+  }
+}
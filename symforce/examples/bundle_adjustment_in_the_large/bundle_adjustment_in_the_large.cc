@@ -9,6 +9,7 @@
 
 #include <sym/pose3.h>
 #include <symforce/opt/factor.h>
+#include <symforce/opt/factor_batch.h>
 #include <symforce/opt/optimizer.h>
 #include <symforce/opt/values.h>
 
@@ -21,23 +22,25 @@ using namespace sym::Keys;
  * Create a `sym::Factor` for the reprojection residual, attached to the given camera and point
  * variables.  It's also attached to fixed entries in the Values for the pixel measurement and the
  * constant EPSILON.
+ *
+ * All the reprojection factors are created from the same `sym::FactorBatch`, so the linearizer can
+ * evaluate them together.
  */
-sym::Factord MakeFactor(int camera, int point, int pixel) {
-  return sym::Factord::Hessian(sym::SnavelyReprojectionFactor<double>,
-                               /* all_keys = */
-                               {
-                                   sym::Key::WithSuper(CAM_T_WORLD, camera),
-                                   sym::Key::WithSuper(INTRINSICS, camera),
-                                   sym::Key::WithSuper(POINT, point),
-                                   sym::Key::WithSuper(PIXEL, pixel),
-                                   EPSILON,
-                               },
-                               /* optimized_keys = */
-                               {
-                                   sym::Key::WithSuper(CAM_T_WORLD, camera),
-                                   sym::Key::WithSuper(INTRINSICS, camera),
-                                   sym::Key::WithSuper(POINT, point),
-                               });
+sym::Factord MakeFactor(const sym::FactorBatchd& batch, int camera, int point, int pixel) {
+  return batch.MakeFactor(/* all_keys = */
+                          {
+                              sym::Key::WithSuper(CAM_T_WORLD, camera),
+                              sym::Key::WithSuper(INTRINSICS, camera),
+                              sym::Key::WithSuper(POINT, point),
+                              sym::Key::WithSuper(PIXEL, pixel),
+                              EPSILON,
+                          },
+                          /* optimized_keys = */
+                          {
+                              sym::Key::WithSuper(CAM_T_WORLD, camera),
+                              sym::Key::WithSuper(INTRINSICS, camera),
+                              sym::Key::WithSuper(POINT, point),
+                          });
 }
 
 /**
@@ -67,6 +70,7 @@ Problem ReadProblem(const std::string& filename) {
   std::vector<sym::Factord> factors;
   sym::Valuesd values;
 
+  const sym::FactorBatchd reprojection_batch(sym::SnavelyReprojectionFactor<double>);
   for (int i = 0; i < num_observations; i++) {
     int camera, point;
     file >> camera;
@@ -76,7 +80,7 @@ Problem ReadProblem(const std::string& filename) {
     file >> px;
     file >> py;
 
-    factors.push_back(MakeFactor(camera, point, i));
+    factors.push_back(MakeFactor(reprojection_batch, camera, point, i));
     values.Set(sym::Key::WithSuper(PIXEL, i), Eigen::Vector2d(px, py));
   }
 
@@ -0,0 +1,11 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./batch_optimizer.h"
+
+// Explicitly instantiate most commonly used batch optimizer templates to allow for faster
+// compilation times.
+template class sym::BatchOptimizer<double>;
+template class sym::BatchOptimizer<float>;
@@ -0,0 +1,182 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "./cholesky/ordering_cache.h"
+#include "./internal/thread_pool.h"
+#include "./optimizer.h"
+
+namespace sym {
+
+namespace internal {
+
+/**
+ * Whether NonlinearSolverType solves with the default SparseCholeskySolver on an
+ * Eigen::SparseMatrix, and can be constructed with one, so that its ordering can be looked up in an
+ * OrderingCache
+ */
+template <typename NonlinearSolverType, typename = void>
+struct SolvesWithSparseCholesky : std::false_type {};
+
+template <typename NonlinearSolverType>
+struct SolvesWithSparseCholesky<
+    NonlinearSolverType,
+    std::enable_if_t<
+        std::is_same<typename NonlinearSolverType::LinearSolver,
+                     SparseCholeskySolver<Eigen::SparseMatrix<
+                         typename NonlinearSolverType::Scalar>>>::value &&
+        std::is_constructible<NonlinearSolverType, const optimizer_params_t&, const std::string&,
+                              typename NonlinearSolverType::Scalar,
+                              const typename NonlinearSolverType::LinearSolver&>::value>>
+    : std::true_type {};
+
+}  // namespace internal
+
+/**
+ * Class for optimizing many independent problems with the same structure, i.e. the same factors
+ * applied to Values with the same keys (inserted in the same order) and only different data.
+ *
+ * A single Optimizer redoes all of its setup - the index of the Values, the Linearizer's index
+ * helpers and sparsity patterns, the fill-reducing ordering and the symbolic factorization of the
+ * hessian - whenever it is given a Values that is not a copy of the one it was set up with.  The
+ * BatchOptimizer instead keeps one Optimizer per thread, each with a Values that the data of every
+ * problem is copied into, so that setup happens once per thread instead of once per problem.  The
+ * fill-reducing ordering is shared between all of the threads through an OrderingCache, if the
+ * linear solver is the default SparseCholeskySolver, so it is computed once in total.
+ *
+ * Problems are solved concurrently on optimizer_params_t::num_threads threads, each running a
+ * single threaded Optimizer.  The results do not depend on the number of threads, and are the
+ * same as optimizing each problem with its own Optimizer.
+ *
+ * Example usage:
+ *
+ *   // One Values per problem, e.g. one pose per object
+ *   std::vector<sym::Valuesd> problems = ...;
+ *
+ *   sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+ *   params.num_threads = 8;
+ *   sym::BatchOptimizer<double> optimizer(params, factors);
+ *   const std::vector<sym::OptimizationStatsd> stats = optimizer.Optimize(&problems);
+ *
+ * The factors are copied into each thread's Optimizer, so they must not share mutable state that
+ * is unsafe to access from multiple threads.
+ *
+ * Not thread safe!  Optimize must not be called concurrently on the same BatchOptimizer.
+ */
+template <typename ScalarType, typename NonlinearSolverType = LevenbergMarquardtSolver<ScalarType>>
+class BatchOptimizer {
+ public:
+  using Scalar = ScalarType;
+  using NonlinearSolver = NonlinearSolverType;
+  using OptimizerType = Optimizer<Scalar, NonlinearSolver>;
+
+  /**
+   * Constructor that copies in factors and keys
+   *
+   * Args:
+   *     ordering_cache: The cache of orderings to share between the threads, which may also be
+   *                     shared with other solvers, or loaded from disk.  If nullptr (the default),
+   *                     a new cache is created.  Unused if the linear solver is not the default
+   *                     SparseCholeskySolver.
+   */
+  BatchOptimizer(const optimizer_params_t& params, const std::vector<Factor<Scalar>>& factors,
+                 const Scalar epsilon = 1e-9, const std::string& name = "sym::BatchOptimize",
+                 const std::vector<Key>& keys = {},
+                 std::shared_ptr<sym::OrderingCache> ordering_cache = nullptr);
+
+  // This cannot be moved or copied because the optimizers cannot
+  BatchOptimizer(BatchOptimizer&&) = delete;
+  BatchOptimizer& operator=(BatchOptimizer&&) = delete;
+  BatchOptimizer(const BatchOptimizer&) = delete;
+  BatchOptimizer& operator=(const BatchOptimizer&) = delete;
+
+  /**
+   * Optimize each of the given values in-place
+   *
+   * All of the values must have the same structure as the values passed to the first call.
+   *
+   * Args:
+   *     num_iterations: If < 0 (the default), uses the number of iterations specified by the params
+   *                     at construction
+   *     populate_best_linearization: If true, the linearization at the best values will be filled
+   *                                  out in the stats
+   *
+   * Returns:
+   *     The optimization stats of each problem
+   */
+  std::vector<OptimizationStats<Scalar>> Optimize(std::vector<Values<Scalar>>* values,
+                                                  int num_iterations = -1,
+                                                  bool populate_best_linearization = false);
+
+  /**
+   * Optimize each of the given values in-place
+   *
+   * This overload takes the stats as an argument, and stores into there.  stats is resized to the
+   * number of problems, and entries that already exist are reused as in Optimizer::Optimize.  If
+   * passed, stats must not be nullptr.
+   */
+  void Optimize(std::vector<Values<Scalar>>* values, int num_iterations,
+                bool populate_best_linearization, std::vector<OptimizationStats<Scalar>>* stats);
+
+  /**
+   * Number of problems solved concurrently
+   */
+  int NumThreads() const;
+
+  /**
+   * Get the optimized keys
+   */
+  const std::vector<Key>& Keys() const;
+
+  /**
+   * Get the cache of orderings shared between the threads
+   */
+  const std::shared_ptr<sym::OrderingCache>& OrderingCache() const;
+
+ private:
+  // The state of one thread
+  struct Worker {
+    std::unique_ptr<OptimizerType> optimizer;
+
+    // The values that each problem solved by this worker is copied into, so that the caches of the
+    // optimizer, which are keyed on Values::Id, are reused.  Empty until the first problem.
+    Values<Scalar> values;
+    index_t index;
+  };
+
+  std::unique_ptr<OptimizerType> MakeOptimizer(const optimizer_params_t& params,
+                                               std::true_type /* solves_with_sparse_cholesky */);
+  std::unique_ptr<OptimizerType> MakeOptimizer(const optimizer_params_t& params,
+                                               std::false_type /* solves_with_sparse_cholesky */);
+
+  // Solve one problem on the given worker
+  void OptimizeOne(Worker* worker, Values<Scalar>* values, int num_iterations,
+                   bool populate_best_linearization, OptimizationStats<Scalar>* stats);
+
+  std::vector<Factor<Scalar>> factors_;
+  Scalar epsilon_;
+  std::string name_;
+  std::vector<Key> keys_;
+  std::shared_ptr<sym::OrderingCache> ordering_cache_;
+
+  std::vector<Worker> workers_;
+  internal::ThreadPool thread_pool_;
+
+  // Whether a problem has been solved, and so the ordering is in the cache
+  bool have_solved_{false};
+};
+
+// Shorthand instantiations
+using BatchOptimizerd = BatchOptimizer<double>;
+using BatchOptimizerf = BatchOptimizer<float>;
+
+}  // namespace sym
+
+#include "./batch_optimizer.tcc"
@@ -0,0 +1,141 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <atomic>
+
+#include "./batch_optimizer.h"
+
+namespace sym {
+
+template <typename ScalarType, typename NonlinearSolverType>
+BatchOptimizer<ScalarType, NonlinearSolverType>::BatchOptimizer(
+    const optimizer_params_t& params, const std::vector<Factor<Scalar>>& factors,
+    const Scalar epsilon, const std::string& name, const std::vector<Key>& keys,
+    std::shared_ptr<sym::OrderingCache> ordering_cache)
+    : factors_(factors),
+      epsilon_(epsilon),
+      name_(name),
+      keys_(keys.empty() ? ComputeKeysToOptimize(factors_) : keys),
+      ordering_cache_(ordering_cache != nullptr ? std::move(ordering_cache)
+                                                : std::make_shared<sym::OrderingCache>()),
+      workers_(std::max(params.num_threads, 1)),
+      thread_pool_(params.num_threads) {
+  // Each problem is solved on a single thread
+  optimizer_params_t worker_params = params;
+  worker_params.num_threads = 1;
+
+  for (Worker& worker : workers_) {
+    worker.optimizer = MakeOptimizer(
+        worker_params, internal::SolvesWithSparseCholesky<NonlinearSolverType>{});
+  }
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+std::vector<OptimizationStats<ScalarType>>
+BatchOptimizer<ScalarType, NonlinearSolverType>::Optimize(
+    std::vector<Values<Scalar>>* const values, const int num_iterations,
+    const bool populate_best_linearization) {
+  std::vector<OptimizationStats<Scalar>> stats;
+  Optimize(values, num_iterations, populate_best_linearization, &stats);
+  return stats;
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+void BatchOptimizer<ScalarType, NonlinearSolverType>::Optimize(
+    std::vector<Values<Scalar>>* const values, const int num_iterations,
+    const bool populate_best_linearization, std::vector<OptimizationStats<Scalar>>* const stats) {
+  SYM_TIME_SCOPE("BatchOptimizer<{}>::Optimize", name_);
+  SYM_ASSERT(values != nullptr);
+  SYM_ASSERT(stats != nullptr);
+
+  const int num_problems = static_cast<int>(values->size());
+  stats->resize(num_problems);
+  if (num_problems == 0) {
+    return;
+  }
+
+  // Solve the first problem before starting the other threads, so that its ordering is in the
+  // cache and the other threads do not each compute it
+  int first_parallel_problem = 0;
+  if (!have_solved_) {
+    OptimizeOne(&workers_[0], &(*values)[0], num_iterations, populate_best_linearization,
+                &(*stats)[0]);
+    have_solved_ = true;
+    first_parallel_problem = 1;
+  }
+
+  // One task per worker, each of which claims problems until there are none left
+  std::atomic<int> next_problem{first_parallel_problem};
+  thread_pool_.Run(NumThreads(), [&](const int worker_index) {
+    Worker& worker = workers_[worker_index];
+    for (int i = next_problem++; i < num_problems; i = next_problem++) {
+      OptimizeOne(&worker, &(*values)[i], num_iterations, populate_best_linearization,
+                  &(*stats)[i]);
+    }
+  });
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+int BatchOptimizer<ScalarType, NonlinearSolverType>::NumThreads() const {
+  return static_cast<int>(workers_.size());
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+const std::vector<Key>& BatchOptimizer<ScalarType, NonlinearSolverType>::Keys() const {
+  return workers_[0].optimizer->Keys();
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+const std::shared_ptr<sym::OrderingCache>&
+BatchOptimizer<ScalarType, NonlinearSolverType>::OrderingCache() const {
+  return ordering_cache_;
+}
+
+// ----------------------------------------------------------------------------
+// Private methods
+// ----------------------------------------------------------------------------
+
+template <typename ScalarType, typename NonlinearSolverType>
+std::unique_ptr<Optimizer<ScalarType, NonlinearSolverType>>
+BatchOptimizer<ScalarType, NonlinearSolverType>::MakeOptimizer(
+    const optimizer_params_t& params, std::true_type /* solves_with_sparse_cholesky */) {
+  using LinearSolver = typename NonlinearSolver::LinearSolver;
+  using MatrixType = typename LinearSolver::MatrixType;
+
+  // The same ordering as the default SparseCholeskySolver, looked up in the shared cache
+  const LinearSolver linear_solver(CachedOrdering<MatrixType>(
+      Eigen::MetisOrdering<typename MatrixType::StorageIndex>(), "metis", ordering_cache_));
+  return std::make_unique<OptimizerType>(params, factors_, epsilon_, name_, keys_,
+                                         /* debug_stats */ false, /* check_derivatives */ false,
+                                         linear_solver);
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+std::unique_ptr<Optimizer<ScalarType, NonlinearSolverType>>
+BatchOptimizer<ScalarType, NonlinearSolverType>::MakeOptimizer(
+    const optimizer_params_t& params, std::false_type /* solves_with_sparse_cholesky */) {
+  return std::make_unique<OptimizerType>(params, factors_, epsilon_, name_, keys_);
+}
+
+template <typename ScalarType, typename NonlinearSolverType>
+void BatchOptimizer<ScalarType, NonlinearSolverType>::OptimizeOne(
+    Worker* const worker, Values<Scalar>* const values, const int num_iterations,
+    const bool populate_best_linearization, OptimizationStats<Scalar>* const stats) {
+  if (worker->values.NumEntries() == 0) {
+    worker->values = *values;
+    worker->index = worker->values.CreateIndex(worker->values.Keys());
+  } else {
+    // Same structure as the first problem, so this is a copy of the data that keeps the Id of the
+    // worker's values
+    SYM_ASSERT(values->Data().size() == worker->values.Data().size());
+    worker->values.Update(worker->index, *values);
+  }
+
+  worker->optimizer->Optimize(&worker->values, num_iterations, populate_best_linearization, stats);
+  values->Update(worker->index, worker->values);
+}
+
+}  // namespace sym
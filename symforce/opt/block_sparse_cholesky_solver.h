@@ -0,0 +1,129 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/MetisSupport>
+#include <Eigen/Sparse>
+
+#include "./assert.h"
+#include "./block_sparse_matrix.h"
+
+namespace sym {
+
+// Solves A * x = b, where A is a symmetric positive definite BlockSparseMatrix and b is a dense
+// vector or matrix, using the block cholesky factorization P * A * P^T = L * L^T.
+//
+// The ordering, the elimination tree and the sparsity of L are all computed on the graph of
+// blocks, and L is stored as a BlockSparseMatrix with the same blocks as A (in permuted order).
+// The numeric factorization is left-looking over block columns, and every update is a dense
+// matrix product between blocks, so there is no scalar index arithmetic in the inner loops.
+//
+// Has the same interface as SparseCholeskySolver, so it can be used as the LinearSolverType of a
+// LevenbergMarquardtSolver, with a Linearizer that builds block sparse hessians (see
+// Linearizer::SetBlockSparseHessian).
+template <typename ScalarType>
+class BlockSparseCholeskySolver {
+ public:
+  using Scalar = ScalarType;
+  using MatrixType = BlockSparseMatrix<Scalar>;
+  using StorageIndex = typename MatrixType::StorageIndex;
+  using RhsType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using PermutationMatrixType =
+      Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+  using Ordering = std::function<void(const Eigen::SparseMatrix<Scalar>&, PermutationMatrixType&)>;
+
+  // Args:
+  //     ordering: Functor to compute the ordering of the blocks, with the same signature as the
+  //         orderings accepted by SparseCholeskySolver.  It's passed the full symmetric pattern of
+  //         the blocks of A, with one row and column per block.
+  explicit BlockSparseCholeskySolver(
+      const Ordering& ordering = Eigen::MetisOrdering<StorageIndex>())
+      : ordering_(ordering) {}
+
+  // Whether we have computed a symbolic sparsity and are ready to factorize/solve.
+  bool IsInitialized() const {
+    return is_initialized_;
+  }
+
+  // Compute the block ordering and the block sparsity of L for A, and store internally.
+  void ComputeSymbolicSparsity(const MatrixType& A);
+
+  // Decompose A into P * A * P^T = L * L^T and store internally.  A must have the same block
+  // sparsity as the matrix passed to ComputeSymbolicSparsity.  Returns false if A is not positive
+  // definite, in which case the factorization is invalid.
+  bool Factorize(const MatrixType& A);
+
+  // Returns x for A x = b, where x and b are dense
+  template <typename Rhs>
+  RhsType Solve(const Eigen::MatrixBase<Rhs>& b) const;
+
+  // Solves in place for x in A x = b, where x and b are dense
+  template <typename Rhs>
+  void SolveInPlace(Eigen::MatrixBase<Rhs>* b) const;
+
+  // The factor L, with the blocks of A in permuted order
+  const MatrixType& BlockL() const {
+    SYM_ASSERT(IsInitialized());
+    return L_;
+  }
+
+  // The factor L as a scalar sparse matrix.  This is converted from BlockL() on every call.
+  Eigen::SparseMatrix<Scalar> L() const {
+    SYM_ASSERT(IsInitialized());
+    return L_.ToSparse();
+  }
+
+  // The permutation of the scalar rows and columns of A
+  const PermutationMatrixType& Permutation() const {
+    SYM_ASSERT(IsInitialized());
+    return permutation_;
+  }
+
+  const PermutationMatrixType& InversePermutation() const {
+    SYM_ASSERT(IsInitialized());
+    return inv_permutation_;
+  }
+
+  // The permutation of the blocks of A
+  const PermutationMatrixType& BlockPermutation() const {
+    SYM_ASSERT(IsInitialized());
+    return block_permutation_;
+  }
+
+ private:
+  bool is_initialized_{false};
+
+  Ordering ordering_;
+
+  // Permutations of the blocks and of the scalar rows and columns
+  PermutationMatrixType block_permutation_;
+  PermutationMatrixType permutation_;
+  PermutationMatrixType inv_permutation_;
+
+  // The factor, computed by Factorize
+  MatrixType L_;
+
+  // For each block of A, the block of L it is added to, and whether it's transposed on the way
+  std::vector<StorageIndex> A_block_targets_;
+  std::vector<uint8_t> A_block_transposed_;
+
+  // The blocks in each block row of L, left of the diagonal, in order of their block columns, as
+  // the block column and the index of the block in L
+  std::vector<StorageIndex> row_starts_;
+  std::vector<StorageIndex> row_block_cols_;
+  std::vector<StorageIndex> row_block_indices_;
+
+  // For the block column of L being factorized, the index of the block in each block row
+  std::vector<StorageIndex> column_block_for_row_;
+};
+
+}  // namespace sym
+
+#include "./block_sparse_cholesky_solver.tcc"
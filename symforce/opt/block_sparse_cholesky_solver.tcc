@@ -0,0 +1,255 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+
+#include "./assert.h"
+#include "./block_sparse_cholesky_solver.h"
+
+namespace sym {
+
+template <typename ScalarType>
+void BlockSparseCholeskySolver<ScalarType>::ComputeSymbolicSparsity(const MatrixType& A) {
+  const StorageIndex num_blocks = A.NumBlockCols();
+  const std::vector<StorageIndex>& A_column_starts = A.ColumnStarts();
+  const std::vector<StorageIndex>& A_row_blocks = A.RowBlocks();
+
+  // Order the blocks, from the full symmetric pattern of the blocks
+  {
+    std::vector<Eigen::Triplet<Scalar, StorageIndex>> pattern_triplets;
+    pattern_triplets.reserve(2 * A.NumBlocks());
+    for (StorageIndex col = 0; col < num_blocks; ++col) {
+      for (StorageIndex k = A_column_starts[col]; k < A_column_starts[col + 1]; ++k) {
+        pattern_triplets.emplace_back(A_row_blocks[k], col, Scalar{1});
+        if (A_row_blocks[k] != col) {
+          pattern_triplets.emplace_back(col, A_row_blocks[k], Scalar{1});
+        }
+      }
+    }
+    Eigen::SparseMatrix<Scalar> pattern(num_blocks, num_blocks);
+    pattern.setFromTriplets(pattern_triplets.begin(), pattern_triplets.end());
+
+    PermutationMatrixType inv_block_permutation;
+    ordering_(pattern, inv_block_permutation);
+    if (inv_block_permutation.size() == 0) {
+      inv_block_permutation.setIdentity(num_blocks);
+    }
+    block_permutation_ = inv_block_permutation.inverse();
+  }
+  const auto& new_block = block_permutation_.indices();
+
+  // Expand the block permutation to the scalar rows and columns
+  std::vector<StorageIndex> permuted_dims(num_blocks);
+  for (StorageIndex block = 0; block < num_blocks; ++block) {
+    permuted_dims[new_block[block]] = A.BlockDim(block);
+  }
+  std::vector<StorageIndex> permuted_offsets(num_blocks + 1, 0);
+  std::partial_sum(permuted_dims.begin(), permuted_dims.end(), permuted_offsets.begin() + 1);
+
+  permutation_.resize(A.Rows());
+  for (StorageIndex block = 0; block < num_blocks; ++block) {
+    for (StorageIndex i = 0; i < A.BlockDim(block); ++i) {
+      permutation_.indices()[A.BlockOffset(block) + i] = permuted_offsets[new_block[block]] + i;
+    }
+  }
+  inv_permutation_ = permutation_.inverse();
+
+  // The blocks of A below the diagonal of each permuted block column
+  std::vector<std::vector<StorageIndex>> A_rows_for_col(num_blocks);
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    for (StorageIndex k = A_column_starts[col]; k < A_column_starts[col + 1]; ++k) {
+      const StorageIndex permuted_row = new_block[A_row_blocks[k]];
+      const StorageIndex permuted_col = new_block[col];
+      if (permuted_row != permuted_col) {
+        A_rows_for_col[std::min(permuted_row, permuted_col)].push_back(
+            std::max(permuted_row, permuted_col));
+      }
+    }
+  }
+
+  // Symbolic factorization on the block elimination tree: the pattern of each column of L is the
+  // pattern of the column of A, merged with the patterns of its children in the tree
+  std::vector<std::vector<StorageIndex>> L_rows_for_col(num_blocks);
+  std::vector<std::vector<StorageIndex>> children(num_blocks);
+  std::vector<StorageIndex> marker(num_blocks, -1);
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    std::vector<StorageIndex>& rows = L_rows_for_col[col];
+    marker[col] = col;
+    const auto add_row = [&](const StorageIndex row) {
+      if (marker[row] != col) {
+        marker[row] = col;
+        rows.push_back(row);
+      }
+    };
+
+    for (const StorageIndex row : A_rows_for_col[col]) {
+      add_row(row);
+    }
+    for (const StorageIndex child : children[col]) {
+      for (const StorageIndex row : L_rows_for_col[child]) {
+        add_row(row);
+      }
+    }
+
+    std::sort(rows.begin(), rows.end());
+    if (!rows.empty()) {
+      children[rows.front()].push_back(col);
+    }
+  }
+
+  std::vector<StorageIndex> L_column_starts = {0};
+  std::vector<StorageIndex> L_row_blocks;
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    L_row_blocks.push_back(col);
+    L_row_blocks.insert(L_row_blocks.end(), L_rows_for_col[col].begin(),
+                        L_rows_for_col[col].end());
+    L_column_starts.push_back(static_cast<StorageIndex>(L_row_blocks.size()));
+  }
+  L_ = MatrixType(std::move(permuted_dims), std::move(L_column_starts), std::move(L_row_blocks));
+
+  // Where each block of A goes in L
+  A_block_targets_.resize(A.NumBlocks());
+  A_block_transposed_.resize(A.NumBlocks());
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    for (StorageIndex k = A_column_starts[col]; k < A_column_starts[col + 1]; ++k) {
+      const StorageIndex permuted_row = new_block[A_row_blocks[k]];
+      const StorageIndex permuted_col = new_block[col];
+      A_block_transposed_[k] = permuted_row < permuted_col;
+      A_block_targets_[k] = L_.FindBlock(std::max(permuted_row, permuted_col),
+                                         std::min(permuted_row, permuted_col));
+      SYM_ASSERT(A_block_targets_[k] >= 0);
+    }
+  }
+
+  // The row structure of L, for the left-looking factorization
+  row_starts_.assign(num_blocks + 1, 0);
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    for (StorageIndex k = L_.ColumnStarts()[col] + 1; k < L_.ColumnStarts()[col + 1]; ++k) {
+      row_starts_[L_.RowBlocks()[k] + 1] += 1;
+    }
+  }
+  std::partial_sum(row_starts_.begin(), row_starts_.end(), row_starts_.begin());
+  row_block_cols_.resize(row_starts_.back());
+  row_block_indices_.resize(row_starts_.back());
+  std::vector<StorageIndex> next = row_starts_;
+  for (StorageIndex col = 0; col < num_blocks; ++col) {
+    for (StorageIndex k = L_.ColumnStarts()[col] + 1; k < L_.ColumnStarts()[col + 1]; ++k) {
+      const StorageIndex row = L_.RowBlocks()[k];
+      row_block_cols_[next[row]] = col;
+      row_block_indices_[next[row]] = k;
+      ++next[row];
+    }
+  }
+
+  column_block_for_row_.assign(num_blocks, -1);
+
+  is_initialized_ = true;
+}
+
+template <typename ScalarType>
+bool BlockSparseCholeskySolver<ScalarType>::Factorize(const MatrixType& A) {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A.NumBlocks() == static_cast<StorageIndex>(A_block_targets_.size()));
+
+  // Scatter A into L
+  L_.SetZero();
+  for (StorageIndex k = 0; k < A.NumBlocks(); ++k) {
+    if (A_block_transposed_[k]) {
+      L_.Block(A_block_targets_[k]) += A.Block(k).transpose();
+    } else {
+      L_.Block(A_block_targets_[k]) += A.Block(k);
+    }
+  }
+
+  bool success = true;
+  const std::vector<StorageIndex>& column_starts = L_.ColumnStarts();
+  const std::vector<StorageIndex>& row_blocks = L_.RowBlocks();
+  for (StorageIndex col = 0; col < L_.NumBlockCols(); ++col) {
+    const StorageIndex diagonal = column_starts[col];
+    const StorageIndex column_end = column_starts[col + 1];
+    for (StorageIndex k = diagonal; k < column_end; ++k) {
+      column_block_for_row_[row_blocks[k]] = k;
+    }
+
+    // Subtract the contributions of every column left of this one with a block in this row, i.e.
+    // L(i, col) -= L(i, left) * L(col, left)^T for all blocks L(i, left) with i >= col
+    for (StorageIndex r = row_starts_[col]; r < row_starts_[col + 1]; ++r) {
+      const StorageIndex left_col_block = row_block_indices_[r];
+      const StorageIndex left_column_end = column_starts[row_block_cols_[r] + 1];
+      const auto L_col_left = L_.Block(left_col_block);
+
+      L_.Block(diagonal).template selfadjointView<Eigen::Lower>().rankUpdate(L_col_left, -1);
+      for (StorageIndex k = left_col_block + 1; k < left_column_end; ++k) {
+        L_.Block(column_block_for_row_[row_blocks[k]]).noalias() -=
+            L_.Block(k) * L_col_left.transpose();
+      }
+    }
+
+    // Factorize the diagonal block in place, and solve for the blocks below it
+    auto L_diagonal = L_.Block(diagonal);
+    Eigen::LLT<Eigen::Ref<MatrixX<Scalar>>> llt(L_diagonal);
+    success = success && llt.info() == Eigen::Success;
+    for (StorageIndex k = diagonal + 1; k < column_end; ++k) {
+      auto L_block = L_.Block(k);
+      L_diagonal.template triangularView<Eigen::Lower>()
+          .transpose()
+          .template solveInPlace<Eigen::OnTheRight>(L_block);
+    }
+  }
+
+  return success;
+}
+
+template <typename ScalarType>
+template <typename Rhs>
+typename BlockSparseCholeskySolver<ScalarType>::RhsType
+BlockSparseCholeskySolver<ScalarType>::Solve(const Eigen::MatrixBase<Rhs>& b) const {
+  RhsType x = b;
+  SolveInPlace(&x);
+  return x;
+}
+
+template <typename ScalarType>
+template <typename Rhs>
+void BlockSparseCholeskySolver<ScalarType>::SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(b != nullptr);
+  SYM_ASSERT(b->rows() == L_.Rows());
+
+  Eigen::MatrixBase<Rhs>& x = *b;
+  x = permutation_ * x;
+
+  const std::vector<StorageIndex>& column_starts = L_.ColumnStarts();
+  const std::vector<StorageIndex>& row_blocks = L_.RowBlocks();
+
+  // Forward substitution, L y = P b
+  for (StorageIndex col = 0; col < L_.NumBlockCols(); ++col) {
+    auto x_col = x.middleRows(L_.BlockOffset(col), L_.BlockDim(col));
+    L_.Block(column_starts[col]).template triangularView<Eigen::Lower>().solveInPlace(x_col);
+    for (StorageIndex k = column_starts[col] + 1; k < column_starts[col + 1]; ++k) {
+      x.middleRows(L_.BlockOffset(row_blocks[k]), L_.BlockDim(row_blocks[k])).noalias() -=
+          L_.Block(k) * x_col;
+    }
+  }
+
+  // Backward substitution, L^T z = y
+  for (StorageIndex col = L_.NumBlockCols() - 1; col >= 0; --col) {
+    auto x_col = x.middleRows(L_.BlockOffset(col), L_.BlockDim(col));
+    for (StorageIndex k = column_starts[col] + 1; k < column_starts[col + 1]; ++k) {
+      x_col.noalias() -= L_.Block(k).transpose() *
+                         x.middleRows(L_.BlockOffset(row_blocks[k]), L_.BlockDim(row_blocks[k]));
+    }
+    L_.Block(column_starts[col]).transpose().template triangularView<Eigen::Upper>().solveInPlace(
+        x_col);
+  }
+
+  // x = P^T z
+  x = inv_permutation_ * x;
+}
+
+}  // namespace sym
@@ -0,0 +1,296 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./block_sparse_matrix.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "./assert.h"
+
+namespace sym {
+
+template <typename Scalar>
+BlockSparseMatrix<Scalar>::BlockSparseMatrix(std::vector<StorageIndex> block_dims,
+                                             std::vector<StorageIndex> column_starts,
+                                             std::vector<StorageIndex> row_blocks)
+    : block_dims_(std::move(block_dims)),
+      column_starts_(std::move(column_starts)),
+      row_blocks_(std::move(row_blocks)) {
+  const StorageIndex num_block_cols = static_cast<StorageIndex>(block_dims_.size());
+  SYM_ASSERT(static_cast<StorageIndex>(column_starts_.size()) == num_block_cols + 1);
+  SYM_ASSERT(column_starts_.front() == 0);
+  SYM_ASSERT(column_starts_.back() == static_cast<StorageIndex>(row_blocks_.size()));
+
+  block_offsets_.resize(num_block_cols + 1);
+  block_offsets_[0] = 0;
+  std::partial_sum(block_dims_.begin(), block_dims_.end(), block_offsets_.begin() + 1);
+
+  value_offsets_.resize(row_blocks_.size() + 1);
+  value_offsets_[0] = 0;
+  for (StorageIndex col = 0; col < num_block_cols; ++col) {
+    SYM_ASSERT(column_starts_[col] < column_starts_[col + 1]);
+    SYM_ASSERT(row_blocks_[column_starts_[col]] == col);
+    for (StorageIndex k = column_starts_[col]; k < column_starts_[col + 1]; ++k) {
+      SYM_ASSERT(k == column_starts_[col] || row_blocks_[k - 1] < row_blocks_[k]);
+      SYM_ASSERT(row_blocks_[k] < num_block_cols);
+      value_offsets_[k + 1] = value_offsets_[k] + block_dims_[row_blocks_[k]] * block_dims_[col];
+    }
+  }
+
+  values_.setZero(value_offsets_.back());
+}
+
+template <typename Scalar>
+BlockSparseMatrix<Scalar> BlockSparseMatrix<Scalar>::FromSparse(
+    const Eigen::SparseMatrix<Scalar>& lower, const std::vector<StorageIndex>& block_dims) {
+  std::vector<StorageIndex> block_for_offset;
+  for (StorageIndex block = 0; block < static_cast<StorageIndex>(block_dims.size()); ++block) {
+    block_for_offset.insert(block_for_offset.end(), block_dims[block], block);
+  }
+  SYM_ASSERT(lower.rows() == static_cast<Eigen::Index>(block_for_offset.size()));
+  SYM_ASSERT(lower.cols() == static_cast<Eigen::Index>(block_for_offset.size()));
+
+  // Block rows touched by each block column, in addition to the diagonal
+  std::vector<std::vector<StorageIndex>> rows_for_col(block_dims.size());
+  for (StorageIndex col_block = 0; col_block < static_cast<StorageIndex>(block_dims.size());
+       ++col_block) {
+    rows_for_col[col_block].push_back(col_block);
+  }
+  for (Eigen::Index col = 0; col < lower.outerSize(); ++col) {
+    for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(lower, col); it; ++it) {
+      if (it.row() > col) {
+        rows_for_col[block_for_offset[col]].push_back(block_for_offset[it.row()]);
+      }
+    }
+  }
+
+  std::vector<StorageIndex> column_starts = {0};
+  std::vector<StorageIndex> row_blocks;
+  for (std::vector<StorageIndex>& rows : rows_for_col) {
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    row_blocks.insert(row_blocks.end(), rows.begin(), rows.end());
+    column_starts.push_back(static_cast<StorageIndex>(row_blocks.size()));
+  }
+
+  BlockSparseMatrix result(block_dims, std::move(column_starts), std::move(row_blocks));
+  for (Eigen::Index col = 0; col < lower.outerSize(); ++col) {
+    for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(lower, col); it; ++it) {
+      if (it.row() >= col) {
+        result.values_[result.StorageOffset(it.row(), col)] = it.value();
+      }
+    }
+  }
+
+  return result;
+}
+
+template <typename Scalar>
+Eigen::SparseMatrix<Scalar> BlockSparseMatrix<Scalar>::ToSparse() const {
+  const StorageIndex N = Rows();
+
+  Eigen::SparseMatrix<Scalar> result(N, N);
+  std::vector<StorageIndex> inner;
+  std::vector<Scalar> values;
+  result.outerIndexPtr()[0] = 0;
+  for (StorageIndex col_block = 0; col_block < NumBlockCols(); ++col_block) {
+    for (StorageIndex col = 0; col < block_dims_[col_block]; ++col) {
+      for (StorageIndex k = column_starts_[col_block]; k < column_starts_[col_block + 1]; ++k) {
+        const StorageIndex row_block = row_blocks_[k];
+        const StorageIndex row_begin = row_block == col_block ? col : 0;
+        for (StorageIndex row = row_begin; row < block_dims_[row_block]; ++row) {
+          inner.push_back(block_offsets_[row_block] + row);
+          values.push_back(values_[value_offsets_[k] + col * block_dims_[row_block] + row]);
+        }
+      }
+      result.outerIndexPtr()[block_offsets_[col_block] + col + 1] =
+          static_cast<StorageIndex>(inner.size());
+    }
+  }
+
+  result.resizeNonZeros(inner.size());
+  std::copy(inner.begin(), inner.end(), result.innerIndexPtr());
+  std::copy(values.begin(), values.end(), result.valuePtr());
+  return result;
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::Rows() const {
+  return block_offsets_.empty() ? 0 : block_offsets_.back();
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::Cols() const {
+  return Rows();
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::NumBlockCols() const {
+  return static_cast<StorageIndex>(block_dims_.size());
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::NumBlocks() const {
+  return static_cast<StorageIndex>(row_blocks_.size());
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::BlockDim(const StorageIndex block_col) const {
+  return block_dims_[block_col];
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::BlockOffset(const StorageIndex block_col) const {
+  return block_offsets_[block_col];
+}
+
+template <typename Scalar>
+const std::vector<int32_t>& BlockSparseMatrix<Scalar>::BlockDims() const {
+  return block_dims_;
+}
+
+template <typename Scalar>
+const std::vector<int32_t>& BlockSparseMatrix<Scalar>::ColumnStarts() const {
+  return column_starts_;
+}
+
+template <typename Scalar>
+const std::vector<int32_t>& BlockSparseMatrix<Scalar>::RowBlocks() const {
+  return row_blocks_;
+}
+
+template <typename Scalar>
+typename BlockSparseMatrix<Scalar>::BlockMap BlockSparseMatrix<Scalar>::Block(
+    const StorageIndex block) {
+  const StorageIndex rows = block_dims_[row_blocks_[block]];
+  const StorageIndex cols = (value_offsets_[block + 1] - value_offsets_[block]) / rows;
+  return BlockMap(values_.data() + value_offsets_[block], rows, cols);
+}
+
+template <typename Scalar>
+typename BlockSparseMatrix<Scalar>::ConstBlockMap BlockSparseMatrix<Scalar>::Block(
+    const StorageIndex block) const {
+  const StorageIndex rows = block_dims_[row_blocks_[block]];
+  const StorageIndex cols = (value_offsets_[block + 1] - value_offsets_[block]) / rows;
+  return ConstBlockMap(values_.data() + value_offsets_[block], rows, cols);
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::FindBlock(const StorageIndex row_block,
+                                             const StorageIndex col_block) const {
+  const auto begin = row_blocks_.begin() + column_starts_[col_block];
+  const auto end = row_blocks_.begin() + column_starts_[col_block + 1];
+  const auto it = std::lower_bound(begin, end, row_block);
+  if (it == end || *it != row_block) {
+    return -1;
+  }
+  return static_cast<StorageIndex>(it - row_blocks_.begin());
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::StorageOffset(const StorageIndex row,
+                                                 const StorageIndex col) const {
+  const auto block_of = [this](const StorageIndex offset) {
+    return static_cast<StorageIndex>(
+        std::upper_bound(block_offsets_.begin(), block_offsets_.end(), offset) -
+        block_offsets_.begin() - 1);
+  };
+
+  if (row < col || col < 0 || row >= Rows()) {
+    throw std::out_of_range("Entry is not in the lower triangle of the matrix");
+  }
+
+  const StorageIndex row_block = block_of(row);
+  const StorageIndex col_block = block_of(col);
+  const StorageIndex block = FindBlock(row_block, col_block);
+  if (block < 0) {
+    throw std::out_of_range("Entry is not in the block sparsity pattern");
+  }
+
+  return value_offsets_[block] + (col - block_offsets_[col_block]) * block_dims_[row_block] +
+         (row - block_offsets_[row_block]);
+}
+
+template <typename Scalar>
+Scalar* BlockSparseMatrix<Scalar>::Data() {
+  return values_.data();
+}
+
+template <typename Scalar>
+const Scalar* BlockSparseMatrix<Scalar>::Data() const {
+  return values_.data();
+}
+
+template <typename Scalar>
+int32_t BlockSparseMatrix<Scalar>::NumValues() const {
+  return static_cast<StorageIndex>(values_.size());
+}
+
+template <typename Scalar>
+void BlockSparseMatrix<Scalar>::SetZero() {
+  values_.setZero();
+}
+
+template <typename Scalar>
+VectorX<Scalar> BlockSparseMatrix<Scalar>::Diagonal() const {
+  VectorX<Scalar> diagonal(Rows());
+  for (StorageIndex col_block = 0; col_block < NumBlockCols(); ++col_block) {
+    diagonal.segment(block_offsets_[col_block], block_dims_[col_block]) =
+        Block(column_starts_[col_block]).diagonal();
+  }
+  return diagonal;
+}
+
+template <typename Scalar>
+void BlockSparseMatrix<Scalar>::SetDiagonal(const VectorX<Scalar>& diagonal) {
+  SYM_ASSERT(diagonal.size() == Rows());
+  for (StorageIndex col_block = 0; col_block < NumBlockCols(); ++col_block) {
+    Block(column_starts_[col_block]).diagonal() =
+        diagonal.segment(block_offsets_[col_block], block_dims_[col_block]);
+  }
+}
+
+template <typename Scalar>
+void BlockSparseMatrix<Scalar>::AddToDiagonal(const VectorX<Scalar>& diagonal) {
+  SYM_ASSERT(diagonal.size() == Rows());
+  for (StorageIndex col_block = 0; col_block < NumBlockCols(); ++col_block) {
+    Block(column_starts_[col_block]).diagonal() +=
+        diagonal.segment(block_offsets_[col_block], block_dims_[col_block]);
+  }
+}
+
+template <typename Scalar>
+void BlockSparseMatrix<Scalar>::SelfAdjointMultiply(const VectorX<Scalar>& x,
+                                                    VectorX<Scalar>* const y) const {
+  SYM_ASSERT(x.size() == Rows());
+  SYM_ASSERT(y != nullptr);
+
+  y->setZero(Rows());
+  for (StorageIndex col_block = 0; col_block < NumBlockCols(); ++col_block) {
+    const StorageIndex col_offset = block_offsets_[col_block];
+    const StorageIndex col_dim = block_dims_[col_block];
+
+    const StorageIndex diagonal = column_starts_[col_block];
+    y->segment(col_offset, col_dim).noalias() +=
+        Block(diagonal).template selfadjointView<Eigen::Lower>() * x.segment(col_offset, col_dim);
+
+    for (StorageIndex k = diagonal + 1; k < column_starts_[col_block + 1]; ++k) {
+      const StorageIndex row_offset = block_offsets_[row_blocks_[k]];
+      const StorageIndex row_dim = block_dims_[row_blocks_[k]];
+      const ConstBlockMap block = Block(k);
+      y->segment(row_offset, row_dim).noalias() += block * x.segment(col_offset, col_dim);
+      y->segment(col_offset, col_dim).noalias() +=
+          block.transpose() * x.segment(row_offset, row_dim);
+    }
+  }
+}
+
+}  // namespace sym
+
+// Explicit instantiation
+template class sym::BlockSparseMatrix<double>;
+template class sym::BlockSparseMatrix<float>;
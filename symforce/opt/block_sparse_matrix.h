@@ -0,0 +1,147 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <sym/util/typedefs.h>
+
+namespace sym {
+
+/**
+ * The lower triangle of a symmetric matrix made of dense blocks, such as the hessian of a problem
+ * with one block row and column per optimized key.
+ *
+ * This is block compressed sparse column (BSR) storage: the nonzero blocks of each block column
+ * are stored in order of their block rows, with one index per block instead of one per scalar
+ * entry.  Each block is stored contiguously in column major order, so every column of a block is
+ * contiguous in Data() as well.  Every block column contains its diagonal block, which is always
+ * its first block.  Only the lower triangle of diagonal blocks is used; the strictly upper triangle
+ * is kept at zero.
+ */
+template <typename ScalarType>
+class BlockSparseMatrix {
+ public:
+  using Scalar = ScalarType;
+  using StorageIndex = int32_t;
+  using BlockMap = Eigen::Map<MatrixX<Scalar>>;
+  using ConstBlockMap = Eigen::Map<const MatrixX<Scalar>>;
+
+  BlockSparseMatrix() = default;
+
+  /**
+   * Construct a matrix with the given block structure, filled with zeros
+   *
+   * Args:
+   *     block_dims: The dimension of each block row and column
+   *     column_starts: For each block column, the index in row_blocks of its first block, followed
+   *                    by the total number of blocks
+   *     row_blocks: The block row of each block.  Must be increasing within each block column, and
+   *                 start with the diagonal block
+   */
+  BlockSparseMatrix(std::vector<StorageIndex> block_dims, std::vector<StorageIndex> column_starts,
+                    std::vector<StorageIndex> row_blocks);
+
+  /**
+   * Convert the lower triangle of a scalar sparse matrix, with block_dims as the dimensions of the
+   * block rows and columns.  The block pattern contains every block with a nonzero entry in
+   * lower, and every diagonal block.
+   */
+  static BlockSparseMatrix FromSparse(const Eigen::SparseMatrix<Scalar>& lower,
+                                      const std::vector<StorageIndex>& block_dims);
+
+  /**
+   * Convert to the lower triangle of a scalar sparse matrix, with an entry for every scalar in the
+   * lower triangle of the block pattern
+   */
+  Eigen::SparseMatrix<Scalar> ToSparse() const;
+
+  /**
+   * Scalar dimension of the matrix
+   */
+  StorageIndex Rows() const;
+  StorageIndex Cols() const;
+
+  /**
+   * Number of block rows and columns
+   */
+  StorageIndex NumBlockCols() const;
+
+  /**
+   * Number of stored (nonzero) blocks
+   */
+  StorageIndex NumBlocks() const;
+
+  StorageIndex BlockDim(StorageIndex block_col) const;
+  StorageIndex BlockOffset(StorageIndex block_col) const;
+
+  /**
+   * The structure of the matrix, as passed to the constructor
+   */
+  const std::vector<StorageIndex>& BlockDims() const;
+  const std::vector<StorageIndex>& ColumnStarts() const;
+  const std::vector<StorageIndex>& RowBlocks() const;
+
+  /**
+   * The block at the given index into RowBlocks
+   */
+  BlockMap Block(StorageIndex block);
+  ConstBlockMap Block(StorageIndex block) const;
+
+  /**
+   * Index into RowBlocks of the block at (row_block, col_block) in the lower triangle, or -1 if
+   * the block is not stored
+   */
+  StorageIndex FindBlock(StorageIndex row_block, StorageIndex col_block) const;
+
+  /**
+   * Offset into Data() of the scalar entry at (row, col) in the lower triangle.  Throws
+   * std::out_of_range if the entry is not stored.
+   */
+  StorageIndex StorageOffset(StorageIndex row, StorageIndex col) const;
+
+  /**
+   * The values of all blocks, back to back
+   */
+  Scalar* Data();
+  const Scalar* Data() const;
+  StorageIndex NumValues() const;
+
+  void SetZero();
+
+  VectorX<Scalar> Diagonal() const;
+  void SetDiagonal(const VectorX<Scalar>& diagonal);
+  void AddToDiagonal(const VectorX<Scalar>& diagonal);
+
+  /**
+   * Compute y = A * x, for the full symmetric matrix A whose lower triangle this is
+   */
+  void SelfAdjointMultiply(const VectorX<Scalar>& x, VectorX<Scalar>* y) const;
+
+ private:
+  std::vector<StorageIndex> block_dims_;
+
+  // Scalar offset of each block row and column, followed by the scalar dimension
+  std::vector<StorageIndex> block_offsets_;
+
+  std::vector<StorageIndex> column_starts_;
+  std::vector<StorageIndex> row_blocks_;
+
+  // Offset into values_ of each block, followed by the total number of values
+  std::vector<StorageIndex> value_offsets_;
+
+  VectorX<Scalar> values_;
+};
+
+// Shorthand instantiations
+using BlockSparseMatrixd = BlockSparseMatrix<double>;
+using BlockSparseMatrixf = BlockSparseMatrix<float>;
+
+}  // namespace sym
@@ -0,0 +1,142 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the MPL2 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./ordering_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace sym {
+
+namespace {
+
+// Identifies the file format, and its version
+constexpr char kFileMagic[8] = {'S', 'Y', 'M', 'O', 'R', 'D', '0', '1'};
+
+template <typename T>
+void WriteValue(std::ofstream& file, const T& value) {
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T ReadValue(std::ifstream& file, const std::string& path) {
+  T value;
+  file.read(reinterpret_cast<char*>(&value), sizeof(T));
+  if (!file) {
+    throw std::runtime_error("Truncated ordering cache file: " + path);
+  }
+  return value;
+}
+
+}  // namespace
+
+bool OrderingCache::IsPermutation(const std::vector<int64_t>& ordering) {
+  const int64_t size = static_cast<int64_t>(ordering.size());
+  std::vector<bool> seen(ordering.size(), false);
+  for (const int64_t index : ordering) {
+    if (index < 0 || index >= size || seen[index]) {
+      return false;
+    }
+    seen[index] = true;
+  }
+  return true;
+}
+
+bool OrderingCache::Find(const uint64_t key, std::vector<int64_t>* const ordering) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = orderings_.find(key);
+  if (it == orderings_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  *ordering = it->second;
+  return true;
+}
+
+void OrderingCache::Insert(const uint64_t key, std::vector<int64_t> ordering) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  orderings_[key] = std::move(ordering);
+}
+
+size_t OrderingCache::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return orderings_.size();
+}
+
+int64_t OrderingCache::Hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+int64_t OrderingCache::Misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+void OrderingCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  orderings_.clear();
+  hits_ = 0;
+  misses_ = 0;
+}
+
+void OrderingCache::Save(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    throw std::runtime_error("Could not open ordering cache file for writing: " + path);
+  }
+
+  file.write(kFileMagic, sizeof(kFileMagic));
+  WriteValue<uint64_t>(file, orderings_.size());
+  for (const auto& key_and_ordering : orderings_) {
+    WriteValue<uint64_t>(file, key_and_ordering.first);
+    WriteValue<uint64_t>(file, key_and_ordering.second.size());
+    file.write(reinterpret_cast<const char*>(key_and_ordering.second.data()),
+               key_and_ordering.second.size() * sizeof(int64_t));
+  }
+
+  if (!file) {
+    throw std::runtime_error("Failed to write ordering cache file: " + path);
+  }
+}
+
+void OrderingCache::Load(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open ordering cache file: " + path);
+  }
+
+  char magic[sizeof(kFileMagic)];
+  file.read(magic, sizeof(magic));
+  if (!file || std::memcmp(magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+    throw std::runtime_error("Not an ordering cache file: " + path);
+  }
+
+  // Read everything before touching the cache, so a bad file leaves it unchanged
+  std::unordered_map<uint64_t, std::vector<int64_t>> orderings;
+  const uint64_t num_orderings = ReadValue<uint64_t>(file, path);
+  for (uint64_t i = 0; i < num_orderings; ++i) {
+    const uint64_t key = ReadValue<uint64_t>(file, path);
+    const uint64_t size = ReadValue<uint64_t>(file, path);
+    std::vector<int64_t> ordering;
+    for (uint64_t j = 0; j < size; ++j) {
+      ordering.push_back(ReadValue<int64_t>(file, path));
+    }
+    if (IsPermutation(ordering)) {
+      orderings[key] = std::move(ordering);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& key_and_ordering : orderings) {
+    orderings_[key_and_ordering.first] = std::move(key_and_ordering.second);
+  }
+}
+
+}  // namespace sym
@@ -0,0 +1,105 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the MPL2 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Sparse>
+
+namespace sym {
+
+// A cache of fill-reducing orderings, keyed by a hash of the sparsity pattern of the matrix and the
+// name of the ordering.
+//
+// Computing an ordering (e.g. with METIS) is often a significant part of the time to set up a
+// solver, and problems with the same structure have the same ordering.  A cache can be shared
+// between any number of solvers through CachedOrdering, including solvers on different threads,
+// and can be saved to and loaded from disk so that orderings persist across runs.
+//
+// The hash is a 64-bit FNV-1a hash of the dimensions and the pattern of the matrix, which is
+// stable across platforms and runs.
+class OrderingCache {
+ public:
+  // Hash of the sparsity pattern of A
+  template <typename MatrixType>
+  static uint64_t PatternHash(const MatrixType& A);
+
+  // Whether ordering contains each of 0, ..., ordering.size() - 1 exactly once
+  static bool IsPermutation(const std::vector<int64_t>& ordering);
+
+  // Look up the ordering for the given key.  Returns false if there is none.
+  bool Find(uint64_t key, std::vector<int64_t>* ordering) const;
+
+  // Insert or replace the ordering for the given key
+  void Insert(uint64_t key, std::vector<int64_t> ordering);
+
+  // Number of cached orderings
+  size_t Size() const;
+
+  // Number of successful and unsuccessful calls to Find
+  int64_t Hits() const;
+  int64_t Misses() const;
+
+  void Clear();
+
+  // Write all cached orderings to a binary file at path.  Throws std::runtime_error on failure.
+  void Save(const std::string& path) const;
+
+  // Add all orderings in the file at path, written by Save, to the cache.  Throws
+  // std::runtime_error if the file cannot be read or is not a valid ordering cache.  Entries that
+  // are not permutations are skipped.
+  void Load(const std::string& path);
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<uint64_t, std::vector<int64_t>> orderings_;
+  mutable int64_t hits_{0};
+  mutable int64_t misses_{0};
+};
+
+// An ordering functor for SparseCholeskySolver that looks orderings up in an OrderingCache, and
+// computes them with another ordering on a cache miss.
+//
+// Example:
+//
+//   auto cache = std::make_shared<sym::OrderingCache>();
+//   cache->Load("orderings.bin");  // Optional
+//   sym::SparseCholeskySolver<Eigen::SparseMatrix<double>> solver(
+//       sym::CachedOrdering<Eigen::SparseMatrix<double>>(
+//           Eigen::MetisOrdering<int>(), "metis", cache));
+template <typename MatrixType>
+class CachedOrdering {
+ public:
+  using StorageIndex = typename MatrixType::StorageIndex;
+  using PermutationType = Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+  using Ordering = std::function<void(const MatrixType&, PermutationType&)>;
+
+  // Args:
+  //     ordering: The ordering to use on a cache miss
+  //     name: A name for the ordering, which is part of the cache key so that different orderings
+  //         of the same pattern can share a cache
+  //     cache: The cache to use, which may be shared
+  CachedOrdering(Ordering ordering, const std::string& name, std::shared_ptr<OrderingCache> cache);
+
+  void operator()(const MatrixType& A, PermutationType& perm) const;
+
+ private:
+  Ordering ordering_;
+  uint64_t name_hash_;
+  std::shared_ptr<OrderingCache> cache_;
+};
+
+}  // namespace sym
+
+// Include implementation, yay templates.
+#define SYM_ORDERING_CACHE_H
+#include "./ordering_cache.tcc"
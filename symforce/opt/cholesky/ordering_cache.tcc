@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the MPL2 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#ifndef SYM_ORDERING_CACHE_H
+#error __FILE__ should only be included from ordering_cache.h
+#endif  // SYM_ORDERING_CACHE_H
+
+#include <algorithm>
+
+namespace sym {
+
+namespace internal {
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+inline void FnvHashAppend(const void* const data, const size_t size, uint64_t* const hash) {
+  const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    *hash = (*hash ^ bytes[i]) * kFnvPrime;
+  }
+}
+
+inline void FnvHashAppend(const int64_t value, uint64_t* const hash) {
+  FnvHashAppend(&value, sizeof(value), hash);
+}
+
+}  // namespace internal
+
+template <typename MatrixType>
+uint64_t OrderingCache::PatternHash(const MatrixType& A) {
+  uint64_t hash = internal::kFnvOffsetBasis;
+  internal::FnvHashAppend(A.rows(), &hash);
+  internal::FnvHashAppend(A.cols(), &hash);
+  for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+    for (typename MatrixType::InnerIterator it(A, col); it; ++it) {
+      internal::FnvHashAppend(it.index(), &hash);
+    }
+    // Mark the end of each column
+    internal::FnvHashAppend(-1, &hash);
+  }
+  return hash;
+}
+
+template <typename MatrixType>
+CachedOrdering<MatrixType>::CachedOrdering(Ordering ordering, const std::string& name,
+                                           std::shared_ptr<OrderingCache> cache)
+    : ordering_(std::move(ordering)),
+      name_hash_(internal::kFnvOffsetBasis),
+      cache_(std::move(cache)) {
+  internal::FnvHashAppend(name.data(), name.size(), &name_hash_);
+}
+
+template <typename MatrixType>
+void CachedOrdering<MatrixType>::operator()(const MatrixType& A, PermutationType& perm) const {
+  uint64_t key = OrderingCache::PatternHash(A);
+  internal::FnvHashAppend(static_cast<int64_t>(name_hash_), &key);
+
+  // An empty ordering is the identity, as for Eigen::NaturalOrdering.  Anything else that is not
+  // a permutation of the columns of A (e.g. from a hash collision) is recomputed.
+  std::vector<int64_t> ordering;
+  if (cache_->Find(key, &ordering) &&
+      (ordering.empty() || (static_cast<Eigen::Index>(ordering.size()) == A.cols() &&
+                            OrderingCache::IsPermutation(ordering)))) {
+    perm.resize(ordering.size());
+    std::copy(ordering.begin(), ordering.end(), perm.indices().data());
+    return;
+  }
+
+  ordering_(A, perm);
+  ordering.assign(perm.indices().data(), perm.indices().data() + perm.size());
+  cache_->Insert(key, std::move(ordering));
+}
+
+}  // namespace sym
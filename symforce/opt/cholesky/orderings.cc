@@ -0,0 +1,212 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the MPL2 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./orderings.h"
+
+#include <algorithm>
+
+namespace sym {
+namespace internal {
+
+namespace {
+
+// Doubly linked lists of the variables with each degree, for finding a variable of minimum degree
+class DegreeLists {
+ public:
+  explicit DegreeLists(const int n) : heads_(n + 1, -1), next_(n, -1), prev_(n, -1), min_(n) {}
+
+  void Insert(const int i, const int degree) {
+    next_[i] = heads_[degree];
+    prev_[i] = -1;
+    if (heads_[degree] != -1) {
+      prev_[heads_[degree]] = i;
+    }
+    heads_[degree] = i;
+    min_ = std::min(min_, degree);
+  }
+
+  void Remove(const int i, const int degree) {
+    if (prev_[i] != -1) {
+      next_[prev_[i]] = next_[i];
+    } else {
+      heads_[degree] = next_[i];
+    }
+    if (next_[i] != -1) {
+      prev_[next_[i]] = prev_[i];
+    }
+  }
+
+  // Remove and return a variable of minimum degree, or -1 if the lists are empty
+  int PopMin() {
+    while (min_ < static_cast<int>(heads_.size()) && heads_[min_] == -1) {
+      ++min_;
+    }
+    if (min_ == static_cast<int>(heads_.size())) {
+      return -1;
+    }
+    const int i = heads_[min_];
+    Remove(i, min_);
+    return i;
+  }
+
+ private:
+  std::vector<int> heads_;
+  std::vector<int> next_;
+  std::vector<int> prev_;
+  int min_;
+};
+
+}  // namespace
+
+void ApproximateMinimumDegree(const int n, const std::vector<int>& col_starts,
+                              const std::vector<int>& rows, const std::vector<int>& groups,
+                              std::vector<int>* const order) {
+  SYM_ASSERT(order != nullptr);
+  SYM_ASSERT(static_cast<int>(col_starts.size()) == n + 1);
+  SYM_ASSERT(groups.empty() || static_cast<int>(groups.size()) == n);
+
+  enum class Status : uint8_t { VARIABLE, ELEMENT, ABSORBED };
+
+  // The quotient graph.  Eliminating a variable p turns it into an element, whose variables are
+  // the variables adjacent to p through its neighbors and elements.  The elements adjacent to p
+  // are absorbed into the new element.
+  std::vector<std::vector<int>> adjacent_variables(n);
+  std::vector<std::vector<int>> adjacent_elements(n);
+  std::vector<std::vector<int>> element_variables(n);
+  std::vector<Status> status(n, Status::VARIABLE);
+  std::vector<int> degree(n);
+  for (int i = 0; i < n; ++i) {
+    adjacent_variables[i].assign(rows.begin() + col_starts[i], rows.begin() + col_starts[i + 1]);
+    degree[i] = static_cast<int>(adjacent_variables[i].size());
+  }
+
+  // The groups in order, and the variables in each group.  Only variables in the current group
+  // are in the degree lists.
+  std::vector<int> group_values = groups;
+  std::sort(group_values.begin(), group_values.end());
+  group_values.erase(std::unique(group_values.begin(), group_values.end()), group_values.end());
+  std::vector<int> group_rank(n, 0);
+  for (int i = 0; i < static_cast<int>(groups.size()); ++i) {
+    group_rank[i] = static_cast<int>(
+        std::lower_bound(group_values.begin(), group_values.end(), groups[i]) -
+        group_values.begin());
+  }
+  int current_group = 0;
+
+  DegreeLists degree_lists(n);
+  for (int i = 0; i < n; ++i) {
+    if (group_rank[i] == current_group) {
+      degree_lists.Insert(i, degree[i]);
+    }
+  }
+
+  // Markers, so sets can be built and cleared in time proportional to their size
+  std::vector<int> in_element(n, -1);
+  std::vector<int> external_size(n, 0);
+  std::vector<int> external_size_mark(n, -1);
+
+  order->clear();
+  order->reserve(n);
+  for (int k = 0; k < n; ++k) {
+    int p = degree_lists.PopMin();
+    while (p == -1) {
+      // The current group is done, start the next one
+      ++current_group;
+      for (int i = 0; i < n; ++i) {
+        if (status[i] == Status::VARIABLE && group_rank[i] == current_group) {
+          degree_lists.Insert(i, degree[i]);
+        }
+      }
+      p = degree_lists.PopMin();
+    }
+    order->push_back(p);
+
+    // Form the new element from the variables adjacent to p, and absorb the elements adjacent
+    // to p
+    std::vector<int>& element = element_variables[p];
+    in_element[p] = p;
+    const auto add_to_element = [&](const int i) {
+      if (status[i] == Status::VARIABLE && in_element[i] != p) {
+        in_element[i] = p;
+        element.push_back(i);
+      }
+    };
+    for (const int i : adjacent_variables[p]) {
+      add_to_element(i);
+    }
+    for (const int e : adjacent_elements[p]) {
+      if (status[e] == Status::ELEMENT) {
+        for (const int i : element_variables[e]) {
+          add_to_element(i);
+        }
+        status[e] = Status::ABSORBED;
+        std::vector<int>().swap(element_variables[e]);
+      }
+    }
+    status[p] = Status::ELEMENT;
+    std::vector<int>().swap(adjacent_variables[p]);
+    std::vector<int>().swap(adjacent_elements[p]);
+
+    const int element_size = static_cast<int>(element.size());
+    for (const int i : element) {
+      if (group_rank[i] == current_group) {
+        degree_lists.Remove(i, degree[i]);
+      }
+    }
+
+    // Compute |Le \ Lp| for every other element e adjacent to a variable in Lp
+    for (const int i : element) {
+      for (const int e : adjacent_elements[i]) {
+        if (status[e] != Status::ELEMENT) {
+          continue;
+        }
+        if (external_size_mark[e] != p) {
+          external_size_mark[e] = p;
+          external_size[e] = static_cast<int>(element_variables[e].size());
+        }
+        external_size[e] -= 1;
+      }
+    }
+
+    // Update the variables in the new element
+    for (const int i : element) {
+      // Absorb elements that are subsets of the new element, and add the new element
+      int external_degree = element_size - 1;
+      std::vector<int>& elements = adjacent_elements[i];
+      elements.erase(std::remove_if(elements.begin(), elements.end(),
+                                    [&](const int e) {
+                                      if (status[e] != Status::ELEMENT) {
+                                        return true;
+                                      }
+                                      if (external_size[e] == 0) {
+                                        status[e] = Status::ABSORBED;
+                                        std::vector<int>().swap(element_variables[e]);
+                                        return true;
+                                      }
+                                      external_degree += external_size[e];
+                                      return false;
+                                    }),
+                     elements.end());
+      elements.push_back(p);
+
+      // Neighbors in the new element are now reachable through it
+      std::vector<int>& variables = adjacent_variables[i];
+      variables.erase(std::remove_if(variables.begin(), variables.end(),
+                                     [&](const int j) {
+                                       return status[j] != Status::VARIABLE || in_element[j] == p;
+                                     }),
+                      variables.end());
+      external_degree += static_cast<int>(variables.size());
+
+      degree[i] = std::min({degree[i] + element_size - 1, external_degree, n - k - 1});
+      if (group_rank[i] == current_group) {
+        degree_lists.Insert(i, degree[i]);
+      }
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace sym
@@ -0,0 +1,188 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the MPL2 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/OrderingMethods>
+#include <Eigen/Sparse>
+
+#include "./sparse_cholesky_solver.h"
+
+namespace sym {
+
+// Fill-reducing orderings for SparseCholeskySolver.
+//
+// Each of these is a functor with the signature of SparseCholeskySolver::Ordering, and like the
+// Eigen orderings it fills out perm such that perm.indices()[i] is the column of A that is
+// eliminated i-th.  SparseCholeskySolver uses this as its inverse permutation.
+
+namespace internal {
+
+// Approximate minimum degree ordering of the symmetric pattern given by col_starts and rows, which
+// must contain both triangles (the diagonal is ignored).  Eliminates the variable with the
+// smallest approximate external degree at each step, on a quotient graph of variables and
+// elements, with element absorption.
+//
+// If groups is not empty, it gives a group for each variable; all variables in a group are
+// eliminated before any variable in a larger group, and the minimum degree ordering is applied
+// within each group (a constrained minimum degree ordering).
+//
+// Fills order with the variables in elimination order.
+void ApproximateMinimumDegree(int n, const std::vector<int>& col_starts,
+                              const std::vector<int>& rows, const std::vector<int>& groups,
+                              std::vector<int>* order);
+
+// Copy the pattern of A into col_starts and rows, without the diagonal
+template <typename MatrixType>
+void SymmetricPatternWithoutDiagonal(const MatrixType& A, std::vector<int>* col_starts,
+                                     std::vector<int>* rows) {
+  col_starts->assign(1, 0);
+  rows->clear();
+  rows->reserve(A.nonZeros());
+  for (int col = 0; col < A.outerSize(); ++col) {
+    for (typename MatrixType::InnerIterator it(A, col); it; ++it) {
+      if (it.index() != col) {
+        rows->push_back(static_cast<int>(it.index()));
+      }
+    }
+    col_starts->push_back(static_cast<int>(rows->size()));
+  }
+}
+
+}  // namespace internal
+
+// Approximate minimum degree (AMD) ordering
+template <typename StorageIndex>
+class AmdOrdering {
+ public:
+  using PermutationType = Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+
+  template <typename MatrixType>
+  void operator()(const MatrixType& A, PermutationType& perm) const {
+    std::vector<int> col_starts;
+    std::vector<int> rows;
+    internal::SymmetricPatternWithoutDiagonal(A, &col_starts, &rows);
+
+    std::vector<int> order;
+    internal::ApproximateMinimumDegree(static_cast<int>(A.cols()), col_starts, rows, {}, &order);
+
+    perm.resize(A.cols());
+    std::copy(order.begin(), order.end(), perm.indices().data());
+  }
+};
+
+// Column approximate minimum degree (COLAMD) ordering of the columns of a jacobian J, for the
+// factorization of the hessian J^T * J.  The ordering functor is only given the hessian, and COLAMD
+// of the hessian itself would order for the fill of H^T * H, so the pattern of J is given at
+// construction.  The rows and columns of the matrix to be ordered must be the columns of J, as
+// for the hessian and jacobian of a Linearizer.
+template <typename StorageIndex>
+class ColamdOrdering {
+ public:
+  using PermutationType = Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+
+  // Args:
+  //     jacobian: The jacobian whose columns to order; only its sparsity pattern is used
+  template <typename JacobianType>
+  explicit ColamdOrdering(const JacobianType& jacobian)
+      : jacobian_pattern_(jacobian.template cast<double>()) {
+    jacobian_pattern_.makeCompressed();
+  }
+
+  template <typename MatrixType>
+  void operator()(const MatrixType& A, PermutationType& perm) const {
+    SYM_ASSERT(A.cols() == jacobian_pattern_.cols());
+
+    // Eigen's COLAMDOrdering returns the permutation from old to new columns, which is the
+    // inverse of the convention here
+    PermutationType colamd_perm;
+    Eigen::COLAMDOrdering<StorageIndex>()(jacobian_pattern_, colamd_perm);
+    perm = colamd_perm.inverse();
+  }
+
+ private:
+  Eigen::SparseMatrix<double, Eigen::ColMajor, StorageIndex> jacobian_pattern_;
+};
+
+// Constrained approximate minimum degree ordering: every variable has a group, variables are
+// eliminated in order of increasing group, and within each group in approximate minimum degree
+// order.
+//
+// For example, for bundle adjustment with groups of 0 for landmark variables and 1 for camera
+// variables, all landmarks are eliminated first, which is the ordering of the Schur complement
+// trick, while still ordering the cameras for low fill.
+template <typename StorageIndex>
+class ConstrainedOrdering {
+ public:
+  using PermutationType = Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+
+  // Args:
+  //     groups: The group of each scalar row and column of the matrix to be ordered
+  explicit ConstrainedOrdering(std::vector<int> groups) : groups_(std::move(groups)) {}
+
+  template <typename MatrixType>
+  void operator()(const MatrixType& A, PermutationType& perm) const {
+    SYM_ASSERT(static_cast<Eigen::Index>(groups_.size()) == A.cols());
+
+    std::vector<int> col_starts;
+    std::vector<int> rows;
+    internal::SymmetricPatternWithoutDiagonal(A, &col_starts, &rows);
+
+    std::vector<int> order;
+    internal::ApproximateMinimumDegree(static_cast<int>(A.cols()), col_starts, rows, groups_,
+                                       &order);
+
+    perm.resize(A.cols());
+    std::copy(order.begin(), order.end(), perm.indices().data());
+  }
+
+  const std::vector<int>& Groups() const {
+    return groups_;
+  }
+
+ private:
+  std::vector<int> groups_;
+};
+
+// The cost and quality of an ordering on a particular matrix
+struct OrderingStats {
+  // Time to compute the ordering, in seconds
+  double ordering_seconds;
+
+  // Number of nonzeros in L (below the diagonal) for the factorization with the ordering
+  int64_t factor_nonzeros;
+};
+
+// Compute the ordering of A with the given ordering, and the fill of the resulting factorization,
+// to compare orderings for a class of problems
+template <typename MatrixType>
+OrderingStats ComputeOrderingStats(
+    const MatrixType& A, const typename SparseCholeskySolver<MatrixType>::Ordering& ordering) {
+  using PermutationMatrixType = typename SparseCholeskySolver<MatrixType>::PermutationMatrixType;
+
+  const MatrixType A_full = A.template selfadjointView<Eigen::Lower>();
+  PermutationMatrixType inv_permutation;
+  const auto start = std::chrono::steady_clock::now();
+  ordering(A_full, inv_permutation);
+  const auto end = std::chrono::steady_clock::now();
+
+  // Run the symbolic factorization with the precomputed ordering
+  SparseCholeskySolver<MatrixType> solver(
+      [&inv_permutation](const MatrixType& /* A */, PermutationMatrixType& perm) {
+        perm = inv_permutation;
+      });
+  solver.ComputeSymbolicSparsity(A);
+
+  OrderingStats stats;
+  stats.ordering_seconds = std::chrono::duration<double>(end - start).count();
+  stats.factor_nonzeros = solver.L().nonZeros();
+  return stats;
+}
+
+}  // namespace sym
@@ -6,6 +6,14 @@
 #pragma once
 
 #include "../assert.h"
+#include "../internal/thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <vector>
 
 // Needed for Metis
 #include <iostream>
@@ -23,6 +31,29 @@ namespace sym {
 // When repeatedly solving systems where A changes but its sparsity pattern remains identical,
 // this class can analyze the sparsity pattern once and use it to more efficiently factorize
 // and solve on subsequent calls.
+//
+// There are two factorization modes, which compute the same L and D:
+//
+// - SIMPLICIAL: An up-looking factorization, which computes L one row at a time with scalar
+//   updates.  Best for very sparse factors, like those of chain-like problems.
+// - SUPERNODAL: Groups consecutive columns of L with the same sparsity pattern below the
+//   diagonal into supernodes, which are detected from the elimination tree and the column counts
+//   during ComputeSymbolicSparsity.  Each supernode is stored as a dense panel, and factorized
+//   left-looking with dense Eigen kernels, so the bulk of the work is dense matrix products.
+//   Much faster when L has large supernodes, e.g. for bundle adjustment or pose graphs with
+//   many loop closures.
+//
+// Neither mode pivots, so A does not need to be positive definite as long as all of the leading
+// principal minors in the chosen ordering are nonsingular.
+//
+// The SIMPLICIAL factorization can run on multiple threads: ComputeSymbolicSparsity splits the
+// elimination tree into tasks, which are disjoint subtrees and the chains of separator nodes above
+// them, and Factorize runs the tasks in waves, each of which only depends on earlier waves.  The
+// result is bitwise identical for any number of threads.
+//
+// When A changes by a few rank-1 terms, e.g. when a fixed-lag smoother adds and removes a few
+// factors, RankUpdate and RankDowndate modify L and D in place, in time proportional to the paths
+// in the elimination tree above the modified variables instead of the full factorization.
 template <typename _MatrixType, int _UpLo = Eigen::Lower>
 class SparseCholeskySolver {
  public:
@@ -34,12 +65,15 @@ class SparseCholeskySolver {
   using Scalar = typename MatrixType::Scalar;
   using StorageIndex = typename MatrixType::StorageIndex;
   using CholMatrixType = Eigen::SparseMatrix<Scalar, Eigen::ColMajor, StorageIndex>;
+  using RowMajorMatrixType = Eigen::SparseMatrix<Scalar, Eigen::RowMajor, StorageIndex>;
   using VectorType = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
   using RhsType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
   using PermutationMatrixType =
       Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
   using Ordering = std::function<void(const MatrixType&, PermutationMatrixType&)>;
 
+  enum class Factorization { SIMPLICIAL, SUPERNODAL };
+
  public:
   // Default constructor
   //
@@ -51,8 +85,16 @@ class SparseCholeskySolver {
   //         triangle; the values may not be the same as in A, but will be nonzero for entries in A
   //         that are nonzero.  Typically this will be an instance of one of the orderings provided
   //         by Eigen, such as Eigen::NaturalOrdering().
-  SparseCholeskySolver(const Ordering& ordering = Eigen::MetisOrdering<StorageIndex>())
-      : is_initialized_(false), ordering_(ordering) {}
+  //     factorization: The factorization mode to use, see above.
+  //     num_threads: Number of threads to factorize with, including the calling thread.  Only
+  //         used by the SIMPLICIAL factorization.
+  SparseCholeskySolver(const Ordering& ordering = Eigen::MetisOrdering<StorageIndex>(),
+                       const Factorization factorization = Factorization::SIMPLICIAL,
+                       const int num_threads = 1)
+      : is_initialized_(false),
+        ordering_(ordering),
+        factorization_(factorization),
+        num_threads_(num_threads) {}
 
   // Construct with a representative sparse matrix
   //
@@ -65,9 +107,14 @@ class SparseCholeskySolver {
   //         triangle; the values may not be the same as in A, but will be nonzero for entries in A
   //         that are nonzero.  Typically this will be an instance of one of the orderings provided
   //         by Eigen, such as Eigen::NaturalOrdering().
+  //     factorization: The factorization mode to use, see above.
+  //     num_threads: Number of threads to factorize with, including the calling thread.  Only
+  //         used by the SIMPLICIAL factorization.
   explicit SparseCholeskySolver(const MatrixType& A,
-                                const Ordering& ordering = Eigen::MetisOrdering<StorageIndex>())
-      : SparseCholeskySolver(ordering) {
+                                const Ordering& ordering = Eigen::MetisOrdering<StorageIndex>(),
+                                const Factorization factorization = Factorization::SIMPLICIAL,
+                                const int num_threads = 1)
+      : SparseCholeskySolver(ordering, factorization, num_threads) {
     ComputeSymbolicSparsity(A);
     Factorize(A);
   }
@@ -88,6 +135,9 @@ class SparseCholeskySolver {
 
   // Decompose A into A = L * D * L^T and store internally.
   // A must have the same sparsity as the matrix used for construction.
+  //
+  // Refactorizing a compressed column major A with the same sparsity as the previous call does
+  // not allocate.
   void Factorize(const MatrixType& A);
 
   // Returns x for A x = b, where x and b are dense
@@ -95,9 +145,83 @@ class SparseCholeskySolver {
   RhsType Solve(const Eigen::MatrixBase<Rhs>& b) const;
 
   // Solves in place for x in A x = b, where x and b are dense
+  //
+  // Permutes b through a workspace owned by the solver, which makes it allocation free after the
+  // first call with b of a given size.  Unlike Solve, this is not safe to call concurrently on the
+  // same solver.
   template <typename Rhs>
   void SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const;
 
+  // Updates the factorization of A to the factorization of A + W^T * W, with one rank-1 update of
+  // L and D per row of W, along the path from the first nonzero of the row to the root of the
+  // elimination tree.  W is in the original (unpermuted) ordering, e.g. the jacobian rows of
+  // factors added to the problem.  This is much cheaper than refactorizing if W has few rows.
+  //
+  // The pattern of L can't change, so this returns false without modifying the factorization if
+  // the pattern of some row of W is not contained in the pattern of L (e.g. if it couples
+  // variables that were not coupled in A), in which case A + W^T * W has to be refactorized.
+  // Requires a call to Factorize first.
+  bool RankUpdate(const RowMajorMatrixType& W);
+
+  // Updates the factorization of A to the factorization of A - W^T * W, e.g. for the jacobian rows
+  // of factors removed from the problem.  Like RankUpdate, returns false without modifying the
+  // factorization if the pattern of W is not contained in the pattern of L.  A - W^T * W must
+  // have nonzero leading principal minors, like any factorized matrix.
+  bool RankDowndate(const RowMajorMatrixType& W);
+
+  // Updates the factorization of A to the factorization of A_new = A + W_added^T * W_added -
+  // W_removed^T * W_removed with RankUpdate and RankDowndate if possible, and otherwise computes
+  // the symbolic sparsity of A_new and factorizes it from scratch.  Returns whether the
+  // factorization was updated in place.
+  bool UpdateFactorization(const MatrixType& A_new, const RowMajorMatrixType& W_added,
+                           const RowMajorMatrixType& W_removed);
+
+  // Computes the selected inverse of A: the entries of A^-1 on the sparsity pattern of L, plus the
+  // diagonal, with the Takahashi recurrences on L and D.  Requires a call to Factorize first.
+  //
+  // This is much cheaper than solving against the identity when only some entries of A^-1 are
+  // needed, such as the marginal covariance of each variable.  It takes O(nnz(L)) memory, and time
+  // proportional to the factorization.  Since the pattern of L includes the pattern of A, every
+  // entry of A^-1 where A is structurally nonzero is computed.
+  //
+  // The result is the lower triangle of the selected inverse in the permuted ordering, i.e. it
+  // is the inverse of the permuted A; use SelectedInverseBlock to read blocks of A^-1 from it.
+  // Each column stores its diagonal entry first, followed by the pattern of the same column of L.
+  void ComputeSelectedInverse(CholMatrixType* selected_inverse) const;
+
+  // Reads the dim x dim block of A^-1 at (offset, offset) from the result of
+  // ComputeSelectedInverse.  Every entry of the block is in the selected inverse if the block is
+  // dense in A.  Columns of the block with entries that are not, because they are structurally
+  // zero in A and not filled in by the factorization, are computed with a solve instead.
+  void SelectedInverseBlock(const CholMatrixType& selected_inverse, StorageIndex offset,
+                            StorageIndex dim, RhsType* block) const;
+
+  const Ordering& GetOrdering() const {
+    return ordering_;
+  }
+
+  Factorization FactorizationMode() const {
+    return factorization_;
+  }
+
+  int NumThreads() const {
+    return num_threads_;
+  }
+
+  // Number of waves of tasks run by the parallel factorization.  Zero if the factorization is
+  // serial.
+  StorageIndex NumParallelWaves() const {
+    SYM_ASSERT(IsInitialized());
+    return thread_pool_ == nullptr ? 0 : static_cast<StorageIndex>(wave_starts_.size()) - 1;
+  }
+
+  // Number of supernodes in L.  Only valid in SUPERNODAL mode.
+  StorageIndex NumSupernodes() const {
+    SYM_ASSERT(IsInitialized());
+    SYM_ASSERT(factorization_ == Factorization::SUPERNODAL);
+    return static_cast<StorageIndex>(supernode_starts_.size()) - 1;
+  }
+
   const CholMatrixType& L() const {
     SYM_ASSERT(IsInitialized());
     return L_;
@@ -119,6 +243,40 @@ class SparseCholeskySolver {
   }
 
  protected:
+  // Target number of parallel tasks per thread, to balance load across threads
+  static constexpr int kTasksPerThread = 4;
+
+  // Compute the pattern of L and the supernodes, from parent_ and nnz_per_col_
+  void ComputeSupernodes();
+
+  // Split the elimination tree into tasks for the parallel factorization
+  void ComputeParallelSchedule();
+
+  // Set A_permuted_ to A permuted by permutation_, in the DstUpLo triangle.  The first call with a
+  // given pattern of A records where each value of A goes in A_permuted_, so that later calls with
+  // the same pattern only copy the values, without allocating.
+  template <int DstUpLo>
+  void TwistIntoAPermuted(const MatrixType& A);
+
+  // Compute row k of L and D(k), using pattern[0:pattern_size] as scratch space for the pattern of
+  // the row
+  void FactorizeRow(StorageIndex k, StorageIndex* pattern, StorageIndex pattern_size);
+
+  // Factorize A_permuted_ supernode by supernode, into L_ and D_
+  void FactorizeSupernodal();
+
+  // Whether the pattern of every row of W, in the permuted ordering, is contained in the pattern
+  // of the column of L at its first nonzero, which means rank-1 updates with W don't change the
+  // pattern of L
+  bool CanRankUpdate(const RowMajorMatrixType& W);
+
+  // Applies a rank-1 update of L and D with sigma * w * w^T for each row w of W
+  void ApplyRankUpdate(const RowMajorMatrixType& W, Scalar sigma);
+
+  // Solves in place for x in P A P^T x = b, i.e. for the twisted right hand side b, with the
+  // factorization L * D * L^T of the permuted matrix
+  void SolvePermutedInPlace(RhsType* x) const;
+
   // Whether we have computed a symbolic sparsity and
   // are ready to factorize/solve.
   bool is_initialized_;
@@ -126,6 +284,10 @@ class SparseCholeskySolver {
   // The ordering function
   Ordering ordering_;
 
+  Factorization factorization_;
+
+  int num_threads_;
+
   // The unit triangular cholesky decomposition L
   // and the diagonal coefficients D
   // These are computed from Factorize()
@@ -147,9 +309,59 @@ class SparseCholeskySolver {
 
   // Internal storage for factorization helpers
   CholMatrixType A_permuted_;
+
+  // The pattern of the matrix last twisted into A_permuted_, the triangle of A_permuted_ it was
+  // twisted into (or -1 if there is no recorded pattern), and the index in A_permuted_ of each
+  // value of the matrix, or -1 for values outside of its UpLo triangle
+  std::vector<StorageIndex> twist_outer_indices_;
+  std::vector<StorageIndex> twist_inner_indices_;
+  int twist_dst_uplo_{-1};
+  std::vector<StorageIndex> twist_value_indices_;
+
   Eigen::Matrix<StorageIndex, Eigen::Dynamic, 1> visited_;
   Eigen::Matrix<StorageIndex, Eigen::Dynamic, 1> L_k_pattern_;
   Eigen::Matrix<Scalar, Eigen::Dynamic, 1> D_agg_;
+
+  // Internal storage for SolveInPlace: the twisted right hand side
+  mutable RhsType solve_workspace_;
+
+  // Internal storage for rank updates: the row being applied in the permuted ordering, and a
+  // marker for the pattern of a column of L
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1> rank_update_row_;
+  Eigen::Matrix<StorageIndex, Eigen::Dynamic, 1> rank_update_marker_;
+
+  // Supernodes, computed from ComputeSymbolicSparsity() in SUPERNODAL mode.  Supernode s is
+  // columns [supernode_starts_[s], supernode_starts_[s + 1]) of L, and is stored as a dense
+  // column major panel of the rows supernode_rows_[supernode_row_starts_[s]:...], which are its
+  // own columns followed by the rows below them
+  std::vector<StorageIndex> supernode_starts_;
+  std::vector<StorageIndex> supernode_row_starts_;
+  std::vector<StorageIndex> supernode_rows_;
+  std::vector<StorageIndex> supernode_value_starts_;
+  std::vector<StorageIndex> supernode_for_col_;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1> supernode_values_;
+
+  // Internal storage for the supernodal factorization
+  // For each supernode, the next supernode in the linked list of supernodes waiting to update the
+  // same supernode, and the position of its next row to apply
+  std::vector<StorageIndex> supernode_list_heads_;
+  std::vector<StorageIndex> supernode_list_next_;
+  std::vector<StorageIndex> supernode_next_row_;
+  std::vector<StorageIndex> row_to_panel_row_;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> update_workspace_;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> scaled_workspace_;
+
+  // Schedule for the parallel factorization, computed from ComputeSymbolicSparsity() if
+  // num_threads_ > 1.  Task t factorizes rows task_nodes_[task_node_starts_[t]:...], using
+  // L_k_pattern_[task_pattern_offsets_[t]:...] as scratch space, and wave w is the tasks
+  // wave_tasks_[wave_starts_[w]:...].
+  std::shared_ptr<internal::ThreadPool> thread_pool_;
+  std::vector<StorageIndex> task_node_starts_;
+  std::vector<StorageIndex> task_nodes_;
+  std::vector<StorageIndex> task_pattern_offsets_;
+  std::vector<StorageIndex> task_pattern_sizes_;
+  std::vector<StorageIndex> wave_starts_;
+  std::vector<StorageIndex> wave_tasks_;
 };
 
 }  // namespace sym
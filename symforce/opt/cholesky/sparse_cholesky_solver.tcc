@@ -32,15 +32,11 @@ void SparseCholeskySolver<MatrixType, UpLo>::ComputeSymbolicSparsity(const Matri
   // Update permutation matrix
   ComputePermutationMatrix(A);
 
-  // Apply permutation matrix (twist A)
+  // Apply permutation matrix (twist A).  The recorded twist is for the old permutation
   const Eigen::Index N = A.cols();
   A_permuted_.resize(N, N);
-  if (permutation_.size() > 0) {
-    A_permuted_.template selfadjointView<Eigen::Upper>() =
-        A.template selfadjointView<UpLo>().twistedBy(permutation_);
-  } else {
-    A_permuted_.template selfadjointView<Eigen::Upper>() = A.template selfadjointView<UpLo>();
-  }
+  twist_dst_uplo_ = -1;
+  TwistIntoAPermuted<Eigen::Upper>(A);
 
   // Everything not visited
   visited_.resize(N);
@@ -100,13 +96,198 @@ void SparseCholeskySolver<MatrixType, UpLo>::ComputeSymbolicSparsity(const Matri
   L_.resizeNonZeros(L_outer[N]);
 
   // Allocate other memory used for subsequent factorization and solve calls
+  if (num_threads_ > 1 && factorization_ == Factorization::SIMPLICIAL) {
+    thread_pool_ = std::make_shared<internal::ThreadPool>(num_threads_);
+  } else {
+    thread_pool_ = nullptr;
+  }
   D_.resize(N);
   L_k_pattern_.resize(N);
   D_agg_.resize(N);
+  rank_update_row_.setZero(N);
+  rank_update_marker_.setConstant(N, -1);
+
+  if (factorization_ == Factorization::SUPERNODAL) {
+    ComputeSupernodes();
+  } else if (thread_pool_ != nullptr) {
+    ComputeParallelSchedule();
+  }
 
   is_initialized_ = true;
 }
 
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::ComputeParallelSchedule() {
+  const StorageIndex N = static_cast<StorageIndex>(L_.rows());
+
+  // Size of each subtree, and an estimate of the work to factorize it.  Parents always come after
+  // their children.
+  std::vector<StorageIndex> subtree_size(N, 1);
+  std::vector<int64_t> subtree_work(N);
+  int64_t total_work = 0;
+  for (StorageIndex i = 0; i < N; ++i) {
+    subtree_work[i] += nnz_per_col_[i] + 1;
+    if (parent_[i] == -1) {
+      total_work += subtree_work[i];
+    } else {
+      subtree_size[parent_[i]] += subtree_size[i];
+      subtree_work[parent_[i]] += subtree_work[i];
+    }
+  }
+
+  // Subtrees with at most this much work are factorized as a single task.  The nodes above them
+  // are split into chains, which are separate tasks wherever the tree branches.
+  const int64_t max_task_work =
+      std::max<int64_t>(1, total_work / (kTasksPerThread * thread_pool_->NumThreads()));
+  const auto is_large = [&](const StorageIndex i) { return subtree_work[i] > max_task_work; };
+
+  std::vector<StorageIndex> num_large_children(N, 0);
+  for (StorageIndex i = 0; i < N; ++i) {
+    if (parent_[i] != -1 && is_large(i)) {
+      num_large_children[parent_[i]] += 1;
+    }
+  }
+
+  // Assign each node to a task, from the roots down, so every task is created before the tasks
+  // below it
+  std::vector<StorageIndex> task_for_node(N);
+  std::vector<StorageIndex> task_top;
+  for (StorageIndex i = N - 1; i >= 0; --i) {
+    const StorageIndex parent = parent_[i];
+    const bool continues_parent_task =
+        parent != -1 && (is_large(i) ? is_large(parent) && num_large_children[parent] == 1
+                                     : !is_large(parent));
+    if (continues_parent_task) {
+      task_for_node[i] = task_for_node[parent];
+    } else {
+      task_for_node[i] = static_cast<StorageIndex>(task_top.size());
+      task_top.push_back(i);
+    }
+  }
+  const StorageIndex num_tasks = static_cast<StorageIndex>(task_top.size());
+
+  // A task can run once every task below it is done, so its wave is one more than the waves of
+  // the tasks below it.  Tasks below have larger indices.
+  std::vector<StorageIndex> task_wave(num_tasks, 0);
+  StorageIndex num_waves = num_tasks > 0 ? 1 : 0;
+  for (StorageIndex task = num_tasks - 1; task >= 0; --task) {
+    const StorageIndex parent = parent_[task_top[task]];
+    if (parent != -1) {
+      StorageIndex& parent_wave = task_wave[task_for_node[parent]];
+      parent_wave = std::max(parent_wave, task_wave[task] + 1);
+      num_waves = std::max(num_waves, parent_wave + 1);
+    }
+  }
+
+  // The nodes of each task, in increasing order
+  task_node_starts_.assign(num_tasks + 1, 0);
+  for (StorageIndex i = 0; i < N; ++i) {
+    task_node_starts_[task_for_node[i] + 1] += 1;
+  }
+  std::partial_sum(task_node_starts_.begin(), task_node_starts_.end(), task_node_starts_.begin());
+  task_nodes_.resize(N);
+  std::vector<StorageIndex> next_node = task_node_starts_;
+  for (StorageIndex i = 0; i < N; ++i) {
+    task_nodes_[next_node[task_for_node[i]]++] = i;
+  }
+
+  // The tasks in each wave.  Their subtrees are disjoint, so each one gets a disjoint part of
+  // L_k_pattern_ as big as its subtree.
+  wave_starts_.assign(num_waves + 1, 0);
+  for (StorageIndex task = 0; task < num_tasks; ++task) {
+    wave_starts_[task_wave[task] + 1] += 1;
+  }
+  std::partial_sum(wave_starts_.begin(), wave_starts_.end(), wave_starts_.begin());
+  wave_tasks_.resize(num_tasks);
+  task_pattern_offsets_.resize(num_tasks);
+  task_pattern_sizes_.resize(num_tasks);
+  std::vector<StorageIndex> next_task(wave_starts_.begin(), wave_starts_.end() - 1);
+  std::vector<StorageIndex> next_pattern_offset(num_waves, 0);
+  for (StorageIndex task = 0; task < num_tasks; ++task) {
+    const StorageIndex wave = task_wave[task];
+    wave_tasks_[next_task[wave]++] = task;
+    task_pattern_offsets_[task] = next_pattern_offset[wave];
+    task_pattern_sizes_[task] = subtree_size[task_top[task]];
+    next_pattern_offset[wave] += task_pattern_sizes_[task];
+  }
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::ComputeSupernodes() {
+  const StorageIndex N = static_cast<StorageIndex>(L_.rows());
+  const StorageIndex* L_outer = L_.outerIndexPtr();
+  StorageIndex* L_inner = L_.innerIndexPtr();
+
+  // Compute the pattern of L, by walking the same row subtrees as ComputeSymbolicSparsity.  Rows
+  // are visited in increasing order, so each column of L comes out sorted.
+  std::vector<StorageIndex> next_in_col(L_outer, L_outer + N);
+  visited_.setConstant(-1);
+  for (StorageIndex k = 0; k < N; ++k) {
+    visited_[k] = k;
+    for (typename CholMatrixType::InnerIterator it(A_permuted_, k); it; ++it) {
+      StorageIndex i = it.index();
+      if (i >= k) {
+        continue;
+      }
+      while (visited_[i] != k) {
+        L_inner[next_in_col[i]++] = k;
+        visited_[i] = k;
+        i = parent_[i];
+      }
+    }
+  }
+
+  // Column j - 1 and column j are in the same supernode if j is the parent of j - 1, and column
+  // j - 1 has exactly one more nonzero below the diagonal.  Since the pattern of a column is a
+  // subset of the pattern of its parent (plus the parent), this means the patterns are the same
+  // below column j.
+  supernode_starts_.assign(1, 0);
+  for (StorageIndex j = 1; j < N; ++j) {
+    if (parent_[j - 1] != j || nnz_per_col_[j - 1] != nnz_per_col_[j] + 1) {
+      supernode_starts_.push_back(j);
+    }
+  }
+  if (N > 0) {
+    supernode_starts_.push_back(N);
+  }
+  const StorageIndex num_supernodes = static_cast<StorageIndex>(supernode_starts_.size()) - 1;
+
+  // Lay out the panels, and size the workspaces for the largest update between two supernodes
+  supernode_row_starts_.assign(1, 0);
+  supernode_value_starts_.assign(1, 0);
+  supernode_rows_.clear();
+  supernode_for_col_.resize(N);
+  StorageIndex max_cols = 0;
+  StorageIndex max_rows_below = 0;
+  for (StorageIndex s = 0; s < num_supernodes; ++s) {
+    const StorageIndex first = supernode_starts_[s];
+    const StorageIndex last = supernode_starts_[s + 1];
+    const StorageIndex num_cols = last - first;
+    const StorageIndex num_rows_below = nnz_per_col_[last - 1];
+
+    for (StorageIndex j = first; j < last; ++j) {
+      supernode_rows_.push_back(j);
+      supernode_for_col_[j] = s;
+    }
+    supernode_rows_.insert(supernode_rows_.end(), L_inner + L_outer[last - 1],
+                           L_inner + L_outer[last - 1] + num_rows_below);
+
+    supernode_row_starts_.push_back(static_cast<StorageIndex>(supernode_rows_.size()));
+    supernode_value_starts_.push_back(supernode_value_starts_.back() +
+                                      (num_cols + num_rows_below) * num_cols);
+    max_cols = std::max(max_cols, num_cols);
+    max_rows_below = std::max(max_rows_below, num_rows_below);
+  }
+
+  supernode_values_.resize(supernode_value_starts_.back());
+  supernode_list_heads_.resize(num_supernodes);
+  supernode_list_next_.resize(num_supernodes);
+  supernode_next_row_.resize(num_supernodes);
+  row_to_panel_row_.resize(N);
+  update_workspace_.resize(max_rows_below, max_rows_below);
+  scaled_workspace_.resize(max_rows_below, max_cols);
+}
+
 template <typename MatrixType, int UpLo>
 void SparseCholeskySolver<MatrixType, UpLo>::Factorize(const MatrixType& A) {
   const Eigen::Index N = A.rows();
@@ -115,14 +296,114 @@ void SparseCholeskySolver<MatrixType, UpLo>::Factorize(const MatrixType& A) {
   SYM_ASSERT(N == L_.rows());
   SYM_ASSERT(N == A.cols());
 
+  // The supernodal factorization is left-looking, so it reads the columns of the lower triangle
+  if (factorization_ == Factorization::SUPERNODAL) {
+    TwistIntoAPermuted<Eigen::Lower>(A);
+    FactorizeSupernodal();
+    return;
+  }
+
   // Apply twist
+  TwistIntoAPermuted<Eigen::Upper>(A);
+
+  // Initialize helpers
+  nnz_per_col_.setZero();
+  D_agg_.setZero();
+
+  if (thread_pool_ == nullptr) {
+    // For each row of L, compute nonzero pattern in topo order
+    for (StorageIndex k = 0; k < N; ++k) {
+      FactorizeRow(k, L_k_pattern_.data(), static_cast<StorageIndex>(N));
+    }
+    return;
+  }
+
+  // The pattern of row k only contains descendants of k in the elimination tree, so rows in
+  // disjoint subtrees read and write disjoint parts of L, D and the helpers.  The tasks in each
+  // wave are disjoint subtrees, and every task only depends on tasks in earlier waves.  Each row
+  // is computed with exactly the same operations as in the serial loop, so the result does not
+  // depend on the number of threads.
+  for (size_t wave = 0; wave + 1 < wave_starts_.size(); ++wave) {
+    const StorageIndex wave_start = wave_starts_[wave];
+    thread_pool_->Run(wave_starts_[wave + 1] - wave_start, [this, wave_start](const int index) {
+      const StorageIndex task = wave_tasks_[wave_start + index];
+      StorageIndex* const pattern = L_k_pattern_.data() + task_pattern_offsets_[task];
+      for (StorageIndex t = task_node_starts_[task]; t < task_node_starts_[task + 1]; ++t) {
+        FactorizeRow(task_nodes_[t], pattern, task_pattern_sizes_[task]);
+      }
+    });
+  }
+}
+
+template <typename MatrixType, int UpLo>
+template <int DstUpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::TwistIntoAPermuted(const MatrixType& A) {
+  const StorageIndex N = static_cast<StorageIndex>(A.cols());
+  const StorageIndex nnz = static_cast<StorageIndex>(A.nonZeros());
+  const StorageIndex* const A_outer = A.outerIndexPtr();
+  const StorageIndex* const A_inner = A.innerIndexPtr();
+
+  // The recorded value indices follow the storage of a compressed column major A
+  const bool can_record = !MatrixType::IsRowMajor && A.isCompressed();
+
+  if (can_record && twist_dst_uplo_ == DstUpLo &&
+      twist_outer_indices_.size() == static_cast<size_t>(N + 1) &&
+      twist_inner_indices_.size() == static_cast<size_t>(nnz) &&
+      std::equal(A_outer, A_outer + N + 1, twist_outer_indices_.begin()) &&
+      std::equal(A_inner, A_inner + nnz, twist_inner_indices_.begin())) {
+    const Scalar* const A_value = A.valuePtr();
+    Scalar* const A_permuted_value = A_permuted_.valuePtr();
+    for (StorageIndex k = 0; k < nnz; ++k) {
+      if (twist_value_indices_[k] >= 0) {
+        A_permuted_value[twist_value_indices_[k]] = A_value[k];
+      }
+    }
+    return;
+  }
+
   if (permutation_.size() > 0) {
-    A_permuted_.template selfadjointView<Eigen::Upper>() =
+    A_permuted_.template selfadjointView<DstUpLo>() =
         A.template selfadjointView<UpLo>().twistedBy(permutation_);
   } else {
-    A_permuted_.template selfadjointView<Eigen::Upper>() = A.template selfadjointView<UpLo>();
+    A_permuted_.template selfadjointView<DstUpLo>() = A.template selfadjointView<UpLo>();
   }
 
+  if (!can_record) {
+    twist_dst_uplo_ = -1;
+    return;
+  }
+
+  // Record where each value went, visiting the entries in the same order as Eigen's twist, which
+  // fills each column of A_permuted_ in that order
+  twist_outer_indices_.assign(A_outer, A_outer + N + 1);
+  twist_inner_indices_.assign(A_inner, A_inner + nnz);
+  twist_value_indices_.resize(nnz);
+  std::vector<StorageIndex> next_value(A_permuted_.outerIndexPtr(),
+                                       A_permuted_.outerIndexPtr() + N);
+  const StorageIndex* const perm =
+      permutation_.size() > 0 ? permutation_.indices().data() : nullptr;
+  for (StorageIndex j = 0; j < N; ++j) {
+    const StorageIndex jp = perm != nullptr ? perm[j] : j;
+    for (StorageIndex k = A_outer[j]; k < A_outer[j + 1]; ++k) {
+      const StorageIndex i = A_inner[k];
+      if ((static_cast<int>(UpLo) == Eigen::Lower && i < j) ||
+          (static_cast<int>(UpLo) == Eigen::Upper && i > j)) {
+        twist_value_indices_[k] = -1;
+        continue;
+      }
+
+      const StorageIndex ip = perm != nullptr ? perm[i] : i;
+      twist_value_indices_[k] =
+          next_value[DstUpLo == Eigen::Lower ? std::min(ip, jp) : std::max(ip, jp)]++;
+    }
+  }
+  twist_dst_uplo_ = DstUpLo;
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::FactorizeRow(const StorageIndex k,
+                                                          StorageIndex* const pattern,
+                                                          const StorageIndex pattern_size) {
   // Get the sparse storage arrays. For details see:
   // https://eigen.tuxfamily.org/dox/group__TutorialSparse.html
   const StorageIndex* L_outer = L_.outerIndexPtr();
@@ -132,88 +413,197 @@ void SparseCholeskySolver<MatrixType, UpLo>::Factorize(const MatrixType& A) {
   // See "Modified Cholesky Factorization", page 145:
   // http://www.bioinfo.org.cn/~wangchao/maa/Numerical_Optimization.pdf
 
-  // Initialize helpers
-  nnz_per_col_.setZero();
-  D_agg_.setZero();
+  // Mark k as visited
+  visited_[k] = k;
 
-  // For each row of L, compute nonzero pattern in topo order
-  for (StorageIndex k = 0; k < N; ++k) {
-    // Mark k as visited
-    visited_[k] = k;
+  // Reverse counter
+  StorageIndex top_inx = pattern_size;
 
-    // Reverse counter
-    StorageIndex top_inx = N;
+  for (typename CholMatrixType::InnerIterator it(A_permuted_, k); it; ++it) {
+    StorageIndex i = it.index();
 
-    for (typename CholMatrixType::InnerIterator it(A_permuted_, k); it; ++it) {
-      StorageIndex i = it.index();
+    if (i > k) {
+      continue;
+    }
 
-      if (i > k) {
-        continue;
-      }
+    // Sum A(i, k) into D_agg
+    D_agg_[i] += it.value();
 
-      // Sum A(i, k) into D_agg
-      D_agg_[i] += it.value();
+    Eigen::Index depth = 0;
+    while (visited_[i] != k) {
+      // L(k,i) is nonzero
+      pattern[depth] = i;
 
-      Eigen::Index depth = 0;
-      while (visited_[i] != k) {
-        // L(k,i) is nonzero
-        L_k_pattern_[depth] = i;
+      // Mark i as visited
+      visited_[i] = k;
 
-        // Mark i as visited
-        visited_[i] = k;
+      // Follow to parent
+      i = parent_[i];
 
-        // Follow to parent
-        i = parent_[i];
+      // Increment depth
+      depth += 1;
+    }
 
-        // Increment depth
-        depth += 1;
-      }
+    // Update pattern
+    while (depth > 0) {
+      top_inx -= 1;
+      depth -= 1;
+      pattern[top_inx] = pattern[depth];
+    }
+  }
 
-      // Update pattern
-      while (depth > 0) {
-        top_inx -= 1;
-        depth -= 1;
-        L_k_pattern_[top_inx] = L_k_pattern_[depth];
-      }
+  // Get D(k, k) and clear D_agg(k)
+  Scalar D_k = D_agg_[k];
+  D_agg_[k] = 0.0;
+
+  // NOTE(hayk): This is a double loop in a loop and is ~O(N^3 / 6)
+  for (; top_inx < pattern_size; ++top_inx) {
+    // pattern[top_inx:] is the pattern of L(:, k)
+    const Eigen::Index i = pattern[top_inx];
+
+    // Compute the nonzero L(k, i)
+    const Scalar D_agg_i = D_agg_[i];
+    const Scalar L_ki = D_agg_i / D_[i];
+
+    // Get the range for i
+    const Eigen::Index ptr_start = L_outer[i];
+    const Eigen::Index ptr_end = ptr_start + nnz_per_col_[i];
+
+    // Update D_agg
+    Eigen::Index ptr;
+    D_agg_[i] = 0.0;
+    for (ptr = ptr_start; ptr < ptr_end; ++ptr) {
+      D_agg_[L_inner[ptr]] -= L_value[ptr] * D_agg_i;
     }
 
-    // Get D(k, k) and clear D_agg(k)
-    Scalar D_k = D_agg_[k];
-    D_agg_[k] = 0.0;
+    // Save L(k, i)
+    L_inner[ptr] = k;
+    L_value[ptr] = L_ki;
+
+    // Update D(k)
+    D_k -= L_ki * D_agg_i;
 
-    // NOTE(hayk): This is a double loop in a loop and is ~O(N^3 / 6)
-    for (; top_inx < N; ++top_inx) {
-      // L_k_pattern_[top_inx:] is the pattern of L(:, k)
-      const Eigen::Index i = L_k_pattern_[top_inx];
+    // Increment nonzeros in column i
+    nnz_per_col_[i] += 1;
+  }
 
-      // Compute the nonzero L(k, i)
-      const Scalar D_agg_i = D_agg_[i];
-      const Scalar L_ki = D_agg_i / D_[i];
+  // Save D(k)
+  D_[k] = D_k;
+}
 
-      // Get the range for i
-      const Eigen::Index ptr_start = L_outer[i];
-      const Eigen::Index ptr_end = ptr_start + nnz_per_col_[i];
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::FactorizeSupernodal() {
+  using PanelMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>;
+
+  const StorageIndex num_supernodes = static_cast<StorageIndex>(supernode_starts_.size()) - 1;
+  supernode_values_.setZero();
+  std::fill(supernode_list_heads_.begin(), supernode_list_heads_.end(), -1);
+
+  // Adds supernode d to the list of supernodes waiting to update the supernode containing its
+  // next row, if it has one
+  const auto push_to_next_supernode = [this](const StorageIndex d) {
+    const StorageIndex next_row = supernode_next_row_[d];
+    const StorageIndex row_start = supernode_row_starts_[d];
+    if (row_start + next_row < supernode_row_starts_[d + 1]) {
+      const StorageIndex target = supernode_for_col_[supernode_rows_[row_start + next_row]];
+      supernode_list_next_[d] = supernode_list_heads_[target];
+      supernode_list_heads_[target] = d;
+    }
+  };
+
+  for (StorageIndex s = 0; s < num_supernodes; ++s) {
+    const StorageIndex first = supernode_starts_[s];
+    const StorageIndex last = supernode_starts_[s + 1];
+    const StorageIndex num_cols = last - first;
+    const StorageIndex* const rows = supernode_rows_.data() + supernode_row_starts_[s];
+    const StorageIndex num_rows = supernode_row_starts_[s + 1] - supernode_row_starts_[s];
+    PanelMap panel(supernode_values_.data() + supernode_value_starts_[s], num_rows, num_cols);
+
+    for (StorageIndex r = 0; r < num_rows; ++r) {
+      row_to_panel_row_[rows[r]] = r;
+    }
 
-      // Update D_agg
-      Eigen::Index ptr;
-      D_agg_[i] = 0.0;
-      for (ptr = ptr_start; ptr < ptr_end; ++ptr) {
-        D_agg_[L_inner[ptr]] -= L_value[ptr] * D_agg_i;
+    // Scatter the columns of A into the panel
+    for (StorageIndex c = 0; c < num_cols; ++c) {
+      for (typename CholMatrixType::InnerIterator it(A_permuted_, first + c); it; ++it) {
+        panel(row_to_panel_row_[it.index()], c) = it.value();
       }
+    }
 
-      // Save L(k, i)
-      L_inner[ptr] = k;
-      L_value[ptr] = L_ki;
+    // Apply the updates from every descendant supernode with rows in the columns of s, i.e.
+    // panel -= L(I, d) * D(d) * L(J, d)^T, where J are the rows of d in the columns of s and I are
+    // the rows of d from J down
+    StorageIndex d = supernode_list_heads_[s];
+    while (d != -1) {
+      const StorageIndex next_d = supernode_list_next_[d];
+
+      const StorageIndex d_first = supernode_starts_[d];
+      const StorageIndex d_num_cols = supernode_starts_[d + 1] - d_first;
+      const StorageIndex* const d_rows = supernode_rows_.data() + supernode_row_starts_[d];
+      const StorageIndex d_num_rows = supernode_row_starts_[d + 1] - supernode_row_starts_[d];
+      const PanelMap d_panel(supernode_values_.data() + supernode_value_starts_[d], d_num_rows,
+                             d_num_cols);
+
+      const StorageIndex row_begin = supernode_next_row_[d];
+      StorageIndex num_update_cols = 0;
+      while (row_begin + num_update_cols < d_num_rows &&
+             d_rows[row_begin + num_update_cols] < last) {
+        ++num_update_cols;
+      }
+      const StorageIndex num_update_rows = d_num_rows - row_begin;
+
+      auto scaled = scaled_workspace_.topLeftCorner(num_update_cols, d_num_cols);
+      scaled.noalias() = d_panel.middleRows(row_begin, num_update_cols) *
+                         D_.segment(d_first, d_num_cols).asDiagonal();
+      auto update = update_workspace_.topLeftCorner(num_update_rows, num_update_cols);
+      update.noalias() = d_panel.middleRows(row_begin, num_update_rows) * scaled.transpose();
+
+      for (StorageIndex c = 0; c < num_update_cols; ++c) {
+        const StorageIndex col = d_rows[row_begin + c] - first;
+        for (StorageIndex r = c; r < num_update_rows; ++r) {
+          panel(row_to_panel_row_[d_rows[row_begin + r]], col) -= update(r, c);
+        }
+      }
 
-      // Update D(k)
-      D_k -= L_ki * D_agg_i;
+      supernode_next_row_[d] = row_begin + num_update_cols;
+      push_to_next_supernode(d);
+      d = next_d;
+    }
 
-      // Increment nonzeros in column i
-      nnz_per_col_[i] += 1;
+    // Factorize the diagonal block in place as L * D * L^T, one column at a time
+    for (StorageIndex c = 0; c < num_cols; ++c) {
+      const Scalar D_c = panel(c, c);
+      D_[first + c] = D_c;
+      auto L_c = panel.col(c).segment(c + 1, num_cols - c - 1);
+      L_c /= D_c;
+      panel.block(c + 1, c + 1, num_cols - c - 1, num_cols - c - 1).noalias() -=
+          L_c * (D_c * L_c).transpose();
     }
 
-    // Save D(k)
-    D_[k] = D_k;
+    // Solve for the rows below the diagonal block, L_below = A_below * L^-T * D^-1
+    auto below = panel.bottomRows(num_rows - num_cols);
+    panel.topRows(num_cols)
+        .transpose()
+        .template triangularView<Eigen::UnitUpper>()
+        .template solveInPlace<Eigen::OnTheRight>(below);
+    below = below * D_.segment(first, num_cols).asDiagonal().inverse();
+
+    supernode_next_row_[s] = num_cols;
+    push_to_next_supernode(s);
+  }
+
+  // Copy the panels into L
+  const StorageIndex* L_outer = L_.outerIndexPtr();
+  Scalar* L_value = L_.valuePtr();
+  for (StorageIndex s = 0; s < num_supernodes; ++s) {
+    const StorageIndex first = supernode_starts_[s];
+    const StorageIndex num_cols = supernode_starts_[s + 1] - first;
+    const StorageIndex num_rows = supernode_row_starts_[s + 1] - supernode_row_starts_[s];
+    const PanelMap panel(supernode_values_.data() + supernode_value_starts_[s], num_rows, num_cols);
+    for (StorageIndex c = 0; c < num_cols; ++c) {
+      Eigen::Map<VectorType>(L_value + L_outer[first + c], num_rows - c - 1) =
+          panel.col(c).tail(num_rows - c - 1);
+    }
   }
 }
 
@@ -221,9 +611,25 @@ template <typename MatrixType, int UpLo>
 template <typename Rhs>
 typename SparseCholeskySolver<MatrixType, UpLo>::RhsType
 SparseCholeskySolver<MatrixType, UpLo>::Solve(const Eigen::MatrixBase<Rhs>& b) const {
-  RhsType x = b;
-  SolveInPlace(&x);
-  return x;
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(L_.rows() == b.rows());
+
+  // Twist
+  RhsType x;
+  if (permutation_.size() > 0) {
+    x = permutation_ * b;
+  } else {
+    x = b;
+  }
+
+  SolvePermutedInPlace(&x);
+
+  // Untwist
+  if (permutation_.size() > 0) {
+    return inv_permutation_ * x;
+  } else {
+    return x;
+  }
 }
 
 template <typename MatrixType, int UpLo>
@@ -233,28 +639,308 @@ void SparseCholeskySolver<MatrixType, UpLo>::SolveInPlace(Eigen::MatrixBase<Rhs>
   SYM_ASSERT(is_initialized_);
   SYM_ASSERT(b != nullptr);
   SYM_ASSERT(L_.rows() == b->rows());
-  SYM_ASSERT(D_.size() > 0);
 
-  // Pre-computed cholesky decomposition
-  const Eigen::TriangularView<const CholMatrixType, Eigen::UnitLower> L(L_);
+  // Twist, into a workspace since permuting in place allocates
+  RhsType& x = solve_workspace_;
+  if (permutation_.size() > 0) {
+    x = permutation_ * (*b);
+  } else {
+    x = *b;
+  }
 
-  Eigen::MatrixBase<Rhs>& x = *b;
+  SolvePermutedInPlace(&x);
 
-  // Twist
+  // Untwist
   if (permutation_.size() > 0) {
-    x = permutation_ * x;
+    *b = inv_permutation_ * x;
+  } else {
+    *b = x;
   }
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::SolvePermutedInPlace(RhsType* const x) const {
+  SYM_ASSERT(D_.size() > 0);
+
+  // Pre-computed cholesky decomposition
+  const Eigen::TriangularView<const CholMatrixType, Eigen::UnitLower> L(L_);
 
   // A * x = b
   // (L * D * L^T) * x = b
   // x = L^-T * D^-1 * L^-1 * b
-  L.solveInPlace(x);
-  x = D_.asDiagonal().inverse() * x;
-  L.adjoint().solveInPlace(x);
+  L.solveInPlace(*x);
+  *x = D_.asDiagonal().inverse() * (*x);
+  L.adjoint().solveInPlace(*x);
+}
 
-  // Untwist
-  if (permutation_.size() > 0) {
-    x = inv_permutation_ * x;
+template <typename MatrixType, int UpLo>
+bool SparseCholeskySolver<MatrixType, UpLo>::CanRankUpdate(const RowMajorMatrixType& W) {
+  SYM_ASSERT(W.cols() == L_.rows());
+
+  const StorageIndex N = static_cast<StorageIndex>(L_.rows());
+  const StorageIndex* L_outer = L_.outerIndexPtr();
+  const StorageIndex* L_inner = L_.innerIndexPtr();
+
+  const auto permuted_index = [this](const StorageIndex i) {
+    return permutation_.size() > 0 ? permutation_.indices()[i] : i;
+  };
+
+  // After the update of column j, the nonzeros of the row are in the pattern of column j of L, and
+  // the pattern of each column below the diagonal is contained in its parent plus the parent, so
+  // only the first column on the path has to be checked
+  for (StorageIndex row = 0; row < W.outerSize(); ++row) {
+    StorageIndex first = N;
+    for (typename RowMajorMatrixType::InnerIterator it(W, row); it; ++it) {
+      first = std::min(first, permuted_index(static_cast<StorageIndex>(it.col())));
+    }
+    if (first == N) {
+      continue;
+    }
+
+    for (StorageIndex ptr = L_outer[first]; ptr < L_outer[first + 1]; ++ptr) {
+      rank_update_marker_[L_inner[ptr]] = row;
+    }
+    rank_update_marker_[first] = row;
+
+    bool contained = true;
+    for (typename RowMajorMatrixType::InnerIterator it(W, row); it; ++it) {
+      contained &= rank_update_marker_[permuted_index(static_cast<StorageIndex>(it.col()))] == row;
+    }
+
+    for (StorageIndex ptr = L_outer[first]; ptr < L_outer[first + 1]; ++ptr) {
+      rank_update_marker_[L_inner[ptr]] = -1;
+    }
+    rank_update_marker_[first] = -1;
+
+    if (!contained) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::ApplyRankUpdate(const RowMajorMatrixType& W,
+                                                             const Scalar sigma) {
+  const StorageIndex N = static_cast<StorageIndex>(L_.rows());
+  const StorageIndex* L_outer = L_.outerIndexPtr();
+  const StorageIndex* L_inner = L_.innerIndexPtr();
+  Scalar* L_value = L_.valuePtr();
+
+  const auto permuted_index = [this](const StorageIndex i) {
+    return permutation_.size() > 0 ? permutation_.indices()[i] : i;
+  };
+
+  // See "Modifying a Sparse Cholesky Factorization", Davis and Hager, algorithm C1:
+  // https://www.cise.ufl.edu/~davis/techreports/modify/modify.pdf
+  //
+  // For L D L^T + sigma * w * w^T, each column j on the path computes
+  //
+  //     alpha_new = alpha + sigma * w(j)^2 / D(j)
+  //     D(j) *= alpha_new / alpha
+  //     w(i) -= w(j) * L(i, j)                      for i in the pattern of column j
+  //     L(i, j) += sigma * w(j) / (D_old(j) * alpha_new) * w(i)
+  //
+  // starting from alpha = 1, and the next column is the first nonzero of w, which is the parent of
+  // j in the elimination tree.  Each entry of rank_update_row_ is cleared once it's used.
+  VectorType& w = rank_update_row_;
+  for (StorageIndex row = 0; row < W.outerSize(); ++row) {
+    StorageIndex j = N;
+    for (typename RowMajorMatrixType::InnerIterator it(W, row); it; ++it) {
+      const StorageIndex i = permuted_index(static_cast<StorageIndex>(it.col()));
+      w[i] = it.value();
+      j = std::min(j, i);
+    }
+
+    Scalar alpha = 1;
+    while (j < N) {
+      const Scalar w_j = w[j];
+      w[j] = 0;
+
+      const Scalar D_j = D_[j];
+      const Scalar alpha_new = alpha + sigma * w_j * w_j / D_j;
+      D_[j] = D_j * alpha_new / alpha;
+      const Scalar gamma = sigma * w_j / (D_j * alpha_new);
+      alpha = alpha_new;
+
+      for (StorageIndex ptr = L_outer[j]; ptr < L_outer[j + 1]; ++ptr) {
+        const StorageIndex i = L_inner[ptr];
+        w[i] -= w_j * L_value[ptr];
+        L_value[ptr] += gamma * w[i];
+      }
+
+      // Columns of L are sorted, so the first entry is the parent
+      j = L_outer[j] < L_outer[j + 1] ? L_inner[L_outer[j]] : N;
+    }
+  }
+}
+
+template <typename MatrixType, int UpLo>
+bool SparseCholeskySolver<MatrixType, UpLo>::RankUpdate(const RowMajorMatrixType& W) {
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(D_.size() > 0);
+
+  if (!CanRankUpdate(W)) {
+    return false;
+  }
+  ApplyRankUpdate(W, 1);
+  return true;
+}
+
+template <typename MatrixType, int UpLo>
+bool SparseCholeskySolver<MatrixType, UpLo>::RankDowndate(const RowMajorMatrixType& W) {
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(D_.size() > 0);
+
+  if (!CanRankUpdate(W)) {
+    return false;
+  }
+  ApplyRankUpdate(W, -1);
+  return true;
+}
+
+template <typename MatrixType, int UpLo>
+bool SparseCholeskySolver<MatrixType, UpLo>::UpdateFactorization(
+    const MatrixType& A_new, const RowMajorMatrixType& W_added,
+    const RowMajorMatrixType& W_removed) {
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(D_.size() > 0);
+
+  // Check both before modifying anything, so we never refactorize after a partial update.  The
+  // updates go before the downdates, so the intermediate matrix stays positive definite if A and
+  // A_new are.
+  if (CanRankUpdate(W_added) && CanRankUpdate(W_removed)) {
+    ApplyRankUpdate(W_added, 1);
+    ApplyRankUpdate(W_removed, -1);
+    return true;
+  }
+
+  ComputeSymbolicSparsity(A_new);
+  Factorize(A_new);
+  return false;
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::ComputeSelectedInverse(
+    CholMatrixType* const selected_inverse) const {
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(selected_inverse != nullptr);
+  SYM_ASSERT(D_.size() > 0);
+
+  const StorageIndex N = static_cast<StorageIndex>(L_.rows());
+  const StorageIndex* L_outer = L_.outerIndexPtr();
+  const StorageIndex* L_inner = L_.innerIndexPtr();
+  const Scalar* L_value = L_.valuePtr();
+
+  // Z has the pattern of L, with the diagonal first in each column
+  CholMatrixType& Z = *selected_inverse;
+  Z.resize(N, N);
+  StorageIndex* Z_outer = Z.outerIndexPtr();
+  for (StorageIndex j = 0; j <= N; ++j) {
+    Z_outer[j] = L_outer[j] + j;
+  }
+  Z.resizeNonZeros(Z_outer[N]);
+  StorageIndex* Z_inner = Z.innerIndexPtr();
+  Scalar* Z_value = Z.valuePtr();
+  for (StorageIndex j = 0; j < N; ++j) {
+    Z_inner[Z_outer[j]] = j;
+    std::copy(L_inner + L_outer[j], L_inner + L_outer[j + 1], Z_inner + Z_outer[j] + 1);
+  }
+
+  // With A = L D L^T and Z = A^-1, Z = D^-1 L^-1 + (I - L^T) Z, and since I - L^T is strictly
+  // upper triangular each column j of Z only depends on the columns after it:
+  //
+  //     Z(i, j) = -sum_{k > j} Z(i, k) L(k, j)         for i > j
+  //     Z(j, j) = 1 / D(j) - sum_{k > j} L(k, j) Z(k, j)
+  //
+  // The sums are over the pattern of column j of L, and for i and k both in that pattern Z(i, k)
+  // is in the pattern of L, so only the entries on the pattern are needed.
+  //
+  // position[i] is the index of row i in the pattern of the current column, or -1
+  std::vector<StorageIndex> position(N, -1);
+  VectorType column_sum(N);
+
+  for (StorageIndex j = N - 1; j >= 0; --j) {
+    const StorageIndex start = L_outer[j];
+    const StorageIndex count = L_outer[j + 1] - start;
+    for (StorageIndex a = 0; a < count; ++a) {
+      position[L_inner[start + a]] = a;
+    }
+    column_sum.head(count).setZero();
+
+    // Every pair of rows (r_a, r_b) of the column with r_a >= r_b is an entry of column r_b of Z
+    for (StorageIndex b = 0; b < count; ++b) {
+      const StorageIndex r_b = L_inner[start + b];
+      const Scalar L_bj = L_value[start + b];
+      for (StorageIndex p = Z_outer[r_b]; p < Z_outer[r_b + 1]; ++p) {
+        const StorageIndex a = position[Z_inner[p]];
+        if (a == -1) {
+          continue;
+        }
+        column_sum[a] += Z_value[p] * L_bj;
+        if (a != b) {
+          column_sum[b] += Z_value[p] * L_value[start + a];
+        }
+      }
+    }
+
+    Scalar diagonal = Scalar(1) / D_[j];
+    for (StorageIndex a = 0; a < count; ++a) {
+      Z_value[Z_outer[j] + 1 + a] = -column_sum[a];
+      diagonal += L_value[start + a] * column_sum[a];
+      position[L_inner[start + a]] = -1;
+    }
+    Z_value[Z_outer[j]] = diagonal;
+  }
+}
+
+template <typename MatrixType, int UpLo>
+void SparseCholeskySolver<MatrixType, UpLo>::SelectedInverseBlock(
+    const CholMatrixType& selected_inverse, const StorageIndex offset, const StorageIndex dim,
+    RhsType* const block) const {
+  SYM_ASSERT(is_initialized_);
+  SYM_ASSERT(block != nullptr);
+  SYM_ASSERT(selected_inverse.rows() == L_.rows());
+  SYM_ASSERT(offset >= 0 && offset + dim <= L_.rows());
+
+  const auto permuted_index = [this](const StorageIndex i) {
+    return permutation_.size() > 0 ? permutation_.indices()[i] : i;
+  };
+
+  block->resize(dim, dim);
+  for (StorageIndex col = 0; col < dim; ++col) {
+    bool have_column = true;
+    for (StorageIndex row = col; row < dim; ++row) {
+      const StorageIndex i = permuted_index(offset + row);
+      const StorageIndex j = permuted_index(offset + col);
+      const StorageIndex z_row = std::max(i, j);
+      const StorageIndex z_col = std::min(i, j);
+
+      const StorageIndex* const begin =
+          selected_inverse.innerIndexPtr() + selected_inverse.outerIndexPtr()[z_col];
+      const StorageIndex* const end =
+          selected_inverse.innerIndexPtr() + selected_inverse.outerIndexPtr()[z_col + 1];
+      const StorageIndex* const found = std::find(begin, end, z_row);
+      if (found == end) {
+        have_column = false;
+        break;
+      }
+
+      const Scalar value = selected_inverse.valuePtr()[found - selected_inverse.innerIndexPtr()];
+      (*block)(row, col) = value;
+      (*block)(col, row) = value;
+    }
+
+    if (!have_column) {
+      // Entries outside the pattern of L are generally nonzero in A^-1, but are not computed by the
+      // selected inversion, so get this column of A^-1 from the factorization instead
+      const RhsType inverse_column = Solve(VectorType::Unit(L_.rows(), offset + col));
+      for (StorageIndex row = col; row < dim; ++row) {
+        (*block)(row, col) = inverse_column(offset + row, 0);
+        (*block)(col, row) = inverse_column(offset + row, 0);
+      }
+    }
   }
 }
 
@@ -0,0 +1,175 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include "./assert.h"
+#include "./hessian_operator.h"
+
+namespace sym {
+
+// Solves A * x = b, where A is a symmetric positive definite HessianOperator and b is a dense
+// vector or matrix, with preconditioned conjugate gradients.
+//
+// A is never factorized; each iteration computes one product with A, which for a HessianOperator
+// built from the jacobian is two products with J.  This makes memory scale with the number of
+// nonzeros in J instead of in a cholesky factor, so this can solve problems too large for a
+// direct solver, at the cost of an inexact solution.  Iteration stops when
+// ||b - A * x|| <= relative_tolerance * ||b||, or after max_iterations.
+//
+// Preconditioners:
+//
+//     NONE: No preconditioning
+//     BLOCK_JACOBI: The inverse of the block diagonal of A
+//     SCHUR_JACOBI: Eliminates a set of blocks that are not coupled to each other (e.g. the
+//         landmarks in bundle adjustment) exactly, and approximates the Schur complement on the
+//         remaining blocks (e.g. the cameras) by its block diagonal.  The eliminated blocks are
+//         chosen by ComputeSymbolicSparsity as a maximal independent set of the graph of blocks,
+//         greedily in order of increasing degree, which picks the landmarks in bundle adjustment
+//         problems.  This is the preconditioner to use for bundle adjustment.
+//
+// Has the same interface as SparseCholeskySolver, so it can be used as the LinearSolverType of a
+// LevenbergMarquardtSolver.  Like Eigen's iterative solvers, it keeps a pointer to the matrix
+// passed to Factorize, which must outlive any calls to Solve.
+//
+// Not thread safe, since solves use internal workspace.
+template <typename ScalarType>
+class ConjugateGradientSolver {
+ public:
+  using Scalar = ScalarType;
+  using MatrixType = HessianOperator<Scalar>;
+  using StorageIndex = typename MatrixType::StorageIndex;
+  using RhsType = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+  using PermutationMatrixType =
+      Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, StorageIndex>;
+
+  enum class Preconditioner { NONE, BLOCK_JACOBI, SCHUR_JACOBI };
+
+  explicit ConjugateGradientSolver(
+      const Preconditioner preconditioner = Preconditioner::BLOCK_JACOBI,
+      const int max_iterations = 500, const Scalar relative_tolerance = 1e-8)
+      : preconditioner_(preconditioner),
+        max_iterations_(max_iterations),
+        relative_tolerance_(relative_tolerance) {}
+
+  // Whether we have computed a symbolic sparsity and are ready to factorize/solve.
+  bool IsInitialized() const {
+    return is_initialized_;
+  }
+
+  // Record the block structure of A, and choose the blocks to eliminate for SCHUR_JACOBI.  For
+  // SCHUR_JACOBI this also records the row structure of the jacobian of A, so later matrices must
+  // have a jacobian with the same sparsity pattern.
+  void ComputeSymbolicSparsity(const MatrixType& A);
+
+  // Compute the preconditioner for A, and keep a pointer to A for Solve.  A must have the same
+  // block structure as the matrix passed to ComputeSymbolicSparsity.  Returns false if a block of
+  // the preconditioner is not positive definite, in which case A is not positive definite.
+  bool Factorize(const MatrixType& A);
+
+  // Returns x for A x = b, where x and b are dense
+  template <typename Rhs>
+  RhsType Solve(const Eigen::MatrixBase<Rhs>& b) const;
+
+  // Solves in place for x in A x = b, where x and b are dense
+  template <typename Rhs>
+  void SolveInPlace(Eigen::MatrixBase<Rhs>* b) const;
+
+  // Total number of conjugate gradient iterations in the last call to Solve or SolveInPlace, over
+  // all columns of b
+  int Iterations() const {
+    return iterations_;
+  }
+
+  // Largest relative residual ||b - A * x|| / ||b|| of a column in the last solve
+  Scalar RelativeResidual() const {
+    return relative_residual_;
+  }
+
+  Preconditioner PreconditionerType() const {
+    return preconditioner_;
+  }
+
+  int MaxIterations() const {
+    return max_iterations_;
+  }
+
+  Scalar RelativeTolerance() const {
+    return relative_tolerance_;
+  }
+
+  // The blocks eliminated by the SCHUR_JACOBI preconditioner, in increasing order
+  const std::vector<StorageIndex>& EliminatedBlocks() const {
+    SYM_ASSERT(IsInitialized());
+    return eliminated_blocks_;
+  }
+
+  // There is no factor, so this is empty.  For compatibility with the direct solvers.
+  Eigen::SparseMatrix<Scalar> L() const {
+    SYM_ASSERT(IsInitialized());
+    return Eigen::SparseMatrix<Scalar>(permutation_.size(), permutation_.size());
+  }
+
+  // The identity.  For compatibility with the direct solvers.
+  const PermutationMatrixType& Permutation() const {
+    SYM_ASSERT(IsInitialized());
+    return permutation_;
+  }
+
+ private:
+  // Compute z = M^-1 * r for the preconditioner M
+  void ApplyPreconditioner(const VectorX<Scalar>& r, VectorX<Scalar>* z) const;
+
+  // Solve A * x = b for one column, starting from x = 0.  Returns the number of iterations.
+  int SolveColumn(const VectorX<Scalar>& b, VectorX<Scalar>* x) const;
+
+  bool is_initialized_{false};
+
+  Preconditioner preconditioner_;
+  int max_iterations_;
+  Scalar relative_tolerance_;
+
+  const MatrixType* A_{nullptr};
+  PermutationMatrixType permutation_;
+
+  // Inverse of the preconditioner on each diagonal block.  For eliminated blocks this is the
+  // inverse of the block of A, and for the other blocks the inverse of the block of the
+  // (approximate) Schur complement.
+  std::vector<MatrixX<Scalar>> block_inverses_;
+
+  // The blocks eliminated by SCHUR_JACOBI, and for each of them the off-diagonal blocks of A in
+  // its block column (all of which are in blocks that are not eliminated)
+  std::vector<StorageIndex> eliminated_blocks_;
+  std::vector<uint8_t> is_eliminated_;
+
+  // The pattern of the jacobian of A in row major order, for SCHUR_JACOBI
+  typename MatrixType::JacobianRows jacobian_rows_;
+  std::vector<StorageIndex> coupling_starts_;
+  std::vector<StorageIndex> coupling_row_blocks_;
+  std::vector<MatrixX<Scalar>> coupling_blocks_;
+
+  // Statistics of the last solve
+  mutable int iterations_{0};
+  mutable Scalar relative_residual_{0};
+
+  // Working storage for the iterations
+  mutable VectorX<Scalar> b_column_;
+  mutable VectorX<Scalar> x_column_;
+  mutable VectorX<Scalar> r_;
+  mutable VectorX<Scalar> z_;
+  mutable VectorX<Scalar> p_;
+  mutable VectorX<Scalar> Ap_;
+  mutable std::vector<VectorX<Scalar>> eliminated_workspace_;
+};
+
+}  // namespace sym
+
+#include "./conjugate_gradient_solver.tcc"
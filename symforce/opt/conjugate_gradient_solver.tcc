@@ -0,0 +1,252 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <algorithm>
+#include <numeric>
+
+#include "./assert.h"
+#include "./conjugate_gradient_solver.h"
+
+namespace sym {
+
+template <typename ScalarType>
+void ConjugateGradientSolver<ScalarType>::ComputeSymbolicSparsity(const MatrixType& A) {
+  const StorageIndex num_blocks = A.NumBlockCols();
+
+  permutation_.setIdentity(A.Cols());
+
+  eliminated_blocks_.clear();
+  is_eliminated_.assign(num_blocks, 0);
+  jacobian_rows_ = typename MatrixType::JacobianRows();
+  if (preconditioner_ == Preconditioner::SCHUR_JACOBI) {
+    jacobian_rows_ = A.ComputeJacobianRows();
+    const std::vector<std::vector<StorageIndex>> adjacency = A.BlockAdjacency(jacobian_rows_);
+
+    // Greedy maximal independent set, visiting blocks in order of increasing degree
+    std::vector<StorageIndex> blocks_by_degree(num_blocks);
+    std::iota(blocks_by_degree.begin(), blocks_by_degree.end(), 0);
+    std::stable_sort(blocks_by_degree.begin(), blocks_by_degree.end(),
+                     [&adjacency](const StorageIndex a, const StorageIndex b) {
+                       return adjacency[a].size() < adjacency[b].size();
+                     });
+
+    std::vector<uint8_t> is_excluded(num_blocks, 0);
+    for (const StorageIndex block : blocks_by_degree) {
+      if (is_excluded[block]) {
+        continue;
+      }
+      is_eliminated_[block] = 1;
+      for (const StorageIndex neighbor : adjacency[block]) {
+        is_excluded[neighbor] = 1;
+      }
+    }
+
+    for (StorageIndex block = 0; block < num_blocks; ++block) {
+      if (is_eliminated_[block]) {
+        eliminated_blocks_.push_back(block);
+      }
+    }
+  }
+
+  block_inverses_.resize(num_blocks);
+  eliminated_workspace_.resize(eliminated_blocks_.size());
+
+  is_initialized_ = true;
+}
+
+template <typename ScalarType>
+bool ConjugateGradientSolver<ScalarType>::Factorize(const MatrixType& A) {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A.NumBlockCols() == static_cast<StorageIndex>(block_inverses_.size()));
+  SYM_ASSERT(A.Cols() == permutation_.size());
+
+  A_ = &A;
+
+  if (preconditioner_ == Preconditioner::NONE) {
+    return true;
+  }
+
+  // The diagonal blocks of A, minus the contributions of eliminated blocks for SCHUR_JACOBI
+  std::vector<MatrixX<Scalar>> diagonal_blocks(A.NumBlockCols());
+  for (StorageIndex block = 0; block < A.NumBlockCols(); ++block) {
+    if (!is_eliminated_[block]) {
+      diagonal_blocks[block] = A.DiagonalBlock(block);
+    }
+  }
+
+  bool success = true;
+
+  coupling_starts_.assign(1, 0);
+  coupling_row_blocks_.clear();
+  coupling_blocks_.clear();
+  if (!eliminated_blocks_.empty()) {
+    std::vector<typename MatrixType::BlockColumn> columns =
+        A.BlockColumns(eliminated_blocks_, jacobian_rows_);
+    for (size_t k = 0; k < eliminated_blocks_.size(); ++k) {
+      typename MatrixType::BlockColumn& column = columns[k];
+
+      // The diagonal block is first
+      const Eigen::LLT<MatrixX<Scalar>> llt(column.blocks[0]);
+      if (llt.info() != Eigen::Success) {
+        success = false;
+      }
+      MatrixX<Scalar>& inverse = block_inverses_[eliminated_blocks_[k]];
+      inverse = llt.solve(MatrixX<Scalar>::Identity(column.blocks[0].rows(),
+                                                    column.blocks[0].cols()));
+
+      // S_cc -= A_ce * A_ee^-1 * A_ec for every pair of blocks coupled to this one.  Only the
+      // diagonal blocks of S are kept.
+      for (size_t i = 1; i < column.row_blocks.size(); ++i) {
+        const StorageIndex row_block = column.row_blocks[i];
+        SYM_ASSERT(!is_eliminated_[row_block]);
+        diagonal_blocks[row_block].noalias() -=
+            column.blocks[i] * inverse * column.blocks[i].transpose();
+
+        coupling_row_blocks_.push_back(row_block);
+        coupling_blocks_.push_back(std::move(column.blocks[i]));
+      }
+      coupling_starts_.push_back(static_cast<StorageIndex>(coupling_row_blocks_.size()));
+    }
+  }
+
+  for (StorageIndex block = 0; block < A.NumBlockCols(); ++block) {
+    if (is_eliminated_[block]) {
+      continue;
+    }
+
+    const Eigen::LLT<MatrixX<Scalar>> llt(diagonal_blocks[block]);
+    if (llt.info() != Eigen::Success) {
+      success = false;
+    }
+    block_inverses_[block] =
+        llt.solve(MatrixX<Scalar>::Identity(A.BlockDim(block), A.BlockDim(block)));
+  }
+
+  return success;
+}
+
+template <typename ScalarType>
+void ConjugateGradientSolver<ScalarType>::ApplyPreconditioner(const VectorX<Scalar>& r,
+                                                              VectorX<Scalar>* const z) const {
+  if (preconditioner_ == Preconditioner::NONE) {
+    *z = r;
+    return;
+  }
+
+  const MatrixType& A = *A_;
+
+  // With eliminated blocks e and remaining blocks c, the preconditioner is
+  //     M = [A_ee, A_ec; A_ce, S~ + A_ce A_ee^-1 A_ec]
+  // where S~ is the block diagonal of the Schur complement, so M^-1 r is computed by block
+  // elimination:
+  //     y_e = A_ee^-1 r_e
+  //     z_c = S~^-1 (r_c - A_ce y_e)
+  //     z_e = y_e - A_ee^-1 A_ec z_c
+  *z = r;
+  for (size_t k = 0; k < eliminated_blocks_.size(); ++k) {
+    const StorageIndex block = eliminated_blocks_[k];
+    VectorX<Scalar>& y = eliminated_workspace_[k];
+    y.noalias() = block_inverses_[block] * r.segment(A.BlockOffset(block), A.BlockDim(block));
+    for (StorageIndex i = coupling_starts_[k]; i < coupling_starts_[k + 1]; ++i) {
+      const StorageIndex row_block = coupling_row_blocks_[i];
+      z->segment(A.BlockOffset(row_block), A.BlockDim(row_block)).noalias() -=
+          coupling_blocks_[i] * y;
+    }
+  }
+
+  for (StorageIndex block = 0; block < A.NumBlockCols(); ++block) {
+    if (!is_eliminated_[block]) {
+      auto z_block = z->segment(A.BlockOffset(block), A.BlockDim(block));
+      z_block = block_inverses_[block] * z_block;
+    }
+  }
+
+  for (size_t k = 0; k < eliminated_blocks_.size(); ++k) {
+    const StorageIndex block = eliminated_blocks_[k];
+    VectorX<Scalar>& y = eliminated_workspace_[k];
+    for (StorageIndex i = coupling_starts_[k]; i < coupling_starts_[k + 1]; ++i) {
+      const StorageIndex row_block = coupling_row_blocks_[i];
+      y.noalias() -= block_inverses_[block] *
+                     (coupling_blocks_[i].transpose() *
+                      z->segment(A.BlockOffset(row_block), A.BlockDim(row_block)));
+    }
+    z->segment(A.BlockOffset(block), A.BlockDim(block)) = y;
+  }
+}
+
+template <typename ScalarType>
+int ConjugateGradientSolver<ScalarType>::SolveColumn(const VectorX<Scalar>& b,
+                                                     VectorX<Scalar>* const x) const {
+  x->setZero(b.size());
+
+  const Scalar b_norm = b.norm();
+  if (b_norm == 0) {
+    return 0;
+  }
+
+  r_ = b;
+  ApplyPreconditioner(r_, &z_);
+  p_ = z_;
+  Scalar rz = r_.dot(z_);
+
+  int iteration = 0;
+  Scalar r_norm = b_norm;
+  while (iteration < max_iterations_ && r_norm > relative_tolerance_ * b_norm) {
+    A_->Multiply(p_, &Ap_);
+    const Scalar pAp = p_.dot(Ap_);
+    if (!(pAp > 0)) {
+      // A is not positive definite along p (or p is zero), so we can't make progress
+      break;
+    }
+
+    const Scalar alpha = rz / pAp;
+    *x += alpha * p_;
+    r_ -= alpha * Ap_;
+    r_norm = r_.norm();
+    ++iteration;
+
+    if (r_norm <= relative_tolerance_ * b_norm) {
+      break;
+    }
+
+    ApplyPreconditioner(r_, &z_);
+    const Scalar rz_new = r_.dot(z_);
+    p_ = z_ + (rz_new / rz) * p_;
+    rz = rz_new;
+  }
+
+  relative_residual_ = std::max(relative_residual_, r_norm / b_norm);
+  return iteration;
+}
+
+template <typename ScalarType>
+template <typename Rhs>
+typename ConjugateGradientSolver<ScalarType>::RhsType ConjugateGradientSolver<ScalarType>::Solve(
+    const Eigen::MatrixBase<Rhs>& b) const {
+  RhsType x = b;
+  SolveInPlace(&x);
+  return x;
+}
+
+template <typename ScalarType>
+template <typename Rhs>
+void ConjugateGradientSolver<ScalarType>::SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A_ != nullptr);
+  SYM_ASSERT(b != nullptr);
+  SYM_ASSERT(b->rows() == A_->Rows());
+
+  iterations_ = 0;
+  relative_residual_ = 0;
+  for (Eigen::Index col = 0; col < b->cols(); ++col) {
+    b_column_ = b->col(col);
+    iterations_ += SolveColumn(b_column_, &x_column_);
+    b->col(col) = x_column_;
+  }
+}
+
+}  // namespace sym
@@ -0,0 +1,241 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <type_traits>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <lcmtypes/sym/optimization_stats_t.hpp>
+#include <lcmtypes/sym/optimizer_params_t.hpp>
+
+#include "./cholesky/sparse_cholesky_solver.h"
+#include "./internal/levenberg_marquardt_state.h"
+#include "./levenberg_marquardt_solver.h"
+#include "./optimization_stats.h"
+#include "./tic_toc.h"
+#include "./values.h"
+
+namespace sym {
+
+/**
+ * Powell's dogleg trust region solver for nonlinear least squares problems specified by a
+ * linearization function.  Has the same interface as LevenbergMarquardtSolver, so it can be used
+ * as the NonlinearSolverType of an Optimizer.
+ *
+ * Levenberg-Marquardt has to damp and refactorize the hessian after every rejected step, even
+ * though the linearization is unchanged.  The dogleg solver instead factorizes the Gauss-Newton
+ * system once per linearization, and picks each step from two fixed points: the Gauss-Newton step
+ *
+ *     dx_gn = -inv(H) * g
+ *
+ * and the Cauchy point, the minimum of the quadratic model along the gradient g = J.T * b,
+ *
+ *     dx_c = -(g.T * g) / (g.T * H * g) * g
+ *
+ * which only needs one product with H.  For a trust region radius r, the step is dx_gn if it is
+ * inside the region, dx_c scaled to the boundary if dx_c is outside the region, and otherwise the
+ * point where the segment from dx_c to dx_gn crosses the boundary.  The radius is grown or shrunk
+ * depending on how well the quadratic model predicted the reduction in error.  A rejected step only
+ * shrinks the radius, and the next iteration picks a new step from the same dx_gn and dx_c, so it
+ * needs neither a factorization nor a linear solve.
+ *
+ * H is damped by epsilon on the diagonal before factorizing, which keeps it positive definite when
+ * the problem is not fully constrained.
+ *
+ * From the optimizer_params_t, this uses iterations, early_exit_min_reduction, and verbose; the
+ * trust region is configured by TrustRegionParams instead of the lambda params.  In the
+ * optimization_iteration_t of each iteration, current_lambda is the trust region radius the step
+ * was computed with, and linear_solver_iterations is 0 for iterations that reuse the factorization.
+ *
+ * The hessian is solved with LinearSolverType, whose MatrixType must be Eigen::SparseMatrix (e.g.
+ * SparseCholeskySolver, SparseSchurSolver or MixedPrecisionCholeskySolver).
+ *
+ * Not thread safe! Create one per thread.
+ */
+template <typename ScalarType,
+          typename LinearSolverType = sym::SparseCholeskySolver<Eigen::SparseMatrix<ScalarType>>>
+class DoglegSolver {
+ public:
+  using Scalar = ScalarType;
+  using LinearSolver = LinearSolverType;
+  using StateType = internal::LevenbergMarquardtState<Scalar>;
+  using HessianType = typename LinearSolver::MatrixType;
+
+  static_assert(std::is_same<HessianType, Eigen::SparseMatrix<Scalar>>::value,
+                "DoglegSolver requires a linear solver for Eigen::SparseMatrix");
+
+  using LinearizeFunc = std::function<void(const Values<Scalar>&, Linearization<Scalar>* const)>;
+
+  /**
+   * Parameters of the trust region
+   */
+  struct TrustRegionParams {
+    // Radius of the trust region on the first iteration
+    double initial_radius{1.0};
+    // Largest allowed radius
+    double max_radius{1e8};
+    // Exit if a step is rejected and the radius is below this
+    double min_radius{1e-12};
+
+    // The radius is multiplied by shrink_factor if the ratio of the actual to the predicted
+    // reduction in error is below min_step_quality, and by grow_factor if the ratio is above
+    // good_step_quality and the step reached the boundary of the region
+    double min_step_quality{0.25};
+    double good_step_quality{0.75};
+    double shrink_factor{0.25};
+    double grow_factor{2.0};
+  };
+
+  /**
+   * Which of the dogleg steps was taken on an iteration
+   */
+  enum class StepType { GAUSS_NEWTON, DOGLEG, STEEPEST_DESCENT };
+
+  DoglegSolver(const optimizer_params_t& p, const std::string& id, const Scalar epsilon)
+      : p_(p), id_(id), epsilon_(epsilon) {}
+
+  DoglegSolver(const optimizer_params_t& p, const std::string& id, const Scalar epsilon,
+               const LinearSolver& linear_solver)
+      : p_(p), id_(id), epsilon_(epsilon), linear_solver_(linear_solver) {}
+
+  DoglegSolver(const optimizer_params_t& p, const std::string& id, const Scalar epsilon,
+               const TrustRegionParams& trust_region_params,
+               const LinearSolver& linear_solver = LinearSolver())
+      : p_(p),
+        trust_region_params_(trust_region_params),
+        id_(id),
+        epsilon_(epsilon),
+        linear_solver_(linear_solver) {}
+
+  void SetIndex(const index_t& index) {
+    index_ = index;
+  }
+
+  // Create an initial state to start a new optimization.
+  void Reset(const Values<Scalar>& values) {
+    // Should have called SetIndex already
+    SYM_ASSERT(!index_.entries.empty());
+
+    radius_ = trust_region_params_.initial_radius;
+    iteration_ = -1;
+
+    ResetState(values);
+  }
+
+  // Reset the state values, such as if the cost function changes and linearizations are invalid.
+  // Resets the values for optimization, but doesn't reset the radius or the number of iterations.
+  void ResetState(const Values<Scalar>& values) {
+    SYM_TIME_SCOPE("Dogleg<{}>::ResetState", id_);
+    // Should have called SetIndex already
+    SYM_ASSERT(!index_.entries.empty());
+
+    have_steps_ = false;
+    state_.Reset(values);
+  }
+
+  const optimizer_params_t& Params() const {
+    return p_;
+  }
+
+  void UpdateParams(const optimizer_params_t& p);
+
+  const TrustRegionParams& GetTrustRegionParams() const {
+    return trust_region_params_;
+  }
+
+  const LinearSolver& GetLinearSolver() const {
+    return linear_solver_;
+  }
+
+  // Run one iteration of the optimization. Returns true if the optimization should early exit.
+  bool Iterate(const LinearizeFunc& func, OptimizationStats<Scalar>* const stats,
+               const bool debug_stats = false);
+
+  const Values<Scalar>& GetBestValues() const {
+    SYM_ASSERT(state_.BestIsValid());
+    return state_.Best().values;
+  }
+
+  const Linearization<Scalar>& GetBestLinearization() const {
+    SYM_ASSERT(state_.BestIsValid() && state_.Best().GetLinearization().IsInitialized());
+    return state_.Best().GetLinearization();
+  }
+
+  // The current trust region radius
+  double Radius() const {
+    return radius_;
+  }
+
+  // The type of step taken on the last iteration
+  StepType LastStepType() const {
+    return step_type_;
+  }
+
+  // Number of factorizations of the hessian since construction
+  int NumFactorizations() const {
+    return num_factorizations_;
+  }
+
+ private:
+  // Compute the Gauss-Newton step and the Cauchy point for the linearization of the init state
+  void ComputeSteps(bool debug_stats, OptimizationStats<Scalar>* stats);
+
+  // Set update_ to the dogleg step for the current radius
+  void ComputeDoglegStep();
+
+  // The reduction in error predicted by the quadratic model for a step of -update
+  Scalar PredictedReduction(const VectorX<Scalar>& update) const;
+
+  void PopulateIterationStats(optimization_iteration_t* const iteration_stats,
+                              const Scalar new_error, const Scalar linear_error,
+                              const Scalar relative_reduction, const bool debug_stats) const;
+
+  void Update(const Values<Scalar>& values, const index_t& index, const VectorX<Scalar>& update,
+              Values<Scalar>* const updated_values) const;
+
+  optimizer_params_t p_;
+  TrustRegionParams trust_region_params_{};
+  std::string id_;
+
+  Scalar epsilon_;
+
+  // State blocks for the optimizer
+  StateType state_;
+
+  LinearSolver linear_solver_{};
+  bool solver_analyzed_{false};
+  int num_factorizations_{0};
+
+  double radius_{1.0};
+  int iteration_{-1};
+
+  // Whether gauss_newton_step_ and cauchy_step_ are for the linearization of the init state.  Both
+  // are stored negated, i.e. as the update subtracted from the values, like in
+  // LevenbergMarquardtSolver.
+  bool have_steps_{false};
+  bool solved_this_iteration_{false};
+  VectorX<Scalar> gauss_newton_step_;
+  VectorX<Scalar> cauchy_step_;
+  Scalar gradient_norm_{0};
+  Scalar gauss_newton_norm_{0};
+  Scalar cauchy_norm_{0};
+  StepType step_type_{StepType::GAUSS_NEWTON};
+
+  // Working storage to avoid reallocation
+  VectorX<Scalar> update_;
+  VectorX<Scalar> H_times_vector_;
+  HessianType H_;
+  HessianType H_damped_;
+
+  // Index for the associated values, used for values.Update or Retract
+  index_t index_{};
+};
+
+}  // namespace sym
+
+#include "./dogleg_solver.tcc"
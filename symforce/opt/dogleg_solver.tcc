@@ -0,0 +1,331 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <spdlog/spdlog.h>
+
+#include "./dogleg_solver.h"
+#include "./tic_toc.h"
+#include "./util.h"
+
+namespace sym {
+
+// ----------------------------------------------------------------------------
+// Private methods
+// ----------------------------------------------------------------------------
+
+template <typename ScalarType, typename LinearSolverType>
+void DoglegSolver<ScalarType, LinearSolverType>::ComputeSteps(
+    const bool debug_stats, OptimizationStats<Scalar>* const stats) {
+  SYM_TIME_SCOPE("Dogleg<{}>: ComputeSteps", id_);
+
+  const Linearization<Scalar>& linearization = state_.Init().GetLinearization();
+  const VectorX<Scalar>& gradient = linearization.rhs;
+
+  H_ = linearization.HessianLower();
+
+  // Analyze the sparsity pattern for efficient repeated factorization
+  if (!solver_analyzed_) {
+    SYM_TIME_SCOPE("Dogleg<{}>: AnalyzePattern", id_);
+    HessianType H_analyze = H_;
+    // Make sure the diagonal is nonzero for analysis
+    H_analyze.diagonal().setOnes();
+    linear_solver_.ComputeSymbolicSparsity(H_analyze);
+    solver_analyzed_ = true;
+  }
+
+  // The Cauchy point minimizes the quadratic model along the gradient.  If the model has no
+  // minimum along the gradient, steps along it are only limited by the trust region.
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: CauchyPoint", id_);
+    gradient_norm_ = gradient.norm();
+    H_times_vector_.noalias() = H_.template selfadjointView<Eigen::Lower>() * gradient;
+    const Scalar gHg = gradient.dot(H_times_vector_);
+    if (gHg > 0) {
+      cauchy_step_ = (gradient.squaredNorm() / gHg) * gradient;
+      cauchy_norm_ = cauchy_step_.norm();
+    } else {
+      cauchy_step_ = gradient;
+      cauchy_norm_ = std::numeric_limits<Scalar>::infinity();
+    }
+  }
+
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: SparseFactorize", id_);
+    H_damped_ = H_;
+    H_damped_.diagonal().array() += epsilon_;
+    linear_solver_.Factorize(H_damped_);
+    num_factorizations_++;
+
+    // NOTE(aaron): This has to happen after the first factorize, since L_inner is not filled out
+    // by ComputeSymbolicSparsity
+    if (debug_stats && stats->linear_solver_ordering.size() == 0) {
+      stats->linear_solver_ordering = linear_solver_.Permutation().indices();
+      const auto& L = linear_solver_.L();
+      stats->cholesky_factor_sparsity = {
+          Eigen::Map<const VectorX<typename HessianType::StorageIndex>>(L.innerIndexPtr(),
+                                                                        L.nonZeros()),
+          Eigen::Map<const VectorX<typename HessianType::StorageIndex>>(L.outerIndexPtr(),
+                                                                        L.outerSize())};
+    }
+  }
+
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: SparseSolve", id_);
+    gauss_newton_step_ = linear_solver_.Solve(gradient);
+    gauss_newton_norm_ = gauss_newton_step_.norm();
+  }
+
+  if (!std::isfinite(gauss_newton_norm_)) {
+    spdlog::warn("Dogleg<{}> Non-finite Gauss-Newton step, using steepest descent", id_);
+    gauss_newton_step_ = cauchy_step_;
+    gauss_newton_norm_ = cauchy_norm_;
+  }
+
+  have_steps_ = true;
+  solved_this_iteration_ = true;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void DoglegSolver<ScalarType, LinearSolverType>::ComputeDoglegStep() {
+  const Scalar radius = static_cast<Scalar>(radius_);
+
+  if (gauss_newton_norm_ <= radius) {
+    step_type_ = StepType::GAUSS_NEWTON;
+    update_ = gauss_newton_step_;
+    return;
+  }
+
+  if (cauchy_norm_ >= radius) {
+    step_type_ = StepType::STEEPEST_DESCENT;
+    const Scalar direction_norm = cauchy_step_.norm();
+    if (direction_norm > 0) {
+      update_ = (radius / direction_norm) * cauchy_step_;
+    } else {
+      update_.setZero(cauchy_step_.rows());
+    }
+    return;
+  }
+
+  // The Cauchy point is inside the region and the Gauss-Newton step is outside, so find
+  // beta in (0, 1] with ||c + beta * (gn - c)|| = radius, i.e. the positive root of
+  //     a * beta**2 + b * beta + c = 0
+  // with a = ||gn - c||**2, b = 2 * c.T * (gn - c), and c = ||c||**2 - radius**2 < 0
+  step_type_ = StepType::DOGLEG;
+  update_ = gauss_newton_step_ - cauchy_step_;
+  const Scalar a = update_.squaredNorm();
+  const Scalar b = 2 * cauchy_step_.dot(update_);
+  const Scalar c = Square(cauchy_norm_) - Square(radius);
+  const Scalar sqrt_discriminant = std::sqrt(b * b - 4 * a * c);
+  // Use the form of the root that avoids cancellation
+  const Scalar beta =
+      b > 0 ? -2 * c / (b + sqrt_discriminant) : (-b + sqrt_discriminant) / (2 * a);
+  update_ = cauchy_step_ + beta * update_;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+ScalarType DoglegSolver<ScalarType, LinearSolverType>::PredictedReduction(
+    const VectorX<Scalar>& update) const {
+  // e(x - update) ~= e(x) - g.T * update + 0.5 * update.T * H * update
+  const auto H = H_.template selfadjointView<Eigen::Lower>();
+  return state_.Init().GetLinearization().rhs.dot(update) - 0.5 * update.dot(H * update);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void DoglegSolver<ScalarType, LinearSolverType>::PopulateIterationStats(
+    optimization_iteration_t* const iteration_stats, const Scalar new_error,
+    const Scalar linear_error, const Scalar relative_reduction, const bool debug_stats) const {
+  SYM_TIME_SCOPE("Dogleg<{}>: IterationStats", id_);
+
+  iteration_stats->iteration = iteration_;
+  iteration_stats->current_lambda = radius_;
+  iteration_stats->linearized = true;
+
+  iteration_stats->new_error = new_error;
+  iteration_stats->new_error_linear = linear_error;
+  iteration_stats->relative_reduction = relative_reduction;
+  iteration_stats->linear_solver_iterations =
+      solved_this_iteration_ ? internal::LinearSolverIterations<LinearSolver>::Get(linear_solver_)
+                             : 0;
+
+  if (p_.verbose) {
+    SYM_TIME_SCOPE("Dogleg<{}>: IterationStats - Print", id_);
+    spdlog::info(
+        "Dogleg<{}> [iter {:4d}] radius: {:.3e}, error prev/linear/new: {:.3f}/{:.3f}/{:.3f}, "
+        "rel reduction: {:.5f}",
+        id_, iteration_stats->iteration, iteration_stats->current_lambda, state_.Init().Error(),
+        iteration_stats->new_error_linear, iteration_stats->new_error,
+        iteration_stats->relative_reduction);
+  }
+
+  if (debug_stats) {
+    iteration_stats->values = state_.New().values.template Cast<double>().GetLcmType();
+    const VectorX<Scalar> residual_vec = state_.New().GetLinearization().residual;
+    iteration_stats->residual = residual_vec.template cast<float>();
+    const VectorX<Scalar> jacobian_vec = state_.New().GetLinearization().JacobianValuesMap();
+    iteration_stats->jacobian_values = jacobian_vec.template cast<float>();
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void DoglegSolver<ScalarType, LinearSolverType>::Update(
+    const Values<Scalar>& values, const index_t& index, const VectorX<Scalar>& update,
+    Values<Scalar>* const updated_values) const {
+  SYM_ASSERT(update.rows() == index.tangent_dim);
+
+  if (updated_values->NumEntries() == 0) {
+    // If the state_ blocks are empty the first time, copy in the full structure
+    (*updated_values) = values;
+  } else {
+    // Otherwise just copy the keys being optimized
+    updated_values->Update(index, values);
+  }
+
+  // Apply the update
+  updated_values->Retract(index, update.data(), epsilon_);
+}
+
+// ----------------------------------------------------------------------------
+// Public methods
+// ----------------------------------------------------------------------------
+
+template <typename ScalarType, typename LinearSolverType>
+void DoglegSolver<ScalarType, LinearSolverType>::UpdateParams(const optimizer_params_t& p) {
+  if (p_.verbose) {
+    spdlog::info("Dogleg<{}>: UPDATING OPTIMIZER PARAMS", id_);
+  }
+  p_ = p;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+bool DoglegSolver<ScalarType, LinearSolverType>::Iterate(const LinearizeFunc& func,
+                                                         OptimizationStats<Scalar>* const stats,
+                                                         const bool debug_stats) {
+  SYM_TIME_SCOPE("Dogleg<{}>::Iterate()", id_);
+  SYM_ASSERT(stats != nullptr);
+
+  // new -> init
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: StateStep", id_);
+    state_.Step();
+    iteration_++;
+  }
+
+  if (!state_.Init().GetLinearization().IsInitialized()) {
+    SYM_TIME_SCOPE("Dogleg<{}>: EvaluateFirst", id_);
+    state_.Init().Relinearize(func);
+    state_.SetBestToInit();
+    have_steps_ = false;
+  }
+
+  // save the initial error state_ before optimizing
+  if (iteration_ == 0) {
+    SYM_TIME_SCOPE("Dogleg<{}>: FirstIterationStats", id_);
+    stats->iterations.emplace_back();
+    optimization_iteration_t& iteration_stats = stats->iterations.back();
+    iteration_stats.iteration = -1;
+    iteration_stats.new_error = state_.Init().Error();
+    iteration_stats.current_lambda = radius_;
+    iteration_stats.linearized = true;
+
+    if (debug_stats) {
+      iteration_stats.values = state_.Init().values.template Cast<double>().GetLcmType();
+      const VectorX<Scalar> residual_vec = state_.Init().GetLinearization().residual;
+      iteration_stats.residual = residual_vec.template cast<float>();
+      const VectorX<Scalar> jacobian_vec = state_.Init().GetLinearization().JacobianValuesMap();
+      iteration_stats.jacobian_values = jacobian_vec.template cast<float>();
+    }
+  }
+
+  // The steps only depend on the linearization, so after a rejected step they are reused
+  solved_this_iteration_ = false;
+  if (!have_steps_) {
+    ComputeSteps(debug_stats, stats);
+  }
+
+  ComputeDoglegStep();
+  const Scalar step_norm = update_.norm();
+
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: Update", id_);
+    Update(state_.Init().values, index_, -update_, &state_.New().values);
+  }
+
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: linearization_func", id_);
+    state_.New().Relinearize(func);
+  }
+
+  const Scalar init_error = state_.Init().Error();
+  const Scalar new_error = state_.New().Error();
+  const Scalar relative_reduction = (init_error - new_error) / (init_error + epsilon_);
+  const Scalar predicted_reduction = PredictedReduction(update_);
+
+  stats->iterations.emplace_back();
+  optimization_iteration_t& iteration_stats = stats->iterations.back();
+  PopulateIterationStats(&iteration_stats, new_error, init_error - predicted_reduction,
+                         relative_reduction, debug_stats);
+
+  if (!std::isfinite(new_error)) {
+    spdlog::warn("Dogleg<{}> Encountered non-finite error: {}", id_, new_error);
+  }
+
+  // Early exit if the reduction in error is too small.
+  bool should_early_exit =
+      (relative_reduction > 0) && (relative_reduction < p_.early_exit_min_reduction);
+
+  {
+    SYM_TIME_SCOPE("Dogleg<{}>: accept_update bookkeeping", id_);
+    const bool accept_update = relative_reduction > 0;
+
+    // Ratio of the actual to the predicted reduction in error
+    const Scalar step_quality =
+        predicted_reduction > 0 ? (init_error - new_error) / predicted_reduction : 0;
+
+    if (!accept_update || step_quality < trust_region_params_.min_step_quality) {
+      // Shrink from the length of the step taken, which may be well inside the region for a
+      // Gauss-Newton step, so that the next step is different
+      radius_ = trust_region_params_.shrink_factor * std::min<double>(radius_, step_norm);
+    } else if (step_quality > trust_region_params_.good_step_quality &&
+               step_type_ != StepType::GAUSS_NEWTON) {
+      radius_ = std::min(trust_region_params_.grow_factor * radius_,
+                         trust_region_params_.max_radius);
+    }
+
+    // If we didn't accept the update and the region has collapsed, just exit.
+    should_early_exit |= (!accept_update && radius_ < trust_region_params_.min_radius);
+
+    if (!accept_update) {
+      // swap state_ blocks so that the next iteration gets the same initial state_ as this one
+      state_.SwapNewAndInit();
+    } else {
+      have_steps_ = false;
+      if (state_.New().Error() <= state_.Best().Error()) {
+        state_.SetBestToNew();
+        stats->best_index = stats->iterations.size() - 1;
+      }
+      // Ensure that we are not going to modify the Best state_ block in the next iteration
+      state_.SetInitToNotBest();
+    }
+
+    // Finish populating iteration_stats
+    iteration_stats.update_angle_change = 0;
+    iteration_stats.update_accepted = accept_update;
+  }
+
+  return should_early_exit;
+}
+
+// ----------------------------------------------------------------------------
+// Shorthand instantiations
+// ----------------------------------------------------------------------------
+
+using DoglegSolverd = DoglegSolver<double>;
+using DoglegSolverf = DoglegSolver<float>;
+
+}  // namespace sym
@@ -61,7 +61,7 @@ void Factor<Scalar>::Linearize(const Values<Scalar>& values, VectorX<Scalar>* re
     sparse_hessian_func_(values, values_id_and_index_entries_.second, residual, nullptr, nullptr,
                          nullptr);
   } else {
-    hessian_func_(values, values_id_and_index_entries_.second, residual, nullptr, nullptr, nullptr);
+    EvaluateDenseHessianFunc(values, residual, nullptr, nullptr, nullptr);
   }
 }
 
@@ -70,7 +70,7 @@ void Factor<Scalar>::Linearize(const Values<Scalar>& values, VectorX<Scalar>* re
                                MatrixX<Scalar>* jacobian) const {
   SYM_ASSERT(!IsSparse());
   EnsureIndexEntriesExist(values);
-  hessian_func_(values, values_id_and_index_entries_.second, residual, jacobian, nullptr, nullptr);
+  EvaluateDenseHessianFunc(values, residual, jacobian, nullptr, nullptr);
 }
 
 template <typename Scalar>
@@ -88,12 +88,12 @@ void Factor<Scalar>::Linearize(const Values<Scalar>& values,
   assert(linearized_factor != nullptr);
   SYM_ASSERT(!IsSparse());
 
-  FillLinearizedFactorIndex(values, *linearized_factor);
-
   // TODO(hayk): Maybe the function should just accept a LinearizedDenseFactor*
   EnsureIndexEntriesExist(values);
-  hessian_func_(values, values_id_and_index_entries_.second, &linearized_factor->residual,
-                &linearized_factor->jacobian, &linearized_factor->hessian, &linearized_factor->rhs);
+  FillLinearizedFactorIndex(*linearized_factor);
+
+  EvaluateDenseHessianFunc(values, &linearized_factor->residual, &linearized_factor->jacobian,
+                           &linearized_factor->hessian, &linearized_factor->rhs);
 
   // Sanity check dimensions
   SYM_ASSERT(linearized_factor->index.tangent_dim == linearized_factor->jacobian.cols());
@@ -107,10 +107,10 @@ void Factor<Scalar>::Linearize(const Values<Scalar>& values,
   assert(linearized_factor != nullptr);
   SYM_ASSERT(IsSparse());
 
-  FillLinearizedFactorIndex(values, *linearized_factor);
-
   // TODO(hayk): Maybe the function should just accept a LinearizedSparseFactor*
   EnsureIndexEntriesExist(values);
+  FillLinearizedFactorIndex(*linearized_factor);
+
   sparse_hessian_func_(values, values_id_and_index_entries_.second, &linearized_factor->residual,
                        &linearized_factor->jacobian, &linearized_factor->hessian,
                        &linearized_factor->rhs);
@@ -121,6 +121,51 @@ void Factor<Scalar>::Linearize(const Values<Scalar>& values,
   SYM_ASSERT(linearized_factor->index.tangent_dim == linearized_factor->rhs.rows());
 }
 
+template <typename Scalar>
+void Factor<Scalar>::LinearizeInto(const Values<Scalar>& values, VectorMap* const residual,
+                                   MatrixMap* const jacobian, MatrixMap* const hessian,
+                                   VectorMap* const rhs) const {
+  SYM_ASSERT(CanLinearizeInto());
+  SYM_ASSERT(residual != nullptr);
+
+  EnsureIndexEntriesExist(values);
+  hessian_map_func_(values, values_id_and_index_entries_.second, residual, jacobian, hessian, rhs);
+}
+
+template <typename Scalar>
+void Factor<Scalar>::EvaluateDenseHessianFunc(const Values<Scalar>& values,
+                                              VectorX<Scalar>* const residual,
+                                              MatrixX<Scalar>* const jacobian,
+                                              MatrixX<Scalar>* const hessian,
+                                              VectorX<Scalar>* const rhs) const {
+  const std::vector<index_entry_t>& keys_to_func = values_id_and_index_entries_.second;
+  if (hessian_func_) {
+    hessian_func_(values, keys_to_func, residual, jacobian, hessian, rhs);
+    return;
+  }
+
+  // Resize the requested outputs to the dimensions of hessian_map_func_ and map them
+  SYM_ASSERT(residual != nullptr);
+  const auto resized_data = [](auto* const output, const int rows, const int cols) -> Scalar* {
+    if (output == nullptr) {
+      return nullptr;
+    }
+    output->resize(rows, cols);
+    return output->data();
+  };
+
+  const int M = map_func_residual_dim_;
+  const int N = map_func_tangent_dim_;
+  VectorMap residual_map(resized_data(residual, M, 1), M);
+  MatrixMap jacobian_map(resized_data(jacobian, M, N), M, N);
+  MatrixMap hessian_map(resized_data(hessian, N, N), N, N);
+  VectorMap rhs_map(resized_data(rhs, N, 1), N);
+  hessian_map_func_(values, keys_to_func, &residual_map,
+                    jacobian == nullptr ? nullptr : &jacobian_map,
+                    hessian == nullptr ? nullptr : &hessian_map,
+                    rhs == nullptr ? nullptr : &rhs_map);
+}
+
 template <typename Scalar>
 typename Factor<Scalar>::LinearizedDenseFactor Factor<Scalar>::Linearize(
     const Values<Scalar>& values) const {
@@ -154,23 +199,25 @@ void Factor<ScalarType>::EnsureIndexEntriesExist(const Values<Scalar>& values) c
   for (const auto& key : keys_) {
     cached_index_entries_.push_back(values.IndexEntryAt(key));
   }
+
+  // The index of the linearized factor only depends on the types of the optimized keys, but those
+  // may have changed along with the structure of the Values.  Set the types and everything from
+  // the Values, but the offset we want is within the factor
+  linearized_factor_index_ = values.CreateIndex(keys_to_optimize_);
+  int32_t offset = 0;
+  for (index_entry_t& entry : linearized_factor_index_.entries) {
+    entry.offset = offset;
+    offset += entry.tangent_dim;
+  }
+
   values_id_and_index_entries_.first = values.Id();
 }
 
 template <typename Scalar>
 template <typename LinearizedFactorT>
-void Factor<Scalar>::FillLinearizedFactorIndex(const Values<Scalar>& values,
-                                               LinearizedFactorT& linearized_factor) const {
+void Factor<Scalar>::FillLinearizedFactorIndex(LinearizedFactorT& linearized_factor) const {
   if (linearized_factor.index.storage_dim == 0) {
-    // Set the types and everything from the index
-    linearized_factor.index = values.CreateIndex(keys_to_optimize_);
-
-    // But the offset we want is within the factor
-    int32_t offset = 0;
-    for (index_entry_t& entry : linearized_factor.index.entries) {
-      entry.offset = offset;
-      offset += entry.tangent_dim;
-    }
+    linearized_factor.index = linearized_factor_index_;
   }
 }
 
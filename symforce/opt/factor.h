@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <memory>
 #include <ostream>
 
 #include <Eigen/Sparse>
@@ -24,6 +25,16 @@ struct LinearizedDenseFactorTypeHelper;
 template <typename _S>
 struct LinearizedSparseFactorTypeHelper;
 
+template <typename _S>
+class FactorBatch;
+
+namespace internal {
+
+template <typename _S>
+class FactorBatchKernel;
+
+}  // namespace internal
+
 // NOTE(aaron): Unlike the dense versions of these, we don't have SparseMatrix eigen_lcm types, so
 // we just defined these as structs, since we don't need to serialize them anyway
 struct linearized_sparse_factor_t {
@@ -101,6 +112,19 @@ class Factor {
   using DenseHessianFunc = HessianFunc<MatrixX<Scalar>>;
   using SparseHessianFunc = HessianFunc<Eigen::SparseMatrix<Scalar>>;
 
+  // Same as DenseHessianFunc, but writes into views of preallocated storage of the correct size,
+  // instead of (possibly) resizing its outputs.  This is used by the Linearizer to evaluate factors
+  // directly into contiguous storage for all factors.
+  using VectorMap = Eigen::Map<VectorX<Scalar>>;
+  using MatrixMap = Eigen::Map<MatrixX<Scalar>>;
+  using DenseHessianMapFunc = std::function<void(const Values<Scalar>&,             // Input storage
+                                                 const std::vector<index_entry_t>&,  // Keys
+                                                 VectorMap*,  // Mx1 residual
+                                                 MatrixMap*,  // MxN jacobian
+                                                 MatrixMap*,  // NxN hessian
+                                                 VectorMap*   // Nx1 right-hand side
+                                                 )>;
+
   // ----------------------------------------------------------------------------------------------
   // Constructors
   // ----------------------------------------------------------------------------------------------
@@ -125,6 +149,15 @@ class Factor {
    */
   Factor(DenseHessianFunc hessian_func, const std::vector<Key>& keys_to_func,
          const std::vector<Key>& keys_to_optimize);
+  /**
+   * Create from a (dense) hessian functor that writes into preallocated storage, for a factor with
+   * a fixed residual dimension and tangent dimension.  Linearizing into dynamic size matrices
+   * resizes them and evaluates the same functor into them, so the factor holds a single functor.
+   * Used by the fixed size Factor::Jacobian and Factor::Hessian constructors.
+   */
+  Factor(DenseHessianMapFunc hessian_map_func, int residual_dim, int tangent_dim,
+         const std::vector<Key>& keys_to_func, const std::vector<Key>& keys_to_optimize);
+
   Factor(SparseHessianFunc hessian_func, const std::vector<Key>& keys_to_func);
   Factor(SparseHessianFunc hessian_func, const std::vector<Key>& keys_to_func,
          const std::vector<Key>& keys_to_optimize);
@@ -136,6 +169,21 @@ class Factor {
     return is_sparse_;
   }
 
+  /**
+   * Can this factor be linearized into preallocated storage with LinearizeInto?
+   */
+  bool CanLinearizeInto() const {
+    return static_cast<bool>(hessian_map_func_);
+  }
+
+  /**
+   * The kernel shared by all the factors of the FactorBatch this factor was created from, or
+   * nullptr if it was not created from a FactorBatch
+   */
+  const internal::FactorBatchKernel<Scalar>* BatchKernel() const {
+    return batch_kernel_.get();
+  }
+
   /**
    * Create from a function that computes the (dense) jacobian. The hessian will be computed using
    * the Gauss Newton approximation:
@@ -303,6 +351,16 @@ class Factor {
    */
   void Linearize(const Values<Scalar>& values, LinearizedSparseFactor* linearized_factor) const;
 
+  /**
+   * Evaluate the factor at the given linearization point, writing the residual, jacobian, hessian,
+   * and right-hand-side into views of preallocated storage, which must already have the correct
+   * sizes.  Any of the outputs after the residual may be nullptr.
+   *
+   * This overload can only be called if CanLinearizeInto is true; otherwise, it will throw
+   */
+  void LinearizeInto(const Values<Scalar>& values, VectorMap* residual, MatrixMap* jacobian,
+                     MatrixMap* hessian, VectorMap* rhs) const;
+
   // ----------------------------------------------------------------------------------------------
   // Helpers
   // ----------------------------------------------------------------------------------------------
@@ -320,14 +378,30 @@ class Factor {
  private:
   void EnsureIndexEntriesExist(const Values<Scalar>& values) const;
 
+  // Set the index of a linearized factor from linearized_factor_index_, if it has not been set
+  // yet.  Requires EnsureIndexEntriesExist to have been called
   template <typename LinearizedFactorT>
-  void FillLinearizedFactorIndex(const Values<Scalar>& values,
-                                 LinearizedFactorT& linearized_factor) const;
+  void FillLinearizedFactorIndex(LinearizedFactorT& linearized_factor) const;
+
+  // Evaluate the dense hessian functor, or hessian_map_func_ if there is none.  Requires
+  // EnsureIndexEntriesExist to have been called
+  void EvaluateDenseHessianFunc(const Values<Scalar>& values, VectorX<Scalar>* residual,
+                                MatrixX<Scalar>* jacobian, MatrixX<Scalar>* hessian,
+                                VectorX<Scalar>* rhs) const;
 
   DenseHessianFunc hessian_func_;
+  DenseHessianMapFunc hessian_map_func_;
+
+  // Dimensions of the outputs of hessian_map_func_
+  int map_func_residual_dim_{0};
+  int map_func_tangent_dim_{0};
   SparseHessianFunc sparse_hessian_func_;
   bool is_sparse_;
 
+  // Set if this factor was created from a FactorBatch
+  std::shared_ptr<const internal::FactorBatchKernel<Scalar>> batch_kernel_;
+  friend class FactorBatch<Scalar>;
+
   // Keys to be optimized in this factor, which must match the column order of the jacobian.
   std::vector<Key> keys_to_optimize_;
 
@@ -338,6 +412,9 @@ class Factor {
   // Values ID are used to detect structure changes.
   mutable std::pair<int64_t, std::vector<index_entry_t>> values_id_and_index_entries_{
       Values<Scalar>::kInvalidId, {}};
+
+  // Index of the optimized keys within a linearized factor, cached along with the index entries
+  mutable index_t linearized_factor_index_{};
 };
 
 // Shorthand instantiations
@@ -17,6 +17,20 @@ template <typename Scalar>
 Factor<Scalar>::Factor(DenseHessianFunc hessian_func, const std::vector<Key>& keys_to_func,
                        const std::vector<Key>& keys_to_optimize)
     : hessian_func_(std::move(hessian_func)),
+      hessian_map_func_(),
+      sparse_hessian_func_(),
+      is_sparse_(false),
+      keys_to_optimize_(keys_to_optimize),
+      keys_(keys_to_func) {}
+
+template <typename Scalar>
+Factor<Scalar>::Factor(DenseHessianMapFunc hessian_map_func, const int residual_dim,
+                       const int tangent_dim, const std::vector<Key>& keys_to_func,
+                       const std::vector<Key>& keys_to_optimize)
+    : hessian_func_(),
+      hessian_map_func_(std::move(hessian_map_func)),
+      map_func_residual_dim_(residual_dim),
+      map_func_tangent_dim_(tangent_dim),
       sparse_hessian_func_(),
       is_sparse_(false),
       keys_to_optimize_(keys_to_optimize),
@@ -30,6 +44,7 @@ template <typename Scalar>
 Factor<Scalar>::Factor(SparseHessianFunc sparse_hessian_func, const std::vector<Key>& keys_to_func,
                        const std::vector<Key>& keys_to_optimize)
     : hessian_func_(),
+      hessian_map_func_(),
       sparse_hessian_func_(std::move(sparse_hessian_func)),
       is_sparse_(true),
       keys_to_optimize_(keys_to_optimize),
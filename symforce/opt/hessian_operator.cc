@@ -0,0 +1,305 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./hessian_operator.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "./assert.h"
+
+namespace sym {
+
+template <typename Scalar>
+void HessianOperator<Scalar>::SetBlockDims(std::vector<StorageIndex> block_dims) {
+  if (block_dims == block_dims_) {
+    return;
+  }
+
+  block_dims_ = std::move(block_dims);
+  block_offsets_.resize(block_dims_.size() + 1);
+  block_offsets_[0] = 0;
+  std::partial_sum(block_dims_.begin(), block_dims_.end(), block_offsets_.begin() + 1);
+
+  block_for_index_.clear();
+  for (StorageIndex block = 0; block < NumBlockCols(); ++block) {
+    block_for_index_.insert(block_for_index_.end(), block_dims_[block], block);
+  }
+}
+
+template <typename Scalar>
+void HessianOperator<Scalar>::SetJacobian(const Eigen::SparseMatrix<Scalar>& jacobian,
+                                          std::vector<StorageIndex> block_dims) {
+  SetBlockDims(std::move(block_dims));
+  SYM_ASSERT(jacobian.cols() == Cols());
+  SYM_ASSERT(jacobian.isCompressed());
+
+  has_jacobian_ = true;
+  jacobian_ = &jacobian;
+  hessian_.resize(0, 0);
+
+  undamped_diagonal_.resize(Cols());
+  for (StorageIndex col = 0; col < Cols(); ++col) {
+    undamped_diagonal_[col] = jacobian.col(col).squaredNorm();
+  }
+  damping_.setZero(Cols());
+}
+
+template <typename Scalar>
+void HessianOperator<Scalar>::SetHessianLower(const Eigen::SparseMatrix<Scalar>& hessian_lower,
+                                              std::vector<StorageIndex> block_dims) {
+  SetBlockDims(std::move(block_dims));
+  SYM_ASSERT(hessian_lower.rows() == Rows());
+  SYM_ASSERT(hessian_lower.cols() == Cols());
+
+  has_jacobian_ = false;
+  jacobian_ = nullptr;
+  hessian_ = hessian_lower.template selfadjointView<Eigen::Lower>();
+
+  undamped_diagonal_ = hessian_.diagonal();
+  damping_.setZero(Cols());
+}
+
+template <typename Scalar>
+bool HessianOperator<Scalar>::HasJacobian() const {
+  return has_jacobian_;
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::StorageIndex HessianOperator<Scalar>::Rows() const {
+  return block_offsets_.empty() ? 0 : block_offsets_.back();
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::StorageIndex HessianOperator<Scalar>::Cols() const {
+  return Rows();
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::StorageIndex HessianOperator<Scalar>::NumBlockCols() const {
+  return static_cast<StorageIndex>(block_dims_.size());
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::StorageIndex HessianOperator<Scalar>::BlockDim(
+    const StorageIndex block_col) const {
+  return block_dims_[block_col];
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::StorageIndex HessianOperator<Scalar>::BlockOffset(
+    const StorageIndex block_col) const {
+  return block_offsets_[block_col];
+}
+
+template <typename Scalar>
+const std::vector<typename HessianOperator<Scalar>::StorageIndex>&
+HessianOperator<Scalar>::BlockDims() const {
+  return block_dims_;
+}
+
+template <typename Scalar>
+VectorX<Scalar> HessianOperator<Scalar>::Diagonal() const {
+  return undamped_diagonal_ + damping_;
+}
+
+template <typename Scalar>
+void HessianOperator<Scalar>::SetDiagonal(const VectorX<Scalar>& diagonal) {
+  SYM_ASSERT(diagonal.size() == Cols());
+  damping_ = diagonal - undamped_diagonal_;
+}
+
+template <typename Scalar>
+void HessianOperator<Scalar>::AddToDiagonal(const VectorX<Scalar>& diagonal) {
+  SYM_ASSERT(diagonal.size() == Cols());
+  damping_ += diagonal;
+}
+
+template <typename Scalar>
+void HessianOperator<Scalar>::Multiply(const VectorX<Scalar>& x, VectorX<Scalar>* const y) const {
+  SYM_ASSERT(x.size() == Cols());
+  SYM_ASSERT(y != nullptr);
+
+  if (has_jacobian_) {
+    residual_workspace_.noalias() = *jacobian_ * x;
+    y->noalias() = jacobian_->transpose() * residual_workspace_;
+  } else {
+    y->noalias() = hessian_ * x;
+  }
+  y->array() += damping_.array() * x.array();
+}
+
+template <typename Scalar>
+MatrixX<Scalar> HessianOperator<Scalar>::DiagonalBlock(const StorageIndex block_col) const {
+  const StorageIndex offset = block_offsets_[block_col];
+  const StorageIndex dim = block_dims_[block_col];
+
+  MatrixX<Scalar> block(dim, dim);
+  if (has_jacobian_) {
+    for (StorageIndex j = 0; j < dim; ++j) {
+      for (StorageIndex i = j; i < dim; ++i) {
+        block(i, j) = jacobian_->col(offset + i).dot(jacobian_->col(offset + j));
+        block(j, i) = block(i, j);
+      }
+    }
+  } else {
+    block = hessian_.block(offset, offset, dim, dim);
+  }
+  block.diagonal() += damping_.segment(offset, dim);
+  return block;
+}
+
+template <typename Scalar>
+typename HessianOperator<Scalar>::JacobianRows HessianOperator<Scalar>::ComputeJacobianRows()
+    const {
+  JacobianRows jacobian_rows;
+  if (!has_jacobian_) {
+    return jacobian_rows;
+  }
+
+  // Counting sort of the entries of J by row.  Columns are visited in order, so the entries in
+  // each row are in increasing order of column.
+  const Eigen::SparseMatrix<Scalar>& jacobian = *jacobian_;
+  jacobian_rows.row_starts.assign(jacobian.rows() + 1, 0);
+  for (StorageIndex i = 0; i < jacobian.nonZeros(); ++i) {
+    jacobian_rows.row_starts[jacobian.innerIndexPtr()[i] + 1] += 1;
+  }
+  std::partial_sum(jacobian_rows.row_starts.begin(), jacobian_rows.row_starts.end(),
+                   jacobian_rows.row_starts.begin());
+
+  std::vector<StorageIndex> next_in_row(jacobian_rows.row_starts.begin(),
+                                        jacobian_rows.row_starts.end() - 1);
+  jacobian_rows.cols.resize(jacobian.nonZeros());
+  jacobian_rows.value_indices.resize(jacobian.nonZeros());
+  for (StorageIndex col = 0; col < jacobian.cols(); ++col) {
+    for (StorageIndex i = jacobian.outerIndexPtr()[col]; i < jacobian.outerIndexPtr()[col + 1];
+         ++i) {
+      const StorageIndex position = next_in_row[jacobian.innerIndexPtr()[i]]++;
+      jacobian_rows.cols[position] = col;
+      jacobian_rows.value_indices[position] = i;
+    }
+  }
+
+  return jacobian_rows;
+}
+
+template <typename Scalar>
+std::vector<typename HessianOperator<Scalar>::BlockColumn> HessianOperator<Scalar>::BlockColumns(
+    const std::vector<StorageIndex>& block_cols, const JacobianRows& jacobian_rows) const {
+  SYM_ASSERT(!has_jacobian_ ||
+             (static_cast<Eigen::Index>(jacobian_rows.row_starts.size()) == jacobian_->rows() + 1 &&
+              static_cast<Eigen::Index>(jacobian_rows.cols.size()) == jacobian_->nonZeros()));
+
+  std::vector<BlockColumn> columns(block_cols.size());
+
+  // For the block column being built, the index of each block row in it, or -1
+  std::vector<StorageIndex> position_for_block(NumBlockCols(), -1);
+
+  for (size_t k = 0; k < block_cols.size(); ++k) {
+    const StorageIndex block_col = block_cols[k];
+    const StorageIndex col_offset = block_offsets_[block_col];
+    const StorageIndex col_dim = block_dims_[block_col];
+    BlockColumn& column = columns[k];
+
+    const auto add_entry = [&](const StorageIndex row, const StorageIndex col_in_block,
+                               const Scalar value) {
+      const StorageIndex row_block = block_for_index_[row];
+      if (position_for_block[row_block] == -1) {
+        position_for_block[row_block] = static_cast<StorageIndex>(column.row_blocks.size());
+        column.row_blocks.push_back(row_block);
+        column.blocks.push_back(MatrixX<Scalar>::Zero(block_dims_[row_block], col_dim));
+      }
+      column.blocks[position_for_block[row_block]](row - block_offsets_[row_block],
+                                                   col_in_block) += value;
+    };
+
+    // The diagonal block is always first, including the damping
+    add_entry(col_offset, 0, 0);
+    column.blocks[0].diagonal() += damping_.segment(col_offset, col_dim);
+
+    for (StorageIndex j = 0; j < col_dim; ++j) {
+      if (has_jacobian_) {
+        // Column j of J^T * J is J^T * J.col(j), from the rows of J with an entry in column j
+        const Scalar* const values = jacobian_->valuePtr();
+        for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(*jacobian_, col_offset + j);
+             it; ++it) {
+          for (StorageIndex k = jacobian_rows.row_starts[it.row()];
+               k < jacobian_rows.row_starts[it.row() + 1]; ++k) {
+            add_entry(jacobian_rows.cols[k], j,
+                      values[jacobian_rows.value_indices[k]] * it.value());
+          }
+        }
+      } else {
+        for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(hessian_, col_offset + j); it;
+             ++it) {
+          add_entry(it.row(), j, it.value());
+        }
+      }
+    }
+
+    for (const StorageIndex row_block : column.row_blocks) {
+      position_for_block[row_block] = -1;
+    }
+  }
+
+  return columns;
+}
+
+template <typename Scalar>
+std::vector<std::vector<typename HessianOperator<Scalar>::StorageIndex>>
+HessianOperator<Scalar>::BlockAdjacency(const JacobianRows& jacobian_rows) const {
+  SYM_ASSERT(!has_jacobian_ ||
+             static_cast<Eigen::Index>(jacobian_rows.row_starts.size()) == jacobian_->rows() + 1);
+
+  std::vector<std::vector<StorageIndex>> adjacency(NumBlockCols());
+
+  const auto add_edge = [&adjacency](const StorageIndex a, const StorageIndex b) {
+    if (a != b) {
+      adjacency[a].push_back(b);
+      adjacency[b].push_back(a);
+    }
+  };
+
+  if (has_jacobian_) {
+    // Every pair of blocks with entries in the same row of J is adjacent
+    std::vector<StorageIndex> row_blocks;
+    for (StorageIndex row = 0; row < jacobian_->rows(); ++row) {
+      row_blocks.clear();
+      for (StorageIndex k = jacobian_rows.row_starts[row]; k < jacobian_rows.row_starts[row + 1];
+           ++k) {
+        const StorageIndex block = block_for_index_[jacobian_rows.cols[k]];
+        if (row_blocks.empty() || row_blocks.back() != block) {
+          row_blocks.push_back(block);
+        }
+      }
+      for (size_t i = 0; i < row_blocks.size(); ++i) {
+        for (size_t j = i + 1; j < row_blocks.size(); ++j) {
+          add_edge(row_blocks[i], row_blocks[j]);
+        }
+      }
+    }
+  } else {
+    for (StorageIndex col = 0; col < hessian_.outerSize(); ++col) {
+      for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(hessian_, col); it; ++it) {
+        if (it.row() > col) {
+          add_edge(block_for_index_[it.row()], block_for_index_[col]);
+        }
+      }
+    }
+  }
+
+  for (std::vector<StorageIndex>& neighbors : adjacency) {
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+  }
+
+  return adjacency;
+}
+
+}  // namespace sym
+
+// Explicit instantiation
+template class sym::HessianOperator<double>;
+template class sym::HessianOperator<float>;
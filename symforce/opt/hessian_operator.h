@@ -0,0 +1,176 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include <sym/util/typedefs.h>
+
+namespace sym {
+
+/**
+ * The damped hessian A = J^T * J + D of a least squares problem as a linear operator, where D is a
+ * diagonal damping matrix, for iterative linear solvers such as ConjugateGradientSolver.
+ *
+ * A is represented by the jacobian J, and products with A are computed as J^T * (J * x) + D * x,
+ * so memory scales with the number of nonzeros in J.  J is referenced rather than copied, so it
+ * must outlive any use of the operator until the next call to SetJacobian or SetHessianLower.  A
+ * can also be represented by the lower triangle of J^T * J directly (e.g. for problems linearized
+ * without a jacobian), in which case products are computed with the hessian.
+ *
+ * The rows and columns of A are grouped into blocks, such as one block per optimized key, which
+ * are used by block preconditioners.
+ *
+ * Not thread safe, since products use internal workspace.
+ */
+template <typename ScalarType>
+class HessianOperator {
+ public:
+  using Scalar = ScalarType;
+  using StorageIndex = int32_t;
+
+  /**
+   * The nonzero blocks of one block column of A, in no particular order
+   */
+  struct BlockColumn {
+    std::vector<StorageIndex> row_blocks;
+    std::vector<MatrixX<Scalar>> blocks;
+  };
+
+  /**
+   * The pattern of J in row major order, for BlockColumns and BlockAdjacency.  This only depends
+   * on the sparsity pattern of J, so it is computed once in the symbolic analysis of a solver and
+   * reused for every J with the same pattern.  Empty if A is represented by a hessian.
+   */
+  struct JacobianRows {
+    // The range of entries in cols and value_indices for each row of J
+    std::vector<StorageIndex> row_starts;
+
+    // The column of each entry, in increasing order within each row
+    std::vector<StorageIndex> cols;
+
+    // The index of each entry into the values of J
+    std::vector<StorageIndex> value_indices;
+  };
+
+  HessianOperator() = default;
+
+  /**
+   * Represent A = J^T * J, with no damping
+   *
+   * Args:
+   *     jacobian: The jacobian J, which must be compressed.  Referenced, not copied.
+   *     block_dims: The dimension of each block row and column of A
+   */
+  void SetJacobian(const Eigen::SparseMatrix<Scalar>& jacobian,
+                   std::vector<StorageIndex> block_dims);
+
+  /**
+   * Represent A by the lower triangle of J^T * J, with no damping
+   */
+  void SetHessianLower(const Eigen::SparseMatrix<Scalar>& hessian_lower,
+                       std::vector<StorageIndex> block_dims);
+
+  /**
+   * Whether A is represented by a jacobian, instead of by a hessian
+   */
+  bool HasJacobian() const;
+
+  /**
+   * Scalar dimension of the matrix
+   */
+  StorageIndex Rows() const;
+  StorageIndex Cols() const;
+
+  /**
+   * Number of block rows and columns
+   */
+  StorageIndex NumBlockCols() const;
+
+  StorageIndex BlockDim(StorageIndex block_col) const;
+  StorageIndex BlockOffset(StorageIndex block_col) const;
+  const std::vector<StorageIndex>& BlockDims() const;
+
+  /**
+   * The diagonal of A, including the damping
+   */
+  VectorX<Scalar> Diagonal() const;
+
+  /**
+   * Set the damping so that the diagonal of A is diagonal
+   */
+  void SetDiagonal(const VectorX<Scalar>& diagonal);
+
+  /**
+   * Add diagonal to the damping
+   */
+  void AddToDiagonal(const VectorX<Scalar>& diagonal);
+
+  /**
+   * Compute y = A * x
+   */
+  void Multiply(const VectorX<Scalar>& x, VectorX<Scalar>* y) const;
+
+  /**
+   * The diagonal block of A for block_col, as a dense matrix
+   */
+  MatrixX<Scalar> DiagonalBlock(StorageIndex block_col) const;
+
+  /**
+   * Compute the pattern of J in row major order, to pass to BlockColumns and BlockAdjacency
+   */
+  JacobianRows ComputeJacobianRows() const;
+
+  /**
+   * The nonzero blocks of A in each of block_cols, including the diagonal blocks
+   *
+   * Args:
+   *     jacobian_rows: The result of ComputeJacobianRows for a J with the same pattern
+   */
+  std::vector<BlockColumn> BlockColumns(const std::vector<StorageIndex>& block_cols,
+                                        const JacobianRows& jacobian_rows) const;
+
+  /**
+   * For each block, the other blocks it has a nonzero block of A with, in increasing order
+   *
+   * Args:
+   *     jacobian_rows: The result of ComputeJacobianRows for a J with the same pattern
+   */
+  std::vector<std::vector<StorageIndex>> BlockAdjacency(const JacobianRows& jacobian_rows) const;
+
+ private:
+  void SetBlockDims(std::vector<StorageIndex> block_dims);
+
+  std::vector<StorageIndex> block_dims_;
+
+  // Scalar offset of each block row and column, followed by the scalar dimension
+  std::vector<StorageIndex> block_offsets_;
+
+  // The block of each scalar row and column
+  std::vector<StorageIndex> block_for_index_;
+
+  // J, or the full symmetric J^T * J if there is no jacobian
+  bool has_jacobian_{false};
+  const Eigen::SparseMatrix<Scalar>* jacobian_{nullptr};
+  Eigen::SparseMatrix<Scalar> hessian_;
+
+  // The diagonal of J^T * J, and the damping D
+  VectorX<Scalar> undamped_diagonal_;
+  VectorX<Scalar> damping_;
+
+  // Storage for J * x
+  mutable VectorX<Scalar> residual_workspace_;
+};
+
+// Shorthand instantiations
+using HessianOperatord = HessianOperator<double>;
+using HessianOperatorf = HessianOperator<float>;
+
+}  // namespace sym
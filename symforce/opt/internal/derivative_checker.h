@@ -75,7 +75,7 @@ bool CheckDerivatives(Linearizer<Scalar>* const linearizer, const Values<Scalar>
 
   // Check hessian
   {
-    const MatrixX<Scalar> hessian_lower_dense = linearization.hessian_lower;
+    const MatrixX<Scalar> hessian_lower_dense = linearization.HessianLower();
     MatrixX<Scalar> full_hessian = hessian_lower_dense + hessian_lower_dense.transpose();
     full_hessian.diagonal() = hessian_lower_dense.diagonal();
 
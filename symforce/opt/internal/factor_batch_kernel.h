@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <utility>
+
+#include <Eigen/Core>
+
+#include <lcmtypes/sym/index_entry_t.hpp>
+
+#include "../assert.h"
+#include "../templates.h"
+#include "../values.h"
+#include "./factor_utils.h"
+#include "./linearized_factor_arena.h"
+
+namespace sym {
+namespace internal {
+
+/**
+ * Type-erased evaluator for the factors of a FactorBatch, which all share one functor.
+ *
+ * The Linearizer hands the kernel chunks of up to kMaxChunkSize factors at a time, along with the
+ * index entries of every factor's keys, and the kernel evaluates the factors of the chunk one
+ * after another directly into the Linearizer's arena.  This is one virtual call per chunk instead
+ * of one std::function call per factor; the factors themselves are not evaluated in SIMD.
+ */
+template <typename Scalar>
+class FactorBatchKernel {
+ public:
+  // Maximum number of factors evaluated in one call to LinearizeInto
+  static constexpr int kMaxChunkSize = 8;
+
+  virtual ~FactorBatchKernel() = default;
+
+  /**
+   * Number of keys each factor of the batch is evaluated on
+   */
+  virtual int NumKeys() const = 0;
+
+  /**
+   * Evaluate num_factors (at most kMaxChunkSize) factors into the arena.  index_entries holds
+   * NumKeys() entries for each factor, back to back, and arena_slots holds the arena index of each
+   * factor.  Different threads may call this concurrently for disjoint arena slots.
+   */
+  virtual void LinearizeInto(const Values<Scalar>& values, const index_entry_t* index_entries,
+                             int num_factors, const int* arena_slots,
+                             LinearizedFactorArena<Scalar>* arena) const = 0;
+};
+
+/**
+ * FactorBatchKernel for a fixed size hessian functor, with the same signature as the functors
+ * accepted by Factor::Hessian.
+ *
+ * Each factor is evaluated by calling the functor directly on its inputs pulled out of the Values,
+ * so there is no std::function dispatch or index lookup per factor.
+ */
+template <typename Scalar, typename Functor>
+class FactorBatchKernelImpl final : public FactorBatchKernel<Scalar> {
+ public:
+  using Base = FactorBatchKernel<Scalar>;
+  using Traits = function_traits<Functor>;
+
+  static constexpr int kNumKeys = static_cast<int>(Traits::num_arguments) - 4;
+
+  template <int Index>
+  using ArgType = typename Traits::template arg<Index>::base_type;
+
+  using ResidualVec = typename std::remove_pointer<ArgType<kNumKeys>>::type;
+  using JacobianMat = typename std::remove_pointer<ArgType<kNumKeys + 1>>::type;
+  using HessianMat = typename std::remove_pointer<ArgType<kNumKeys + 2>>::type;
+  using RhsVec = typename std::remove_pointer<ArgType<kNumKeys + 3>>::type;
+
+  static_assert(JacobianMat::RowsAtCompileTime != Eigen::Dynamic &&
+                    JacobianMat::ColsAtCompileTime != Eigen::Dynamic,
+                "FactorBatch requires a functor with fixed size matrices");
+
+  explicit FactorBatchKernelImpl(Functor func) : func_(std::move(func)) {}
+
+  const Functor& Func() const {
+    return func_;
+  }
+
+  int NumKeys() const override {
+    return kNumKeys;
+  }
+
+  void LinearizeInto(const Values<Scalar>& values, const index_entry_t* const index_entries,
+                     const int num_factors, const int* const arena_slots,
+                     LinearizedFactorArena<Scalar>* const arena) const override {
+    SYM_ASSERT(num_factors <= Base::kMaxChunkSize);
+    SYM_ASSERT(arena != nullptr);
+
+    ResidualVec residual;
+    JacobianMat jacobian;
+    HessianMat hessian;
+    RhsVec rhs;
+    for (int i = 0; i < num_factors; ++i) {
+      Evaluate(values, index_entries + i * kNumKeys, &residual, &jacobian, &hessian, &rhs,
+               Range());
+
+      auto views = arena->Views(arena_slots[i]);
+      views.residual = residual;
+      views.jacobian = jacobian;
+      views.hessian = hessian;
+      views.rhs = rhs;
+    }
+  }
+
+ private:
+  using Range = typename RangeGenerator<kNumKeys>::Range;
+
+  template <int Index>
+  using ArgExtractor = ValuesArgExtractor<typename Traits::template arg<Index>::type>;
+
+  template <int... S>
+  void Evaluate(const Values<Scalar>& values, const index_entry_t* const index_entries,
+                ResidualVec* const residual, JacobianMat* const jacobian,
+                HessianMat* const hessian, RhsVec* const rhs, Sequence<S...>) const {
+    func_(ArgExtractor<S>::Get(values, index_entries[S])..., residual, jacobian, hessian, rhs);
+  }
+
+  Functor func_;
+};
+
+}  // namespace internal
+}  // namespace sym
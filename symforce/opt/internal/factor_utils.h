@@ -12,11 +12,84 @@
  * Primarily intended to be included by factor.tcc and used internally there
  */
 
+#include <type_traits>
+
+#include <Eigen/Core>
+
 #include "../factor.h"
 
 namespace sym {
 namespace internal {
 
+// ------------------------------------------------------------------------------------------------
+// Functor argument extraction
+// ------------------------------------------------------------------------------------------------
+
+/**
+ * The matrix type T of an argument that can be bound to an Eigen::Map<const T> of the storage of a
+ * Values, i.e. of an Eigen::Ref<const T> or an Eigen::Map<const T>
+ */
+template <typename Arg>
+struct MappableEigenArg {
+  static constexpr bool value = false;
+};
+
+template <typename T, int Options, typename StrideType>
+struct MappableEigenArg<Eigen::Ref<const T, Options, StrideType>> {
+  static constexpr bool value = true;
+  using Type = T;
+};
+
+template <typename T>
+struct MappableEigenArg<Eigen::Map<const T>> {
+  static constexpr bool value = true;
+  using Type = T;
+};
+
+/**
+ * Pulls an argument declared as Arg in a functor's signature out of the Values.
+ *
+ * Matrix arguments declared as an Eigen::Ref<const T> or an Eigen::Map<const T> (by value or by
+ * const reference) are bound to an Eigen::Map of the storage, without copying.  Arguments of other
+ * non-matrix types declared as a const T&, such as the geo types, are bound to a ValueView, which
+ * copies the storage without normalizing it.  Everything else, including matrix arguments declared
+ * as a const Eigen::Matrix&, is a copy made with Values::At.
+ */
+template <typename Arg, typename = void>
+struct ValuesArgExtractor {
+  using Type = std::decay_t<Arg>;
+
+  template <typename Scalar>
+  static Type Get(const Values<Scalar>& values, const index_entry_t& entry) {
+    return values.template At<Type>(entry);
+  }
+};
+
+template <typename Arg>
+struct ValuesArgExtractor<Arg, std::enable_if_t<MappableEigenArg<std::decay_t<Arg>>::value>> {
+  using MatrixType = typename MappableEigenArg<std::decay_t<Arg>>::Type;
+  using Type = Eigen::Map<const MatrixType>;
+
+  template <typename Scalar>
+  static Type Get(const Values<Scalar>& values, const index_entry_t& entry) {
+    return values.template MapAt<MatrixType>(entry);
+  }
+};
+
+template <typename Arg>
+struct ValuesArgExtractor<
+    Arg, std::enable_if_t<std::is_lvalue_reference<Arg>::value &&
+                          std::is_const<std::remove_reference_t<Arg>>::value &&
+                          !kIsEigenType<std::decay_t<Arg>> &&
+                          !std::is_arithmetic<std::decay_t<Arg>>::value>> {
+  using Type = ValueView<std::decay_t<Arg>>;
+
+  template <typename Scalar>
+  static Type Get(const Values<Scalar>& values, const index_entry_t& entry) {
+    return values.template MapAt<std::decay_t<Arg>>(entry);
+  }
+};
+
 // ------------------------------------------------------------------------------------------------
 // Factor::Jacobian constructor dispatcher
 //
@@ -53,11 +126,15 @@ struct JacobianFuncValuesExtractor {
   using ResidualVec = typename JacobianFuncTypeHelper<Functor>::ResidualVec;
   using JacobianMat = typename JacobianFuncTypeHelper<Functor>::JacobianMat;
 
+  template <int Index>
+  using ArgExtractor =
+      ValuesArgExtractor<typename function_traits<Functor>::template arg<Index>::type>;
+
   /** Pull out the arg given by Index from the Values. */
   template <int Index>
-  inline static ArgType<Index> GetValue(const sym::Values<Scalar>& values,
-                                        const std::vector<index_entry_t>& keys) {
-    return values.template At<ArgType<Index>>(keys[Index]);
+  inline static typename ArgExtractor<Index>::Type GetValue(
+      const sym::Values<Scalar>& values, const std::vector<index_entry_t>& keys) {
+    return ArgExtractor<Index>::Get(values, keys[Index]);
   }
 
   /** Invokes the user function with the proper input args extracted from the Values. */
@@ -104,9 +181,9 @@ struct RankUpdateHelper<Eigen::SparseMatrix<Scalar>> {
 /**
  * Precondition: residual and jacobian have the same number of rows
  */
-template <typename RVecType, typename JMatrixType, typename HMatrixType, typename Scalar>
+template <typename RVecType, typename JMatrixType, typename HMatrixType, typename RhsVecType>
 void CalculateHessianRhs(const RVecType& residual, const JMatrixType& jacobian,
-                         HMatrixType* hessian, VectorX<Scalar>* rhs) {
+                         HMatrixType* hessian, RhsVecType* rhs) {
   // Compute the lower triangle of the hessian if needed
   if (hessian != nullptr) {
     hessian->resize(jacobian.cols(), jacobian.cols());
@@ -163,49 +240,69 @@ struct JacobianDispatcher<true /* is_dynamic */, IsSparse, Scalar> {
 // size of the matrix multiplies at compile time for computing H = J^T * J and rhs = J^T * b.  This
 // does produce a noticeable speedup for small factors, and is not expected to be slower for any
 // size factors.
-template <typename Scalar, typename Functor>
-Factor<Scalar> JacobianFixed(Functor&& func, const std::vector<Key>& keys_to_func,
-                             const std::vector<Key>& keys_to_optimize) {
+/**
+ * Evaluate a fixed size jacobian functor, and copy the results into the outputs.  The outputs may
+ * be dynamic size matrices, which are resized, or Maps of preallocated storage, which must already
+ * have the correct sizes.
+ */
+template <typename Scalar, typename Functor, typename VectorType, typename MatrixType>
+void LinearizeJacobianFixed(const Functor& func, const Values<Scalar>& values,
+                            const std::vector<index_entry_t>& keys_to_func, VectorType* residual,
+                            MatrixType* jacobian, MatrixType* hessian, VectorType* rhs) {
   using Traits = function_traits<Functor>;
-  using FunctorType = std::decay_t<Functor>;
 
   // Get matrix types from function signature
   using JacobianMat = typename std::remove_pointer<
       typename Traits::template arg<Traits::num_arguments - 1>::type>::type;
 
-  return Factor<Scalar>(
-      [func = std::forward<Functor>(func)](const Values<Scalar>& values,
-                                           const std::vector<index_entry_t>& keys_to_func,
-                                           VectorX<Scalar>* residual, MatrixX<Scalar>* jacobian,
-                                           MatrixX<Scalar>* hessian, VectorX<Scalar>* rhs) {
-        // Get dimensions (these have already been sanity checked in Factor::Jacobian)
-        constexpr int M = JacobianMat::RowsAtCompileTime;
-        constexpr int N = JacobianMat::ColsAtCompileTime;
+  // Get dimensions (these have already been sanity checked in Factor::Jacobian)
+  constexpr int M = JacobianMat::RowsAtCompileTime;
+  constexpr int N = JacobianMat::ColsAtCompileTime;
 
-        SYM_ASSERT(residual != nullptr);
-        Eigen::Matrix<Scalar, M, 1> residual_fixed;
-
-        if (jacobian != nullptr) {
-          // jacobian is requested
-          Eigen::Matrix<Scalar, M, N> jacobian_fixed;
-          JacobianFuncValuesExtractor<Scalar, FunctorType>::Invoke(
-              func, values, keys_to_func, &residual_fixed, &jacobian_fixed);
-          (*jacobian) = jacobian_fixed;
-          CalculateHessianRhs(residual_fixed, jacobian_fixed, hessian, rhs);
-        } else {
-          // jacobian not requested
-          Eigen::Matrix<Scalar, M, N>* const jacobian_invoke_arg = nullptr;
-          JacobianFuncValuesExtractor<Scalar, FunctorType>::Invoke(
-              func, values, keys_to_func, &residual_fixed, jacobian_invoke_arg);
+  SYM_ASSERT(residual != nullptr);
+  Eigen::Matrix<Scalar, M, 1> residual_fixed;
+
+  if (jacobian != nullptr) {
+    // jacobian is requested
+    Eigen::Matrix<Scalar, M, N> jacobian_fixed;
+    JacobianFuncValuesExtractor<Scalar, Functor>::Invoke(func, values, keys_to_func,
+                                                         &residual_fixed, &jacobian_fixed);
+    (*jacobian) = jacobian_fixed;
+    CalculateHessianRhs(residual_fixed, jacobian_fixed, hessian, rhs);
+  } else {
+    // jacobian not requested
+    Eigen::Matrix<Scalar, M, N>* const jacobian_invoke_arg = nullptr;
+    JacobianFuncValuesExtractor<Scalar, Functor>::Invoke(func, values, keys_to_func,
+                                                         &residual_fixed, jacobian_invoke_arg);
+
+    // Check that the hessian and rhs weren't requested without the jacobian
+    SYM_ASSERT(hessian == nullptr);
+    SYM_ASSERT(rhs == nullptr);
+  }
 
-          // Check that the hessian and rhs weren't requested without the jacobian
-          SYM_ASSERT(hessian == nullptr);
-          SYM_ASSERT(rhs == nullptr);
-        }
+  (*residual) = residual_fixed;
+}
 
-        (*residual) = residual_fixed;
+template <typename Scalar, typename Functor>
+Factor<Scalar> JacobianFixed(Functor&& func, const std::vector<Key>& keys_to_func,
+                             const std::vector<Key>& keys_to_optimize) {
+  using FunctorType = std::decay_t<Functor>;
+  using VectorMap = typename Factor<Scalar>::VectorMap;
+  using MatrixMap = typename Factor<Scalar>::MatrixMap;
+
+  using Traits = function_traits<FunctorType>;
+  using JacobianMat = typename std::remove_pointer<
+      typename Traits::template arg<Traits::num_arguments - 1>::type>::type;
+
+  // The factor holds the only copy of the functor, and resizes dynamic size outputs to pass to it
+  return Factor<Scalar>(
+      [func = std::forward<Functor>(func)](
+          const Values<Scalar>& values, const std::vector<index_entry_t>& keys_to_func,
+          VectorMap* residual, MatrixMap* jacobian, MatrixMap* hessian, VectorMap* rhs) {
+        LinearizeJacobianFixed(func, values, keys_to_func, residual, jacobian, hessian, rhs);
       },
-      keys_to_func, keys_to_optimize);
+      JacobianMat::RowsAtCompileTime, JacobianMat::ColsAtCompileTime, keys_to_func,
+      keys_to_optimize);
 }
 
 /** Specialize the dispatch mechanism */
@@ -258,11 +355,15 @@ struct HessianFuncValuesExtractor {
   using HessianMat = typename HessianFuncTypeHelper<Functor>::HessianMat;
   using RhsVec = typename HessianFuncTypeHelper<Functor>::RhsVec;
 
+  template <int Index>
+  using ArgExtractor =
+      ValuesArgExtractor<typename function_traits<Functor>::template arg<Index>::type>;
+
   /** Pull out the arg given by Index from the Values. */
   template <int Index>
-  inline static ArgType<Index> GetValue(const sym::Values<Scalar>& values,
-                                        const std::vector<index_entry_t>& keys) {
-    return values.template At<ArgType<Index>>(keys[Index]);
+  inline static typename ArgExtractor<Index>::Type GetValue(
+      const sym::Values<Scalar>& values, const std::vector<index_entry_t>& keys) {
+    return ArgExtractor<Index>::Get(values, keys[Index]);
   }
 
   /** Invokes the user function with the proper input args extracted from the Values. */
@@ -318,49 +419,68 @@ struct HessianDispatcher<true /* is_dynamic */, IsSparse, Scalar> {
 // Factor::Hessian constructor support for fixed size matrices
 // ----------------------------------------------------------------------------
 
-template <typename Scalar, typename Functor>
-Factor<Scalar> HessianFixedDense(Functor&& func, const std::vector<Key>& keys_to_func,
-                                 const std::vector<Key>& keys_to_optimize) {
+/**
+ * Evaluate a fixed size hessian functor, and copy the results into the outputs.  The outputs may be
+ * dynamic size matrices, which are resized, or Maps of preallocated storage, which must already
+ * have the correct sizes.
+ */
+template <typename Scalar, typename Functor, typename VectorType, typename MatrixType>
+void LinearizeHessianFixedDense(const Functor& func, const Values<Scalar>& values,
+                                const std::vector<index_entry_t>& keys_to_func,
+                                VectorType* residual, MatrixType* jacobian, MatrixType* hessian,
+                                VectorType* rhs) {
   // Get matrix types from function signature
   using JacobianMat = typename HessianFuncValuesExtractor<Scalar, Functor>::JacobianMat;
-  using FunctorType = std::decay_t<Functor>;
 
   // Get dimensions (these have already been sanity checked in Factor::Hessian)
   constexpr int M = JacobianMat::RowsAtCompileTime;
   constexpr int N = JacobianMat::ColsAtCompileTime;
 
-  return Factor<Scalar>(
-      [func = std::forward<Functor>(func)](const Values<Scalar>& values,
-                                           const std::vector<index_entry_t>& keys_to_func,
-                                           VectorX<Scalar>* residual, MatrixX<Scalar>* jacobian,
-                                           MatrixX<Scalar>* hessian, VectorX<Scalar>* rhs) {
-        Eigen::Matrix<Scalar, M, 1> residual_fixed;
-        Eigen::Matrix<Scalar, M, N> jacobian_fixed;
-        Eigen::Matrix<Scalar, N, N> hessian_fixed;
-        Eigen::Matrix<Scalar, N, 1> rhs_fixed;
+  Eigen::Matrix<Scalar, M, 1> residual_fixed;
+  Eigen::Matrix<Scalar, M, N> jacobian_fixed;
+  Eigen::Matrix<Scalar, N, N> hessian_fixed;
+  Eigen::Matrix<Scalar, N, 1> rhs_fixed;
 
-        HessianFuncValuesExtractor<Scalar, FunctorType>::Invoke(
-            func, values, keys_to_func, residual == nullptr ? nullptr : &residual_fixed,
-            jacobian == nullptr ? nullptr : &jacobian_fixed,
-            hessian == nullptr ? nullptr : &hessian_fixed, rhs == nullptr ? nullptr : &rhs_fixed);
+  HessianFuncValuesExtractor<Scalar, Functor>::Invoke(
+      func, values, keys_to_func, residual == nullptr ? nullptr : &residual_fixed,
+      jacobian == nullptr ? nullptr : &jacobian_fixed,
+      hessian == nullptr ? nullptr : &hessian_fixed, rhs == nullptr ? nullptr : &rhs_fixed);
 
-        if (residual != nullptr) {
-          (*residual) = residual_fixed;
-        }
+  if (residual != nullptr) {
+    (*residual) = residual_fixed;
+  }
 
-        if (jacobian != nullptr) {
-          (*jacobian) = jacobian_fixed;
-        }
+  if (jacobian != nullptr) {
+    (*jacobian) = jacobian_fixed;
+  }
 
-        if (hessian != nullptr) {
-          (*hessian) = hessian_fixed;
-        }
+  if (hessian != nullptr) {
+    (*hessian) = hessian_fixed;
+  }
 
-        if (rhs != nullptr) {
-          (*rhs) = rhs_fixed;
-        }
+  if (rhs != nullptr) {
+    (*rhs) = rhs_fixed;
+  }
+}
+
+template <typename Scalar, typename Functor>
+Factor<Scalar> HessianFixedDense(Functor&& func, const std::vector<Key>& keys_to_func,
+                                 const std::vector<Key>& keys_to_optimize) {
+  using FunctorType = std::decay_t<Functor>;
+  using VectorMap = typename Factor<Scalar>::VectorMap;
+  using MatrixMap = typename Factor<Scalar>::MatrixMap;
+
+  using JacobianMat = typename HessianFuncValuesExtractor<Scalar, FunctorType>::JacobianMat;
+
+  // The factor holds the only copy of the functor, and resizes dynamic size outputs to pass to it
+  return Factor<Scalar>(
+      [func = std::forward<Functor>(func)](
+          const Values<Scalar>& values, const std::vector<index_entry_t>& keys_to_func,
+          VectorMap* residual, MatrixMap* jacobian, MatrixMap* hessian, VectorMap* rhs) {
+        LinearizeHessianFixedDense(func, values, keys_to_func, residual, jacobian, hessian, rhs);
       },
-      keys_to_func, keys_to_optimize);
+      JacobianMat::RowsAtCompileTime, JacobianMat::ColsAtCompileTime, keys_to_func,
+      keys_to_optimize);
 }
 
 /** Specialize the dispatch mechanism */
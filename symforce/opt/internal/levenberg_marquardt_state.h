@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <utility>
+
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
@@ -56,6 +58,27 @@ class LevenbergMarquardtState {
       have_cached_error_ = false;
     }
 
+    // Evaluate only the residual, which is enough for Error().  The rest of the linearization is
+    // stale afterwards, so it is marked as not initialized until the next call to Relinearize.
+    template <typename ResidualFunc>
+    void EvaluateResidual(const ResidualFunc& func) {
+      func(values, &linearization_.residual);
+      linearization_.SetInitialized(false);
+      cached_error_ = 0.5 * linearization_.residual.squaredNorm();
+      have_cached_error_ = true;
+    }
+
+    // Swap in values and the residual evaluated at them, leaving the linearization in the same
+    // state as EvaluateResidual.  other_values and residual get the previous contents of the block.
+    void SwapEvaluatedResidual(Values<Scalar>* const other_values,
+                               VectorX<Scalar>* const residual) {
+      std::swap(values, *other_values);
+      linearization_.residual.swap(*residual);
+      linearization_.SetInitialized(false);
+      cached_error_ = 0.5 * linearization_.residual.squaredNorm();
+      have_cached_error_ = true;
+    }
+
     const Linearization<Scalar>& GetLinearization() const {
       return linearization_;
     }
@@ -0,0 +1,146 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "../assert.h"
+
+namespace sym {
+namespace internal {
+
+/**
+ * Contiguous storage for the residuals, jacobians, hessians, and rhs of many dense linearized
+ * factors.
+ *
+ * Factors are added with their dimensions, then Allocate creates a single buffer holding all of
+ * them.  Each factor's block starts on a 64 byte (cache line) boundary and stores, in order, the
+ * residual (M), the column-major jacobian (M x N), the column-major hessian (N x N), and the rhs
+ * (N).
+ * Views into the buffer are Eigen::Maps, so factors can be evaluated directly into the arena, and
+ * the Linearizer walks the buffer in order when building the combined problem.
+ */
+template <typename Scalar>
+class LinearizedFactorArena {
+ public:
+  static constexpr size_t kAlignmentBytes = 64;
+
+  using VectorMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>;
+  using MatrixMap = Eigen::Map<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>;
+  using ConstVectorMap = Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>;
+  using ConstMatrixMap = Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>;
+
+  // Views of the storage for one factor, with the same member names as LinearizedDenseFactor
+  template <typename VectorMapT, typename MatrixMapT>
+  struct FactorViews {
+    VectorMapT residual;
+    MatrixMapT jacobian;
+    MatrixMapT hessian;
+    VectorMapT rhs;
+  };
+
+  /**
+   * Reserve space for a factor with the given residual and tangent dimensions.  Returns the index
+   * of the factor in the arena.  Must be called before Allocate.
+   */
+  int Add(const int residual_dim, const int tangent_dim) {
+    SYM_ASSERT(data_ == nullptr);
+
+    Block block;
+    block.offset = size_;
+    block.residual_dim = residual_dim;
+    block.tangent_dim = tangent_dim;
+    blocks_.push_back(block);
+
+    const size_t block_size =
+        residual_dim + residual_dim * tangent_dim + tangent_dim * tangent_dim + tangent_dim;
+    size_ += RoundUpToAlignment(block_size);
+
+    return static_cast<int>(blocks_.size()) - 1;
+  }
+
+  /**
+   * Allocate (zero-initialized) storage for all the factors that have been added
+   */
+  void Allocate() {
+    SYM_ASSERT(data_ == nullptr);
+
+    // Over-allocate by one alignment unit so the start of the data can be aligned
+    buffer_.reset(new Scalar[size_ + kAlignmentScalars]());
+    void* ptr = buffer_.get();
+    size_t space = (size_ + kAlignmentScalars) * sizeof(Scalar);
+    data_ = static_cast<Scalar*>(std::align(kAlignmentBytes, size_ * sizeof(Scalar), ptr, space));
+    SYM_ASSERT(data_ != nullptr);
+  }
+
+  bool IsAllocated() const {
+    return data_ != nullptr;
+  }
+
+  int NumFactors() const {
+    return static_cast<int>(blocks_.size());
+  }
+
+  /**
+   * Size of the buffer in bytes, including alignment padding
+   */
+  size_t SizeInBytes() const {
+    return (size_ + kAlignmentScalars) * sizeof(Scalar);
+  }
+
+  FactorViews<VectorMap, MatrixMap> Views(const int i) {
+    return MakeViews<VectorMap, MatrixMap>(data_, blocks_[i]);
+  }
+
+  FactorViews<ConstVectorMap, ConstMatrixMap> Views(const int i) const {
+    return MakeViews<ConstVectorMap, ConstMatrixMap>(data_, blocks_[i]);
+  }
+
+ private:
+  static constexpr size_t kAlignmentScalars = kAlignmentBytes / sizeof(Scalar);
+
+  struct Block {
+    // Offset of the start of the block in data_, in Scalars
+    size_t offset;
+    int32_t residual_dim;
+    int32_t tangent_dim;
+  };
+
+  static size_t RoundUpToAlignment(const size_t size) {
+    return (size + kAlignmentScalars - 1) / kAlignmentScalars * kAlignmentScalars;
+  }
+
+  template <typename VectorMapT, typename MatrixMapT, typename DataPtr>
+  static FactorViews<VectorMapT, MatrixMapT> MakeViews(DataPtr data, const Block& block) {
+    SYM_ASSERT(data != nullptr);
+    const int M = block.residual_dim;
+    const int N = block.tangent_dim;
+
+    DataPtr residual = data + block.offset;
+    DataPtr jacobian = residual + M;
+    DataPtr hessian = jacobian + M * N;
+    DataPtr rhs = hessian + N * N;
+    return {VectorMapT(residual, M), MatrixMapT(jacobian, M, N), MatrixMapT(hessian, N, N),
+            VectorMapT(rhs, N)};
+  }
+
+  std::vector<Block> blocks_;
+
+  // Total size of all blocks, in Scalars
+  size_t size_{0};
+
+  std::unique_ptr<Scalar[]> buffer_;
+
+  // Aligned start of the storage in buffer_
+  Scalar* data_{nullptr};
+};
+
+}  // namespace internal
+}  // namespace sym
@@ -3,6 +3,9 @@
  * This source code is under the Apache 2.0 license found in the LICENSE file.
  * ---------------------------------------------------------------------------- */
 
+#include <algorithm>
+#include <stdexcept>
+
 #include <Eigen/Sparse>
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
@@ -10,97 +13,54 @@
 #include <lcmtypes/sym/linearization_dense_factor_helper_t.hpp>
 #include <lcmtypes/sym/linearization_sparse_factor_helper_t.hpp>
 
+#include "../block_sparse_matrix.h"
 #include "../factor.h"
-#include "./hash_combine.h"
 
 namespace sym {
 namespace internal {
 
-// Ordered map from (row, col) location in a dense matrix to a storage offset in a sparse matrix
-// Ordered by column then row, and only supports constructing with strictly increasing keys and size
-// known ahead of time
-class CoordsToStorageOrderedMap {
- public:
-  CoordsToStorageOrderedMap() : data_() {}
-
-  void reserve(const size_t size) {
-    data_.reserve(size);
-  }
-
-  void insert(const std::pair<std::pair<int32_t, int32_t>, int32_t>& key_and_value) {
-    const auto& key = key_and_value.first;
-    const auto& value = key_and_value.second;
-    SYM_ASSERT(data_.empty() || ColumnOrderingLessThan(data_.back().first, key));
-    data_.emplace_back(key, value);
-  }
-
-  int32_t at(const std::pair<int32_t, int32_t>& key) const {
-    // Binary search data_ for key
-    const auto at_and_after_iterator =
-        std::equal_range(data_.begin(), data_.end(), std::make_pair(key, /* unused value */ 0),
-                         ColumnOrderingPairLessThan);
-    if (at_and_after_iterator.first + 1 != at_and_after_iterator.second) {
-      throw std::out_of_range("Key not in CoordsToStorageMap");
-    }
-    return at_and_after_iterator.first->second;
-  }
-
- private:
-  static bool ColumnOrderingPairLessThan(
-      const std::pair<std::pair<int32_t, int32_t>, int32_t>& a_pair,
-      const std::pair<std::pair<int32_t, int32_t>, int32_t>& b_pair) {
-    return ColumnOrderingLessThan(a_pair.first, b_pair.first);
-  }
-
-  static bool ColumnOrderingLessThan(const std::pair<int32_t, int32_t>& a,
-                                     const std::pair<int32_t, int32_t>& b) {
-    return std::make_pair(a.second, a.first) < std::make_pair(b.second, b.first);
-  }
-
-  std::vector<std::pair<std::pair<int32_t, int32_t>, int32_t>> data_;
-};
-
-struct StdPairHash {
- public:
-  template <typename T, typename U>
-  std::size_t operator()(const std::pair<T, U>& x) const {
-    std::size_t ret = 0;
-    sym::internal::hash_combine(ret, x.first, x.second);
-    return ret;
-  }
-};
-
-// TODO(aaron):  For large enough problems we'll probably want the option to switch this to
-// std::unordered_map
-using CoordsToStorageMap = CoordsToStorageOrderedMap;
-
+/**
+ * Offset of the nonzero at (row, col) in the storage of the compressed matrix mat, found with a
+ * binary search over the rows of the column.  Throws if the pattern of mat has no such nonzero.
+ */
 template <typename Scalar>
-CoordsToStorageMap CoordsToStorageOffset(const Eigen::SparseMatrix<Scalar>& mat) {
-  CoordsToStorageMap coords_to_storage_offset;
-  coords_to_storage_offset.reserve(mat.nonZeros());
-  int32_t storage_index = 0;
-  for (int col = 0; col < mat.outerSize(); ++col) {
-    for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(mat, col); it; ++it) {
-      coords_to_storage_offset.insert(
-          std::make_pair(std::make_pair(it.row(), it.col()), storage_index));
-      storage_index += 1;
-    }
+int32_t StorageOffset(const Eigen::SparseMatrix<Scalar>& mat, const int32_t row,
+                      const int32_t col) {
+  const auto* const column_begin = mat.innerIndexPtr() + mat.outerIndexPtr()[col];
+  const auto* const column_end = mat.innerIndexPtr() + mat.outerIndexPtr()[col + 1];
+  const auto* const it = std::lower_bound(column_begin, column_end, row);
+  if (it == column_end || *it != row) {
+    throw std::out_of_range("Coordinates not in the sparsity pattern");
   }
-  SYM_ASSERT(storage_index == mat.nonZeros());
-  return coords_to_storage_offset;
+  return static_cast<int32_t>(it - mat.innerIndexPtr());
 }
 
+/**
+ * Offset of the entry at (row, col) in the values of the block sparse matrix mat
+ */
 template <typename Scalar>
-void ComputeKeyHelperSparseColOffsets(const CoordsToStorageMap& jacobian_row_col_to_storage_offset,
-                                      const CoordsToStorageMap& hessian_row_col_to_storage_offset,
+int32_t StorageOffset(const BlockSparseMatrix<Scalar>& mat, const int32_t row, const int32_t col) {
+  return mat.StorageOffset(row, col);
+}
+
+/**
+ * Compute the storage offsets of the blocks of a dense factor in the combined jacobian and
+ * hessian.  If the jacobian is empty, as for a Linearizer with SetHessianOnly(true), only the
+ * hessian offsets are computed.
+ */
+template <typename Scalar, typename HessianMatrixType>
+void ComputeKeyHelperSparseColOffsets(const Eigen::SparseMatrix<Scalar>& jacobian,
+                                      const HessianMatrixType& hessian_lower,
                                       linearization_dense_factor_helper_t& factor_helper) {
   for (int key_i = 0; key_i < static_cast<int>(factor_helper.key_helpers.size()); ++key_i) {
     linearization_dense_key_helper_t& key_helper = factor_helper.key_helpers[key_i];
 
-    key_helper.jacobian_storage_col_starts.resize(key_helper.tangent_dim);
-    for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
-      key_helper.jacobian_storage_col_starts[col] = jacobian_row_col_to_storage_offset.at(
-          std::make_pair(factor_helper.combined_residual_offset, key_helper.combined_offset + col));
+    if (jacobian.size() > 0) {
+      key_helper.jacobian_storage_col_starts.resize(key_helper.tangent_dim);
+      for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
+        key_helper.jacobian_storage_col_starts[col] = StorageOffset(
+            jacobian, factor_helper.combined_residual_offset, key_helper.combined_offset + col);
+      }
     }
 
     key_helper.hessian_storage_col_starts.resize(key_i + 1);
@@ -110,8 +70,8 @@ void ComputeKeyHelperSparseColOffsets(const CoordsToStorageMap& jacobian_row_col
     std::vector<int32_t>& diag_col_starts = key_helper.hessian_storage_col_starts[key_i];
     diag_col_starts.resize(key_helper.tangent_dim);
     for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
-      diag_col_starts[col] = hessian_row_col_to_storage_offset.at(
-          std::make_pair(key_helper.combined_offset + col, key_helper.combined_offset + col));
+      diag_col_starts[col] = StorageOffset(hessian_lower, key_helper.combined_offset + col,
+                                           key_helper.combined_offset + col);
     }
 
     // Off diagonal blocks
@@ -123,27 +83,29 @@ void ComputeKeyHelperSparseColOffsets(const CoordsToStorageMap& jacobian_row_col
       if (j_key_helper.combined_offset < key_helper.combined_offset) {
         col_starts.resize(j_key_helper.tangent_dim);
         for (int32_t j_col = 0; j_col < j_key_helper.tangent_dim; ++j_col) {
-          col_starts[j_col] = hessian_row_col_to_storage_offset.at(
-              std::make_pair(key_helper.combined_offset, j_key_helper.combined_offset + j_col));
+          col_starts[j_col] = StorageOffset(hessian_lower, key_helper.combined_offset,
+                                            j_key_helper.combined_offset + j_col);
         }
       } else {
         col_starts.resize(key_helper.tangent_dim);
         for (int32_t i_col = 0; i_col < key_helper.tangent_dim; ++i_col) {
-          col_starts[i_col] = hessian_row_col_to_storage_offset.at(
-              std::make_pair(j_key_helper.combined_offset, key_helper.combined_offset + i_col));
+          col_starts[i_col] = StorageOffset(hessian_lower, j_key_helper.combined_offset,
+                                            key_helper.combined_offset + i_col);
         }
       }
     }
   }
 }
 
-template <typename Scalar>
+/**
+ * Compute the storage offset of each nonzero of a sparse factor in the combined jacobian and
+ * hessian.  If the jacobian is empty, only the hessian offsets are computed.
+ */
+template <typename Scalar, typename HessianMatrixType>
 void ComputeKeyHelperSparseMap(
     const typename Factor<Scalar>::LinearizedSparseFactor& linearized_factor,
-    const CoordsToStorageMap& jacobian_row_col_to_storage_offset,
-    const CoordsToStorageMap& hessian_row_col_to_storage_offset,
+    const Eigen::SparseMatrix<Scalar>& jacobian, const HessianMatrixType& hessian_lower,
     linearization_sparse_factor_helper_t& factor_helper) {
-  // We're computing this in UpdateFromSparseOnesFactorIntoTripletLists too...
   std::vector<int> key_for_factor_offset;
   // Reserve?
   for (int key_i = 0; key_i < static_cast<int>(factor_helper.key_helpers.size()); key_i++) {
@@ -153,8 +115,9 @@ void ComputeKeyHelperSparseMap(
     }
   }
 
+  const int jacobian_outer_size = jacobian.size() > 0 ? linearized_factor.jacobian.outerSize() : 0;
   factor_helper.jacobian_index_map.reserve(linearized_factor.jacobian.nonZeros());
-  for (int outer_i = 0; outer_i < linearized_factor.jacobian.outerSize(); ++outer_i) {
+  for (int outer_i = 0; outer_i < jacobian_outer_size; ++outer_i) {
     for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(linearized_factor.jacobian,
                                                                 outer_i);
          it; ++it) {
@@ -163,8 +126,8 @@ void ComputeKeyHelperSparseMap(
 
       const auto& key_helper = factor_helper.key_helpers[key_for_factor_offset[col]];
       const auto problem_col = col - key_helper.factor_offset + key_helper.combined_offset;
-      factor_helper.jacobian_index_map.push_back(jacobian_row_col_to_storage_offset.at(
-          std::make_pair(row + factor_helper.combined_residual_offset, problem_col)));
+      factor_helper.jacobian_index_map.push_back(
+          StorageOffset(jacobian, row + factor_helper.combined_residual_offset, problem_col));
     }
   }
 
@@ -183,11 +146,9 @@ void ComputeKeyHelperSparseMap(
       // Put the entry in the lower triangle - even if the factor hessian is lower triangular, the
       // entry might naively go into the upper triangle if the key order is reversed in the full
       // problem
-      const auto full_problem_indices = problem_row >= problem_col
-                                            ? std::make_pair(problem_row, problem_col)
-                                            : std::make_pair(problem_col, problem_row);
       factor_helper.hessian_index_map.push_back(
-          hessian_row_col_to_storage_offset.at(full_problem_indices));
+          problem_row >= problem_col ? StorageOffset(hessian_lower, problem_row, problem_col)
+                                     : StorageOffset(hessian_lower, problem_col, problem_row));
     }
   }
 }
@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./thread_pool.h"
+
+namespace sym {
+namespace internal {
+
+ThreadPool::ThreadPool(const int num_threads) {
+  const int num_workers = std::max(num_threads, 1) - 1;
+  workers_.reserve(num_workers);
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back([this]() { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+int ThreadPool::NumThreads() const {
+  return static_cast<int>(workers_.size()) + 1;
+}
+
+void ThreadPool::Run(const int num_tasks, const std::function<void(int)>& task) {
+  if (workers_.empty() || num_tasks <= 1) {
+    for (int i = 0; i < num_tasks; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    num_tasks_ = num_tasks;
+    next_task_.store(0, std::memory_order_relaxed);
+    num_busy_workers_ = static_cast<int>(workers_.size());
+    exception_ = nullptr;
+    ++generation_;
+  }
+  work_available_.notify_all();
+
+  RunTasks();
+
+  std::exception_ptr exception;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this]() { return num_busy_workers_ == 0; });
+    task_ = nullptr;
+    std::swap(exception, exception_);
+  }
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  uint64_t last_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_available_.wait(
+          lock, [this, last_generation]() { return stop_ || generation_ != last_generation; });
+      if (stop_) {
+        return;
+      }
+      last_generation = generation_;
+    }
+
+    RunTasks();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_busy_workers_--;
+      if (num_busy_workers_ == 0) {
+        work_done_.notify_one();
+      }
+    }
+  }
+}
+
+void ThreadPool::RunTasks() {
+  while (true) {
+    const int i = next_task_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= num_tasks_) {
+      return;
+    }
+
+    try {
+      (*task_)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!exception_) {
+        exception_ = std::current_exception();
+      }
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace sym
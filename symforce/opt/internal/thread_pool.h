@@ -0,0 +1,116 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sym {
+namespace internal {
+
+/**
+ * A fixed-size pool of worker threads for running data-parallel loops.
+ *
+ * The calling thread always participates in the work, so a pool with num_threads threads spawns
+ * num_threads - 1 workers, and a pool with a single thread runs everything inline on the caller
+ * without any synchronization.
+ *
+ * Work is handed out in chunks claimed dynamically by whichever thread is free, so callers that
+ * need deterministic results must make sure the result of each chunk does not depend on which
+ * thread runs it or in what order chunks complete.
+ *
+ * Not reentrant: Run / ParallelFor must not be called from inside a task, or concurrently from
+ * multiple threads on the same pool.
+ */
+class ThreadPool {
+ public:
+  /**
+   * Create a pool with the given total number of threads (including the calling thread).  Values
+   * less than 1 are treated as 1.
+   */
+  explicit ThreadPool(int num_threads = 1);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int NumThreads() const;
+
+  /**
+   * Call task(i) for every i in [0, num_tasks), distributed across the threads in the pool.  Blocks
+   * until every task has returned.  If any task throws, the first exception is rethrown here after
+   * all threads have stopped.
+   */
+  void Run(int num_tasks, const std::function<void(int)>& task);
+
+  /**
+   * Call func(i) for every i in [begin, end), in contiguous chunks of grain_size indices.  If
+   * grain_size is not positive, the range is split into a small multiple of the number of threads
+   * to balance load.
+   */
+  template <typename Func>
+  void ParallelFor(int begin, int end, Func&& func, int grain_size = 0) {
+    const int count = end - begin;
+    if (count <= 0) {
+      return;
+    }
+
+    if (grain_size <= 0) {
+      grain_size = std::max(1, count / (kChunksPerThread * NumThreads()));
+    }
+
+    // The task only captures a reference to this, so that it fits in the small buffer of the
+    // std::function and calling ParallelFor does not allocate
+    struct Loop {
+      int begin;
+      int end;
+      int grain_size;
+      Func& func;
+    } loop{begin, end, grain_size, func};
+
+    const int num_chunks = (count + grain_size - 1) / grain_size;
+    Run(num_chunks, [&loop](const int chunk) {
+      const int chunk_begin = loop.begin + chunk * loop.grain_size;
+      const int chunk_end = std::min(loop.end, chunk_begin + loop.grain_size);
+      for (int i = chunk_begin; i < chunk_end; ++i) {
+        loop.func(i);
+      }
+    });
+  }
+
+ private:
+  static constexpr int kChunksPerThread = 8;
+
+  void WorkerLoop();
+
+  // Claim and run tasks from the current job until there are none left
+  void RunTasks();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+
+  // State of the current job, written by Run under mutex_ before waking the workers
+  const std::function<void(int)>* task_{nullptr};
+  int num_tasks_{0};
+  std::atomic<int> next_task_{0};
+  int num_busy_workers_{0};
+  uint64_t generation_{0};
+  std::exception_ptr exception_{};
+  bool stop_{false};
+};
+
+}  // namespace internal
+}  // namespace sym
@@ -31,7 +31,7 @@ TimePoint GetMonotonicTime() {
 }
 
 // Accumulate a duration specified by the startime and end time with the named block
-void TicTocUpdate(const std::string& name, const Duration& duration) {
+void TicTocUpdate(const fmt::string_view name, const Duration& duration) {
   g_thread_ctx.Update(name, duration);
 }
 
@@ -84,9 +84,10 @@ ThreadContext::~ThreadContext() {
   g_tic_toc.Consume(block_map_);
 }
 
-void ThreadContext::Update(const std::string& name, const Duration& duration) {
+void ThreadContext::Update(const fmt::string_view name, const Duration& duration) {
+  key_.assign(name.data(), name.size());
   // This intentionally default-constructs the block if it doesn't exist
-  block_map_[name].Update(duration);
+  block_map_[key_].Update(duration);
 }
 
 // --------------------------------------------------------------------------------------------
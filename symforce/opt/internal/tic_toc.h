@@ -6,12 +6,15 @@
 #include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <iterator>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include <fmt/format.h>
+
 namespace sym {
 namespace internal {
 
@@ -20,18 +23,24 @@ using TimePoint = std::chrono::time_point<Clock>;
 using Duration = TimePoint::duration;
 
 TimePoint GetMonotonicTime();
-void TicTocUpdate(const std::string& name, const Duration& duration);
+void TicTocUpdate(fmt::string_view name, const Duration& duration);
 
 class ScopedTicToc {
  public:
-  explicit ScopedTicToc(const std::string& name) : name_(name), start_(GetMonotonicTime()) {}
+  // The name is formatted into an inline buffer, so this does not allocate unless the name is
+  // very long
+  template <typename... Args>
+  explicit ScopedTicToc(const fmt::string_view format_str, const Args&... args) {
+    fmt::vformat_to(std::back_inserter(name_), format_str, fmt::make_format_args(args...));
+    start_ = GetMonotonicTime();
+  }
 
   ~ScopedTicToc() {
-    TicTocUpdate(name_, GetMonotonicTime() - start_);
+    TicTocUpdate(fmt::string_view(name_.data(), name_.size()), GetMonotonicTime() - start_);
   }
 
  private:
-  std::string name_;
+  fmt::memory_buffer name_;
   TimePoint start_;
 };
 
@@ -60,11 +69,15 @@ class ThreadContext {
   ThreadContext() = default;
   ~ThreadContext();
 
-  // Add a sample of length Duration to the block for name
-  void Update(const std::string& name, const Duration& duration);
+  // Add a sample of length Duration to the block for name.  Does not allocate if the block
+  // already exists
+  void Update(fmt::string_view name, const Duration& duration);
 
  private:
   std::unordered_map<std::string, TicTocStats> block_map_;
+
+  // Storage for the key to look up in block_map_, which keeps its capacity between calls
+  std::string key_;
 };
 
 class TicTocManager {
@@ -5,20 +5,98 @@
 
 #pragma once
 
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
 #include <lcmtypes/sym/optimization_stats_t.hpp>
 #include <lcmtypes/sym/optimizer_params_t.hpp>
 
+#include "./block_sparse_matrix.h"
 #include "./cholesky/sparse_cholesky_solver.h"
+#include "./hessian_operator.h"
 #include "./internal/levenberg_marquardt_state.h"
+#include "./internal/thread_pool.h"
 #include "./optimization_stats.h"
 #include "./tic_toc.h"
 #include "./values.h"
 
 namespace sym {
 
+namespace internal {
+
+/**
+ * The number of iterations in the last solve of an iterative linear solver, i.e. one with an
+ * Iterations() method such as ConjugateGradientSolver, or the refinement steps of a
+ * MixedPrecisionCholeskySolver, or 0 for a direct solver
+ */
+template <typename LinearSolverType, typename = void>
+struct LinearSolverIterations {
+  static int Get(const LinearSolverType& /* linear_solver */) {
+    return 0;
+  }
+};
+
+template <typename LinearSolverType>
+struct LinearSolverIterations<
+    LinearSolverType, decltype(void(std::declval<const LinearSolverType&>().Iterations()))> {
+  static int Get(const LinearSolverType& linear_solver) {
+    return linear_solver.Iterations();
+  }
+};
+
+/**
+ * Factorize A with a linear solver, and return whether the factorization succeeded.  Linear solvers
+ * whose Factorize returns a bool, such as ConjugateGradientSolver or BlockSparseCholeskySolver,
+ * report failure for a matrix that is not positive definite; the others always succeed.
+ */
+template <typename LinearSolverType, typename = void>
+struct LinearSolverFactorize {
+  template <typename MatrixType>
+  static bool Factorize(LinearSolverType& linear_solver, const MatrixType& A) {
+    linear_solver.Factorize(A);
+    return true;
+  }
+};
+
+template <typename LinearSolverType>
+struct LinearSolverFactorize<
+    LinearSolverType,
+    std::enable_if_t<std::is_same<
+        decltype(std::declval<LinearSolverType&>().Factorize(
+            std::declval<const typename LinearSolverType::MatrixType&>())),
+        bool>::value>> {
+  template <typename MatrixType>
+  static bool Factorize(LinearSolverType& linear_solver, const MatrixType& A) {
+    return linear_solver.Factorize(A);
+  }
+};
+
+/**
+ * The number of threads a linear solver factorizes with, i.e. its NumThreads() if it has one such
+ * as SparseCholeskySolver or SparseSchurSolver, or 1
+ */
+template <typename LinearSolverType, typename = void>
+struct LinearSolverNumThreads {
+  static int Get(const LinearSolverType& /* linear_solver */) {
+    return 1;
+  }
+};
+
+template <typename LinearSolverType>
+struct LinearSolverNumThreads<
+    LinearSolverType, decltype(void(std::declval<const LinearSolverType&>().NumThreads()))> {
+  static int Get(const LinearSolverType& linear_solver) {
+    return linear_solver.NumThreads();
+  }
+};
+
+}  // namespace internal
+
 /**
  * Fast Levenberg-Marquardt solver for nonlinear least squares problems specified by a
  * linearization function.  Supports on-manifold optimization and sparse solving, and attempts to
@@ -27,7 +105,11 @@ namespace sym {
  * This assumes the problem structure is the same for the lifetime of the object - if the problem
  * structure changes, create a new LevenbergMarquardtSolver.
  *
- * TODO(aaron): Analyze what repeated allocations we do have, and get rid of them if possible
+ * With the default SparseCholeskySolver, Iterate does not allocate after the first iteration, as
+ * long as the linearize function doesn't (e.g. a Linearizer), stats has room for the iteration
+ * (see OptimizationStats::Reset), and neither verbose nor debug_stats is set.  The hessian is
+ * damped in place through the storage offsets of its diagonal, which are computed on the first
+ * iteration.
  *
  * Not thread safe! Create one per thread.
  *
@@ -115,6 +197,30 @@ namespace sym {
  *   takes the form lambda * I, or lambda * diag(J.T * J), where lambda is another parameter updated
  *   by the solver at each iteration.  Configuration of how this term is computed can be found
  *   in the optimizer params.
+ *
+ * The hessian is solved with LinearSolverType, whose MatrixType is Eigen::SparseMatrix,
+ * BlockSparseMatrix or HessianOperator.  With a BlockSparseMatrix (e.g. a
+ * BlockSparseCholeskySolver), the hessian is damped and factorized in block form; the hessian is
+ * taken from Linearization::hessian_lower_blocks if the linearization has one, and is otherwise
+ * converted from Linearization::hessian_lower, with one block per key in the index.  With a
+ * HessianOperator (e.g. a ConjugateGradientSolver), the damped hessian is never formed; it is
+ * applied through Linearization::jacobian, with one block per key in the index.  The number of
+ * iterations of an iterative linear solver is reported in
+ * optimization_iteration_t::linear_solver_iterations.
+ *
+ * If Iterate is given a ResidualFunc and optimizer_params_t::defer_linearization is set, each
+ * candidate step is first evaluated with the ResidualFunc, and the full linearization is only
+ * computed if the step is accepted.  A rejected step then only costs a residual evaluation, instead
+ * of a jacobian and hessian that are thrown away.  optimization_iteration_t::linearized records
+ * which iterations computed the full linearization.
+ *
+ * If Iterate is given a ResidualFunc and optimizer_params_t::speculative_lambdas is K > 1, each
+ * iteration instead tries K damping values at once: the hessian is damped, factorized and solved
+ * for each of them concurrently on optimizer_params_t::num_threads threads, the K candidate steps
+ * are evaluated with the ResidualFunc, and the first candidate that reduces the error is taken.  If
+ * the linear solver is itself multithreaded, the candidates are instead solved one at a time.
+ * This gives the same steps as standard iterations, without the iterations that are rejected while
+ * lambda increases, so it spends more computation per iteration for fewer iterations.
  */
 template <typename ScalarType,
           typename LinearSolverType = sym::SparseCholeskySolver<Eigen::SparseMatrix<ScalarType>>>
@@ -123,11 +229,16 @@ class LevenbergMarquardtSolver {
   using Scalar = ScalarType;
   using LinearSolver = LinearSolverType;
   using StateType = internal::LevenbergMarquardtState<Scalar>;
+  using HessianType = typename LinearSolver::MatrixType;
 
   // Function that evaluates the objective function and produces a quadratic approximation of
   // it by linearizing a least-squares residual.
   using LinearizeFunc = std::function<void(const Values<Scalar>&, Linearization<Scalar>* const)>;
 
+  // Function that evaluates only the residual of the objective function, in the same layout as
+  // Linearization::residual
+  using ResidualFunc = std::function<void(const Values<Scalar>&, VectorX<Scalar>* const)>;
+
   LevenbergMarquardtSolver(const optimizer_params_t& p, const std::string& id, const Scalar epsilon)
       : p_(p), id_(id), epsilon_(epsilon) {}
 
@@ -173,6 +284,12 @@ class LevenbergMarquardtSolver {
   bool Iterate(const LinearizeFunc& func, OptimizationStats<Scalar>* const stats,
                const bool debug_stats = false);
 
+  // Run one iteration of the optimization, evaluating the candidate step with residual_func first
+  // if defer_linearization is set in the params.  residual_func may be empty, in which case every
+  // candidate is fully linearized.  Returns true if the optimization should early exit.
+  bool Iterate(const LinearizeFunc& func, const ResidualFunc& residual_func,
+               OptimizationStats<Scalar>* const stats, const bool debug_stats = false);
+
   const Values<Scalar>& GetBestValues() const {
     SYM_ASSERT(state_.BestIsValid());
     return state_.Best().values;
@@ -183,20 +300,94 @@ class LevenbergMarquardtSolver {
     return state_.Best().GetLinearization();
   }
 
+  const LinearSolver& GetLinearSolver() const {
+    return linear_solver_;
+  }
+
+  // Computes the full dense covariance, i.e. the inverse of the hessian damped by epsilon.
+  // Optimizer::ComputeAllCovariances only computes the blocks of it for each key, which takes much
+  // less memory and time for large problems.
   void ComputeCovariance(const Eigen::SparseMatrix<Scalar>& hessian_lower,
                          MatrixX<Scalar>* covariance);
 
  private:
-  Eigen::SparseMatrix<Scalar> DampHessian(const Eigen::SparseMatrix<Scalar>& hessian_lower,
-                                          bool* const have_max_diagonal,
-                                          VectorX<Scalar>* const max_diagonal,
-                                          const Scalar lambda) const;
-
-  void CheckHessianDiagonal(const Eigen::SparseMatrix<Scalar>& hessian_lower_damped);
+  void DampHessian(bool* const have_max_diagonal, VectorX<Scalar>* const max_diagonal,
+                   const Scalar lambda, HessianType* const hessian_lower);
+
+  // The diagonal that is scaled by lambda for diagonal damping of the undamped hessian_lower,
+  // updating max_diagonal if keep_max_diagonal_damping is set.  Unused without diagonal damping.
+  const VectorX<Scalar>& DampingDiagonal(const HessianType& hessian_lower,
+                                         bool* const have_max_diagonal,
+                                         VectorX<Scalar>* const max_diagonal);
+
+  // Add the damping for lambda to hessian_lower, using damping as storage.  Does not modify the
+  // solver, so this can be called concurrently for different hessians.
+  void AddDamping(const VectorX<Scalar>& damping_diagonal, const Scalar lambda,
+                  VectorX<Scalar>* const damping, HessianType* const hessian_lower) const;
+
+  // Damp, factorize and solve H_damped_ for each candidate lambda on thread_pool_, and evaluate
+  // the candidate steps with residual_func in order of increasing lambda.  Returns the index of the
+  // first candidate that factorizes and reduces the error, or of the last candidate if none does.
+  int SolveSpeculativeCandidates(const ResidualFunc& residual_func);
+
+  // Fill out the linear solver ordering and factor sparsity in the debug stats, if not already
+  void PopulateLinearSolverStats(const LinearSolver& linear_solver,
+                                 OptimizationStats<Scalar>* const stats) const;
+
+  void CheckHessianDiagonal(const HessianType& hessian_lower_damped);
+
+  // Set hessian_lower to the hessian of a linearization, or to a scalar hessian, in the form used
+  // by the linear solver
+  void SetHessian(const Linearization<Scalar>& linearization,
+                  Eigen::SparseMatrix<Scalar>* hessian_lower) const;
+  void SetHessian(const Linearization<Scalar>& linearization,
+                  BlockSparseMatrix<Scalar>* hessian_lower) const;
+  void SetHessian(const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+                  Eigen::SparseMatrix<Scalar>* hessian_lower) const;
+  void SetHessian(const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+                  BlockSparseMatrix<Scalar>* hessian_lower) const;
+  void SetHessian(const Linearization<Scalar>& linearization,
+                  HessianOperator<Scalar>* hessian_lower) const;
+  void SetHessian(const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+                  HessianOperator<Scalar>* hessian_lower) const;
+
+  // The tangent dimension of each key in the index
+  std::vector<int32_t> IndexBlockDims() const;
+
+  // Compute diagonal_offsets_ for the structure of hessian_lower, or leave it empty if some
+  // diagonal entry is not stored.  Only used for an Eigen::SparseMatrix hessian
+  void ComputeDiagonalOffsets(const Eigen::SparseMatrix<Scalar>& hessian_lower);
+  void ComputeDiagonalOffsets(const BlockSparseMatrix<Scalar>& hessian_lower);
+  void ComputeDiagonalOffsets(const HessianOperator<Scalar>& hessian_lower);
+
+  // Access to the diagonal of either type of hessian.  The Eigen::SparseMatrix versions go
+  // through diagonal_offsets_ if hessian_lower has the structure they were computed for.
+  void HessianDiagonal(const Eigen::SparseMatrix<Scalar>& hessian_lower,
+                       VectorX<Scalar>* diagonal) const;
+  void HessianDiagonal(const BlockSparseMatrix<Scalar>& hessian_lower,
+                       VectorX<Scalar>* diagonal) const;
+  void HessianDiagonal(const HessianOperator<Scalar>& hessian_lower,
+                       VectorX<Scalar>* diagonal) const;
+  static void SetHessianDiagonal(const VectorX<Scalar>& diagonal,
+                                 Eigen::SparseMatrix<Scalar>* hessian_lower);
+  static void SetHessianDiagonal(const VectorX<Scalar>& diagonal,
+                                 BlockSparseMatrix<Scalar>* hessian_lower);
+  static void SetHessianDiagonal(const VectorX<Scalar>& diagonal,
+                                 HessianOperator<Scalar>* hessian_lower);
+  void AddToHessianDiagonal(const VectorX<Scalar>& diagonal,
+                            Eigen::SparseMatrix<Scalar>* hessian_lower) const;
+  void AddToHessianDiagonal(const VectorX<Scalar>& diagonal,
+                            BlockSparseMatrix<Scalar>* hessian_lower) const;
+  void AddToHessianDiagonal(const VectorX<Scalar>& diagonal,
+                            HessianOperator<Scalar>* hessian_lower) const;
+
+  // Whether diagonal_offsets_ can be used for hessian_lower
+  bool HaveDiagonalOffsets(const Eigen::SparseMatrix<Scalar>& hessian_lower) const;
 
   void PopulateIterationStats(optimization_iteration_t* const iteration_stats,
-                              const StateType& state, const Scalar new_error,
-                              const Scalar relative_reduction, const bool debug_stats) const;
+                              const StateType& state, const int linear_solver_iterations,
+                              const Scalar new_error, const Scalar relative_reduction,
+                              const bool debug_stats);
 
   void Update(const Values<Scalar>& values, const index_t& index, const VectorX<Scalar>& update,
               Values<Scalar>* const updated_values) const;
@@ -227,12 +418,48 @@ class LevenbergMarquardtSolver {
 
   // Working storage to avoid reallocation
   VectorX<Scalar> update_;
-  Eigen::SparseMatrix<Scalar> H_damped_;
+  VectorX<Scalar> negative_update_;
+  VectorX<Scalar> linear_error_workspace_;
+  HessianType H_damped_;
+  VectorX<Scalar> diagonal_;
+  // Separate from diagonal_, which may be the damping diagonal while candidates are damped
+  VectorX<Scalar> damped_diagonal_;
+  VectorX<Scalar> damping_;
   Eigen::Array<bool, Eigen::Dynamic, 1> zero_diagonal_;
   std::vector<int> zero_diagonal_indices_;
 
+  // Index into H_damped_.valuePtr() of each diagonal entry, if H_damped_ is an Eigen::SparseMatrix
+  // with every diagonal entry stored.  Computed on the first iteration, since the structure of
+  // H_damped_ stays the same, and cleared by ComputeCovariance which changes it.
+  bool have_diagonal_offsets_{false};
+  std::vector<int32_t> diagonal_offsets_;
+
   // Index for the associated values, used for values.Update or Retract
   index_t index_{};
+
+  // Storage for one of the threads that damp, factorize and solve the candidate lambdas on each
+  // iteration with speculative_lambdas > 1.  Each has its own copy of the analyzed linear solver,
+  // so that they can factorize concurrently.
+  struct SpeculativeWorkspace {
+    HessianType H_damped;
+    LinearSolver linear_solver{};
+    VectorX<Scalar> damping;
+  };
+
+  std::vector<SpeculativeWorkspace> speculative_workspaces_;
+
+  // The lambda, update, number of linear solver iterations, and whether the damped hessian
+  // factorized, for each candidate
+  std::vector<Scalar> candidate_lambdas_;
+  std::vector<VectorX<Scalar>> candidate_updates_;
+  std::vector<int> candidate_linear_solver_iterations_;
+  std::vector<uint8_t> candidate_factorized_;
+
+  // The values and residual of the last candidate evaluated
+  Values<Scalar> candidate_values_{};
+  VectorX<Scalar> candidate_residual_;
+
+  std::unique_ptr<internal::ThreadPool> thread_pool_;
 };
 
 }  // namespace sym
@@ -3,6 +3,10 @@
  * This source code is under the Apache 2.0 license found in the LICENSE file.
  * ---------------------------------------------------------------------------- */
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
 #include <fmt/ranges.h>
 #include <spdlog/spdlog.h>
 
@@ -17,40 +21,185 @@ namespace sym {
 // ----------------------------------------------------------------------------
 
 template <typename ScalarType, typename LinearSolverType>
-Eigen::SparseMatrix<ScalarType> LevenbergMarquardtSolver<ScalarType, LinearSolverType>::DampHessian(
-    const Eigen::SparseMatrix<Scalar>& hessian_lower, bool* const have_max_diagonal,
-    VectorX<Scalar>* const max_diagonal, const Scalar lambda) const {
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::DampHessian(
+    bool* const have_max_diagonal, VectorX<Scalar>* const max_diagonal, const Scalar lambda,
+    HessianType* const H_damped) {
   SYM_TIME_SCOPE("LM<{}>: DampHessian", id_);
-  Eigen::SparseMatrix<Scalar> H_damped = hessian_lower;
 
+  const VectorX<Scalar>& damping_diagonal =
+      DampingDiagonal(*H_damped, have_max_diagonal, max_diagonal);
+  AddDamping(damping_diagonal, lambda, &damping_, H_damped);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+const VectorX<ScalarType>& LevenbergMarquardtSolver<ScalarType, LinearSolverType>::DampingDiagonal(
+    const HessianType& hessian_lower, bool* const have_max_diagonal,
+    VectorX<Scalar>* const max_diagonal) {
+  if (!p_.use_diagonal_damping) {
+    return diagonal_;
+  }
+
+  HessianDiagonal(hessian_lower, &diagonal_);
+  if (!p_.keep_max_diagonal_damping) {
+    return diagonal_;
+  }
+
+  if (!*have_max_diagonal) {
+    *max_diagonal = diagonal_;
+    *max_diagonal = max_diagonal->cwiseMax(p_.diagonal_damping_min);
+  } else {
+    *max_diagonal = max_diagonal->cwiseMax(diagonal_);
+  }
+
+  *have_max_diagonal = true;
+  return *max_diagonal;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::AddDamping(
+    const VectorX<Scalar>& damping_diagonal, const Scalar lambda, VectorX<Scalar>* const damping,
+    HessianType* const H_damped) const {
   if (p_.use_diagonal_damping) {
-    if (p_.keep_max_diagonal_damping) {
-      if (!*have_max_diagonal) {
-        *max_diagonal = H_damped.diagonal();
-        *max_diagonal = max_diagonal->cwiseMax(p_.diagonal_damping_min);
-      } else {
-        *max_diagonal = max_diagonal->cwiseMax(H_damped.diagonal());
-      }
+    *damping = damping_diagonal * lambda;
+    AddToHessianDiagonal(*damping, H_damped);
+  }
+
+  if (p_.use_unit_damping) {
+    damping->setConstant(index_.tangent_dim, lambda);
+    AddToHessianDiagonal(*damping, H_damped);
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+int LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SolveSpeculativeCandidates(
+    const ResidualFunc& residual_func) {
+  SYM_TIME_SCOPE("LM<{}>: SolveSpeculativeCandidates", id_);
+
+  const int num_candidates = p_.speculative_lambdas;
+
+  // A linear solver with its own threads shares them with its copies, so the candidates are then
+  // factorized one at a time, each of which is parallel.  Otherwise they are factorized
+  // concurrently, with one workspace per thread.
+  const bool solve_concurrently =
+      internal::LinearSolverNumThreads<LinearSolver>::Get(linear_solver_) <= 1;
+  const int num_workspaces =
+      solve_concurrently ? std::min(num_candidates, std::max(p_.num_threads, 1)) : 1;
+  if (static_cast<int>(speculative_workspaces_.size()) != num_workspaces) {
+    speculative_workspaces_.resize(num_workspaces);
+    for (SpeculativeWorkspace& workspace : speculative_workspaces_) {
+      workspace.linear_solver = linear_solver_;
+    }
+  }
+  if (num_workspaces > 1 &&
+      (thread_pool_ == nullptr || thread_pool_->NumThreads() != num_workspaces)) {
+    thread_pool_ = std::make_unique<internal::ThreadPool>(num_workspaces);
+  }
 
-      *have_max_diagonal = true;
+  candidate_lambdas_.resize(num_candidates);
+  candidate_updates_.resize(num_candidates);
+  candidate_linear_solver_iterations_.resize(num_candidates);
+  candidate_factorized_.resize(num_candidates);
+  Scalar lambda = current_lambda_;
+  for (int i = 0; i < num_candidates; ++i) {
+    candidate_lambdas_[i] = Clamp(lambda, p_.lambda_lower_bound, p_.lambda_upper_bound);
+    lambda *= p_.lambda_up_factor;
+  }
 
-      H_damped.diagonal().array() += max_diagonal->array() * lambda;
+  // H_damped_ is undamped here, and is the starting point for every candidate
+  const VectorX<Scalar>& damping_diagonal =
+      DampingDiagonal(H_damped_, &have_max_diagonal_, &max_diagonal_);
+
+  {
+    SYM_TIME_SCOPE("LM<{}>: SpeculativeFactorizeAndSolve", id_);
+
+    // Each task claims candidates until there are none left.  The task only captures a reference
+    // to this, so that it fits in the small buffer of the std::function and does not allocate
+    struct Job {
+      LevenbergMarquardtSolver* solver;
+      const VectorX<Scalar>& damping_diagonal;
+      std::atomic<int> next_candidate;
+    } job{this, damping_diagonal, {0}};
+
+    const auto solve_candidates = [&job, num_candidates](const int workspace_index) {
+      LevenbergMarquardtSolver& solver = *job.solver;
+      SpeculativeWorkspace& workspace = solver.speculative_workspaces_[workspace_index];
+      for (int i = job.next_candidate++; i < num_candidates; i = job.next_candidate++) {
+        workspace.H_damped = solver.H_damped_;
+        solver.AddDamping(job.damping_diagonal, solver.candidate_lambdas_[i], &workspace.damping,
+                          &workspace.H_damped);
+        solver.candidate_factorized_[i] =
+            internal::LinearSolverFactorize<LinearSolver>::Factorize(workspace.linear_solver,
+                                                                     workspace.H_damped);
+        solver.candidate_updates_[i] = solver.state_.Init().GetLinearization().rhs;
+        if (solver.candidate_factorized_[i]) {
+          workspace.linear_solver.SolveInPlace(&solver.candidate_updates_[i]);
+          solver.candidate_linear_solver_iterations_[i] =
+              internal::LinearSolverIterations<LinearSolver>::Get(workspace.linear_solver);
+        } else {
+          solver.candidate_updates_[i].setZero();
+          solver.candidate_linear_solver_iterations_[i] = 0;
+        }
+
+        if (i == 0) {
+          solver.CheckHessianDiagonal(workspace.H_damped);
+        }
+      }
+    };
+
+    if (num_workspaces > 1) {
+      thread_pool_->Run(num_workspaces, solve_candidates);
     } else {
-      H_damped.diagonal().array() += H_damped.diagonal().array() * lambda;
+      solve_candidates(0);
     }
   }
 
-  if (p_.use_unit_damping) {
-    H_damped.diagonal().array() += lambda;
+  // The residual_func is not reentrant, so the candidates are evaluated one at a time, each of
+  // which may be parallel over the factors, into the same storage.  The candidate taken is the one
+  // with the smallest lambda that reduces the error, which is the step that a sequence of standard
+  // iterations would accept after rejecting the candidates before it, so evaluation stops there.
+  // Taking the candidate with the smallest error instead favors heavily damped short steps, and
+  // takes more iterations to converge.  If no candidate reduces the error, the one with the
+  // largest lambda is returned, to be rejected.  Candidates that failed to factorize have a zero
+  // update, and are skipped unless they are the last one.
+  const Scalar init_error = state_.Init().Error();
+  for (int i = 0; i < num_candidates; ++i) {
+    if (!candidate_factorized_[i] && i + 1 < num_candidates) {
+      continue;
+    }
+
+    SYM_TIME_SCOPE("LM<{}>: residual_func", id_);
+    negative_update_ = -candidate_updates_[i];
+    Update(state_.Init().values, index_, negative_update_, &candidate_values_);
+    residual_func(candidate_values_, &candidate_residual_);
+    if (candidate_factorized_[i] && 0.5 * candidate_residual_.squaredNorm() < init_error) {
+      return i;
+    }
   }
 
-  return H_damped;
+  return num_candidates - 1;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::PopulateLinearSolverStats(
+    const LinearSolver& linear_solver, OptimizationStats<Scalar>* const stats) const {
+  // NOTE(aaron): This has to happen after the first factorize, since L_inner is not filled out
+  // by ComputeSymbolicSparsity
+  if (stats->linear_solver_ordering.size() == 0) {
+    stats->linear_solver_ordering = linear_solver.Permutation().indices();
+    const auto& L = linear_solver.L();
+    stats->cholesky_factor_sparsity = {
+        Eigen::Map<const VectorX<typename LinearSolverType::MatrixType::StorageIndex>>(
+            L.innerIndexPtr(), L.nonZeros()),
+        Eigen::Map<const VectorX<typename LinearSolverType::MatrixType::StorageIndex>>(
+            L.outerIndexPtr(), L.outerSize())};
+  }
 }
 
 template <typename ScalarType, typename LinearSolverType>
 void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::CheckHessianDiagonal(
-    const Eigen::SparseMatrix<Scalar>& hessian_lower_damped) {
-  zero_diagonal_ = hessian_lower_damped.diagonal().array().abs() < epsilon_;
+    const HessianType& hessian_lower_damped) {
+  HessianDiagonal(hessian_lower_damped, &damped_diagonal_);
+  zero_diagonal_ = damped_diagonal_.array().abs() < epsilon_;
 
   // NOTE(aaron): We call this outside the condition so it's guaranteed to do the allocation on the
   // first iteration
@@ -69,10 +218,184 @@ void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::CheckHessianDiagona
   }
 }
 
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Linearization<Scalar>& linearization,
+    Eigen::SparseMatrix<Scalar>* const hessian_lower) const {
+  if (linearization.HasBlockSparseHessian()) {
+    *hessian_lower = linearization.HessianLower();
+  } else {
+    *hessian_lower = linearization.hessian_lower;
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Linearization<Scalar>& linearization,
+    BlockSparseMatrix<Scalar>* const hessian_lower) const {
+  if (linearization.HasBlockSparseHessian()) {
+    *hessian_lower = linearization.hessian_lower_blocks;
+  } else {
+    SetHessian(linearization.hessian_lower, hessian_lower);
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+    Eigen::SparseMatrix<Scalar>* const hessian_lower) const {
+  *hessian_lower = hessian_lower_in;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+    BlockSparseMatrix<Scalar>* const hessian_lower) const {
+  *hessian_lower = BlockSparseMatrix<Scalar>::FromSparse(hessian_lower_in, IndexBlockDims());
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Linearization<Scalar>& linearization,
+    HessianOperator<Scalar>* const hessian_lower) const {
+  if (linearization.jacobian.cols() == index_.tangent_dim) {
+    hessian_lower->SetJacobian(linearization.jacobian, IndexBlockDims());
+  } else {
+    SetHessian(linearization.HessianLower(), hessian_lower);
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessian(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower_in,
+    HessianOperator<Scalar>* const hessian_lower) const {
+  hessian_lower->SetHessianLower(hessian_lower_in, IndexBlockDims());
+}
+
+template <typename ScalarType, typename LinearSolverType>
+std::vector<int32_t> LevenbergMarquardtSolver<ScalarType, LinearSolverType>::IndexBlockDims()
+    const {
+  std::vector<int32_t> block_dims;
+  block_dims.reserve(index_.entries.size());
+  for (const index_entry_t& entry : index_.entries) {
+    block_dims.push_back(entry.tangent_dim);
+  }
+  return block_dims;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::ComputeDiagonalOffsets(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower) {
+  have_diagonal_offsets_ = true;
+  diagonal_offsets_.clear();
+  if (!hessian_lower.isCompressed()) {
+    return;
+  }
+
+  const auto* const outer = hessian_lower.outerIndexPtr();
+  const auto* const inner = hessian_lower.innerIndexPtr();
+  diagonal_offsets_.resize(hessian_lower.cols());
+  for (int col = 0; col < hessian_lower.cols(); ++col) {
+    const auto* const entry = std::lower_bound(inner + outer[col], inner + outer[col + 1], col);
+    if (entry == inner + outer[col + 1] || *entry != col) {
+      diagonal_offsets_.clear();
+      return;
+    }
+    diagonal_offsets_[col] = static_cast<int32_t>(entry - inner);
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::ComputeDiagonalOffsets(
+    const BlockSparseMatrix<Scalar>& /* hessian_lower */) {
+  have_diagonal_offsets_ = true;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::ComputeDiagonalOffsets(
+    const HessianOperator<Scalar>& /* hessian_lower */) {
+  have_diagonal_offsets_ = true;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::HaveDiagonalOffsets(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower) const {
+  return have_diagonal_offsets_ && !diagonal_offsets_.empty() &&
+         static_cast<Eigen::Index>(diagonal_offsets_.size()) == hessian_lower.cols();
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::HessianDiagonal(
+    const Eigen::SparseMatrix<Scalar>& hessian_lower, VectorX<Scalar>* const diagonal) const {
+  if (HaveDiagonalOffsets(hessian_lower)) {
+    diagonal->resize(hessian_lower.cols());
+    for (size_t i = 0; i < diagonal_offsets_.size(); ++i) {
+      (*diagonal)[i] = hessian_lower.valuePtr()[diagonal_offsets_[i]];
+    }
+  } else {
+    *diagonal = hessian_lower.diagonal();
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::HessianDiagonal(
+    const BlockSparseMatrix<Scalar>& hessian_lower, VectorX<Scalar>* const diagonal) const {
+  *diagonal = hessian_lower.Diagonal();
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::HessianDiagonal(
+    const HessianOperator<Scalar>& hessian_lower, VectorX<Scalar>* const diagonal) const {
+  *diagonal = hessian_lower.Diagonal();
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessianDiagonal(
+    const VectorX<Scalar>& diagonal, Eigen::SparseMatrix<Scalar>* const hessian_lower) {
+  hessian_lower->diagonal() = diagonal;
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessianDiagonal(
+    const VectorX<Scalar>& diagonal, BlockSparseMatrix<Scalar>* const hessian_lower) {
+  hessian_lower->SetDiagonal(diagonal);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::SetHessianDiagonal(
+    const VectorX<Scalar>& diagonal, HessianOperator<Scalar>* const hessian_lower) {
+  hessian_lower->SetDiagonal(diagonal);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::AddToHessianDiagonal(
+    const VectorX<Scalar>& diagonal, Eigen::SparseMatrix<Scalar>* const hessian_lower) const {
+  if (HaveDiagonalOffsets(*hessian_lower)) {
+    for (size_t i = 0; i < diagonal_offsets_.size(); ++i) {
+      hessian_lower->valuePtr()[diagonal_offsets_[i]] += diagonal[i];
+    }
+  } else {
+    hessian_lower->diagonal() += diagonal;
+  }
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::AddToHessianDiagonal(
+    const VectorX<Scalar>& diagonal, BlockSparseMatrix<Scalar>* const hessian_lower) const {
+  hessian_lower->AddToDiagonal(diagonal);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::AddToHessianDiagonal(
+    const VectorX<Scalar>& diagonal, HessianOperator<Scalar>* const hessian_lower) const {
+  hessian_lower->AddToDiagonal(diagonal);
+}
+
 template <typename ScalarType, typename LinearSolverType>
 void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::PopulateIterationStats(
     optimization_iteration_t* const iteration_stats, const StateType& state_,
-    const Scalar new_error, const Scalar relative_reduction, const bool debug_stats) const {
+    const int linear_solver_iterations, const Scalar new_error, const Scalar relative_reduction,
+    const bool debug_stats) {
   SYM_TIME_SCOPE("LM<{}>: IterationStats", id_);
 
   iteration_stats->iteration = iteration_;
@@ -80,10 +403,12 @@ void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::PopulateIterationSt
 
   iteration_stats->new_error = new_error;
   iteration_stats->relative_reduction = relative_reduction;
+  iteration_stats->linear_solver_iterations = linear_solver_iterations;
 
   {
     SYM_TIME_SCOPE("LM<{}>: IterationStats - LinearErrorFromValues", id_);
-    iteration_stats->new_error_linear = state_.Init().GetLinearization().LinearError(update_);
+    iteration_stats->new_error_linear =
+        state_.Init().GetLinearization().LinearError(update_, &linear_error_workspace_);
   }
 
   if (p_.verbose) {
@@ -139,6 +464,13 @@ void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::UpdateParams(
 template <typename ScalarType, typename LinearSolverType>
 bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
     const LinearizeFunc& func, OptimizationStats<Scalar>* const stats, const bool debug_stats) {
+  return Iterate(func, ResidualFunc(), stats, debug_stats);
+}
+
+template <typename ScalarType, typename LinearSolverType>
+bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
+    const LinearizeFunc& func, const ResidualFunc& residual_func,
+    OptimizationStats<Scalar>* const stats, const bool debug_stats) {
   SYM_TIME_SCOPE("LM<{}>::Iterate()", id_);
   SYM_ASSERT(stats != nullptr);
 
@@ -163,6 +495,7 @@ bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
     iteration_stats.iteration = -1;
     iteration_stats.new_error = state_.Init().Error();
     iteration_stats.current_lambda = current_lambda_;
+    iteration_stats.linearized = true;
 
     if (debug_stats) {
       iteration_stats.values = state_.Init().values.template Cast<double>().GetLcmType();
@@ -173,51 +506,93 @@ bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
     }
   }
 
+  // Damping happens in place, so this copies the hessian.  The structure is the same on every
+  // iteration, so this does not allocate after the first one
+  SetHessian(state_.Init().GetLinearization(), &H_damped_);
+  if (!have_diagonal_offsets_) {
+    ComputeDiagonalOffsets(H_damped_);
+  }
+
   // Analyze the sparsity pattern for efficient repeated factorization
   if (!solver_analyzed_) {
     // TODO(aaron): Do this with the ones linearization computed by the Linearizer
     SYM_TIME_SCOPE("LM<{}>: AnalyzePattern", id_);
-    Eigen::SparseMatrix<Scalar> H_analyze = state_.Init().GetLinearization().hessian_lower;
-    H_analyze.diagonal().array() = 1.0;  // Make sure the diagonal is nonzero for analysis
+    HessianType H_analyze = H_damped_;
+    // Make sure the diagonal is nonzero for analysis
+    SetHessianDiagonal(VectorX<Scalar>::Ones(index_.tangent_dim), &H_analyze);
     linear_solver_.ComputeSymbolicSparsity(H_analyze);
     solver_analyzed_ = true;
   }
 
-  // TODO(aaron): Get rid of this copy
-  H_damped_ = DampHessian(state_.Init().GetLinearization().hessian_lower, &have_max_diagonal_,
-                          &max_diagonal_, current_lambda_);
+  const bool speculative = p_.speculative_lambdas > 1 && residual_func;
+  int linear_solver_iterations = 0;
 
-  CheckHessianDiagonal(H_damped_);
+  // If the damped hessian fails to factorize (e.g. it is not positive definite for an iterative
+  // solver), the update is zero and the step is rejected, so that lambda increases
+  bool factorized = true;
 
-  {
-    SYM_TIME_SCOPE("LM<{}>: SparseFactorize", id_);
-    linear_solver_.Factorize(H_damped_);
-
-    // NOTE(aaron): This has to happen after the first factorize, since L_inner is not filled out
-    // by ComputeSymbolicSparsity
-    if (debug_stats && stats->linear_solver_ordering.size() == 0) {
-      stats->linear_solver_ordering = linear_solver_.Permutation().indices();
-      stats->cholesky_factor_sparsity = {
-          Eigen::Map<const VectorX<typename LinearSolverType::MatrixType::StorageIndex>>(
-              linear_solver_.L().innerIndexPtr(), linear_solver_.L().nonZeros()),
-          Eigen::Map<const VectorX<typename LinearSolverType::MatrixType::StorageIndex>>(
-              linear_solver_.L().outerIndexPtr(), linear_solver_.L().outerSize())};
+  // The debug stats need the jacobian at every step
+  const bool defer_linearization =
+      (p_.defer_linearization || speculative) && residual_func && !debug_stats;
+
+  if (speculative) {
+    const int step_candidate = SolveSpeculativeCandidates(residual_func);
+
+    // The step is taken with the chosen candidate, as if the iterations with the candidates before
+    // it had been rejected
+    current_lambda_ = candidate_lambdas_[step_candidate];
+    factorized = candidate_factorized_[step_candidate];
+    linear_solver_iterations = candidate_linear_solver_iterations_[step_candidate];
+    update_ = candidate_updates_[step_candidate];
+    state_.New().SwapEvaluatedResidual(&candidate_values_, &candidate_residual_);
+
+    if (debug_stats) {
+      // The ordering and the sparsity of the factor are the same for every workspace
+      PopulateLinearSolverStats(speculative_workspaces_.front().linear_solver, stats);
+
+      SYM_TIME_SCOPE("LM<{}>: linearization_func", id_);
+      state_.New().Relinearize(func);
     }
-  }
+  } else {
+    DampHessian(&have_max_diagonal_, &max_diagonal_, current_lambda_, &H_damped_);
 
-  {
-    SYM_TIME_SCOPE("LM<{}>: SparseSolve", id_);
-    update_ = linear_solver_.Solve(state_.Init().GetLinearization().rhs);
-  }
+    CheckHessianDiagonal(H_damped_);
 
-  {
-    SYM_TIME_SCOPE("LM<{}>: Update", id_);
-    Update(state_.Init().values, index_, -update_, &state_.New().values);
-  }
+    {
+      SYM_TIME_SCOPE("LM<{}>: SparseFactorize", id_);
+      factorized =
+          internal::LinearSolverFactorize<LinearSolver>::Factorize(linear_solver_, H_damped_);
 
-  {
-    SYM_TIME_SCOPE("LM<{}>: linearization_func", id_);
-    state_.New().Relinearize(func);
+      if (debug_stats) {
+        PopulateLinearSolverStats(linear_solver_, stats);
+      }
+    }
+
+    {
+      SYM_TIME_SCOPE("LM<{}>: SparseSolve", id_);
+      update_ = state_.Init().GetLinearization().rhs;
+      if (factorized) {
+        linear_solver_.SolveInPlace(&update_);
+        linear_solver_iterations =
+            internal::LinearSolverIterations<LinearSolver>::Get(linear_solver_);
+      } else {
+        update_.setZero();
+      }
+    }
+
+    {
+      SYM_TIME_SCOPE("LM<{}>: Update", id_);
+      negative_update_ = -update_;
+      Update(state_.Init().values, index_, negative_update_, &state_.New().values);
+    }
+
+    if (defer_linearization) {
+      SYM_TIME_SCOPE("LM<{}>: residual_func", id_);
+      state_.New().EvaluateResidual(residual_func);
+    } else {
+      SYM_TIME_SCOPE("LM<{}>: linearization_func", id_);
+      state_.New().Relinearize(func);
+    }
   }
 
   const Scalar new_error = state_.New().Error();
@@ -226,24 +601,36 @@ bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
 
   stats->iterations.emplace_back();
   optimization_iteration_t& iteration_stats = stats->iterations.back();
-  PopulateIterationStats(&iteration_stats, state_, new_error, relative_reduction, debug_stats);
+  PopulateIterationStats(&iteration_stats, state_, linear_solver_iterations, new_error,
+                         relative_reduction, debug_stats);
 
   if (!std::isfinite(new_error)) {
     spdlog::warn("LM<{}> Encountered non-finite error: {}", id_, new_error);
   }
 
+  if (!factorized) {
+    spdlog::warn("LM<{}> Failed to factorize the damped hessian with lambda {}", id_,
+                 current_lambda_);
+  }
+
   // Early exit if the reduction in error is too small.
   bool should_early_exit =
       (relative_reduction > 0) && (relative_reduction < p_.early_exit_min_reduction);
 
   {
     SYM_TIME_SCOPE("LM<{}>: accept_update bookkeeping", id_);
-    bool accept_update = relative_reduction > 0;
+    bool accept_update = factorized && relative_reduction > 0;
 
     // NOTE(jack): Reference https://arxiv.org/abs/1201.5885
     Scalar update_angle_change = 0;
-    if (p_.enable_bold_updates && have_last_update_ && !accept_update) {
-      update_angle_change = last_update_.normalized().dot(update_.stableNormalized());
+    if (p_.enable_bold_updates && have_last_update_ && factorized && !accept_update) {
+      // The cosine of the angle between the updates, computed from the norms instead of
+      // normalized copies to avoid allocating
+      const Scalar last_update_norm = last_update_.norm();
+      const Scalar update_norm = update_.stableNorm();
+      if (last_update_norm > 0 && update_norm > 0) {
+        update_angle_change = last_update_.dot(update_) / (last_update_norm * update_norm);
+      }
 
       accept_update = (Square(1 - update_angle_change) * new_error) <= state_.Best().Error();
     }
@@ -256,6 +643,11 @@ bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
       // swap state_ blocks so that the next iteration gets the same initial state_ as this one
       state_.SwapNewAndInit();
     } else {
+      if (defer_linearization) {
+        SYM_TIME_SCOPE("LM<{}>: linearization_func", id_);
+        state_.New().Relinearize(func);
+      }
+
       current_lambda_ *= p_.lambda_down_factor;
       have_last_update_ = true;
       last_update_ = update_;
@@ -273,6 +665,7 @@ bool LevenbergMarquardtSolver<ScalarType, LinearSolverType>::Iterate(
     // Finish populating iteration_stats
     iteration_stats.update_angle_change = update_angle_change;
     iteration_stats.update_accepted = accept_update;
+    iteration_stats.linearized = !defer_linearization || accept_update;
   }
 
   return should_early_exit;
@@ -283,13 +676,18 @@ void LevenbergMarquardtSolver<ScalarType, LinearSolverType>::ComputeCovariance(
     const Eigen::SparseMatrix<Scalar>& hessian_lower, MatrixX<Scalar>* const covariance) {
   SYM_TIME_SCOPE("LM<{}>: ComputeCovariance()", id_);
 
-  H_damped_ = hessian_lower;
-  H_damped_.diagonal().array() += epsilon_;
+  // This changes the structure of H_damped_
+  have_diagonal_offsets_ = false;
+  SetHessian(hessian_lower, &H_damped_);
+  AddToHessianDiagonal(VectorX<Scalar>::Constant(hessian_lower.rows(), epsilon_), &H_damped_);
 
   // TODO(hayk, aaron): This solver assumes a dense RHS, should add support for a sparse RHS
-  linear_solver_.Factorize(H_damped_);
-  *covariance = MatrixX<Scalar>::Identity(H_damped_.rows(), H_damped_.rows());
-  linear_solver_.SolveInPlace(covariance);
+  if (!internal::LinearSolverFactorize<LinearSolver>::Factorize(linear_solver_, H_damped_)) {
+    spdlog::warn("LM<{}> Failed to factorize the hessian for the covariance", id_);
+  }
+  // Solve rather than SolveInPlace, so that the linear solver doesn't keep an N x N workspace
+  *covariance =
+      linear_solver_.Solve(MatrixX<Scalar>::Identity(hessian_lower.rows(), hessian_lower.rows()));
 }
 
 // ----------------------------------------------------------------------------
@@ -11,6 +11,7 @@
 #include <sym/util/typedefs.h>
 
 #include "./assert.h"
+#include "./block_sparse_matrix.h"
 
 namespace sym {
 
@@ -48,12 +49,94 @@ struct Linearization {
     return 0.5 * residual.squaredNorm();
   }
 
+  /**
+   * The error of the linearized residual after the update, 0.5 * |residual - jacobian * x_update|^2
+   *
+   * If the linearization has no jacobian (see Linearizer::SetHessianOnly), this is computed as
+   * Error() - LinearErrorReduction(x_update), which needs one product with the hessian
+   */
   inline double LinearError(const VectorType& x_update) const {
+    VectorType workspace;
+    return LinearError(x_update, &workspace);
+  }
+
+  /**
+   * Same as LinearError(x_update), with storage for the intermediate vector, so that this does not
+   * allocate if workspace already has the right size
+   */
+  inline double LinearError(const VectorType& x_update, VectorType* const workspace) const {
+    SYM_ASSERT(workspace != nullptr);
+
+    if (!HasJacobian()) {
+      return Error() - LinearErrorReduction(x_update, workspace);
+    }
+
     SYM_ASSERT(jacobian.cols() == x_update.size());
-    const auto linear_residual_new = -jacobian * x_update + residual;
+    VectorType& linear_residual_new = *workspace;
+    linear_residual_new.noalias() = jacobian * x_update;
+    linear_residual_new = residual - linear_residual_new;
     return 0.5 * linear_residual_new.squaredNorm();
   }
 
+  /**
+   * The reduction in error predicted by the linearization for the update, i.e.
+   * Error() - LinearError(x_update), which is
+   *
+   *     x_update.T * rhs - 0.5 * x_update.T * H * x_update
+   *
+   * This is computed directly, with the hessian or with the jacobian as
+   * x_update.T * rhs - 0.5 * |jacobian * x_update|^2, instead of as the difference of the two
+   * errors, which loses precision to cancellation when the update is small.  workspace is storage
+   * for the intermediate vector, as in LinearError.
+   */
+  inline double LinearErrorReduction(const VectorType& x_update,
+                                     VectorType* const workspace) const {
+    SYM_ASSERT(workspace != nullptr);
+    SYM_ASSERT(rhs.size() == x_update.size());
+
+    if (HasJacobian()) {
+      SYM_ASSERT(jacobian.cols() == x_update.size());
+      VectorType& J_x_update = *workspace;
+      J_x_update.noalias() = jacobian * x_update;
+      return x_update.dot(rhs) - 0.5 * J_x_update.squaredNorm();
+    }
+
+    VectorType& H_x_update = *workspace;
+    if (HasBlockSparseHessian()) {
+      hessian_lower_blocks.SelfAdjointMultiply(x_update, &H_x_update);
+    } else {
+      H_x_update.noalias() = hessian_lower.template selfadjointView<Eigen::Lower>() * x_update;
+    }
+    return x_update.dot(rhs) - 0.5 * x_update.dot(H_x_update);
+  }
+
+  /**
+   * Whether the combined jacobian is stored, i.e. whether this was not built by a Linearizer with
+   * SetHessianOnly(true)
+   */
+  bool HasJacobian() const {
+    return has_jacobian_;
+  }
+
+  void SetHasJacobian(const bool has_jacobian = true) {
+    has_jacobian_ = has_jacobian;
+  }
+
+  /**
+   * Whether the hessian is stored in hessian_lower_blocks, instead of in hessian_lower
+   */
+  bool HasBlockSparseHessian() const {
+    return hessian_lower_blocks.NumBlockCols() > 0;
+  }
+
+  /**
+   * The lower triangle of the hessian as a scalar sparse matrix, converted from
+   * hessian_lower_blocks if the hessian is block sparse
+   */
+  MatrixType HessianLower() const {
+    return HasBlockSparseHessian() ? hessian_lower_blocks.ToSparse() : hessian_lower;
+  }
+
   Eigen::Map<const VectorX<typename MatrixType::StorageIndex>> JacobianColumnPointersMap() const {
     return Eigen::Map<const VectorX<typename MatrixType::StorageIndex>>(jacobian.outerIndexPtr(),
                                                                         jacobian.outerSize());
@@ -74,8 +157,14 @@ struct Linearization {
   MatrixType jacobian;
   VectorType rhs;
 
+  // Block sparse storage of the hessian, with one block row and column per optimized key.  Filled
+  // out instead of hessian_lower by a Linearizer with SetBlockSparseHessian(true), and empty
+  // otherwise
+  BlockSparseMatrix<Scalar> hessian_lower_blocks;
+
  private:
   bool initialized_{false};
+  bool has_jacobian_{true};
 };
 
 // Shorthand instantiations
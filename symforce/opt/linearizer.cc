@@ -5,6 +5,10 @@
 
 #include "./linearizer.h"
 
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
 #include "./assert.h"
 #include "./internal/linearizer_utils.h"
 
@@ -17,20 +21,27 @@ namespace sym {
 template <typename ScalarType>
 Linearizer<ScalarType>::Linearizer(const std::string& name,
                                    const std::vector<Factor<Scalar>>& factors,
-                                   const std::vector<Key>& key_order)
-    : name_(name), factors_(&factors), dense_linearized_factors_(), sparse_linearized_factors_() {
+                                   const std::vector<Key>& key_order, const int num_threads)
+    : name_(name),
+      factors_(&factors),
+      dense_linearized_factors_(),
+      sparse_linearized_factors_(),
+      thread_pool_(std::make_unique<internal::ThreadPool>(num_threads)) {
   if (key_order.empty()) {
     keys_ = ComputeKeysToOptimize(factors);
   } else {
     keys_ = key_order;
   }
 
-  size_t num_sparse_factors = 0;
-  size_t num_dense_factors = 0;
+  int num_sparse_factors = 0;
+  int num_dense_factors = 0;
+  linearized_factor_slots_.reserve(factors_->size());
   for (const auto& factor : *factors_) {
     if (factor.IsSparse()) {
+      linearized_factor_slots_.push_back(num_sparse_factors);
       num_sparse_factors++;
     } else {
+      linearized_factor_slots_.push_back(num_dense_factors);
       num_dense_factors++;
     }
   }
@@ -44,26 +55,93 @@ void Linearizer<ScalarType>::Relinearize(const Values<Scalar>& values,
                                          Linearization<Scalar>* const linearization) {
   SYM_ASSERT(linearization != nullptr);
 
-  // Evaluate the factors
-  auto sparse_iter = std::begin(sparse_linearized_factors_);
-  auto dense_iter = std::begin(dense_linearized_factors_);
-  for (const auto& factor : *factors_) {
+  if (incremental_.threshold >= 0) {
+    RelinearizeIncremental(values, linearization);
+  } else {
+    RelinearizeAll(values, linearization);
+  }
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::EvaluateResidual(const Values<Scalar>& values,
+                                              VectorX<Scalar>* const residual) {
+  SYM_ASSERT(residual != nullptr);
+  SYM_ASSERT(IsInitialized());
+
+  residual->resize(linearization_ones_.residual.size());
+
+  // Each factor only writes to its own residual and its own segment of the combined residual
+  thread_pool_->ParallelFor(0, static_cast<int>(factors_->size()), [&](const int i) {
+    const Factor<Scalar>& factor = (*factors_)[i];
+    const int slot = linearized_factor_slots_[i];
+    int32_t combined_residual_offset;
+    int32_t residual_dim;
     if (factor.IsSparse()) {
-      factor.Linearize(values, &*sparse_iter);
-      ++sparse_iter;
+      combined_residual_offset = sparse_factor_update_helpers_[slot].combined_residual_offset;
+      residual_dim = sparse_factor_update_helpers_[slot].residual_dim;
     } else {
-      factor.Linearize(values, &*dense_iter);
-      ++dense_iter;
+      combined_residual_offset = dense_factor_update_helpers_[slot].combined_residual_offset;
+      residual_dim = dense_factor_update_helpers_[slot].residual_dim;
     }
-  }
 
-  // Allocate matrices and create index if it's the first time
-  if (!IsInitialized()) {
-    InitializeStorageAndIndices();
-  }
+    if (!factor.IsSparse() && factor.CanLinearizeInto()) {
+      // Fixed size factors evaluate straight into their segment
+      typename Factor<Scalar>::VectorMap factor_residual(
+          residual->data() + combined_residual_offset, residual_dim);
+      factor.LinearizeInto(values, &factor_residual, nullptr, nullptr, nullptr);
+    } else {
+      factor.Linearize(values, &factor_residuals_[i]);
+      SYM_ASSERT(factor_residuals_[i].size() == residual_dim);
+      residual->segment(combined_residual_offset, residual_dim) = factor_residuals_[i];
+    }
+  });
+}
 
-  // Update combined problem from factors, using precomputed indices
-  BuildCombinedProblemSparse(dense_linearized_factors_, sparse_linearized_factors_, linearization);
+template <typename ScalarType>
+void Linearizer<ScalarType>::SetRelinearizationThreshold(const Scalar threshold) {
+  incremental_.threshold = threshold;
+
+  // Start over from a full relinearization the next time incremental relinearization is used
+  incremental_.values_id = Values<Scalar>::kInvalidId;
+}
+
+template <typename ScalarType>
+ScalarType Linearizer<ScalarType>::RelinearizationThreshold() const {
+  return incremental_.threshold;
+}
+
+template <typename ScalarType>
+int Linearizer<ScalarType>::NumFactorsRelinearized() const {
+  return num_factors_relinearized_;
+}
+
+template <typename ScalarType>
+int Linearizer<ScalarType>::NumScatterColors() const {
+  return static_cast<int>(scatter_colors_.size());
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::SetBlockSparseHessian(const bool block_sparse_hessian) {
+  // The hessian format must be set before the first call to Relinearize
+  SYM_ASSERT(!IsInitialized() || block_sparse_hessian == block_sparse_hessian_);
+  block_sparse_hessian_ = block_sparse_hessian;
+}
+
+template <typename ScalarType>
+bool Linearizer<ScalarType>::BlockSparseHessian() const {
+  return block_sparse_hessian_;
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::SetHessianOnly(const bool hessian_only) {
+  // Whether the jacobian is built must be set before the first call to Relinearize
+  SYM_ASSERT(!IsInitialized() || hessian_only == hessian_only_);
+  hessian_only_ = hessian_only;
+}
+
+template <typename ScalarType>
+bool Linearizer<ScalarType>::HessianOnly() const {
+  return hessian_only_;
 }
 
 template <typename ScalarType>
@@ -105,7 +183,25 @@ template <typename ScalarType>
 std::pair<const std::vector<typename Factor<ScalarType>::LinearizedDenseFactor>&,
           const std::vector<typename Factor<ScalarType>::LinearizedSparseFactor>&>
 Linearizer<ScalarType>::LinearizedFactors() const {
-  return std::make_pair(dense_linearized_factors_, sparse_linearized_factors_);
+  // NOTE: std::make_pair would return references to copies of the factors
+  return {dense_linearized_factors_, sparse_linearized_factors_};
+}
+
+template <typename ScalarType>
+std::vector<typename Factor<ScalarType>::LinearizedDenseFactor>
+Linearizer<ScalarType>::CopyLinearizedDenseFactors() const {
+  std::vector<LinearizedDenseFactor> dense_linearized_factors = dense_linearized_factors_;
+  for (int i = 0; i < static_cast<int>(dense_factor_arena_slots_.size()); ++i) {
+    if (dense_factor_arena_slots_[i] >= 0) {
+      const auto views = dense_factor_arena_.Views(dense_factor_arena_slots_[i]);
+      LinearizedDenseFactor& linearized_factor = dense_linearized_factors[i];
+      linearized_factor.residual = views.residual;
+      linearized_factor.jacobian = views.jacobian;
+      linearized_factor.hessian = views.hessian;
+      linearized_factor.rhs = views.rhs;
+    }
+  }
+  return dense_linearized_factors;
 }
 
 template <typename ScalarType>
@@ -119,10 +215,336 @@ const std::unordered_map<key_t, index_entry_t>& Linearizer<ScalarType>::StateInd
   return state_index_;
 }
 
+template <typename ScalarType>
+int Linearizer<ScalarType>::NumThreads() const {
+  return thread_pool_->NumThreads();
+}
+
 // ----------------------------------------------------------------------------
 // Private Methods
 // ----------------------------------------------------------------------------
 
+template <typename ScalarType>
+void Linearizer<ScalarType>::RelinearizeAll(const Values<Scalar>& values,
+                                            Linearization<Scalar>* const linearization) {
+  const bool has_factor_batches = IsInitialized() && !factor_batch_chunks_.empty();
+  if (has_factor_batches && values.Id() != factor_batch_values_id_) {
+    UpdateFactorBatchIndices(values);
+  }
+
+  // Evaluate the factors.  Each factor only writes to its own linearized factor slot (and its own
+  // cached index entries), so factors can be evaluated concurrently in any order
+  thread_pool_->ParallelFor(0, static_cast<int>(factors_->size()), [&](const int i) {
+    if (has_factor_batches && factor_is_batched_[i]) {
+      return;
+    }
+
+    LinearizeFactor(values, i);
+  });
+
+  if (has_factor_batches) {
+    thread_pool_->ParallelFor(
+        0, static_cast<int>(factor_batch_chunks_.size()), [this, &values](const int i) {
+          const FactorBatchChunk& chunk = factor_batch_chunks_[i];
+          chunk.kernel->LinearizeInto(values, chunk.index_entries.data(),
+                                      static_cast<int>(chunk.factors.size()),
+                                      chunk.arena_slots.data(), &dense_factor_arena_);
+        });
+  }
+
+  num_factors_relinearized_ = static_cast<int>(factors_->size());
+
+  // Allocate matrices and create index if it's the first time
+  if (!IsInitialized()) {
+    InitializeStorageAndIndices();
+  }
+
+  // Update combined problem from factors, using precomputed indices
+  BuildCombinedProblemSparse(dense_linearized_factors_, sparse_linearized_factors_, linearization);
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::RelinearizeIncremental(const Values<Scalar>& values,
+                                                    Linearization<Scalar>* const linearization) {
+  if (values.Id() != incremental_.values_id) {
+    // Linearize everything at values
+    incremental_.linearization_point = values;
+    RelinearizeAll(incremental_.linearization_point, &incremental_.linearization);
+    InitializeIncrementalState(values);
+  } else {
+    const int num_moved_factors = MoveKeysAboveRelinearizationThreshold(values);
+
+    // Past some point it's cheaper to rebuild the combined problem than to subtract and add the
+    // moved factors, which also clears out accumulated round-off
+    const bool rebuild = 2 * num_moved_factors > static_cast<int>(factors_->size());
+    if (!rebuild) {
+      UpdateIncrementalLinearization(/* subtract */ true);
+    }
+
+    const Values<Scalar>& linearization_point = incremental_.linearization_point;
+    thread_pool_->ParallelFor(0, static_cast<int>(factors_->size()), [&](const int i) {
+      const int slot = linearized_factor_slots_[i];
+      const bool moved = (*factors_)[i].IsSparse() ? incremental_.sparse_factor_moved[slot]
+                                                   : incremental_.dense_factor_moved[slot];
+      if (moved) {
+        LinearizeFactor(linearization_point, i);
+      }
+    });
+    num_factors_relinearized_ = num_moved_factors;
+
+    if (rebuild) {
+      BuildCombinedProblemSparse(dense_linearized_factors_, sparse_linearized_factors_,
+                                 &incremental_.linearization);
+    } else {
+      UpdateIncrementalLinearization(/* subtract */ false);
+    }
+  }
+
+  // The residual and rhs depend on the deltas of all factors, so they are recomputed from scratch
+  // rather than updated along with the hessian, which would accumulate the contributions of every
+  // moved factor on every call.  Factors of one color write to disjoint segments of rhs, as in
+  // BuildCombinedProblemSparse
+  Linearization<Scalar>& combined = incremental_.linearization;
+  combined.rhs.setZero();
+  for (const ScatterColor& color : scatter_colors_) {
+    ForEachFactorInColor(color, static_cast<int>(color.dense_factors.size()), [&](const int i) {
+      const int factor_index = color.dense_factors[i];
+      const int arena_slot = dense_factor_arena_slots_[factor_index];
+      if (arena_slot >= 0) {
+        UpdateResidualAndRhsFromDeltas(dense_factor_arena_.Views(arena_slot),
+                                       dense_factor_update_helpers_[factor_index], &combined);
+      } else {
+        UpdateResidualAndRhsFromDeltas(dense_linearized_factors_[factor_index],
+                                       dense_factor_update_helpers_[factor_index], &combined);
+      }
+    });
+    ForEachFactorInColor(color, static_cast<int>(color.sparse_factors.size()), [&](const int i) {
+      const int factor_index = color.sparse_factors[i];
+      UpdateResidualAndRhsFromDeltas(sparse_linearized_factors_[factor_index],
+                                     sparse_factor_update_helpers_[factor_index],
+                                     &incremental_.sparse_factor_deltas[factor_index], &combined);
+    });
+  }
+
+  // Copy out the combined problem
+  EnsureLinearizationHasCorrectSize(linearization);
+  HessianValues(linearization) = HessianValues(combined);
+  if (!hessian_only_) {
+    std::copy_n(combined.jacobian.valuePtr(), combined.jacobian.nonZeros(),
+                linearization->jacobian.valuePtr());
+  }
+  linearization->residual = combined.residual;
+  linearization->rhs = combined.rhs;
+
+  linearization->SetInitialized();
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::LinearizeFactor(const Values<Scalar>& values, const int factor_index) {
+  const Factor<Scalar>& factor = (*factors_)[factor_index];
+  const int slot = linearized_factor_slots_[factor_index];
+  if (factor.IsSparse()) {
+    factor.Linearize(values, &sparse_linearized_factors_[slot]);
+  } else if (IsInitialized() && dense_factor_arena_slots_[slot] >= 0) {
+    auto views = dense_factor_arena_.Views(dense_factor_arena_slots_[slot]);
+    factor.LinearizeInto(values, &views.residual, &views.jacobian, &views.hessian, &views.rhs);
+  } else {
+    factor.Linearize(values, &dense_linearized_factors_[slot]);
+  }
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::InitializeIncrementalState(const Values<Scalar>& values) {
+  SYM_ASSERT(IsInitialized());
+
+  IncrementalState& state = incremental_;
+  state.values_id = values.Id();
+
+  // Index every key of every factor
+  std::unordered_map<Key, int> key_positions;
+  state.key_indices.clear();
+  state.key_state_offsets.clear();
+  state.factor_keys.clear();
+  state.factor_keys.reserve(factors_->size());
+  for (const Factor<Scalar>& factor : *factors_) {
+    std::vector<int> factor_keys;
+    factor_keys.reserve(factor.AllKeys().size());
+    for (const Key& key : factor.AllKeys()) {
+      const auto inserted =
+          key_positions.emplace(key, static_cast<int>(state.key_indices.size()));
+      if (inserted.second) {
+        state.key_indices.push_back(values.CreateIndex({key}));
+
+        const auto state_entry = state_index_.find(key.GetLcmType());
+        state.key_state_offsets.push_back(state_entry == state_index_.end()
+                                              ? -1
+                                              : state_entry->second.offset);
+      }
+      factor_keys.push_back(inserted.first->second);
+    }
+    state.factor_keys.push_back(std::move(factor_keys));
+  }
+
+  state.state_index = values.CreateIndex(keys_);
+  state.state_deltas = VectorX<Scalar>::Zero(state.state_index.tangent_dim);
+  state.key_moved.assign(state.key_indices.size(), 0);
+  state.dense_factor_moved.assign(dense_linearized_factors_.size(), 0);
+  state.sparse_factor_moved.assign(sparse_linearized_factors_.size(), 0);
+
+  state.sparse_factor_deltas.resize(sparse_linearized_factors_.size());
+  for (size_t i = 0; i < sparse_linearized_factors_.size(); ++i) {
+    const auto& jacobian = sparse_linearized_factors_[i].jacobian;
+    state.sparse_factor_deltas[i].deltas.resize(jacobian.cols());
+    state.sparse_factor_deltas[i].jacobian_deltas.resize(jacobian.rows());
+    state.sparse_factor_deltas[i].rhs_deltas.resize(jacobian.cols());
+  }
+}
+
+template <typename ScalarType>
+int Linearizer<ScalarType>::MoveKeysAboveRelinearizationThreshold(const Values<Scalar>& values) {
+  IncrementalState& state = incremental_;
+  Values<Scalar>& linearization_point = state.linearization_point;
+
+  values.LocalCoordinates(linearization_point, state.state_index, kDefaultEpsilon<Scalar>,
+                          state.state_deltas.data());
+
+  for (int k = 0; k < static_cast<int>(state.key_indices.size()); ++k) {
+    const index_entry_t& entry = state.key_indices[k].entries[0];
+    const int32_t state_offset = state.key_state_offsets[k];
+
+    // Keys that are not optimized only move when they're changed at all.  Optimized keys that
+    // are unchanged get an exact zero delta, rather than whatever LocalCoordinates computes
+    const auto storage = values.Data().begin() + entry.offset;
+    bool moved = !std::equal(storage, storage + entry.storage_dim,
+                             linearization_point.Data().begin() + entry.offset);
+    if (state_offset >= 0) {
+      auto delta = state.state_deltas.segment(state_offset, entry.tangent_dim);
+      if (!moved) {
+        delta.setZero();
+      } else {
+        moved = delta.cwiseAbs().maxCoeff() > state.threshold;
+      }
+    }
+
+    state.key_moved[k] = moved;
+    if (moved) {
+      linearization_point.Update(state.key_indices[k], values);
+      if (state_offset >= 0) {
+        state.state_deltas.segment(state_offset, entry.tangent_dim).setZero();
+      }
+    }
+  }
+
+  // Sparse factors are always evaluated again, since their sparsity may change along with their
+  // values
+  int num_moved_factors = 0;
+  for (int i = 0; i < static_cast<int>(factors_->size()); ++i) {
+    const bool is_sparse = (*factors_)[i].IsSparse();
+    bool moved = is_sparse;
+    for (const int k : state.factor_keys[i]) {
+      moved = moved || state.key_moved[k];
+    }
+
+    const int slot = linearized_factor_slots_[i];
+    if (is_sparse) {
+      state.sparse_factor_moved[slot] = moved;
+    } else {
+      state.dense_factor_moved[slot] = moved;
+    }
+    num_moved_factors += moved;
+  }
+
+  return num_moved_factors;
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::UpdateIncrementalLinearization(const bool subtract) {
+  Linearization<Scalar>* const linearization = &incremental_.linearization;
+  for (const ScatterColor& color : scatter_colors_) {
+    ForEachFactorInColor(color, static_cast<int>(color.dense_factors.size()), [&](const int i) {
+      const int factor_index = color.dense_factors[i];
+      if (!incremental_.dense_factor_moved[factor_index]) {
+        return;
+      }
+
+      const int arena_slot = dense_factor_arena_slots_[factor_index];
+      if (arena_slot >= 0) {
+        UpdateFromLinearizedDenseFactorIntoSparse(dense_factor_arena_.Views(arena_slot),
+                                                  dense_factor_update_helpers_[factor_index],
+                                                  linearization, subtract);
+      } else {
+        UpdateFromLinearizedDenseFactorIntoSparse(dense_linearized_factors_[factor_index],
+                                                  dense_factor_update_helpers_[factor_index],
+                                                  linearization, subtract);
+      }
+    });
+    ForEachFactorInColor(color, static_cast<int>(color.sparse_factors.size()), [&](const int i) {
+      const int factor_index = color.sparse_factors[i];
+      if (incremental_.sparse_factor_moved[factor_index]) {
+        UpdateFromLinearizedSparseFactorIntoSparse(sparse_linearized_factors_[factor_index],
+                                                   sparse_factor_update_helpers_[factor_index],
+                                                   linearization, subtract);
+      }
+    });
+  }
+}
+
+template <typename ScalarType>
+template <typename LinearizedDenseFactorType>
+void Linearizer<ScalarType>::UpdateResidualAndRhsFromDeltas(
+    const LinearizedDenseFactorType& linearized_factor,
+    const linearization_dense_factor_helper_t& factor_helper,
+    Linearization<Scalar>* const linearization) const {
+  const VectorX<Scalar>& deltas = incremental_.state_deltas;
+  auto residual = linearization->residual.segment(factor_helper.combined_residual_offset,
+                                                  factor_helper.residual_dim);
+
+  // J * delta
+  residual.setZero();
+  for (const linearization_dense_key_helper_t& key_helper : factor_helper.key_helpers) {
+    residual.noalias() +=
+        linearized_factor.jacobian.middleCols(key_helper.factor_offset, key_helper.tangent_dim) *
+        deltas.segment(key_helper.combined_offset, key_helper.tangent_dim);
+  }
+
+  for (const linearization_dense_key_helper_t& key_helper : factor_helper.key_helpers) {
+    auto rhs = linearization->rhs.segment(key_helper.combined_offset, key_helper.tangent_dim);
+    rhs += linearized_factor.rhs.segment(key_helper.factor_offset, key_helper.tangent_dim);
+    rhs.noalias() +=
+        linearized_factor.jacobian.middleCols(key_helper.factor_offset, key_helper.tangent_dim)
+            .transpose() *
+        residual;
+  }
+
+  residual += linearized_factor.residual;
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::UpdateResidualAndRhsFromDeltas(
+    const LinearizedSparseFactor& linearized_factor,
+    const linearization_sparse_factor_helper_t& factor_helper, SparseFactorDeltas* const workspace,
+    Linearization<Scalar>* const linearization) const {
+  VectorX<Scalar>& factor_deltas = workspace->deltas;
+  for (const linearization_sparse_key_helper_t& key_helper : factor_helper.key_helpers) {
+    factor_deltas.segment(key_helper.factor_offset, key_helper.tangent_dim) =
+        incremental_.state_deltas.segment(key_helper.combined_offset, key_helper.tangent_dim);
+  }
+
+  VectorX<Scalar>& jacobian_deltas = workspace->jacobian_deltas;
+  VectorX<Scalar>& rhs_deltas = workspace->rhs_deltas;
+  jacobian_deltas.noalias() = linearized_factor.jacobian * factor_deltas;
+  rhs_deltas.noalias() = linearized_factor.jacobian.transpose() * jacobian_deltas;
+  for (const linearization_sparse_key_helper_t& key_helper : factor_helper.key_helpers) {
+    linearization->rhs.segment(key_helper.combined_offset, key_helper.tangent_dim) +=
+        linearized_factor.rhs.segment(key_helper.factor_offset, key_helper.tangent_dim) +
+        rhs_deltas.segment(key_helper.factor_offset, key_helper.tangent_dim);
+  }
+
+  linearization->residual.segment(factor_helper.combined_residual_offset,
+                                  factor_helper.residual_dim) =
+      linearized_factor.residual + jacobian_deltas;
+}
+
 template <typename ScalarType>
 void Linearizer<ScalarType>::InitializeStorageAndIndices() {
   SYM_ASSERT(!IsInitialized());
@@ -171,36 +593,223 @@ void Linearizer<ScalarType>::InitializeStorageAndIndices() {
   // Allocate storage of combined linearization
   linearization_ones_.residual.resize(M);
   linearization_ones_.rhs.resize(N);
-  linearization_ones_.jacobian.resize(M, N);
-  linearization_ones_.hessian_lower.resize(N, N);
+  if (!hessian_only_) {
+    linearization_ones_.jacobian.resize(M, N);
+  }
+  if (!block_sparse_hessian_) {
+    linearization_ones_.hessian_lower.resize(N, N);
+  }
 
-  // Update combined dense jacobian/hessian from indices, then create a sparseView. This will be
-  // filled out assuming nonzeros in factors are all ones so there will not happen to be any
-  // numerical zeros.
+  // Compute the sparsity pattern of the combined jacobian/hessian, with ones in all nonzeros so
+  // there will not happen to be any numerical zeros.
   BuildCombinedProblemSparsityPattern(&linearization_ones_);
 
-  // Create a hash map from the sparse nonzero indices of the jacobian/hessian to their storage
-  // offset within the sparse array.
-  const auto jacobian_row_col_to_storage_offset =
-      internal::CoordsToStorageOffset(linearization_ones_.jacobian);
-  const auto hessian_row_col_to_storage_offset =
-      internal::CoordsToStorageOffset(linearization_ones_.hessian_lower);
+  // Mark sparse storage offsets for every column of each key block of each factor, by searching
+  // the rows of each column in the pattern
+  const auto compute_storage_offsets = [this](const auto& hessian_lower) {
+    for (int i = 0; i < static_cast<int>(dense_linearized_factors_.size()); ++i) {
+      linearization_dense_factor_helper_t& factor_helper = dense_factor_update_helpers_[i];
+      internal::ComputeKeyHelperSparseColOffsets<Scalar>(linearization_ones_.jacobian,
+                                                         hessian_lower, factor_helper);
+    }
+    for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
+      const LinearizedSparseFactor& linearized_factor = sparse_linearized_factors_[i];
+      linearization_sparse_factor_helper_t& factor_helper = sparse_factor_update_helpers_[i];
+      internal::ComputeKeyHelperSparseMap<Scalar>(linearized_factor, linearization_ones_.jacobian,
+                                                  hessian_lower, factor_helper);
+    }
+  };
+  if (block_sparse_hessian_) {
+    compute_storage_offsets(linearization_ones_.hessian_lower_blocks);
+  } else {
+    compute_storage_offsets(linearization_ones_.hessian_lower);
+  }
+
+  ComputeScatterSchedule();
+
+  MoveDenseFactorsToArena();
+  ComputeFactorBatchChunks();
+
+  // Storage for EvaluateResidual
+  factor_residuals_.resize(factors_->size());
+
+  initialized_ = true;
+}
 
-  // Use the hash map to mark sparse storage offsets for every row of each key block of each factor
+template <typename ScalarType>
+void Linearizer<ScalarType>::MoveDenseFactorsToArena() {
+  dense_factor_arena_slots_.assign(dense_linearized_factors_.size(), -1);
+  for (int i = 0; i < static_cast<int>(factors_->size()); ++i) {
+    const Factor<Scalar>& factor = (*factors_)[i];
+    if (!factor.IsSparse() && factor.CanLinearizeInto()) {
+      const int slot = linearized_factor_slots_[i];
+      const LinearizedDenseFactor& linearized_factor = dense_linearized_factors_[slot];
+      dense_factor_arena_slots_[slot] = dense_factor_arena_.Add(
+          linearized_factor.residual.rows(), linearized_factor.jacobian.cols());
+    }
+  }
+
+  if (dense_factor_arena_.NumFactors() == 0) {
+    return;
+  }
+
+  dense_factor_arena_.Allocate();
+
+  // Copy over the first linearization, which is used to build the combined problem, and release
+  // the per-factor storage.  The index is kept for LinearizedFactors
   for (int i = 0; i < static_cast<int>(dense_linearized_factors_.size()); ++i) {
-    linearization_dense_factor_helper_t& factor_helper = dense_factor_update_helpers_[i];
-    internal::ComputeKeyHelperSparseColOffsets<Scalar>(
-        jacobian_row_col_to_storage_offset, hessian_row_col_to_storage_offset, factor_helper);
+    if (dense_factor_arena_slots_[i] < 0) {
+      continue;
+    }
+
+    auto views = dense_factor_arena_.Views(dense_factor_arena_slots_[i]);
+    LinearizedDenseFactor& linearized_factor = dense_linearized_factors_[i];
+    views.residual = linearized_factor.residual;
+    views.jacobian = linearized_factor.jacobian;
+    views.hessian = linearized_factor.hessian;
+    views.rhs = linearized_factor.rhs;
+
+    linearized_factor.residual = VectorX<Scalar>();
+    linearized_factor.jacobian = MatrixX<Scalar>();
+    linearized_factor.hessian = MatrixX<Scalar>();
+    linearized_factor.rhs = VectorX<Scalar>();
   }
-  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
-    const LinearizedSparseFactor& linearized_factor = sparse_linearized_factors_[i];
-    linearization_sparse_factor_helper_t& factor_helper = sparse_factor_update_helpers_[i];
-    internal::ComputeKeyHelperSparseMap<Scalar>(linearized_factor,
-                                                jacobian_row_col_to_storage_offset,
-                                                hessian_row_col_to_storage_offset, factor_helper);
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::ComputeScatterSchedule() {
+  static_assert(kMaxScatterColors <= 64, "Colors of each key are stored in a uint64_t");
+
+  // Number of factors touching each key, indexed by the offset of the key in the combined state
+  std::vector<int> key_degrees(linearization_ones_.rhs.size(), 0);
+  const auto count_keys = [&key_degrees](const auto& factor_helpers) {
+    for (const auto& factor_helper : factor_helpers) {
+      for (const auto& key_helper : factor_helper.key_helpers) {
+        ++key_degrees[key_helper.combined_offset];
+      }
+    }
+  };
+  count_keys(dense_factor_update_helpers_);
+  count_keys(sparse_factor_update_helpers_);
+
+  // Bitset of the colors already used by factors touching each key
+  std::vector<uint64_t> used_colors_for_key(linearization_ones_.rhs.size(), 0);
+
+  // Returns the smallest color not used by any key of this factor, or -1 if the factor goes in the
+  // serial color.  Factors on keys with more factors than there are colors go straight to the
+  // serial color, so that they don't take up colors that the rest of the factors could share.
+  const auto assign_color = [&](const auto& factor_helper) {
+    uint64_t used_colors = 0;
+    for (const auto& key_helper : factor_helper.key_helpers) {
+      if (key_degrees[key_helper.combined_offset] > kMaxScatterColors) {
+        return -1;
+      }
+      used_colors |= used_colors_for_key[key_helper.combined_offset];
+    }
+
+    int color = 0;
+    while (color < kMaxScatterColors && (used_colors & (uint64_t{1} << color))) {
+      ++color;
+    }
+    if (color == kMaxScatterColors) {
+      return -1;
+    }
+
+    // Mark it as used for every key of this factor
+    for (const auto& key_helper : factor_helper.key_helpers) {
+      used_colors_for_key[key_helper.combined_offset] |= uint64_t{1} << color;
+    }
+    return color;
+  };
+
+  scatter_colors_.clear();
+  ScatterColor serial_color;
+  serial_color.serial = true;
+  const auto color_for = [this, &serial_color](const int color) -> ScatterColor& {
+    if (color < 0) {
+      return serial_color;
+    }
+    if (static_cast<int>(scatter_colors_.size()) <= color) {
+      scatter_colors_.resize(color + 1);
+    }
+    return scatter_colors_[color];
+  };
+
+  for (int i = 0; i < static_cast<int>(dense_factor_update_helpers_.size()); ++i) {
+    color_for(assign_color(dense_factor_update_helpers_[i])).dense_factors.push_back(i);
+  }
+  for (int i = 0; i < static_cast<int>(sparse_factor_update_helpers_.size()); ++i) {
+    color_for(assign_color(sparse_factor_update_helpers_[i])).sparse_factors.push_back(i);
   }
 
-  initialized_ = true;
+  // The serial color is scattered last
+  if (!serial_color.dense_factors.empty() || !serial_color.sparse_factors.empty()) {
+    scatter_colors_.push_back(std::move(serial_color));
+  }
+}
+
+template <typename ScalarType>
+template <typename Func>
+void Linearizer<ScalarType>::ForEachFactorInColor(const ScatterColor& color,
+                                                  const int num_factors, Func&& func,
+                                                  const int grain_size) const {
+  if (color.serial) {
+    for (int i = 0; i < num_factors; ++i) {
+      func(i);
+    }
+  } else {
+    thread_pool_->ParallelFor(0, num_factors, std::forward<Func>(func), grain_size);
+  }
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::ComputeFactorBatchChunks() {
+  factor_batch_chunks_.clear();
+  factor_is_batched_.assign(factors_->size(), false);
+
+  // The chunk currently being filled for each batch
+  std::unordered_map<const internal::FactorBatchKernel<Scalar>*, int> open_chunks;
+  for (int i = 0; i < static_cast<int>(factors_->size()); ++i) {
+    const Factor<Scalar>& factor = (*factors_)[i];
+    if (factor.IsSparse() || factor.BatchKernel() == nullptr) {
+      continue;
+    }
+
+    const int arena_slot = dense_factor_arena_slots_[linearized_factor_slots_[i]];
+    if (arena_slot < 0) {
+      continue;
+    }
+
+    const auto open_chunk = open_chunks.find(factor.BatchKernel());
+    if (open_chunk == open_chunks.end() ||
+        static_cast<int>(factor_batch_chunks_[open_chunk->second].factors.size()) ==
+            internal::FactorBatchKernel<Scalar>::kMaxChunkSize) {
+      factor_batch_chunks_.push_back({factor.BatchKernel(), {}, {}, {}});
+      open_chunks[factor.BatchKernel()] = static_cast<int>(factor_batch_chunks_.size()) - 1;
+    }
+
+    FactorBatchChunk& chunk = factor_batch_chunks_[open_chunks.at(factor.BatchKernel())];
+    chunk.factors.push_back(i);
+    chunk.arena_slots.push_back(arena_slot);
+    factor_is_batched_[i] = true;
+  }
+
+  // Force the index entries to be computed on the next call to Relinearize
+  factor_batch_values_id_ = Values<Scalar>::kInvalidId;
+}
+
+template <typename ScalarType>
+void Linearizer<ScalarType>::UpdateFactorBatchIndices(const Values<Scalar>& values) {
+  for (FactorBatchChunk& chunk : factor_batch_chunks_) {
+    chunk.index_entries.clear();
+    for (const int factor_index : chunk.factors) {
+      const index_t index = values.CreateIndex((*factors_)[factor_index].AllKeys());
+      chunk.index_entries.insert(chunk.index_entries.end(), index.entries.begin(),
+                                 index.entries.end());
+    }
+  }
+
+  factor_batch_values_id_ = values.Id();
 }
 
 template <typename ScalarType>
@@ -258,44 +867,57 @@ std::unordered_map<key_t, index_entry_t> Linearizer<ScalarType>::ComputeStateInd
 }
 
 template <typename ScalarType>
+template <typename LinearizedDenseFactorType>
 void Linearizer<ScalarType>::UpdateFromLinearizedDenseFactorIntoSparse(
-    const LinearizedDenseFactor& linearized_factor,
+    const LinearizedDenseFactorType& linearized_factor,
     const linearization_dense_factor_helper_t& factor_helper,
-    Linearization<Scalar>* const linearization) const {
+    Linearization<Scalar>* const linearization, const bool subtract) const {
   // The residual dimension must be the same, even for factors that return VectorX.  If the residual
   // size changes, the optimizer must be re-created.
   SYM_ASSERT(factor_helper.residual_dim == linearized_factor.residual.size());
 
+  // Sign of the hessian contribution
+  const Scalar sign = subtract ? -1 : 1;
+
+  // The storage offsets of the hessian are into either the block sparse or the scalar hessian,
+  // where the columns of each key block are contiguous either way
+  Scalar* const hessian_values = HessianValues(linearization).data();
+
   // Fill in the combined residual slice
-  linearization->residual.segment(factor_helper.combined_residual_offset,
-                                  factor_helper.residual_dim) = linearized_factor.residual;
+  if (!subtract) {
+    linearization->residual.segment(factor_helper.combined_residual_offset,
+                                    factor_helper.residual_dim) = linearized_factor.residual;
+  }
 
   // For each key
   for (int key_i = 0; key_i < static_cast<int>(factor_helper.key_helpers.size()); ++key_i) {
     const linearization_dense_key_helper_t& key_helper = factor_helper.key_helpers[key_i];
 
-    // Fill in jacobian block, column by column
-    for (int col_block = 0; col_block < key_helper.tangent_dim; ++col_block) {
-      Eigen::Map<VectorX<Scalar>>(
-          linearization->jacobian.valuePtr() + key_helper.jacobian_storage_col_starts[col_block],
-          factor_helper.residual_dim) =
-          linearized_factor.jacobian.block(0, key_helper.factor_offset + col_block,
-                                           factor_helper.residual_dim, 1);
-    }
+    if (!subtract) {
+      // Fill in jacobian block, column by column
+      if (!hessian_only_) {
+        for (int col_block = 0; col_block < key_helper.tangent_dim; ++col_block) {
+          Eigen::Map<VectorX<Scalar>>(linearization->jacobian.valuePtr() +
+                                          key_helper.jacobian_storage_col_starts[col_block],
+                                      factor_helper.residual_dim) =
+              linearized_factor.jacobian.block(0, key_helper.factor_offset + col_block,
+                                               factor_helper.residual_dim, 1);
+        }
+      }
 
-    // Add contribution from right-hand-side
-    linearization->rhs.segment(key_helper.combined_offset, key_helper.tangent_dim) +=
-        linearized_factor.rhs.segment(key_helper.factor_offset, key_helper.tangent_dim);
+      // Add contribution from right-hand-side
+      linearization->rhs.segment(key_helper.combined_offset, key_helper.tangent_dim) +=
+          linearized_factor.rhs.segment(key_helper.factor_offset, key_helper.tangent_dim);
+    }
 
     // Add contribution from diagonal hessian block, column by column
     for (int col_block = 0; col_block < key_helper.tangent_dim; ++col_block) {
       const std::vector<int32_t>& diag_col_starts = key_helper.hessian_storage_col_starts[key_i];
-      Eigen::Map<VectorX<Scalar>>(
-          linearization->hessian_lower.valuePtr() + diag_col_starts[col_block],
-          key_helper.tangent_dim - col_block) +=
-          linearized_factor.hessian.block(key_helper.factor_offset + col_block,
-                                          key_helper.factor_offset + col_block,
-                                          key_helper.tangent_dim - col_block, 1);
+      Eigen::Map<VectorX<Scalar>>(hessian_values + diag_col_starts[col_block],
+                                  key_helper.tangent_dim - col_block) +=
+          sign * linearized_factor.hessian.block(key_helper.factor_offset + col_block,
+                                                 key_helper.factor_offset + col_block,
+                                                 key_helper.tangent_dim - col_block, 1);
     }
 
     // Add contributions from off-diagonal hessian blocks, column by column
@@ -308,20 +930,20 @@ void Linearizer<ScalarType>::UpdateFromLinearizedDenseFactorIntoSparse(
 
       if (key_helper_j.combined_offset < key_helper.combined_offset) {
         for (int32_t col_j = 0; col_j < static_cast<int32_t>(col_starts.size()); ++col_j) {
-          Eigen::Map<VectorX<Scalar>>(linearization->hessian_lower.valuePtr() + col_starts[col_j],
+          Eigen::Map<VectorX<Scalar>>(hessian_values + col_starts[col_j],
                                       key_helper.tangent_dim) +=
-              linearized_factor.hessian.block(key_helper.factor_offset,
-                                              key_helper_j.factor_offset + col_j,
-                                              key_helper.tangent_dim, 1);
+              sign * linearized_factor.hessian.block(key_helper.factor_offset,
+                                                     key_helper_j.factor_offset + col_j,
+                                                     key_helper.tangent_dim, 1);
         }
       } else {
         for (int32_t col_i = 0; col_i < static_cast<int32_t>(col_starts.size()); ++col_i) {
-          Eigen::Map<VectorX<Scalar>>(linearization->hessian_lower.valuePtr() + col_starts[col_i],
+          Eigen::Map<VectorX<Scalar>>(hessian_values + col_starts[col_i],
                                       key_helper_j.tangent_dim) +=
-              linearized_factor.hessian
-                  .block(key_helper.factor_offset + col_i, key_helper_j.factor_offset, 1,
-                         key_helper_j.tangent_dim)
-                  .transpose();
+              sign * linearized_factor.hessian
+                         .block(key_helper.factor_offset + col_i, key_helper_j.factor_offset, 1,
+                                key_helper_j.tangent_dim)
+                         .transpose();
         }
       }
     }
@@ -332,11 +954,22 @@ template <typename ScalarType>
 void Linearizer<ScalarType>::UpdateFromLinearizedSparseFactorIntoSparse(
     const LinearizedSparseFactor& linearized_factor,
     const linearization_sparse_factor_helper_t& factor_helper,
-    Linearization<Scalar>* const linearization) const {
+    Linearization<Scalar>* const linearization, const bool subtract) const {
   // The residual dimension must be the same, even for factors that return VectorX.  If the residual
   // size changes, the optimizer must be re-created.
   SYM_ASSERT(factor_helper.residual_dim == linearized_factor.residual.size());
 
+  SYM_ASSERT(factor_helper.hessian_index_map.size() ==
+             static_cast<size_t>(linearized_factor.hessian.nonZeros()));
+  Scalar* const hessian_values = HessianValues(linearization).data();
+  if (subtract) {
+    for (int i = 0; i < static_cast<int>(factor_helper.hessian_index_map.size()); i++) {
+      hessian_values[factor_helper.hessian_index_map[i]] -=
+          linearized_factor.hessian.valuePtr()[i];
+    }
+    return;
+  }
+
   // Fill in the combined residual slice
   linearization->residual.segment(factor_helper.combined_residual_offset,
                                   factor_helper.residual_dim) = linearized_factor.residual;
@@ -350,126 +983,50 @@ void Linearizer<ScalarType>::UpdateFromLinearizedSparseFactorIntoSparse(
   }
 
   // Fill out jacobian
-  SYM_ASSERT(factor_helper.jacobian_index_map.size() ==
-             static_cast<size_t>(linearized_factor.jacobian.nonZeros()));
-  for (int i = 0; i < static_cast<int>(factor_helper.jacobian_index_map.size()); i++) {
-    linearization->jacobian.valuePtr()[factor_helper.jacobian_index_map[i]] =
-        linearized_factor.jacobian.valuePtr()[i];
+  if (!hessian_only_) {
+    SYM_ASSERT(factor_helper.jacobian_index_map.size() ==
+               static_cast<size_t>(linearized_factor.jacobian.nonZeros()));
+    for (int i = 0; i < static_cast<int>(factor_helper.jacobian_index_map.size()); i++) {
+      linearization->jacobian.valuePtr()[factor_helper.jacobian_index_map[i]] =
+          linearized_factor.jacobian.valuePtr()[i];
+    }
   }
 
   // Fill out hessian
-  SYM_ASSERT(factor_helper.hessian_index_map.size() ==
-             static_cast<size_t>(linearized_factor.hessian.nonZeros()));
   for (int i = 0; i < static_cast<int>(factor_helper.hessian_index_map.size()); i++) {
-    linearization->hessian_lower.valuePtr()[factor_helper.hessian_index_map[i]] +=
+    hessian_values[factor_helper.hessian_index_map[i]] +=
         linearized_factor.hessian.valuePtr()[i];
   }
 }
 
 template <typename ScalarType>
-void Linearizer<ScalarType>::UpdatePatternFromDenseFactorIntoTripletLists(
-    const linearization_dense_factor_helper_t& factor_helper,
-    std::vector<Eigen::Triplet<Scalar>>* const jacobian_triplets,
-    std::vector<Eigen::Triplet<Scalar>>* const hessian_lower_triplets) const {
-  const auto update_triplets_from_blocks =
-      [](const int rows, const int cols, const int lhs_row_start, const int lhs_col_start,
-         const bool lower_triangle_only, std::vector<Eigen::Triplet<Scalar>>* const triplets) {
-        for (int block_row = 0; block_row < rows; block_row++) {
-          for (int block_col = 0; block_col < (lower_triangle_only ? block_row + 1 : cols);
-               block_col++) {
-            triplets->emplace_back(lhs_row_start + block_row, lhs_col_start + block_col, 1);
-          }
-        }
-      };
-
-  // For each key
-  for (int key_i = 0; key_i < static_cast<int>(factor_helper.key_helpers.size()); ++key_i) {
-    const linearization_dense_key_helper_t& key_helper = factor_helper.key_helpers[key_i];
-
-    // Fill in jacobian block
-    update_triplets_from_blocks(factor_helper.residual_dim, key_helper.tangent_dim,
-                                factor_helper.combined_residual_offset, key_helper.combined_offset,
-                                false, jacobian_triplets);
-
-    // Add contribution from diagonal hessian block
-    update_triplets_from_blocks(key_helper.tangent_dim, key_helper.tangent_dim,
-                                key_helper.combined_offset, key_helper.combined_offset, true,
-                                hessian_lower_triplets);
-
-    // Add contributions from off-diagonal hessian blocks
-    for (int key_j = 0; key_j < key_i; ++key_j) {
-      const linearization_dense_key_helper_t& key_helper_j = factor_helper.key_helpers[key_j];
-      if (key_helper.combined_offset > key_helper_j.combined_offset) {
-        update_triplets_from_blocks(key_helper.tangent_dim, key_helper_j.tangent_dim,
-                                    key_helper.combined_offset, key_helper_j.combined_offset, false,
-                                    hessian_lower_triplets);
-      } else {
-        // If key_j is actually after key_i in the full problem, swap indices to put it in the lower
-        // triangle
-        update_triplets_from_blocks(key_helper_j.tangent_dim, key_helper.tangent_dim,
-                                    key_helper_j.combined_offset, key_helper.combined_offset, false,
-                                    hessian_lower_triplets);
-      }
-    }
+Eigen::Map<VectorX<ScalarType>> Linearizer<ScalarType>::HessianValues(
+    Linearization<Scalar>* const linearization) const {
+  if (block_sparse_hessian_) {
+    return {linearization->hessian_lower_blocks.Data(),
+            linearization->hessian_lower_blocks.NumValues()};
+  } else {
+    return {linearization->hessian_lower.valuePtr(), linearization->hessian_lower.nonZeros()};
   }
 }
 
 template <typename ScalarType>
-void Linearizer<ScalarType>::UpdatePatternFromSparseFactorIntoTripletLists(
-    const LinearizedSparseFactor& linearized_factor,
-    const linearization_sparse_factor_helper_t& factor_helper,
-    std::vector<Eigen::Triplet<Scalar>>* const jacobian_triplets,
-    std::vector<Eigen::Triplet<Scalar>>* const hessian_lower_triplets) const {
-  std::vector<int> key_for_factor_offset;
-  // key_for_factor_offset.reserve();
-  for (int key_i = 0; key_i < static_cast<int>(factor_helper.key_helpers.size()); key_i++) {
-    for (int key_offset = 0; key_offset < factor_helper.key_helpers[key_i].tangent_dim;
-         key_offset++) {
-      key_for_factor_offset.push_back(key_i);
-    }
-  }
-
-  for (int outer_i = 0; outer_i < linearized_factor.jacobian.outerSize(); ++outer_i) {
-    for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(linearized_factor.jacobian,
-                                                                outer_i);
-         it; ++it) {
-      const auto row = it.row();
-      const auto col = it.col();
-
-      const auto& key_helper = factor_helper.key_helpers[key_for_factor_offset[col]];
-      const auto problem_col = col - key_helper.factor_offset + key_helper.combined_offset;
-      jacobian_triplets->emplace_back(row + factor_helper.combined_residual_offset, problem_col, 1);
-    }
-  }
-
-  for (int outer_i = 0; outer_i < linearized_factor.hessian.outerSize(); ++outer_i) {
-    for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(linearized_factor.hessian, outer_i);
-         it; ++it) {
-      const auto row = it.row();
-      const auto col = it.col();
-
-      const auto& key_helper_row = factor_helper.key_helpers[key_for_factor_offset[row]];
-      const auto& key_helper_col = factor_helper.key_helpers[key_for_factor_offset[col]];
-      const auto problem_row = row - key_helper_row.factor_offset + key_helper_row.combined_offset;
-      const auto problem_col = col - key_helper_col.factor_offset + key_helper_col.combined_offset;
-
-      // Put the entry in the lower triangle - even if the factor hessian is lower triangular, the
-      // entry might naively go into the upper triangle if the key order is reversed in the full
-      // problem
-      if (problem_row >= problem_col) {
-        hessian_lower_triplets->emplace_back(problem_row, problem_col, 1);
-      } else {
-        hessian_lower_triplets->emplace_back(problem_col, problem_row, 1);
-      }
-    }
+Eigen::Map<const VectorX<ScalarType>> Linearizer<ScalarType>::HessianValues(
+    const Linearization<Scalar>& linearization) const {
+  if (block_sparse_hessian_) {
+    return {linearization.hessian_lower_blocks.Data(),
+            linearization.hessian_lower_blocks.NumValues()};
+  } else {
+    return {linearization.hessian_lower.valuePtr(), linearization.hessian_lower.nonZeros()};
   }
 }
 
 template <typename ScalarType>
 void Linearizer<ScalarType>::EnsureLinearizationHasCorrectSize(
     Linearization<Scalar>* const linearization) const {
-  if (linearization->residual.size() == 0) {
-    // Linearization has never been initialized
+  if (linearization->residual.size() == 0 || linearization->rhs.size() == 0) {
+    // Linearization has never been initialized, although its residual may have been evaluated by
+    // EvaluateResidual
     // NOTE(aaron): This is independent of linearization.IsInitialized(), i.e. a Linearization can
     // have been initialized in the past and have the correct sizes/sparsity but have been reset
     SYM_ASSERT(linearization_ones_.IsInitialized());
@@ -479,6 +1036,7 @@ void Linearizer<ScalarType>::EnsureLinearizationHasCorrectSize(
     linearization->rhs.resize(linearization_ones_.rhs.size());
     linearization->jacobian = linearization_ones_.jacobian;
     linearization->hessian_lower = linearization_ones_.hessian_lower;
+    linearization->hessian_lower_blocks = linearization_ones_.hessian_lower_blocks;
     SYM_ASSERT(linearization->jacobian.isCompressed());
     SYM_ASSERT(linearization->hessian_lower.isCompressed());
   } else {
@@ -486,11 +1044,19 @@ void Linearizer<ScalarType>::EnsureLinearizationHasCorrectSize(
     const int N = linearization_ones_.rhs.size();
 
     SYM_ASSERT(linearization->residual.size() == M);
-    SYM_ASSERT(linearization->jacobian.rows() == M && linearization->jacobian.cols() == N);
-    SYM_ASSERT(linearization->hessian_lower.rows() == N &&
-               linearization->hessian_lower.cols() == N);
+    if (!hessian_only_) {
+      SYM_ASSERT(linearization->jacobian.rows() == M && linearization->jacobian.cols() == N);
+    }
+    if (block_sparse_hessian_) {
+      SYM_ASSERT(linearization->hessian_lower_blocks.Rows() == N);
+    } else {
+      SYM_ASSERT(linearization->hessian_lower.rows() == N &&
+                 linearization->hessian_lower.cols() == N);
+    }
     SYM_ASSERT(linearization->rhs.size() == N);
   }
+
+  linearization->SetHasJacobian(!hessian_only_);
 }
 
 template <typename ScalarType>
@@ -502,49 +1068,245 @@ void Linearizer<ScalarType>::BuildCombinedProblemSparse(
 
   // Zero out blocks that are built additively
   linearization->rhs.setZero();
-  Eigen::Map<VectorX<Scalar>>(linearization->hessian_lower.valuePtr(),
-                              linearization->hessian_lower.nonZeros())
-      .setZero();
+  HessianValues(linearization).setZero();
+
+  // Scattering a single factor is cheap, so hand out at least this many factors at a time to
+  // amortize the cost of waking up the threads
+  static constexpr int kMinFactorsPerTask = 32;
+  const auto grain_size = [this](const size_t num_factors) {
+    return std::max(kMinFactorsPerTask,
+                    static_cast<int>(num_factors) / (8 * thread_pool_->NumThreads()));
+  };
 
-  // Update each factor using precomputed index helpers
-  for (int i = 0; i < static_cast<int>(dense_linearized_factors.size()); ++i) {
-    UpdateFromLinearizedDenseFactorIntoSparse(dense_linearized_factors[i],
-                                              dense_factor_update_helpers_[i], linearization);
-  }
-  for (int i = 0; i < static_cast<int>(sparse_linearized_factors.size()); ++i) {
-    UpdateFromLinearizedSparseFactorIntoSparse(sparse_linearized_factors[i],
-                                               sparse_factor_update_helpers_[i], linearization);
+  // Update each factor using precomputed index helpers.  Factors of the same color touch disjoint
+  // parts of the combined problem, except for the serial color which is scattered in order, and
+  // each entry is accumulated in color order, so the result does not depend on the number of
+  // threads
+  for (const ScatterColor& color : scatter_colors_) {
+    ForEachFactorInColor(
+        color, static_cast<int>(color.dense_factors.size()),
+        [&](const int i) {
+          const int factor_index = color.dense_factors[i];
+          const int arena_slot = dense_factor_arena_slots_[factor_index];
+          if (arena_slot >= 0) {
+            UpdateFromLinearizedDenseFactorIntoSparse(dense_factor_arena_.Views(arena_slot),
+                                                      dense_factor_update_helpers_[factor_index],
+                                                      linearization);
+          } else {
+            UpdateFromLinearizedDenseFactorIntoSparse(dense_linearized_factors[factor_index],
+                                                      dense_factor_update_helpers_[factor_index],
+                                                      linearization);
+          }
+        },
+        grain_size(color.dense_factors.size()));
+    ForEachFactorInColor(
+        color, static_cast<int>(color.sparse_factors.size()),
+        [&](const int i) {
+          const int factor_index = color.sparse_factors[i];
+          UpdateFromLinearizedSparseFactorIntoSparse(sparse_linearized_factors[factor_index],
+                                                     sparse_factor_update_helpers_[factor_index],
+                                                     linearization);
+        },
+        grain_size(color.sparse_factors.size()));
   }
 
   linearization->SetInitialized();
 }
 
+template <typename ScalarType>
+void Linearizer<ScalarType>::BuildCombinedJacobianSparsityPattern(
+    const std::vector<std::vector<int32_t>>& sparse_factor_problem_cols,
+    Linearization<Scalar>* const linearization) const {
+  using StorageIndex = typename Eigen::SparseMatrix<Scalar>::StorageIndex;
+
+  const int32_t N = linearization->rhs.size();
+
+  // Every factor owns a distinct range of rows, and the factors are visited in order of
+  // their residual offsets, so each column comes out sorted.  First count the nonzeros in each
+  // column, then fill in the rows.
+  Eigen::SparseMatrix<Scalar>& jacobian = linearization->jacobian;
+  std::vector<StorageIndex> jacobian_outer(N + 1, 0);
+  for (const linearization_dense_factor_helper_t& factor_helper : dense_factor_update_helpers_) {
+    for (const linearization_dense_key_helper_t& key_helper : factor_helper.key_helpers) {
+      for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
+        jacobian_outer[key_helper.combined_offset + col + 1] += factor_helper.residual_dim;
+      }
+    }
+  }
+  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
+    const auto& factor_jacobian = sparse_linearized_factors_[i].jacobian;
+    for (int col = 0; col < factor_jacobian.outerSize(); ++col) {
+      for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(factor_jacobian, col); it;
+           ++it) {
+        jacobian_outer[sparse_factor_problem_cols[i][col] + 1] += 1;
+      }
+    }
+  }
+  std::partial_sum(jacobian_outer.begin(), jacobian_outer.end(), jacobian_outer.begin());
+
+  jacobian.resizeNonZeros(jacobian_outer.back());
+  std::copy(jacobian_outer.begin(), jacobian_outer.end(), jacobian.outerIndexPtr());
+  std::vector<StorageIndex>& jacobian_next = jacobian_outer;
+  for (const linearization_dense_factor_helper_t& factor_helper : dense_factor_update_helpers_) {
+    for (const linearization_dense_key_helper_t& key_helper : factor_helper.key_helpers) {
+      for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
+        StorageIndex& next = jacobian_next[key_helper.combined_offset + col];
+        for (int32_t row = 0; row < factor_helper.residual_dim; ++row) {
+          jacobian.innerIndexPtr()[next++] = factor_helper.combined_residual_offset + row;
+        }
+      }
+    }
+  }
+  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
+    const auto& factor_jacobian = sparse_linearized_factors_[i].jacobian;
+    const int32_t residual_offset = sparse_factor_update_helpers_[i].combined_residual_offset;
+    for (int col = 0; col < factor_jacobian.outerSize(); ++col) {
+      StorageIndex& next = jacobian_next[sparse_factor_problem_cols[i][col]];
+      for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(factor_jacobian, col); it;
+           ++it) {
+        jacobian.innerIndexPtr()[next++] = residual_offset + it.row();
+      }
+    }
+  }
+
+  // Fill the values with ones, so there are no numerical zeros
+  std::fill_n(jacobian.valuePtr(), jacobian.nonZeros(), Scalar{1});
+  SYM_ASSERT(jacobian.isCompressed());
+}
+
 template <typename ScalarType>
 void Linearizer<ScalarType>::BuildCombinedProblemSparsityPattern(
     Linearization<Scalar>* const linearization) const {
-  std::vector<Eigen::Triplet<Scalar>> jacobian_triplets;
-  std::vector<Eigen::Triplet<Scalar>> hessian_lower_triplets;
+  using StorageIndex = typename Eigen::SparseMatrix<Scalar>::StorageIndex;
 
-  // Update each factor using precomputed index helpers
-  for (int i = 0; i < static_cast<int>(dense_factor_update_helpers_.size()); ++i) {
-    UpdatePatternFromDenseFactorIntoTripletLists(dense_factor_update_helpers_[i],
-                                                 &jacobian_triplets, &hessian_lower_triplets);
+  const int32_t N = linearization->rhs.size();
+
+  // Sparse factors, with the problem column of each column of the factor
+  std::vector<std::vector<int32_t>> sparse_factor_problem_cols(sparse_linearized_factors_.size());
+  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
+    for (const linearization_sparse_key_helper_t& key_helper :
+         sparse_factor_update_helpers_[i].key_helpers) {
+      for (int32_t col = 0; col < key_helper.tangent_dim; ++col) {
+        sparse_factor_problem_cols[i].push_back(key_helper.combined_offset + col);
+      }
+    }
   }
-  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); i++) {
-    UpdatePatternFromSparseFactorIntoTripletLists(sparse_linearized_factors_[i],
-                                                  sparse_factor_update_helpers_[i],
-                                                  &jacobian_triplets, &hessian_lower_triplets);
+
+  if (!hessian_only_) {
+    BuildCombinedJacobianSparsityPattern(sparse_factor_problem_cols, linearization);
   }
 
-  // Create the sparse matrices
-  {
-    linearization->jacobian.setFromTriplets(jacobian_triplets.begin(), jacobian_triplets.end());
-    linearization->hessian_lower.setFromTriplets(hessian_lower_triplets.begin(),
-                                                 hessian_lower_triplets.end());
-    SYM_ASSERT(linearization->jacobian.isCompressed());
-    SYM_ASSERT(linearization->hessian_lower.isCompressed());
+  // Hessian.  Dense factors fill whole blocks, so they're accumulated as the set of key blocks
+  // below the diagonal in each key's block column, in the key ordering
+  std::vector<int32_t> key_for_offset(N);
+  std::vector<index_entry_t> key_entries;
+  key_entries.reserve(keys_.size());
+  for (const Key& key : keys_) {
+    const index_entry_t& entry = state_index_.at(key.GetLcmType());
+    std::fill_n(key_for_offset.begin() + entry.offset, entry.tangent_dim,
+                static_cast<int32_t>(key_entries.size()));
+    key_entries.push_back(entry);
+  }
+
+  std::vector<std::vector<int32_t>> lower_keys_for_key(key_entries.size());
+  for (const linearization_dense_factor_helper_t& factor_helper : dense_factor_update_helpers_) {
+    for (const linearization_dense_key_helper_t& key_helper_i : factor_helper.key_helpers) {
+      for (const linearization_dense_key_helper_t& key_helper_j : factor_helper.key_helpers) {
+        if (key_helper_i.combined_offset >= key_helper_j.combined_offset) {
+          lower_keys_for_key[key_for_offset[key_helper_j.combined_offset]].push_back(
+              key_for_offset[key_helper_i.combined_offset]);
+        }
+      }
+    }
+  }
+  for (std::vector<int32_t>& lower_keys : lower_keys_for_key) {
+    std::sort(lower_keys.begin(), lower_keys.end());
+    lower_keys.erase(std::unique(lower_keys.begin(), lower_keys.end()), lower_keys.end());
+  }
+
+  // Sparse factors are added entry by entry, as (col, row) pairs in the lower triangle
+  std::vector<std::pair<int32_t, int32_t>> sparse_hessian_entries;
+  for (int i = 0; i < static_cast<int>(sparse_linearized_factors_.size()); ++i) {
+    const auto& factor_hessian = sparse_linearized_factors_[i].hessian;
+    const std::vector<int32_t>& problem_cols = sparse_factor_problem_cols[i];
+    for (int col = 0; col < factor_hessian.outerSize(); ++col) {
+      for (typename Eigen::SparseMatrix<Scalar>::InnerIterator it(factor_hessian, col); it;
+           ++it) {
+        const int32_t problem_row = problem_cols[it.row()];
+        const int32_t problem_col = problem_cols[it.col()];
+        sparse_hessian_entries.emplace_back(std::min(problem_row, problem_col),
+                                            std::max(problem_row, problem_col));
+      }
+    }
+  }
+  std::sort(sparse_hessian_entries.begin(), sparse_hessian_entries.end());
+
+  if (block_sparse_hessian_) {
+    // Each sparse entry fills in its whole key block, and every diagonal block is stored
+    for (const std::pair<int32_t, int32_t>& entry : sparse_hessian_entries) {
+      lower_keys_for_key[key_for_offset[entry.first]].push_back(key_for_offset[entry.second]);
+    }
+
+    std::vector<int32_t> block_dims;
+    std::vector<int32_t> column_starts = {0};
+    std::vector<int32_t> row_blocks;
+    for (int32_t key = 0; key < static_cast<int32_t>(key_entries.size()); ++key) {
+      std::vector<int32_t>& lower_keys = lower_keys_for_key[key];
+      lower_keys.push_back(key);
+      std::sort(lower_keys.begin(), lower_keys.end());
+      lower_keys.erase(std::unique(lower_keys.begin(), lower_keys.end()), lower_keys.end());
+
+      block_dims.push_back(key_entries[key].tangent_dim);
+      row_blocks.insert(row_blocks.end(), lower_keys.begin(), lower_keys.end());
+      column_starts.push_back(static_cast<int32_t>(row_blocks.size()));
+    }
+
+    // The values are zeroed before the factors are accumulated into them, so unlike the scalar
+    // pattern this does not need to be filled with ones
+    linearization->hessian_lower_blocks = BlockSparseMatrix<Scalar>(
+        std::move(block_dims), std::move(column_starts), std::move(row_blocks));
+    linearization->SetInitialized();
+    return;
   }
 
+  // Fill in the rows of each column, from the key blocks and then the sparse entries
+  Eigen::SparseMatrix<Scalar>& hessian_lower = linearization->hessian_lower;
+  std::vector<StorageIndex> hessian_inner;
+  auto sparse_entry = sparse_hessian_entries.begin();
+  hessian_lower.outerIndexPtr()[0] = 0;
+  for (int32_t col = 0; col < N; ++col) {
+    const size_t column_start = hessian_inner.size();
+    const int32_t key = key_for_offset[col];
+    for (const int32_t row_key : lower_keys_for_key[key]) {
+      const index_entry_t& row_entry = key_entries[row_key];
+      const int32_t row_begin = row_key == key ? col : row_entry.offset;
+      for (int32_t row = row_begin; row < row_entry.offset + row_entry.tangent_dim; ++row) {
+        hessian_inner.push_back(row);
+      }
+    }
+
+    bool has_sparse_entries = false;
+    for (; sparse_entry != sparse_hessian_entries.end() && sparse_entry->first == col;
+         ++sparse_entry) {
+      hessian_inner.push_back(sparse_entry->second);
+      has_sparse_entries = true;
+    }
+    if (has_sparse_entries) {
+      std::sort(hessian_inner.begin() + column_start, hessian_inner.end());
+      hessian_inner.erase(std::unique(hessian_inner.begin() + column_start, hessian_inner.end()),
+                          hessian_inner.end());
+    }
+
+    hessian_lower.outerIndexPtr()[col + 1] = static_cast<StorageIndex>(hessian_inner.size());
+  }
+
+  hessian_lower.resizeNonZeros(hessian_inner.size());
+  std::copy(hessian_inner.begin(), hessian_inner.end(), hessian_lower.innerIndexPtr());
+
+  // Fill the values with ones, so there are no numerical zeros
+  std::fill_n(hessian_lower.valuePtr(), hessian_lower.nonZeros(), Scalar{1});
+  SYM_ASSERT(hessian_lower.isCompressed());
+
   linearization->SetInitialized();
 }
 
@@ -5,6 +5,10 @@
 
 #pragma once
 
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <Eigen/Sparse>
@@ -13,6 +17,9 @@
 #include <lcmtypes/sym/linearization_sparse_factor_helper_t.hpp>
 
 #include "./factor.h"
+#include "./internal/factor_batch_kernel.h"
+#include "./internal/linearized_factor_arena.h"
+#include "./internal/thread_pool.h"
 #include "./linearization.h"
 #include "./values.h"
 
@@ -42,19 +49,99 @@ class Linearizer {
    *                to optimize. Can equal the set of all factor keys or a subset of all
    *                factor keys. If not provided, it is computed from all keys for all
    *                factors using a default ordering.
+   *     num_threads: Number of threads used to evaluate factors in Relinearize, including the
+   *                  calling thread.  Values less than 2 evaluate factors serially.
    */
   Linearizer(const std::string& name, const std::vector<Factor<Scalar>>& factors,
-             const std::vector<Key>& key_order = {});
+             const std::vector<Key>& key_order = {}, int num_threads = 1);
 
   /**
    * Update linearization at a new evaluation point. Returns the total residual dimension M.
    * This is more efficient than reconstructing this object repeatedly.  On the first call, it will
    * allocate memory and perform analysis needed for efficient repeated relinearization.
    *
+   * Factors are evaluated on the thread pool if this Linearizer was created with more than one
+   * thread, and factors created from the same FactorBatch are evaluated together in chunks.  The
+   * combined problem is always accumulated in the same order, so the result is bitwise identical
+   * for any number of threads.
+   *
+   * If incremental relinearization is enabled (see SetRelinearizationThreshold), only the factors
+   * touching keys that moved more than the threshold are evaluated again.
+   *
    * TODO(aaron): This should be const except that it can initialize the object
    */
   void Relinearize(const Values<Scalar>& values, Linearization<Scalar>* const linearization);
 
+  /**
+   * Evaluate only the combined residual at values, without computing any jacobians or hessians.
+   * The residual has the same layout as Linearization::residual after Relinearize, so its squared
+   * norm can be compared against the error of a full linearization, e.g. to decide whether a step
+   * is worth linearizing.  Factors are evaluated on the thread pool like in Relinearize, without a
+   * jacobian.  Fixed size factors write straight into their segment of residual, through
+   * Factor::LinearizeInto, and others through Factor::Linearize(values, residual).
+   *
+   * Requires the Linearizer to be initialized.  The residual is always exact, even with incremental
+   * relinearization enabled, and none of the state for Relinearize is modified.
+   */
+  void EvaluateResidual(const Values<Scalar>& values, VectorX<Scalar>* residual);
+
+  /**
+   * Enable incremental relinearization, similar to the fluid relinearization of iSAM2, or disable
+   * it if threshold is negative (the default).
+   *
+   * In incremental mode the Linearizer keeps a linearization point for every key.  On each call to
+   * Relinearize, a key whose tangent space delta from its linearization point has any component
+   * larger than threshold (or any key that is not optimized and changed at all) is moved to its
+   * new value, and only the factors touching moved keys are evaluated again, at the linearization
+   * point.  Their old contributions to the combined hessian and jacobian are subtracted and the
+   * new ones added; all other factors are reused as they are.  The combined residual and rhs are
+   * then updated to first order for the deltas of the keys that did not move:
+   *
+   *     residual = residual_0 + J * delta
+   *     rhs = rhs_0 + J^T * J * delta
+   *
+   * So the linearization is exact for a threshold of 0, and otherwise approximates the residual of
+   * factors on slowly moving keys with their linearization.  The linearized factors are the
+   * ones at their linearization points.  Any change to the structure of the Values
+   * relinearizes everything.
+   */
+  void SetRelinearizationThreshold(Scalar threshold);
+
+  Scalar RelinearizationThreshold() const;
+
+  /**
+   * Number of factors that were evaluated in the last call to Relinearize
+   */
+  int NumFactorsRelinearized() const;
+
+  /**
+   * Number of colors that factors are scattered into the combined problem in, including the
+   * serial color if there is one.  See ComputeScatterSchedule.
+   */
+  int NumScatterColors() const;
+
+  /**
+   * Build the combined hessian as a BlockSparseMatrix in Linearization::hessian_lower_blocks, with
+   * one block row and column per key in Keys(), instead of in the scalar
+   * Linearization::hessian_lower, which is then left empty.  The block pattern stores one index per
+   * pair of keys instead of one per scalar entry, and factors are scattered into it one contiguous
+   * block column at a time.  Must be set before the first call to Relinearize.
+   */
+  void SetBlockSparseHessian(bool block_sparse_hessian);
+
+  bool BlockSparseHessian() const;
+
+  /**
+   * Build only the residual, hessian, and rhs of the combined problem, and leave
+   * Linearization::jacobian empty.  The combined jacobian has an entry for every entry of every
+   * factor jacobian, so for large problems it is usually the largest part of the linearization, and
+   * scattering it takes as much bandwidth as the hessian.  Linearization::LinearError is then
+   * computed from the hessian and rhs instead.  Must be set before the first call to Relinearize.
+   */
+  void SetHessianOnly(bool hessian_only);
+
+  bool HessianOnly() const;
+
   /**
    * Check whether the keys in `keys` correspond 1-1 (and in the same order) with the start of the
    * key ordering in the problem linearization
@@ -84,21 +171,125 @@ class Linearizer {
 
   /**
    * Basic accessors.
+   *
+   * The residual, jacobian, hessian and rhs of fixed size dense factors are stored in an arena
+   * (see InitializeStorageAndIndices), and are empty in the dense factors returned here.  Use
+   * CopyLinearizedDenseFactors to get all of the dense factors with their values.
    */
   std::pair<const std::vector<LinearizedDenseFactor>&, const std::vector<LinearizedSparseFactor>&>
   LinearizedFactors() const;
 
+  /**
+   * Returns a copy of the dense linearized factors, including the values of the ones stored in the
+   * arena.  This copies every factor on each call, so it is not meant for hot loops.
+   */
+  std::vector<LinearizedDenseFactor> CopyLinearizedDenseFactors() const;
+
   const std::vector<Key>& Keys() const;
 
   const std::unordered_map<key_t, index_entry_t>& StateIndex() const;
 
+  int NumThreads() const;
+
  private:
+  /**
+   * Evaluate all factors at values, and build the combined problem from them
+   */
+  void RelinearizeAll(const Values<Scalar>& values, Linearization<Scalar>* linearization);
+
+  /**
+   * Implementation of Relinearize for incremental relinearization
+   */
+  void RelinearizeIncremental(const Values<Scalar>& values, Linearization<Scalar>* linearization);
+
+  /**
+   * Evaluate the factor at the given index into its linearized factor storage
+   */
+  void LinearizeFactor(const Values<Scalar>& values, int factor_index);
+
+  /**
+   * Set up the key index and linearization point for incremental relinearization at values.
+   * Requires the Linearizer to be initialized.
+   */
+  void InitializeIncrementalState(const Values<Scalar>& values);
+
+  /**
+   * Compute the deltas of all keys from their linearization points, move the keys above the
+   * relinearization threshold to values, and flag the factors touching them.  Returns the number of
+   * flagged factors.
+   */
+  int MoveKeysAboveRelinearizationThreshold(const Values<Scalar>& values);
+
+  /**
+   * Add (or subtract) the hessian contributions of the flagged factors to the incremental
+   * linearization, one scatter color at a time
+   */
+  void UpdateIncrementalLinearization(bool subtract);
+
+  /**
+   * Fill the residual and rhs of the combined problem from all factors at their linearization
+   * points, to first order in the deltas of their keys
+   */
+  template <typename LinearizedDenseFactorType>
+  void UpdateResidualAndRhsFromDeltas(const LinearizedDenseFactorType& linearized_factor,
+                                      const linearization_dense_factor_helper_t& factor_helper,
+                                      Linearization<Scalar>* linearization) const;
+  struct SparseFactorDeltas;
+  void UpdateResidualAndRhsFromDeltas(const LinearizedSparseFactor& linearized_factor,
+                                      const linearization_sparse_factor_helper_t& factor_helper,
+                                      SparseFactorDeltas* workspace,
+                                      Linearization<Scalar>* linearization) const;
+
   /**
    * Allocate all factor storage and compute sparsity pattern. This does a lot of index
    * computation on the first linearization, such that repeated linearization can be fast.
    */
   void InitializeStorageAndIndices();
 
+  /**
+   * Group the factors into colors, such that no two factors of the same color touch the same
+   * optimized key.  Factors of one color then write to disjoint columns of hessian_lower and
+   * disjoint segments of rhs, so BuildCombinedProblemSparse can scatter all the factors of a color
+   * concurrently without locks or atomics.  Requires the factor update helpers.
+   *
+   * Colors are assigned greedily in factor order, so the schedule only depends on the problem
+   * structure.  A key touched by many factors would force at least that many colors, each with
+   * too few factors to be worth scattering concurrently, so there are at most kMaxScatterColors
+   * colors.  Factors that touch a key shared by more than kMaxScatterColors factors, or that do
+   * not fit in any of the colors, go in a final serial color that is scattered in order on the
+   * calling thread.
+   */
+  void ComputeScatterSchedule();
+
+  struct ScatterColor;
+
+  /**
+   * Call func(i) for each i in [0, num_factors), where i indexes the dense or sparse factors of
+   * the given color.  Runs concurrently on the thread pool, or in order on the calling thread if
+   * the color is serial.
+   */
+  template <typename Func>
+  void ForEachFactorInColor(const ScatterColor& color, int num_factors, Func&& func,
+                            int grain_size = 0) const;
+
+  /**
+   * Move the linearized dense factors that support Factor::LinearizeInto (all fixed size factors)
+   * into a single contiguous, cache line aligned arena, and release their individual heap
+   * allocations.  Subsequent calls to Relinearize evaluate these factors directly into the arena.
+   */
+  void MoveDenseFactorsToArena();
+
+  /**
+   * Split the arena-backed factors created from each FactorBatch into chunks of up to
+   * FactorBatchKernel::kMaxChunkSize factors, in factor order.  Requires MoveDenseFactorsToArena.
+   */
+  void ComputeFactorBatchChunks();
+
+  /**
+   * Look up the index entries of the factors in each batch chunk in values
+   */
+  void UpdateFactorBatchIndices(const Values<Scalar>& values);
+
   /**
    * Hashmap of keys to information about the key's offset in the full problem.
    */
@@ -107,30 +298,28 @@ class Linearizer {
       const std::vector<LinearizedSparseFactor>& sparse_factors, const std::vector<Key>& keys);
 
   /**
-   * Update the sparse combined problem linearization from a single factor.
+   * Update the sparse combined problem linearization from a single factor.  The dense factor may
+   * be a LinearizedDenseFactor or a view into the arena.
+   *
+   * If subtract is true, only subtracts the factor's contribution from the hessian, and leaves the
+   * rest of the linearization unchanged.
    */
+  template <typename LinearizedDenseFactorType>
   void UpdateFromLinearizedDenseFactorIntoSparse(
-      const LinearizedDenseFactor& linearized_factor,
+      const LinearizedDenseFactorType& linearized_factor,
       const linearization_dense_factor_helper_t& factor_helper,
-      Linearization<Scalar>* const linearization) const;
+      Linearization<Scalar>* const linearization, bool subtract = false) const;
   void UpdateFromLinearizedSparseFactorIntoSparse(
       const LinearizedSparseFactor& linearized_factor,
       const linearization_sparse_factor_helper_t& factor_helper,
-      Linearization<Scalar>* const linearization) const;
+      Linearization<Scalar>* const linearization, bool subtract = false) const;
 
   /**
-   * Update the combined residual and rhs, along with triplet lists for the sparse matrices, from a
-   * single factor
+   * The storage of the combined hessian in a linearization, i.e. the values of either
+   * hessian_lower_blocks or hessian_lower
    */
-  void UpdatePatternFromDenseFactorIntoTripletLists(
-      const linearization_dense_factor_helper_t& factor_helper,
-      std::vector<Eigen::Triplet<Scalar>>* const jacobian_triplets,
-      std::vector<Eigen::Triplet<Scalar>>* const hessian_lower_triplets) const;
-  void UpdatePatternFromSparseFactorIntoTripletLists(
-      const LinearizedSparseFactor& linearized_factor,
-      const linearization_sparse_factor_helper_t& factor_helper,
-      std::vector<Eigen::Triplet<Scalar>>* const jacobian_triplets,
-      std::vector<Eigen::Triplet<Scalar>>* const hessian_lower_triplets) const;
+  Eigen::Map<VectorX<Scalar>> HessianValues(Linearization<Scalar>* linearization) const;
+  Eigen::Map<const VectorX<Scalar>> HessianValues(const Linearization<Scalar>& linearization) const;
 
   /**
    * Check if a Linearization has the correct sizes, and if not, initialize it
@@ -148,23 +337,73 @@ class Linearizer {
 
   /**
    * Create the combined problem linearization sparsity pattern, assuming nonzeros in all locations
-   * for dense factors, and all existing locations in sparse factors.  This is done by creating the
-   * sparse matrices from triplet lists.
+   * for dense factors, and all existing locations in sparse factors.  The compressed column storage
+   * is built directly, from the blocks of pairs of keys touched by dense factors and the individual
+   * entries of sparse factors, so this never holds a list of all the scalar nonzeros.  For a block
+   * sparse hessian, every key block touched by a factor is stored.
    */
   void BuildCombinedProblemSparsityPattern(Linearization<Scalar>* const linearization) const;
 
+  /**
+   * Create the sparsity pattern of the combined jacobian, given the problem column of each column
+   * of each sparse factor
+   */
+  void BuildCombinedJacobianSparsityPattern(
+      const std::vector<std::vector<int32_t>>& sparse_factor_problem_cols,
+      Linearization<Scalar>* const linearization) const;
+
   bool initialized_{false};
 
+  // Whether to build the hessian in Linearization::hessian_lower_blocks
+  bool block_sparse_hessian_{false};
+
+  // Whether to skip building Linearization::jacobian
+  bool hessian_only_{false};
+
   // The name of this linearizer to be used for printing debug information.
   std::string name_;
 
   // Pointer to the nonlinear factors
   const std::vector<Factor<Scalar>>* factors_;
 
-  // Linearized factors - stores individual factor residuals, jacobians, etc
+  // Linearized factors - stores individual factor residuals, jacobians, etc.  Dense factors that
+  // live in dense_factor_arena_ only keep their index here after initialization
   std::vector<LinearizedDenseFactor> dense_linearized_factors_;
   std::vector<LinearizedSparseFactor> sparse_linearized_factors_;
 
+  // Contiguous storage for the linearized dense factors that support Factor::LinearizeInto, and
+  // for each dense factor its index in the arena, or -1 if it is stored in
+  // dense_linearized_factors_
+  internal::LinearizedFactorArena<Scalar> dense_factor_arena_;
+  std::vector<int> dense_factor_arena_slots_;
+
+  // Factors from one FactorBatch that are evaluated together, see ComputeFactorBatchChunks
+  struct FactorBatchChunk {
+    const internal::FactorBatchKernel<Scalar>* kernel;
+
+    // Indices into *factors_, and the arena slot of each factor
+    std::vector<int> factors;
+    std::vector<int> arena_slots;
+
+    // Index entries of the keys of each factor, back to back
+    std::vector<index_entry_t> index_entries;
+  };
+
+  std::vector<FactorBatchChunk> factor_batch_chunks_;
+
+  // For each factor in *factors_, whether it is evaluated as part of a FactorBatchChunk
+  std::vector<bool> factor_is_batched_;
+
+  // Id of the Values the index entries in factor_batch_chunks_ were computed for
+  int64_t factor_batch_values_id_{Values<Scalar>::kInvalidId};
+
+  // For each factor in *factors_, its index into dense_linearized_factors_ or
+  // sparse_linearized_factors_, depending on whether the factor is sparse
+  std::vector<int> linearized_factor_slots_;
+
+  // Threads used to evaluate factors
+  std::unique_ptr<internal::ThreadPool> thread_pool_;
+
   // Keys that form the state vector
   std::vector<Key> keys_;
 
@@ -175,7 +414,76 @@ class Linearizer {
   std::vector<linearization_dense_factor_helper_t> dense_factor_update_helpers_;
   std::vector<linearization_sparse_factor_helper_t> sparse_factor_update_helpers_;
 
+  // Indices of the dense and sparse factors of one color, see ComputeScatterSchedule
+  struct ScatterColor {
+    std::vector<int> dense_factors;
+    std::vector<int> sparse_factors;
+
+    // Whether these factors may share keys, and so must be scattered one at a time
+    bool serial{false};
+  };
+
+  // Maximum number of concurrently scattered colors, see ComputeScatterSchedule
+  static constexpr int kMaxScatterColors = 16;
+
+  // Schedule for scattering linearized factors into the combined problem, one color at a time
+  std::vector<ScatterColor> scatter_colors_;
+
   Linearization<Scalar> linearization_ones_;
+
+  // Number of factors evaluated in the last call to Relinearize
+  int num_factors_relinearized_{0};
+
+  // The residual of each factor in *factors_ that can't be evaluated directly into the combined
+  // residual, used by EvaluateResidual
+  std::vector<VectorX<Scalar>> factor_residuals_;
+
+  // Workspace for UpdateResidualAndRhsFromDeltas on a sparse factor: the deltas of its keys, its
+  // jacobian times the deltas, and its hessian times the deltas
+  struct SparseFactorDeltas {
+    VectorX<Scalar> deltas;
+    VectorX<Scalar> jacobian_deltas;
+    VectorX<Scalar> rhs_deltas;
+  };
+
+  // State for incremental relinearization, see SetRelinearizationThreshold
+  struct IncrementalState {
+    // Negative if incremental relinearization is disabled
+    Scalar threshold{-1};
+
+    // Values at which each key was last linearized, which is where all factors are evaluated, and
+    // the Id of the Values it was copied from
+    Values<Scalar> linearization_point{};
+    int64_t values_id{Values<Scalar>::kInvalidId};
+
+    // Every key of every factor, as a single entry index into the Values, along with the key's
+    // offset in the state vector, or -1 if it is not optimized
+    std::vector<index_t> key_indices;
+    std::vector<int32_t> key_state_offsets;
+
+    // For each factor, its keys as indices into key_indices
+    std::vector<std::vector<int>> factor_keys;
+
+    // Index of keys_ in the Values, and the delta of each from its linearization point
+    index_t state_index;
+    VectorX<Scalar> state_deltas;
+
+    // Whether each key moved, and whether each dense and sparse linearized factor needs to be
+    // evaluated again, in the last call to Relinearize
+    std::vector<uint8_t> key_moved;
+    std::vector<uint8_t> dense_factor_moved;
+    std::vector<uint8_t> sparse_factor_moved;
+
+    // One workspace per sparse factor, sized when the state is initialized
+    std::vector<SparseFactorDeltas> sparse_factor_deltas;
+
+    // The combined hessian and jacobian of all factors at their linearization points, and the
+    // residual and rhs to first order in the deltas, which are recomputed from all factors on every
+    // call to Relinearize
+    Linearization<Scalar> linearization;
+  };
+
+  IncrementalState incremental_;
 };
 
 // Free function as an alternate way to call.
@@ -222,6 +530,81 @@ std::vector<Key> ComputeKeysToOptimize(const std::vector<Factor<Scalar>>& factor
   return ComputeKeysToOptimize(factors, &sym::Key::LexicalLessThan);
 }
 
+/**
+ * Reorder keys so that a set of keys whose block of the hessian is block diagonal comes last, for
+ * linear solvers that eliminate those keys with the Schur complement (see SparseSchurSolver).
+ *
+ * Two keys are coupled if a factor optimizes both of them.  The keys moved to the end are a
+ * maximal set of keys with no coupling between them, chosen greedily in order of increasing number
+ * of coupled keys.  In bundle adjustment these are the landmarks (and inverse ranges), since each
+ * is coupled only to the few cameras that observe it.  The relative order of the keys is otherwise
+ * preserved, so keys that are already in this form are left in place.
+ */
+template <typename Scalar>
+std::vector<Key> OrderBlockDiagonalKeysLast(const std::vector<Factor<Scalar>>& factors,
+                                            const std::vector<Key>& keys) {
+  std::unordered_map<Key, int> key_indices;
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    key_indices.emplace(keys[i], i);
+  }
+
+  // The keys coupled to each key
+  std::vector<std::vector<int>> coupled_keys(keys.size());
+  std::vector<int> factor_keys;
+  for (const Factor<Scalar>& factor : factors) {
+    factor_keys.clear();
+    for (const Key& key : factor.OptimizedKeys()) {
+      const auto it = key_indices.find(key);
+      if (it != key_indices.end()) {
+        factor_keys.push_back(it->second);
+      }
+    }
+    for (const int a : factor_keys) {
+      for (const int b : factor_keys) {
+        if (a != b) {
+          coupled_keys[a].push_back(b);
+        }
+      }
+    }
+  }
+  for (std::vector<int>& coupled : coupled_keys) {
+    std::sort(coupled.begin(), coupled.end());
+    coupled.erase(std::unique(coupled.begin(), coupled.end()), coupled.end());
+  }
+
+  // Greedy maximal independent set
+  std::vector<int> keys_by_degree(keys.size());
+  std::iota(keys_by_degree.begin(), keys_by_degree.end(), 0);
+  std::stable_sort(keys_by_degree.begin(), keys_by_degree.end(),
+                   [&coupled_keys](const int a, const int b) {
+                     return coupled_keys[a].size() < coupled_keys[b].size();
+                   });
+  std::vector<uint8_t> is_last(keys.size(), 0);
+  std::vector<uint8_t> is_excluded(keys.size(), 0);
+  for (const int i : keys_by_degree) {
+    if (!is_excluded[i]) {
+      is_last[i] = 1;
+      for (const int j : coupled_keys[i]) {
+        is_excluded[j] = 1;
+      }
+    }
+  }
+
+  std::vector<Key> ordered_keys;
+  ordered_keys.reserve(keys.size());
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    if (!is_last[i]) {
+      ordered_keys.push_back(keys[i]);
+    }
+  }
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    if (is_last[i]) {
+      ordered_keys.push_back(keys[i]);
+    }
+  }
+  return ordered_keys;
+}
+
 }  // namespace sym
 
 #include "./linearizer.tcc"
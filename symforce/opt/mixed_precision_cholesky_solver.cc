@@ -0,0 +1,136 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include "./mixed_precision_cholesky_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace sym {
+
+void MixedPrecisionCholeskySolver::ComputeSymbolicSparsity(const MatrixType& A) {
+  SYM_ASSERT(A.isCompressed());
+
+  A_float_ = A.cast<float>();
+  float_solver_.ComputeSymbolicSparsity(A_float_);
+
+  // The pattern may have changed, so the double factorization has to be analyzed again if needed
+  double_solver_ = DoubleSolverType();
+  use_double_ = false;
+}
+
+void MixedPrecisionCholeskySolver::Factorize(const MatrixType& A) {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A.isCompressed());
+  SYM_ASSERT(A.nonZeros() == A_float_.nonZeros());
+
+  A_ = &A;
+  use_double_ = false;
+
+  // D = diag(A)^-1/2, and the Frobenius norm of D * A * D, whose off-diagonal entries in the
+  // lower triangle appear twice in the symmetric matrix
+  equilibration_.resize(A.rows());
+  for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+    const double diagonal = A.coeff(col, col);
+    equilibration_[col] = diagonal > 0 ? 1 / std::sqrt(diagonal) : 1;
+  }
+  double squared_norm = 0;
+  for (Eigen::Index col = 0; col < A.outerSize(); ++col) {
+    for (MatrixType::InnerIterator it(A, col); it; ++it) {
+      const double value = equilibration_[it.row()] * it.value() * equilibration_[it.col()];
+      squared_norm += (it.row() == it.col() ? 1 : 2) * value * value;
+    }
+  }
+  equilibrated_A_norm_ = std::sqrt(squared_norm);
+
+  Eigen::Map<Eigen::VectorXf>(A_float_.valuePtr(), A_float_.nonZeros()) =
+      Eigen::Map<const Eigen::VectorXd>(A.valuePtr(), A.nonZeros()).cast<float>();
+  float_solver_.Factorize(A_float_);
+}
+
+void MixedPrecisionCholeskySolver::SolveInFloat(const RhsType& b, RhsType* const x) const {
+  column_scales_ = b.cwiseAbs().colwise().maxCoeff().transpose();
+  for (Eigen::Index col = 0; col < column_scales_.size(); ++col) {
+    if (!(column_scales_[col] > 0)) {
+      column_scales_[col] = 1;
+    }
+  }
+
+  float_workspace_ = (b * column_scales_.cwiseInverse().asDiagonal()).cast<float>();
+  float_solver_.SolveInPlace(&float_workspace_);
+  *x = float_workspace_.cast<double>() * column_scales_.asDiagonal();
+}
+
+double MixedPrecisionCholeskySolver::BackwardError(const RhsType& x) const {
+  if (!residual_.allFinite()) {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  double backward_error = 0;
+  for (Eigen::Index col = 0; col < residual_.cols(); ++col) {
+    const double scale =
+        equilibrated_A_norm_ * x.col(col).cwiseQuotient(equilibration_).norm() +
+        b_.col(col).cwiseProduct(equilibration_).norm();
+    if (scale > 0) {
+      backward_error = std::max(
+          backward_error, residual_.col(col).cwiseProduct(equilibration_).norm() / scale);
+    }
+  }
+  return backward_error;
+}
+
+void MixedPrecisionCholeskySolver::SolveInPlace(RhsType* const b) const {
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A_ != nullptr);
+  SYM_ASSERT(b != nullptr);
+  SYM_ASSERT(b->rows() == A_->rows());
+
+  refinement_steps_ = 0;
+
+  if (use_double_) {
+    double_solver_.SolveInPlace(b);
+    return;
+  }
+
+  const auto A = A_->selfadjointView<Eigen::Lower>();
+  RhsType& x = *b;
+
+  b_ = x;
+
+  SolveInFloat(b_, &x);
+  double last_backward_error = std::numeric_limits<double>::infinity();
+  while (true) {
+    residual_ = b_;
+    residual_.noalias() -= A * x;
+    const double backward_error = BackwardError(x);
+    if (backward_error <= tolerance_) {
+      return;
+    }
+
+    // Stop as soon as refinement stops making progress, since it will not converge
+    if (refinement_steps_ == max_refinement_steps_ || !std::isfinite(backward_error) ||
+        backward_error > min_reduction_ * last_backward_error) {
+      break;
+    }
+    last_backward_error = backward_error;
+
+    SolveInFloat(residual_, &correction_);
+    x += correction_;
+    ++refinement_steps_;
+  }
+
+  // Refinement did not converge, so fall back to a factorization in double
+  use_double_ = true;
+  refinement_steps_ = 0;
+  if (!double_solver_.IsInitialized()) {
+    double_solver_.ComputeSymbolicSparsity(*A_);
+  }
+  double_solver_.Factorize(*A_);
+  x = b_;
+  double_solver_.SolveInPlace(&x);
+}
+
+}  // namespace sym
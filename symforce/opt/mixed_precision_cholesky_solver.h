@@ -0,0 +1,157 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+
+#include "./assert.h"
+#include "./cholesky/sparse_cholesky_solver.h"
+
+namespace sym {
+
+// Solves A * x = b, where A is a symmetric positive definite sparse matrix in double precision, by
+// factorizing A in float and refining the solution in double.
+//
+// Factorize casts A to float and factorizes it with a SparseCholeskySolver in float, which is
+// faster and needs half the memory bandwidth of a factorization in double.  Solve then runs
+// iterative refinement against the original A in double:
+//
+//     x = A_float^-1 * b
+//     r = b - A * x, x += A_float^-1 * r, repeated until the normwise backward error
+//     ||D r|| / (||D A D|| * ||D^-1 x|| + ||D b||) <= tolerance
+//
+// for each column of b, for at most max_refinement_steps corrections, where D = diag(A)^-1/2 and
+// ||D A D|| is the Frobenius norm.  It is measured on the equilibrated D A D so that it does not
+// depend on the scaling of the variables, which varies by orders of magnitude in a typical hessian.
+// The backward error, unlike ||r|| / ||b||, is attainable for ill-conditioned A, so this converges
+// whenever the float factorization is accurate enough for refinement to make progress.  If it is
+// not, e.g. because A is too ill-conditioned for float, the backward error stops shrinking;
+// refinement then stops early, and A is factorized in double and the solve is redone with that
+// factorization, which is then used for all solves until the next call to Factorize.
+//
+// Has the same interface as SparseCholeskySolver, so it can be used as the LinearSolverType of a
+// LevenbergMarquardtSolver<double>.  Like ConjugateGradientSolver, it keeps a pointer to the matrix
+// passed to Factorize, which must outlive any calls to Solve.
+//
+// Not thread safe, since solves use internal workspace.
+class MixedPrecisionCholeskySolver {
+ public:
+  using Scalar = double;
+  using MatrixType = Eigen::SparseMatrix<double>;
+  using StorageIndex = typename MatrixType::StorageIndex;
+  using RhsType = Eigen::MatrixXd;
+  using FloatSolverType = SparseCholeskySolver<Eigen::SparseMatrix<float>, Eigen::Lower>;
+  using DoubleSolverType = SparseCholeskySolver<MatrixType, Eigen::Lower>;
+
+  // Args:
+  //     max_refinement_steps: The most refinement steps before falling back to double
+  //     tolerance: The backward error to refine to.  The default is far below the accuracy of a
+  //         float solve, but attainable in double for any A that refinement converges on, which
+  //         takes a few steps.
+  //     min_reduction: Refinement stops and falls back to double if a step does not reduce the
+  //         backward error by at least this factor
+  explicit MixedPrecisionCholeskySolver(const int max_refinement_steps = 10,
+                                        const double tolerance = 1e-14,
+                                        const double min_reduction = 0.5)
+      : max_refinement_steps_(max_refinement_steps),
+        tolerance_(tolerance),
+        min_reduction_(min_reduction) {}
+
+  // Whether we have computed a symbolic sparsity and are ready to factorize/solve.
+  bool IsInitialized() const {
+    return float_solver_.IsInitialized();
+  }
+
+  // Compute the ordering and symbolic factorization of the lower triangular A, in float.  The
+  // factorization in double is only analyzed if it is needed.
+  void ComputeSymbolicSparsity(const MatrixType& A);
+
+  // Factorize the lower triangular A in float, and keep a pointer to A for Solve.  A must have the
+  // same sparsity as the matrix passed to ComputeSymbolicSparsity.
+  void Factorize(const MatrixType& A);
+
+  // Returns x for A x = b, where x and b are dense
+  template <typename Rhs>
+  RhsType Solve(const Eigen::MatrixBase<Rhs>& b) const {
+    RhsType x = b;
+    SolveInPlace(&x);
+    return x;
+  }
+
+  // Solves in place for x in A x = b, where x and b are dense
+  void SolveInPlace(RhsType* b) const;
+
+  template <typename Rhs>
+  void SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const {
+    SYM_ASSERT(b != nullptr);
+    rhs_workspace_ = *b;
+    SolveInPlace(&rhs_workspace_);
+    *b = rhs_workspace_;
+  }
+
+  // Number of refinement steps in the last call to Solve or SolveInPlace, or 0 if it used the
+  // factorization in double
+  int Iterations() const {
+    return refinement_steps_;
+  }
+
+  // Whether the last factorization fell back to double, because refinement did not converge
+  bool UsedDoubleFactorization() const {
+    return use_double_;
+  }
+
+  int MaxRefinementSteps() const {
+    return max_refinement_steps_;
+  }
+
+  double Tolerance() const {
+    return tolerance_;
+  }
+
+  // The factor L of the factorization in float
+  const typename FloatSolverType::CholMatrixType& L() const {
+    return float_solver_.L();
+  }
+
+  const typename FloatSolverType::PermutationMatrixType& Permutation() const {
+    return float_solver_.Permutation();
+  }
+
+ private:
+  // Compute x = A_float^-1 * b, scaling each column of b so that it is representable in float
+  void SolveInFloat(const RhsType& b, RhsType* x) const;
+
+  // The largest normwise backward error of the columns of x, given residual_ = b_ - A * x
+  double BackwardError(const RhsType& x) const;
+
+  int max_refinement_steps_;
+  double tolerance_;
+  double min_reduction_;
+
+  const MatrixType* A_{nullptr};
+  // The diagonal of D = diag(A)^-1/2, and the Frobenius norm of D * A * D, for BackwardError
+  Eigen::VectorXd equilibration_;
+  double equilibrated_A_norm_{0};
+  Eigen::SparseMatrix<float> A_float_;
+  FloatSolverType float_solver_;
+
+  // The fallback factorization in double, computed on demand by Solve
+  mutable DoubleSolverType double_solver_;
+  mutable bool use_double_{false};
+
+  mutable int refinement_steps_{0};
+
+  // Working storage for refinement
+  mutable RhsType b_;
+  mutable RhsType residual_;
+  mutable RhsType correction_;
+  mutable Eigen::VectorXd column_scales_;
+  mutable Eigen::MatrixXf float_workspace_;
+  mutable RhsType rhs_workspace_;
+};
+
+}  // namespace sym
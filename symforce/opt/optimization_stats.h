@@ -39,7 +39,8 @@ struct OptimizationStats {
   // Reset the optimization stats
   // Does _not_ cause reallocation, except for things in debug stats
   void Reset(const size_t num_iterations) {
-    iterations.reserve(num_iterations);
+    // One entry per iteration, plus one for the initial state
+    iterations.reserve(num_iterations + 1);
     iterations.clear();
 
     best_index = {};
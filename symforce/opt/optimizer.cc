@@ -19,6 +19,10 @@ sym::optimizer_params_t sym::DefaultOptimizerParams() {
   const int iterations = 50;
   const double early_exit_min_reduction = 1e-6;
   const bool enable_bold_updates = false;
+  const int num_threads = 1;
+  const bool defer_linearization = false;
+  const bool hessian_only_linearization = false;
+  const int speculative_lambdas = 1;
 
   return sym::optimizer_params_t{
       verbose,
@@ -34,6 +38,10 @@ sym::optimizer_params_t sym::DefaultOptimizerParams() {
       iterations,
       early_exit_min_reduction,
       enable_bold_updates,
+      num_threads,
+      defer_linearization,
+      hessian_only_linearization,
+      speculative_lambdas,
   };
 }
 
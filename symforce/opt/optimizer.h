@@ -5,12 +5,123 @@
 
 #pragma once
 
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./block_sparse_matrix.h"
+#include "./dogleg_solver.h"
 #include "./levenberg_marquardt_solver.h"
 #include "./linearizer.h"
 #include "./optimization_stats.h"
+#include "./sparse_schur_solver.h"
 
 namespace sym {
 
+namespace internal {
+
+/**
+ * Whether NonlinearSolverType solves block sparse hessians, i.e. whether it has a LinearSolver
+ * whose MatrixType is a BlockSparseMatrix
+ */
+template <typename NonlinearSolverType, typename = void>
+struct SolvesBlockSparseHessian : std::false_type {};
+
+template <typename NonlinearSolverType>
+struct SolvesBlockSparseHessian<
+    NonlinearSolverType,
+    std::enable_if_t<std::is_same<typename NonlinearSolverType::LinearSolver::MatrixType,
+                                  BlockSparseMatrix<typename NonlinearSolverType::Scalar>>::value>>
+    : std::true_type {};
+
+/**
+ * Whether NonlinearSolverType solves with a SparseSchurSolver, which requires the keys with a block
+ * diagonal hessian to be last
+ */
+template <typename NonlinearSolverType, typename = void>
+struct SolvesWithSchurComplement : std::false_type {};
+
+template <typename NonlinearSolverType>
+struct SolvesWithSchurComplement<
+    NonlinearSolverType,
+    std::enable_if_t<std::is_same<
+        typename NonlinearSolverType::LinearSolver,
+        SparseSchurSolver<typename NonlinearSolverType::LinearSolver::MatrixType>>::value>>
+    : std::true_type {};
+
+/**
+ * Whether NonlinearSolverType can evaluate candidate steps residual-only, i.e. whether it has a
+ * ResidualFunc and an Iterate overload that takes one (see LevenbergMarquardtSolver)
+ */
+template <typename NonlinearSolverType, typename = void>
+struct TakesResidualFunc : std::false_type {};
+
+template <typename NonlinearSolverType>
+struct TakesResidualFunc<
+    NonlinearSolverType,
+    std::enable_if_t<std::is_same<
+        typename NonlinearSolverType::ResidualFunc,
+        std::function<void(const Values<typename NonlinearSolverType::Scalar>&,
+                           VectorX<typename NonlinearSolverType::Scalar>* const)>>::value>>
+    : std::true_type {};
+
+/**
+ * Run one iteration of solver, passing residual_func if the solver takes one
+ */
+template <typename NonlinearSolverType>
+std::enable_if_t<TakesResidualFunc<NonlinearSolverType>::value, bool> IterateNonlinearSolver(
+    NonlinearSolverType* const solver, const typename NonlinearSolverType::LinearizeFunc& func,
+    const typename NonlinearSolverType::ResidualFunc& residual_func,
+    OptimizationStats<typename NonlinearSolverType::Scalar>* const stats, const bool debug_stats) {
+  return solver->Iterate(func, residual_func, stats, debug_stats);
+}
+
+template <typename NonlinearSolverType, typename ResidualFunc>
+std::enable_if_t<!TakesResidualFunc<NonlinearSolverType>::value, bool> IterateNonlinearSolver(
+    NonlinearSolverType* const solver, const typename NonlinearSolverType::LinearizeFunc& func,
+    const ResidualFunc& /* residual_func */,
+    OptimizationStats<typename NonlinearSolverType::Scalar>* const stats, const bool debug_stats) {
+  return solver->Iterate(func, stats, debug_stats);
+}
+
+/**
+ * Whether NonlinearSolverType exposes its LinearSolver with GetLinearSolver, and that is a
+ * SparseCholeskySolver on an Eigen::SparseMatrix, like the one Optimizer::ComputeAllCovariances
+ * uses
+ */
+template <typename NonlinearSolverType, typename = void>
+struct ExposesSparseCholeskySolver : std::false_type {};
+
+template <typename NonlinearSolverType>
+struct ExposesSparseCholeskySolver<
+    NonlinearSolverType,
+    std::enable_if_t<std::is_same<
+        std::decay_t<decltype(std::declval<const NonlinearSolverType&>().GetLinearSolver())>,
+        SparseCholeskySolver<Eigen::SparseMatrix<typename NonlinearSolverType::Scalar>>>::value>>
+    : std::true_type {};
+
+/**
+ * A SparseCholeskySolver for computing covariances, with the same ordering, factorization and
+ * number of threads as the linear solver of solver if it is also a SparseCholeskySolver
+ */
+template <typename NonlinearSolverType>
+std::enable_if_t<ExposesSparseCholeskySolver<NonlinearSolverType>::value,
+                 SparseCholeskySolver<Eigen::SparseMatrix<typename NonlinearSolverType::Scalar>>>
+MakeCovarianceSolver(const NonlinearSolverType& solver) {
+  const auto& linear_solver = solver.GetLinearSolver();
+  return {linear_solver.GetOrdering(), linear_solver.FactorizationMode(),
+          linear_solver.NumThreads()};
+}
+
+template <typename NonlinearSolverType>
+std::enable_if_t<!ExposesSparseCholeskySolver<NonlinearSolverType>::value,
+                 SparseCholeskySolver<Eigen::SparseMatrix<typename NonlinearSolverType::Scalar>>>
+MakeCovarianceSolver(const NonlinearSolverType& /* solver */) {
+  return {};
+}
+
+}  // namespace internal
+
 /**
  * Class for optimizing a nonlinear least-squares problem specified as a list of Factors.  For
  * efficient use, create once and call Optimize() multiple times with different initial guesses, as
@@ -61,6 +172,22 @@ namespace sym {
  *   sym::Optimizer<double> optimizer(params, factors, epsilon);
  *   optimizer.Optimize(&values);
  *
+ * NonlinearSolverType is a LevenbergMarquardtSolver by default, and can also be a DoglegSolver,
+ * which avoids refactorizing the hessian when a step is rejected.
+ *
+ * If optimizer_params_t::defer_linearization is set and the NonlinearSolverType supports it (e.g.
+ * the LevenbergMarquardtSolver), candidate steps are evaluated with Linearizer::EvaluateResidual,
+ * and only accepted steps are fully linearized.
+ *
+ * If the linear solver of the NonlinearSolverType takes a BlockSparseMatrix, such as
+ * LevenbergMarquardtSolver<Scalar, BlockSparseCholeskySolver<Scalar>>, the Linearizer builds the
+ * hessian in block sparse form (see Linearizer::SetBlockSparseHessian).
+ *
+ * If the linear solver is a SparseSchurSolver, the keys are reordered so that a set of keys with a
+ * block diagonal hessian (e.g. the landmarks in bundle adjustment) is last, and the solver only
+ * factorizes the Schur complement on the other keys (see OrderBlockDiagonalKeysLast).  Keys()
+ * returns the keys in this order.
+ *
  * See symforce/test/symforce_optimizer_test.cc for more examples
  */
 template <typename ScalarType, typename NonlinearSolverType = LevenbergMarquardtSolver<ScalarType>>
@@ -69,6 +196,9 @@ class Optimizer {
   using Scalar = ScalarType;
   using NonlinearSolver = NonlinearSolverType;
 
+  // Function that evaluates only the residual, see Linearizer::EvaluateResidual
+  using ResidualFunc = std::function<void(const Values<Scalar>&, VectorX<Scalar>* const)>;
+
   /**
    * Constructor that copies in factors and keys
    */
@@ -186,6 +316,12 @@ class Optimizer {
    * keys that are not optimized by this Optimizer.
    *
    * May not be called before either Optimize or Linearize has been called.
+   *
+   * Only the entries of the inverse hessian on the sparsity pattern of its cholesky factor are
+   * computed (see SparseCholeskySolver::ComputeSelectedInverse), so this takes memory proportional
+   * to the factor rather than to the square of the problem dimension.  If the nonlinear solver
+   * solves with a SparseCholeskySolver, the factorization uses the same ordering and options,
+   * otherwise it uses the defaults of SparseCholeskySolver.
    */
   void ComputeAllCovariances(const Linearization<Scalar>& linearization,
                              std::unordered_map<Key, MatrixX<Scalar>>* covariances_by_key);
@@ -247,6 +383,12 @@ class Optimizer {
    */
   typename NonlinearSolver::LinearizeFunc BuildLinearizeFunc(const bool check_derivatives);
 
+  /**
+   * Build the residual_func functor, for nonlinear solvers that evaluate candidate steps
+   * residual-only
+   */
+  ResidualFunc BuildResidualFunc();
+
   bool IsInitialized() const;
 
   /**
@@ -256,6 +398,13 @@ class Optimizer {
 
   const std::string& GetName();
 
+  /**
+   * The keys in the order of the state vector for the linear solver, which is the order of keys
+   * unless the linear solver requires a different order
+   */
+  static std::vector<Key> OrderKeysForLinearSolver(const std::vector<Factor<Scalar>>& factors,
+                                                   std::vector<Key> keys);
+
   // Store a copy of the nonlinear factors. The Linearization object in the state keeps a
   // pointer to this memory.
   std::vector<Factor<Scalar>> factors_;
@@ -276,16 +425,24 @@ class Optimizer {
 
   // Covariance matrix and damped Hessian, only used by ComputeCovariances but cached here to save
   // reallocations. This may be the full problem covariance, or a subblock; it's always the full
-  // problem Hessian
+  // problem Hessian.  ComputeAllCovariances also keeps its sparse cholesky solver, whose symbolic
+  // factorization is reused across calls while the sparsity pattern of the Hessian it was computed
+  // for (stored in analyzed_outer_index and analyzed_inner_index) stays the same, and the selected
+  // inverse of the damped Hessian.
   struct ComputeCovariancesStorage {
     sym::MatrixX<Scalar> covariance;
     Eigen::SparseMatrix<Scalar> H_damped;
+    SparseCholeskySolver<Eigen::SparseMatrix<Scalar>> solver;
+    std::vector<typename Eigen::SparseMatrix<Scalar>::StorageIndex> analyzed_outer_index;
+    std::vector<typename Eigen::SparseMatrix<Scalar>::StorageIndex> analyzed_inner_index;
+    Eigen::SparseMatrix<Scalar> selected_inverse;
   };
 
   mutable ComputeCovariancesStorage compute_covariances_storage_;
 
   // Functor for interfacing with the optimizer
   typename NonlinearSolver::LinearizeFunc linearize_func_;
+  ResidualFunc residual_func_;
 };
 
 // Shorthand instantiations
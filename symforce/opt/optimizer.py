@@ -99,6 +99,10 @@ class Optimizer:
         iterations: int = 50
         early_exit_min_reduction: float = 1e-6
         enable_bold_updates: bool = False
+        num_threads: int = 1
+        defer_linearization: bool = False
+        hessian_only_linearization: bool = False
+        speculative_lambdas: int = 1
 
     @dataclass
     class Result:
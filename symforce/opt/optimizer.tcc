@@ -3,6 +3,8 @@
  * This source code is under the Apache 2.0 license found in the LICENSE file.
  * ---------------------------------------------------------------------------- */
 
+#include <algorithm>
+
 #include "./internal/covariance_utils.h"
 #include "./internal/derivative_checker.h"
 #include "./optimizer.h"
@@ -24,10 +26,12 @@ Optimizer<ScalarType, NonlinearSolverType>::Optimizer(const optimizer_params_t&
       nonlinear_solver_(params, name, epsilon),
       epsilon_(epsilon),
       debug_stats_(debug_stats),
-      keys_(keys.empty() ? ComputeKeysToOptimize(factors_) : keys),
+      keys_(OrderKeysForLinearSolver(factors_,
+                                     keys.empty() ? ComputeKeysToOptimize(factors_) : keys)),
       index_(),
-      linearizer_(name_, factors_, keys_),
-      linearize_func_(BuildLinearizeFunc(check_derivatives)) {}
+      linearizer_(name_, factors_, keys_, params.num_threads),
+      linearize_func_(BuildLinearizeFunc(check_derivatives)),
+      residual_func_(BuildResidualFunc()) {}
 
 template <typename ScalarType, typename NonlinearSolverType>
 template <typename... NonlinearSolverArgs>
@@ -41,10 +45,12 @@ Optimizer<ScalarType, NonlinearSolverType>::Optimizer(
                         std::forward<NonlinearSolverArgs>(nonlinear_solver_args)...),
       epsilon_(epsilon),
       debug_stats_(debug_stats),
-      keys_(keys.empty() ? ComputeKeysToOptimize(factors_) : keys),
+      keys_(OrderKeysForLinearSolver(factors_,
+                                     keys.empty() ? ComputeKeysToOptimize(factors_) : keys)),
       index_(),
-      linearizer_(name_, factors_, keys_),
-      linearize_func_(BuildLinearizeFunc(check_derivatives)) {}
+      linearizer_(name_, factors_, keys_, params.num_threads),
+      linearize_func_(BuildLinearizeFunc(check_derivatives)),
+      residual_func_(BuildResidualFunc()) {}
 
 template <typename ScalarType, typename NonlinearSolverType>
 Optimizer<ScalarType, NonlinearSolverType>::Optimizer(const optimizer_params_t& params,
@@ -57,10 +63,12 @@ Optimizer<ScalarType, NonlinearSolverType>::Optimizer(const optimizer_params_t&
       nonlinear_solver_(params, name, epsilon),
       epsilon_(epsilon),
       debug_stats_(debug_stats),
-      keys_(keys.empty() ? ComputeKeysToOptimize(factors_) : std::move(keys)),
+      keys_(OrderKeysForLinearSolver(
+          factors_, keys.empty() ? ComputeKeysToOptimize(factors_) : std::move(keys))),
       index_(),
-      linearizer_(name_, factors_, keys_),
-      linearize_func_(BuildLinearizeFunc(check_derivatives)) {}
+      linearizer_(name_, factors_, keys_, params.num_threads),
+      linearize_func_(BuildLinearizeFunc(check_derivatives)),
+      residual_func_(BuildResidualFunc()) {}
 
 template <typename ScalarType, typename NonlinearSolverType>
 template <typename... NonlinearSolverArgs>
@@ -73,10 +81,12 @@ Optimizer<ScalarType, NonlinearSolverType>::Optimizer(
                         std::forward<NonlinearSolverArgs>(nonlinear_solver_args)...),
       epsilon_(epsilon),
       debug_stats_(debug_stats),
-      keys_(keys.empty() ? ComputeKeysToOptimize(factors_) : std::move(keys)),
+      keys_(OrderKeysForLinearSolver(
+          factors_, keys.empty() ? ComputeKeysToOptimize(factors_) : std::move(keys))),
       index_(),
-      linearizer_(name_, factors_, keys_),
-      linearize_func_(BuildLinearizeFunc(check_derivatives)) {}
+      linearizer_(name_, factors_, keys_, params.num_threads),
+      linearize_func_(BuildLinearizeFunc(check_derivatives)),
+      residual_func_(BuildResidualFunc()) {}
 
 // ----------------------------------------------------------------------------
 // Public methods
@@ -139,10 +149,40 @@ void Optimizer<ScalarType, NonlinearSolverType>::ComputeAllCovariances(
     const Linearization<Scalar>& linearization,
     std::unordered_map<Key, MatrixX<Scalar>>* const covariances_by_key) {
   SYM_ASSERT(IsInitialized());
-  nonlinear_solver_.ComputeCovariance(linearization.hessian_lower,
-                                      &compute_covariances_storage_.covariance);
-  linearizer_.SplitCovariancesByKey(compute_covariances_storage_.covariance, keys_,
-                                    covariances_by_key);
+  SYM_TIME_SCOPE("Optimizer<{}>::ComputeAllCovariances", name_);
+
+  // Only the blocks on the diagonal of the covariance are needed, which are in the selected
+  // inverse of the damped hessian, so we never form the full covariance
+  ComputeCovariancesStorage& storage = compute_covariances_storage_;
+  storage.H_damped = linearization.HessianLower();
+  storage.H_damped.diagonal().array() += epsilon_;
+
+  // The symbolic factorization is only valid for the pattern it was computed for
+  const auto& H = storage.H_damped;
+  const bool same_pattern =
+      storage.solver.IsInitialized() &&
+      std::equal(storage.analyzed_outer_index.begin(), storage.analyzed_outer_index.end(),
+                 H.outerIndexPtr(), H.outerIndexPtr() + H.outerSize() + 1) &&
+      std::equal(storage.analyzed_inner_index.begin(), storage.analyzed_inner_index.end(),
+                 H.innerIndexPtr(), H.innerIndexPtr() + H.nonZeros());
+  if (!same_pattern) {
+    storage.solver = internal::MakeCovarianceSolver(nonlinear_solver_);
+    storage.solver.ComputeSymbolicSparsity(H);
+    storage.analyzed_outer_index.assign(H.outerIndexPtr(), H.outerIndexPtr() + H.outerSize() + 1);
+    storage.analyzed_inner_index.assign(H.innerIndexPtr(), H.innerIndexPtr() + H.nonZeros());
+  }
+  storage.solver.Factorize(H);
+  storage.solver.ComputeSelectedInverse(&storage.selected_inverse);
+
+  const auto& state_index = linearizer_.StateIndex();
+  for (const Key& key : keys_) {
+    const index_entry_t& entry = state_index.at(key.GetLcmType());
+    storage.solver.SelectedInverseBlock(storage.selected_inverse, entry.offset, entry.tangent_dim,
+                                        &(*covariances_by_key)[key]);
+  }
+
+  // If this fails, covariances_by_key contained keys not optimized by this Optimizer
+  SYM_ASSERT(covariances_by_key->size() == keys_.size());
 }
 
 template <typename ScalarType, typename NonlinearSolverType>
@@ -154,7 +194,7 @@ void Optimizer<ScalarType, NonlinearSolverType>::ComputeCovariances(
   SYM_ASSERT(contiguous);
 
   // Copy into modifiable storage
-  compute_covariances_storage_.H_damped = linearization.hessian_lower;
+  compute_covariances_storage_.H_damped = linearization.HessianLower();
 
   internal::ComputeCovarianceBlockWithSchurComplement(&compute_covariances_storage_.H_damped,
                                                       block_dim, epsilon_,
@@ -206,7 +246,8 @@ void Optimizer<ScalarType, NonlinearSolverType>::IterateToConvergence(
 
   // Iterate
   for (int i = 0; i < num_iterations; i++) {
-    const bool should_early_exit = nonlinear_solver_.Iterate(linearize_func_, stats, debug_stats_);
+    const bool should_early_exit = internal::IterateNonlinearSolver(
+        &nonlinear_solver_, linearize_func_, residual_func_, stats, debug_stats_);
     if (should_early_exit) {
       optimization_early_exited = true;
       break;
@@ -249,17 +290,34 @@ Optimizer<ScalarType, NonlinearSolverType>::BuildLinearizeFunc(const bool check_
 
     if (check_derivatives) {
       SYM_ASSERT(linearization != nullptr);
+      // The derivatives are checked against the combined jacobian
+      SYM_ASSERT(linearization->HasJacobian());
       SYM_ASSERT(
           internal::CheckDerivatives(&linearizer_, values, index_, *linearization, epsilon_));
     }
   };
 }
 
+template <typename ScalarType, typename NonlinearSolverType>
+typename Optimizer<ScalarType, NonlinearSolverType>::ResidualFunc
+Optimizer<ScalarType, NonlinearSolverType>::BuildResidualFunc() {
+  return [this](const Values<Scalar>& values, VectorX<Scalar>* const residual) {
+    linearizer_.EvaluateResidual(values, residual);
+  };
+}
+
 template <typename ScalarType, typename NonlinearSolverType>
 void Optimizer<ScalarType, NonlinearSolverType>::Initialize(const Values<Scalar>& values) {
   if (!IsInitialized()) {
     index_ = values.CreateIndex(keys_);
     nonlinear_solver_.SetIndex(index_);
+    if (internal::SolvesBlockSparseHessian<NonlinearSolverType>::value &&
+        !linearizer_.IsInitialized()) {
+      linearizer_.SetBlockSparseHessian(true);
+    }
+    if (nonlinear_solver_.Params().hessian_only_linearization && !linearizer_.IsInitialized()) {
+      linearizer_.SetHessianOnly(true);
+    }
   }
 }
 
@@ -268,6 +326,15 @@ const std::string& Optimizer<ScalarType, NonlinearSolverType>::GetName() {
   return name_;
 }
 
+template <typename ScalarType, typename NonlinearSolverType>
+std::vector<Key> Optimizer<ScalarType, NonlinearSolverType>::OrderKeysForLinearSolver(
+    const std::vector<Factor<Scalar>>& factors, std::vector<Key> keys) {
+  if (internal::SolvesWithSchurComplement<NonlinearSolverType>::value) {
+    return OrderBlockDiagonalKeysLast(factors, keys);
+  }
+  return keys;
+}
+
 extern template class Optimizer<double>;
 extern template class Optimizer<float>;
 
@@ -5,11 +5,16 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <Eigen/Dense>
 #include <Eigen/MetisSupport>
 #include <Eigen/Sparse>
 
+#include "./assert.h"
 #include "./cholesky/sparse_cholesky_solver.h"
+#include "./internal/thread_pool.h"
 
 namespace sym {
 
@@ -54,6 +59,18 @@ namespace sym {
 // y, we can use the equation for z above to solve for z, and we're done.
 //
 // See http://ceres-solver.org/nnls_solving.html#dense-schur-sparse-schur
+//
+// This can be used as the LinearSolverType of a LevenbergMarquardtSolver, in which case the
+// dimension of C is computed from the structure of the hessian (see ComputeSymbolicSparsity), and
+// only S is factorized with a sparse cholesky factorization.  The variables with block diagonal C
+// must come last in the problem; an Optimizer with this linear solver moves them there (see
+// OrderBlockDiagonalKeysLast).
+//
+// ComputeSymbolicSparsity precomputes the sparsity pattern of S, and for each block of C which
+// entries of S it contributes to, so Factorize only accumulates into preallocated storage and does
+// not allocate (apart from inside the sparse cholesky factorization of S).  Factorize inverts the
+// blocks of C in parallel, and then forms the columns of S in parallel, each column summing its
+// contributions in a fixed order so the result does not depend on the number of threads.
 template <typename _MatrixType>
 class SparseSchurSolver {
  public:
@@ -68,20 +85,40 @@ class SparseSchurSolver {
   using MatrixX = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
   using VectorX = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
 
+  // Args:
+  //     ordering: The ordering for the sparse cholesky factorization of S
+  //     num_threads: Number of threads to factorize with, including the calling thread.  Used both
+  //         to form S and by the sparse cholesky factorization of S.
   SparseSchurSolver(const typename SMatrixSolverType::Ordering& ordering =
-                        Eigen::MetisOrdering<typename SMatrixSolverType::StorageIndex>())
-      : is_initialized_(false), S_solver_(ordering) {}
+                        Eigen::MetisOrdering<typename SMatrixSolverType::StorageIndex>(),
+                    const int num_threads = 1)
+      : is_initialized_(false),
+        num_threads_(num_threads),
+        S_solver_(ordering, SMatrixSolverType::Factorization::SIMPLICIAL, num_threads) {}
 
   bool IsInitialized() const {
     return is_initialized_;
   }
 
+  int NumThreads() const {
+    return num_threads_;
+  }
+
   // Analyzes A and precomputes/allocates some things (some additional initialization is also done
   // on the first call to Factorize)
   //
-  // `A` should be lower triangular
+  // `A` should be lower triangular and compressed, and later calls to Factorize must have the same
+  // sparsity pattern
   void ComputeSymbolicSparsity(const MatrixType& A, const int C_dim);
 
+  // Analyzes A, with C the largest block diagonal block of A at the bottom right whose blocks are
+  // dense.  B always keeps at least one row and column.
+  void ComputeSymbolicSparsity(const MatrixType& A);
+
+  // The dimension of the largest block diagonal block of the lower triangular A at its bottom
+  // right, whose blocks are dense, such that the rest of A is not empty
+  static int BlockDiagonalTailDim(const MatrixType& A);
+
   void Factorize(const MatrixType& A);
 
   // Solve A x = rhs, return x
@@ -98,8 +135,45 @@ class SparseSchurSolver {
   //                is stored here
   void SInvInPlace(Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>* const x_and_rhs) const;
 
+  // Solves in place for x in A x = b, where x and b are dense
+  template <typename Rhs>
+  void SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const;
+
+  // Dimensions of B and C
+  int BDim() const {
+    return sparsity_information_.B_dim_;
+  }
+
+  int CDim() const {
+    return sparsity_information_.C_dim_;
+  }
+
+  // The factor L of S, as computed by the sparse cholesky solver for S.  Requires a call to
+  // Factorize first.
+  const typename SMatrixSolverType::CholMatrixType& L() const {
+    return S_solver_.L();
+  }
+
+  // The permutation of A, which is the permutation of the sparse cholesky solver for S on B, and
+  // the identity on C.  Requires a call to Factorize first.
+  const typename SMatrixSolverType::PermutationMatrixType& Permutation() const {
+    SYM_ASSERT(S_solver_.IsInitialized());
+    return permutation_;
+  }
+
  private:
+  // Invert block `block_index` of C into the values of C_inv_lower, and compute L^-1 E^T for its
+  // block row of E^T, where L is its cholesky factor, into the workspace.  Dim is the dimension of
+  // the block if it is known at compile time, or Eigen::Dynamic.
+  template <int Dim>
+  void FactorizeCBlock(const MatrixType& A, int block_index);
+
+  // Compute column `col` of S_lower from B and the contributions of the blocks of C, and copy
+  // column `col` of E^T
+  void FormSColumn(const MatrixType& A, int col);
+
   bool is_initialized_;
+  int num_threads_;
 
   // Data that depends only on the structure of A, not on the values
   struct SparsityInformation {
@@ -108,12 +182,60 @@ class SparseSchurSolver {
       int start_idx;
       int dim;
       std::vector<int> col_starts_in_C_inv;
+
+      // Range in coupled_cols_ of the columns of B this block is coupled to, i.e. the nonzero
+      // columns of its block row of E^T
+      int coupled_start;
+      int num_coupled;
+
+      // Range in E_entries_ of the entries of A in this block row of E^T
+      int E_entries_start;
+      int E_entries_end;
+
+      // Offsets of this block in C_workspace and E_workspace
+      int C_workspace_offset;
+      int E_workspace_offset;
+    };
+
+    // An entry of A in a block row of E^T, as the index into the values of A and the index into
+    // the dense dim x num_coupled matrix for the block
+    struct EEntry {
+      int value_index;
+      int dense_index;
+    };
+
+    // The contribution of one block of C to one column of S, which is
+    //     -(L^-1 E^T)[:, position:]^T * (L^-1 E^T)[:, position]
+    // for the block's matrix L^-1 E^T, added to the values of S at
+    // S_scatter_indices_[scatter_start:scatter_start + num_coupled - position]
+    struct SContribution {
+      int block;
+      int position;
+      int scatter_start;
     };
 
     int total_dim_;
     int B_dim_;
     int C_dim_;
     std::vector<CBlock> C_blocks_;
+
+    std::vector<int> coupled_cols_;
+    std::vector<EEntry> E_entries_;
+
+    // For each value of S_lower, the index of the value of A in B at the same position, or -1
+    std::vector<int> S_B_sources_;
+
+    // The contributions to column j of S are
+    // S_contributions_[S_contribution_starts_[j]:S_contribution_starts_[j + 1]], in increasing
+    // order of block
+    std::vector<int> S_contribution_starts_;
+    std::vector<SContribution> S_contributions_;
+    std::vector<int> S_scatter_indices_;
+
+    // For each column of B, the index into the values of A of the first entry in E^T
+    std::vector<int> E_value_starts_;
+
+    int A_nonzeros_;
   };
 
   // Data that depends on the structure and values in A.  Not cleared on calls to Factorize however,
@@ -122,11 +244,23 @@ class SparseSchurSolver {
     Eigen::SparseMatrix<Scalar> C_inv_lower;
     Eigen::SparseMatrix<Scalar> E_transpose;
     Eigen::SparseMatrix<Scalar> S_lower;
+
+    // For each block of C, its cholesky factor and inverse, as dense dim x dim matrices
+    VectorX C_workspace;
+
+    // For each block of C, L^-1 E^T for its block row of E^T, as a dense dim x num_coupled matrix
+    VectorX E_workspace;
   };
 
   SparsityInformation sparsity_information_;
   FactorizationData factorization_data_;
   SMatrixSolverType S_solver_;
+
+  // Whether the symbolic factorization of S needs to be computed on the next call to Factorize
+  bool S_needs_analysis_{true};
+  typename SMatrixSolverType::PermutationMatrixType permutation_;
+
+  std::shared_ptr<internal::ThreadPool> thread_pool_;
 };
 
 }  // namespace sym
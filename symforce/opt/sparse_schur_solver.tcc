@@ -5,19 +5,53 @@
 
 #pragma once
 
+#include <algorithm>
+#include <type_traits>
+
 #include "./assert.h"
 #include "./sparse_schur_solver.h"
 
 namespace sym {
+namespace internal {
+
+// Calls func(std::integral_constant<int, Dim>()), where Dim is dim for the block dimensions with
+// fixed-size kernels, and Eigen::Dynamic for other dimensions
+template <typename Func>
+void DispatchSchurBlockDim(const int dim, Func&& func) {
+  switch (dim) {
+    case 1:
+      func(std::integral_constant<int, 1>());
+      return;
+    case 2:
+      func(std::integral_constant<int, 2>());
+      return;
+    case 3:
+      func(std::integral_constant<int, 3>());
+      return;
+    case 4:
+      func(std::integral_constant<int, 4>());
+      return;
+    case 6:
+      func(std::integral_constant<int, 6>());
+      return;
+    default:
+      func(std::integral_constant<int, Eigen::Dynamic>());
+      return;
+  }
+}
+
+}  // namespace internal
 
 template <typename _MatrixType>
 void SparseSchurSolver<_MatrixType>::ComputeSymbolicSparsity(const MatrixType& A, const int C_dim) {
   // A must be square
   SYM_ASSERT(A.rows() == A.cols());
+  SYM_ASSERT(A.isCompressed());
 
   sparsity_information_.total_dim_ = A.rows();
   sparsity_information_.B_dim_ = sparsity_information_.total_dim_ - C_dim;
   sparsity_information_.C_dim_ = C_dim;
+  sparsity_information_.C_blocks_.clear();
 
   // Iterate over blocks along the diagonal of C
   bool currently_in_block = false;
@@ -86,47 +120,327 @@ void SparseSchurSolver<_MatrixType>::ComputeSymbolicSparsity(const MatrixType& A
   Eigen::SparseMatrix<Scalar>& C_inv_lower = factorization_data_.C_inv_lower;
   C_inv_lower = Eigen::SparseMatrix<Scalar>(C_dim, C_dim);
   C_inv_lower.setFromTriplets(triplets.begin(), triplets.end());
+
+  SparsityInformation& info = sparsity_information_;
+  const int B_dim = info.B_dim_;
+  const int num_blocks = static_cast<int>(info.C_blocks_.size());
+  const auto* const A_outer = A.outerIndexPtr();
+  const auto* const A_inner = A.innerIndexPtr();
+  info.A_nonzeros_ = static_cast<int>(A.nonZeros());
+
+  std::vector<int> block_for_row(C_dim);
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    const auto& block = info.C_blocks_[block_index];
+    std::fill_n(block_for_row.begin() + (block.start_idx - B_dim), block.dim, block_index);
+  }
+
+  // Find the columns of B coupled to each block of C, and the entries of A in each block row of E^T
+  std::vector<std::vector<int>> coupled_cols(num_blocks);
+  std::vector<std::vector<typename SparsityInformation::EEntry>> E_entries(num_blocks);
+  info.E_value_starts_.resize(B_dim);
+  for (int col = 0; col < B_dim; ++col) {
+    info.E_value_starts_[col] = A_outer[col + 1];
+    for (int index = A_outer[col + 1] - 1; index >= A_outer[col] && A_inner[index] >= B_dim;
+         --index) {
+      info.E_value_starts_[col] = index;
+    }
+
+    for (int index = info.E_value_starts_[col]; index < A_outer[col + 1]; ++index) {
+      const int block_index = block_for_row[A_inner[index] - B_dim];
+      const auto& block = info.C_blocks_[block_index];
+      std::vector<int>& block_cols = coupled_cols[block_index];
+      if (block_cols.empty() || block_cols.back() != col) {
+        block_cols.push_back(col);
+      }
+      const int position = static_cast<int>(block_cols.size()) - 1;
+      E_entries[block_index].push_back(
+          {index, position * block.dim + (A_inner[index] - block.start_idx)});
+    }
+  }
+
+  info.coupled_cols_.clear();
+  info.E_entries_.clear();
+  int C_workspace_size = 0;
+  int E_workspace_size = 0;
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    auto& block = info.C_blocks_[block_index];
+    block.coupled_start = static_cast<int>(info.coupled_cols_.size());
+    block.num_coupled = static_cast<int>(coupled_cols[block_index].size());
+    info.coupled_cols_.insert(info.coupled_cols_.end(), coupled_cols[block_index].begin(),
+                              coupled_cols[block_index].end());
+
+    block.E_entries_start = static_cast<int>(info.E_entries_.size());
+    info.E_entries_.insert(info.E_entries_.end(), E_entries[block_index].begin(),
+                           E_entries[block_index].end());
+    block.E_entries_end = static_cast<int>(info.E_entries_.size());
+
+    block.C_workspace_offset = C_workspace_size;
+    C_workspace_size += 2 * block.dim * block.dim;
+    block.E_workspace_offset = E_workspace_size;
+    E_workspace_size += block.dim * block.num_coupled;
+  }
+  factorization_data_.C_workspace.resize(C_workspace_size);
+  factorization_data_.E_workspace.resize(E_workspace_size);
+
+  // The pattern of S is the lower triangle of B, plus every pair of columns coupled to the same
+  // block of C
+  std::vector<std::vector<int>> S_col_rows(B_dim);
+  for (int col = 0; col < B_dim; ++col) {
+    for (int index = A_outer[col]; index < info.E_value_starts_[col]; ++index) {
+      if (A_inner[index] >= col) {
+        S_col_rows[col].push_back(A_inner[index]);
+      }
+    }
+  }
+  for (const std::vector<int>& block_cols : coupled_cols) {
+    for (size_t position = 0; position < block_cols.size(); ++position) {
+      S_col_rows[block_cols[position]].insert(S_col_rows[block_cols[position]].end(),
+                                              block_cols.begin() + position, block_cols.end());
+    }
+  }
+
+  Eigen::SparseMatrix<Scalar>& S_lower = factorization_data_.S_lower;
+  S_lower = Eigen::SparseMatrix<Scalar>(B_dim, B_dim);
+  Eigen::VectorXi S_col_sizes(B_dim);
+  for (int col = 0; col < B_dim; ++col) {
+    std::vector<int>& rows = S_col_rows[col];
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    S_col_sizes[col] = static_cast<int>(rows.size());
+  }
+  S_lower.reserve(S_col_sizes);
+  for (int col = 0; col < B_dim; ++col) {
+    for (const int row : S_col_rows[col]) {
+      S_lower.insert(row, col) = 0;
+    }
+  }
+  S_lower.makeCompressed();
+
+  const auto S_index = [&S_lower](const int row, const int col) {
+    const auto* const begin = S_lower.innerIndexPtr() + S_lower.outerIndexPtr()[col];
+    const auto* const end = S_lower.innerIndexPtr() + S_lower.outerIndexPtr()[col + 1];
+    return static_cast<int>(std::lower_bound(begin, end, row) - S_lower.innerIndexPtr());
+  };
+
+  info.S_B_sources_.assign(S_lower.nonZeros(), -1);
+  for (int col = 0; col < B_dim; ++col) {
+    for (int index = A_outer[col]; index < info.E_value_starts_[col]; ++index) {
+      if (A_inner[index] >= col) {
+        info.S_B_sources_[S_index(A_inner[index], col)] = index;
+      }
+    }
+  }
+
+  // Group the contributions of the blocks of C by column of S, in increasing order of block
+  info.S_contribution_starts_.assign(B_dim + 1, 0);
+  for (const int col : info.coupled_cols_) {
+    info.S_contribution_starts_[col + 1]++;
+  }
+  std::partial_sum(info.S_contribution_starts_.begin(), info.S_contribution_starts_.end(),
+                   info.S_contribution_starts_.begin());
+  info.S_contributions_.resize(info.coupled_cols_.size());
+  std::vector<int> next_contribution(info.S_contribution_starts_.begin(),
+                                     info.S_contribution_starts_.end() - 1);
+  for (int block_index = 0; block_index < num_blocks; ++block_index) {
+    const auto& block = info.C_blocks_[block_index];
+    for (int position = 0; position < block.num_coupled; ++position) {
+      const int col = info.coupled_cols_[block.coupled_start + position];
+      info.S_contributions_[next_contribution[col]++] = {block_index, position, 0};
+    }
+  }
+
+  info.S_scatter_indices_.clear();
+  for (int col = 0; col < B_dim; ++col) {
+    for (int i = info.S_contribution_starts_[col]; i < info.S_contribution_starts_[col + 1]; ++i) {
+      auto& contribution = info.S_contributions_[i];
+      const auto& block = info.C_blocks_[contribution.block];
+      contribution.scatter_start = static_cast<int>(info.S_scatter_indices_.size());
+      for (int position = contribution.position; position < block.num_coupled; ++position) {
+        info.S_scatter_indices_.push_back(
+            S_index(info.coupled_cols_[block.coupled_start + position], col));
+      }
+    }
+  }
+
+  factorization_data_.E_transpose = A.block(B_dim, 0, C_dim, B_dim);
+
+  if (num_threads_ > 1) {
+    thread_pool_ = std::make_shared<internal::ThreadPool>(num_threads_);
+  } else {
+    thread_pool_ = nullptr;
+  }
+
+  S_needs_analysis_ = true;
+  is_initialized_ = true;
+}
+
+template <typename _MatrixType>
+void SparseSchurSolver<_MatrixType>::ComputeSymbolicSparsity(const MatrixType& A) {
+  ComputeSymbolicSparsity(A, BlockDiagonalTailDim(A));
+}
+
+template <typename _MatrixType>
+int SparseSchurSolver<_MatrixType>::BlockDiagonalTailDim(const MatrixType& A) {
+  SYM_ASSERT(A.rows() == A.cols());
+
+  // Walk the columns backwards.  C can be extended by a column if the column's entries are a
+  // contiguous run of rows from the diagonal, which either ends at the diagonal (starting a new
+  // 1x1 block) or extends the block starting at the next column, whose own entries must end at
+  // the same row.
+  int C_start = A.cols();
+  int block_end = -1;
+  int first_block_end = -1;
+  for (int col = A.cols() - 1; col >= 0; --col) {
+    int end_row = -1;
+    bool contiguous = true;
+    for (typename MatrixType::InnerIterator it(A, col); it; ++it) {
+      if ((end_row == -1 && it.row() != col) || (end_row != -1 && it.row() != end_row + 1)) {
+        contiguous = false;
+        break;
+      }
+      end_row = it.row();
+    }
+
+    if (!contiguous || end_row == -1 || (end_row != col && end_row != block_end)) {
+      break;
+    }
+
+    if (end_row == col) {
+      // This column starts a new block, ending at itself
+      block_end = col;
+    }
+    first_block_end = block_end;
+    C_start = col;
+  }
+
+  // Leave the first block in B if all of A is block diagonal
+  if (C_start == 0) {
+    C_start = first_block_end + 1;
+  }
+
+  return A.cols() - C_start;
 }
 
 // TODO(aaron): Record conditioning information here, and have a way for the user to get it
 template <typename _MatrixType>
 void SparseSchurSolver<_MatrixType>::Factorize(const MatrixType& A) {
-  // Compute C_inv
+  SYM_ASSERT(IsInitialized());
+  SYM_ASSERT(A.isCompressed());
+  SYM_ASSERT(A.nonZeros() == sparsity_information_.A_nonzeros_);
+
+  // Compute C_inv, and L^-1 E^T for each block of C
   // NOTE(aaron): Doing this with dense block-wise inversions is faster than a full sparse inversion
-  Eigen::SparseMatrix<Scalar>& C_inv_lower = factorization_data_.C_inv_lower;
-  for (const typename SparsityInformation::CBlock& block : sparsity_information_.C_blocks_) {
-    const MatrixX dense_block = A.block(block.start_idx, block.start_idx, block.dim, block.dim);
+  const int num_blocks = static_cast<int>(sparsity_information_.C_blocks_.size());
+  const auto factorize_block = [this, &A](const int block_index) {
+    internal::DispatchSchurBlockDim(
+        sparsity_information_.C_blocks_[block_index].dim, [this, &A, block_index](auto dim) {
+          this->template FactorizeCBlock<decltype(dim)::value>(A, block_index);
+        });
+  };
+
+  // Then S = B - E C^-1 E^T, one column at a time
+  const auto form_column = [this, &A](const int col) { FormSColumn(A, col); };
+
+  if (thread_pool_ == nullptr) {
+    for (int block_index = 0; block_index < num_blocks; ++block_index) {
+      factorize_block(block_index);
+    }
+    for (int col = 0; col < sparsity_information_.B_dim_; ++col) {
+      form_column(col);
+    }
+  } else {
+    thread_pool_->ParallelFor(0, num_blocks, factorize_block);
+    thread_pool_->ParallelFor(0, sparsity_information_.B_dim_, form_column);
+  }
 
-    // TODO(aaron): Check conditioning explicitly here
-    const MatrixX dense_block_inv =
-        dense_block.template selfadjointView<Eigen::Lower>().llt().solve(
-            MatrixX::Identity(block.dim, block.dim));
+  const Eigen::SparseMatrix<Scalar>& S_lower = factorization_data_.S_lower;
 
-    for (int block_col = 0; block_col < block.dim; block_col++) {
-      const int col_size = block.dim - block_col;
-      Eigen::Map<VectorX>(C_inv_lower.valuePtr(), C_inv_lower.nonZeros())
-          .segment(block.col_starts_in_C_inv[block_col], col_size) =
-          dense_block_inv.block(block_col, block_col, col_size, 1);
+  if (S_needs_analysis_) {
+    S_solver_.ComputeSymbolicSparsity(S_lower);
+    S_needs_analysis_ = false;
+
+    // The full permutation is the permutation of S on B, and the identity on C
+    const int B_dim = sparsity_information_.B_dim_;
+    permutation_.resize(sparsity_information_.total_dim_);
+    permutation_.indices().head(B_dim) = S_solver_.Permutation().indices();
+    for (int i = B_dim; i < sparsity_information_.total_dim_; ++i) {
+      permutation_.indices()[i] = i;
     }
   }
 
-  Eigen::SparseMatrix<Scalar>& E_transpose = factorization_data_.E_transpose;
-  E_transpose = A.block(sparsity_information_.B_dim_, 0, sparsity_information_.C_dim_,
-                        sparsity_information_.B_dim_);
+  S_solver_.Factorize(S_lower);
+}
+
+template <typename _MatrixType>
+template <int Dim>
+void SparseSchurSolver<_MatrixType>::FactorizeCBlock(const MatrixType& A, const int block_index) {
+  const auto& block = sparsity_information_.C_blocks_[block_index];
+  const int dim = block.dim;
+
+  Scalar* const C_data = factorization_data_.C_workspace.data() + block.C_workspace_offset;
+  Eigen::Map<Eigen::Matrix<Scalar, Dim, Dim>> L(C_data, dim, dim);
+  Eigen::Map<Eigen::Matrix<Scalar, Dim, Dim>> C_inv(C_data + dim * dim, dim, dim);
+
+  // The block is dense, so the lower triangle of each of its columns is contiguous in A, starting
+  // at the diagonal
+  for (int col = 0; col < dim; ++col) {
+    L.col(col).tail(dim - col) = Eigen::Map<const VectorX>(
+        A.valuePtr() + A.outerIndexPtr()[block.start_idx + col], dim - col);
+  }
+
+  // TODO(aaron): Check conditioning explicitly here
+  const Eigen::LLT<Eigen::Ref<Eigen::Matrix<Scalar, Dim, Dim>>> llt(L);
 
-  const auto B = A.topLeftCorner(sparsity_information_.B_dim_, sparsity_information_.B_dim_);
+  C_inv.setIdentity();
+  llt.matrixL().solveInPlace(C_inv);
+  llt.matrixU().solveInPlace(C_inv);
+
+  Scalar* const C_inv_values = factorization_data_.C_inv_lower.valuePtr();
+  for (int col = 0; col < dim; ++col) {
+    Eigen::Map<VectorX>(C_inv_values + block.col_starts_in_C_inv[col], dim - col) =
+        C_inv.col(col).tail(dim - col);
+  }
+
+  // E^T C^-1 E = (L^-1 E^T)^T (L^-1 E^T)
+  Eigen::Map<Eigen::Matrix<Scalar, Dim, Eigen::Dynamic>> L_inv_E_transpose(
+      factorization_data_.E_workspace.data() + block.E_workspace_offset, dim, block.num_coupled);
+  L_inv_E_transpose.setZero();
+  for (int i = block.E_entries_start; i < block.E_entries_end; ++i) {
+    const auto& entry = sparsity_information_.E_entries_[i];
+    L_inv_E_transpose.data()[entry.dense_index] = A.valuePtr()[entry.value_index];
+  }
+  llt.matrixL().solveInPlace(L_inv_E_transpose);
+}
 
+template <typename _MatrixType>
+void SparseSchurSolver<_MatrixType>::FormSColumn(const MatrixType& A, const int col) {
+  const SparsityInformation& info = sparsity_information_;
   Eigen::SparseMatrix<Scalar>& S_lower = factorization_data_.S_lower;
-  S_lower.template selfadjointView<Eigen::Lower>() =
-      (B -
-       E_transpose.transpose() * C_inv_lower.template selfadjointView<Eigen::Lower>() * E_transpose)
-          .template selfadjointView<Eigen::Lower>();
+  Scalar* const S_values = S_lower.valuePtr();
 
-  if (!S_solver_.IsInitialized()) {
-    S_solver_.ComputeSymbolicSparsity(S_lower);
+  for (int i = S_lower.outerIndexPtr()[col]; i < S_lower.outerIndexPtr()[col + 1]; ++i) {
+    const int source = info.S_B_sources_[i];
+    S_values[i] = source == -1 ? Scalar(0) : A.valuePtr()[source];
   }
 
-  S_solver_.Factorize(S_lower);
+  for (int i = info.S_contribution_starts_[col]; i < info.S_contribution_starts_[col + 1]; ++i) {
+    const auto& contribution = info.S_contributions_[i];
+    const auto& block = info.C_blocks_[contribution.block];
+    internal::DispatchSchurBlockDim(block.dim, [&](auto dim) {
+      const Eigen::Map<const Eigen::Matrix<Scalar, decltype(dim)::value, Eigen::Dynamic>>
+          L_inv_E_transpose(factorization_data_.E_workspace.data() + block.E_workspace_offset,
+                            block.dim, block.num_coupled);
+      const int* scatter_index = info.S_scatter_indices_.data() + contribution.scatter_start;
+      for (int position = contribution.position; position < block.num_coupled; ++position) {
+        S_values[*scatter_index++] -= L_inv_E_transpose.col(position).dot(
+            L_inv_E_transpose.col(contribution.position));
+      }
+    });
+  }
+
+  Eigen::SparseMatrix<Scalar>& E_transpose = factorization_data_.E_transpose;
+  std::copy(A.valuePtr() + info.E_value_starts_[col], A.valuePtr() + A.outerIndexPtr()[col + 1],
+            E_transpose.valuePtr() + E_transpose.outerIndexPtr()[col]);
 }
 
 template <typename _MatrixType>
@@ -153,6 +467,13 @@ SparseSchurSolver<_MatrixType>::Solve(const Eigen::MatrixBase<RhsType>& rhs) con
   return yz;
 }
 
+template <typename _MatrixType>
+template <typename Rhs>
+void SparseSchurSolver<_MatrixType>::SolveInPlace(Eigen::MatrixBase<Rhs>* const b) const {
+  SYM_ASSERT(b != nullptr);
+  *b = Solve(*b);
+}
+
 template <typename _MatrixType>
 void SparseSchurSolver<_MatrixType>::SInvInPlace(
     Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>* const x_and_rhs) const {
@@ -0,0 +1,178 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./factor.h"
+#include "./factor_batch.h"
+
+namespace sym {
+
+/**
+ * Wraps a function pointer known at compile time in a functor type, so that calls to it can be
+ * inlined wherever the functor type is known.  Usually created with SYM_FUNCTION_FUNCTOR, e.g.
+ *
+ *     using BetweenFunctor = SYM_FUNCTION_FUNCTOR(sym::BetweenFactorPose3<double>);
+ */
+template <typename FunctionPtr, FunctionPtr Function>
+struct FunctionFunctor;
+
+template <typename ReturnType, typename... Args, ReturnType (*Function)(Args...)>
+struct FunctionFunctor<ReturnType (*)(Args...), Function> {
+  ReturnType operator()(Args... args) const {
+    return Function(std::forward<Args>(args)...);
+  }
+};
+
+#define SYM_FUNCTION_FUNCTOR(function) ::sym::FunctionFunctor<decltype(&function), &function>
+
+/**
+ * A factor graph whose factor types are known at compile time.
+ *
+ * Each of the Functors is a fixed size hessian functor, with the same signature as the functors
+ * accepted by Factor::Hessian.  Factors are added for one of the functors at a time, and are
+ * stored grouped by functor.  Factors() returns them as ordinary Factors, one FactorBatch per
+ * functor, so the graph can be passed to the existing Linearizer and Optimizer.  The Linearizer
+ * then evaluates each functor in its own loop, calling the functor type directly (no
+ * std::function) with all matrix dimensions known at compile time.  For the calls to be inlined,
+ * the functors should be class types - use SYM_FUNCTION_FUNCTOR for generated functions.
+ *
+ * Usage:
+ *
+ *     using PriorFunctor = SYM_FUNCTION_FUNCTOR(sym::PriorFactorPose3<double>);
+ *     using BetweenFunctor = SYM_FUNCTION_FUNCTOR(sym::BetweenFactorPose3<double>);
+ *
+ *     sym::StaticFactorGraph<double, PriorFunctor, BetweenFunctor> graph;
+ *     graph.Add<PriorFunctor>({{'P', 0}, 'T', 'S', 'e'}, {{'P', 0}});
+ *     graph.Add<BetweenFunctor>({{'P', 0}, {'P', 1}, 'U', 'S', 'e'}, {{'P', 0}, {'P', 1}});
+ *
+ *     sym::Optimizerd optimizer(params, graph.Factors());
+ */
+template <typename ScalarType, typename... Functors>
+class StaticFactorGraph {
+ public:
+  using Scalar = ScalarType;
+
+  static constexpr int kNumFactorTypes = sizeof...(Functors);
+
+  template <int Index>
+  using FunctorType = std::tuple_element_t<Index, std::tuple<Functors...>>;
+
+  static_assert(kNumFactorTypes > 0, "StaticFactorGraph requires at least one factor type");
+
+  /**
+   * Construct from an instance of each functor
+   */
+  explicit StaticFactorGraph(Functors... functors)
+      : batches_{{FactorBatch<Scalar>(std::move(functors))...}} {}
+
+  /**
+   * Construct with default constructed functors
+   */
+  StaticFactorGraph() : StaticFactorGraph(Functors{}...) {}
+
+  /**
+   * Add a factor evaluating the functor at position Index in Functors on keys_to_func, and
+   * optimizing keys_to_optimize.
+   */
+  template <int Index>
+  void Add(const std::vector<Key>& keys_to_func, const std::vector<Key>& keys_to_optimize) {
+    static_assert(0 <= Index && Index < kNumFactorTypes, "Invalid factor type index");
+    factors_[Index].push_back(batches_[Index].MakeFactor(keys_to_func, keys_to_optimize));
+  }
+
+  /**
+   * Add a factor evaluating the functor at position Index in Functors on keys, and optimizing all
+   * of them.
+   */
+  template <int Index>
+  void Add(const std::vector<Key>& keys) {
+    Add<Index>(keys, keys);
+  }
+
+  /**
+   * Add a factor evaluating the functor of type Functor, which must appear exactly once in
+   * Functors, on keys_to_func, and optimizing keys_to_optimize.
+   */
+  template <typename Functor>
+  void Add(const std::vector<Key>& keys_to_func, const std::vector<Key>& keys_to_optimize) {
+    static_assert(IndexOf<Functor>() >= 0, "Functor must appear exactly once in Functors");
+    Add<IndexOf<Functor>()>(keys_to_func, keys_to_optimize);
+  }
+
+  /**
+   * Add a factor evaluating the functor of type Functor, which must appear exactly once in
+   * Functors, on keys, and optimizing all of them.
+   */
+  template <typename Functor>
+  void Add(const std::vector<Key>& keys) {
+    static_assert(IndexOf<Functor>() >= 0, "Functor must appear exactly once in Functors");
+    Add<IndexOf<Functor>()>(keys, keys);
+  }
+
+  /**
+   * Number of factors of the type at position Index in Functors
+   */
+  template <int Index>
+  int NumFactors() const {
+    static_assert(0 <= Index && Index < kNumFactorTypes, "Invalid factor type index");
+    return static_cast<int>(factors_[Index].size());
+  }
+
+  /**
+   * Total number of factors
+   */
+  int NumFactors() const {
+    int num_factors = 0;
+    for (const auto& factors : factors_) {
+      num_factors += static_cast<int>(factors.size());
+    }
+    return num_factors;
+  }
+
+  /**
+   * All factors in the graph, grouped by type in the order of Functors, and in the order they
+   * were added within each type.
+   */
+  std::vector<Factor<Scalar>> Factors() const {
+    std::vector<Factor<Scalar>> all_factors;
+    all_factors.reserve(NumFactors());
+    for (const auto& factors : factors_) {
+      all_factors.insert(all_factors.end(), factors.begin(), factors.end());
+    }
+    return all_factors;
+  }
+
+ private:
+  template <typename Functor>
+  static constexpr int IndexOf() {
+    constexpr std::array<bool, kNumFactorTypes> matches = {
+        {std::is_same<Functor, Functors>::value...}};
+
+    int index = -1;
+    int num_matches = 0;
+    for (int i = 0; i < kNumFactorTypes; ++i) {
+      if (matches[i]) {
+        index = i;
+        ++num_matches;
+      }
+    }
+    return num_matches == 1 ? index : -1;
+  }
+
+  std::array<FactorBatch<Scalar>, kNumFactorTypes> batches_;
+  std::array<std::vector<Factor<Scalar>>, kNumFactorTypes> factors_;
+};
+
+template <typename ScalarType, typename... Functors>
+constexpr int StaticFactorGraph<ScalarType, Functors...>::kNumFactorTypes;
+
+}  // namespace sym
@@ -43,7 +43,7 @@
 #define _SYMFORCE_OPT_INTERNAL_COMBINE(X, Y) _SYMFORCE_OPT_INTERNAL_COMBINE1(X, Y)
 #define SYM_TIME_SCOPE(fmt_str, ...)                          \
   sym::internal::ScopedTicToc _SYMFORCE_OPT_INTERNAL_COMBINE( \
-      scope_timer_, __LINE__)((fmt::format(fmt_str, ##__VA_ARGS__)))
+      scope_timer_, __LINE__)(fmt_str, ##__VA_ARGS__)
 #endif
 
 #endif  // defined(SYMFORCE_TIC_TOC_HEADER)
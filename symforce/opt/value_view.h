@@ -0,0 +1,95 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include <Eigen/Core>
+
+#include <sym/util/type_ops.h>
+
+namespace sym {
+
+namespace internal {
+
+/**
+ * Construct a T from its storage like StorageOps<T>::FromStorage, except that types with a
+ * FromNormalizedData constructor (the rotations) are not normalized again.  The storage of a
+ * Values is written from constructed values, so it is already normalized.
+ */
+template <typename T, typename = void>
+struct FromStorageWithoutNormalizing {
+  static T Get(const typename StorageOps<T>::Scalar* const data) {
+    return StorageOps<T>::FromStorage(data);
+  }
+};
+
+template <typename T>
+struct FromStorageWithoutNormalizing<
+    T, decltype(void(T::FromNormalizedData(std::declval<const typename T::DataVec&>())))> {
+  static T Get(const typename StorageOps<T>::Scalar* const data) {
+    return T::FromNormalizedData(Eigen::Map<const typename T::DataVec>(data));
+  }
+};
+
+}  // namespace internal
+
+/**
+ * A read-only value of type T held in a Values, see Values::MapAt.
+ *
+ * Scalars and the geo and camera types are not laid out in memory like their storage, and reading
+ * the storage through a T* would break the strict aliasing rules, so the view holds a T copied
+ * from the storage.  Unlike Values::At, the copy is not normalized, so for example viewing a Rot3
+ * copies the stored quaternion as is instead of renormalizing it.  The view converts to a
+ * const T&, so it can be passed to functions that take a const T&.
+ */
+template <typename T>
+class ValueView {
+ public:
+  using Scalar = typename StorageOps<T>::Scalar;
+
+  explicit ValueView(const Scalar* const data)
+      : value_(internal::FromStorageWithoutNormalizing<T>::Get(data)) {}
+
+  const T& Get() const {
+    return value_;
+  }
+
+  operator const T&() const {
+    return value_;
+  }
+
+  const T& operator*() const {
+    return value_;
+  }
+
+  const T* operator->() const {
+    return &value_;
+  }
+
+ private:
+  T value_;
+};
+
+/**
+ * The type returned by Values::MapAt<T>: an Eigen::Map for matrix types, and a ValueView for
+ * everything else
+ */
+template <typename T, typename = void>
+struct ValueMapHelper {
+  using Type = ValueView<T>;
+};
+
+template <typename T>
+struct ValueMapHelper<T, std::enable_if_t<kIsEigenType<T>>> {
+  using Type = Eigen::Map<const T>;
+};
+
+template <typename T>
+using ValueMap = typename ValueMapHelper<T>::Type;
+
+}  // namespace sym
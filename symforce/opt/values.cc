@@ -265,18 +265,23 @@ BY_TYPE_HELPER(LocalCoordinatesByType, LocalCoordinatesHelper);
 
 template <typename Scalar>
 VectorX<Scalar> Values<Scalar>::LocalCoordinates(const Values<Scalar>& others, const index_t& index,
-                                                 const Scalar epsilon) {
+                                                 const Scalar epsilon) const {
   VectorX<Scalar> tangent_vec(index.tangent_dim);
+  LocalCoordinates(others, index, epsilon, tangent_vec.data());
+  return tangent_vec;
+}
+
+template <typename Scalar>
+void Values<Scalar>::LocalCoordinates(const Values<Scalar>& others, const index_t& index,
+                                      const Scalar epsilon, Scalar* const tangent) const {
   size_t tangent_inx = 0;
 
   for (const index_entry_t& entry : index.entries) {
     LocalCoordinatesByType<Scalar>(entry.type, data_.data() + entry.offset,
-                                   others.data_.data() + entry.offset,
-                                   tangent_vec.data() + tangent_inx, epsilon);
+                                   others.data_.data() + entry.offset, tangent + tangent_inx,
+                                   epsilon);
     tangent_inx += entry.tangent_dim;
   }
-
-  return tangent_vec;
 }
 
 namespace {
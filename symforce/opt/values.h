@@ -14,6 +14,7 @@
 #include <sym/util/type_ops.h>
 
 #include "./key.h"
+#include "./value_view.h"
 
 namespace sym {
 
@@ -184,6 +185,18 @@ class Values {
   template <typename T>
   T At(const index_entry_t& entry) const;
 
+  /**
+   * Retrieve a read-only view of a value by index entry.  For matrix types this is an
+   * Eigen::Map<const T> that refers to the storage without copying it, and for other types a
+   * ValueView<T>, which holds a copy of the storage that is not normalized (unlike At()) and
+   * converts to a const T&.
+   *
+   * The view is INVALIDATED by anything that invalidates the index entry, as well as by adding
+   * entries to this Values.
+   */
+  template <typename T>
+  ValueMap<T> MapAt(const index_entry_t& entry) const;
+
   /**
    * Update a value by index entry with no map lookup (compared to Set(key)).
    * This does NOT add new values and assumes the key exists already.
@@ -234,7 +247,16 @@ class Values {
    *   epsilon: Small constant to avoid singularities (do not use zero)
    */
   VectorX<Scalar> LocalCoordinates(const Values<Scalar>& others, const index_t& index,
-                                   const Scalar epsilon);
+                                   const Scalar epsilon) const;
+
+  /**
+   * Same as above, but writes the local coordinates into tangent instead of allocating them
+   *
+   * Args:
+   *   tangent: Pointer to output vector - MUST be the size of index.tangent_dim!
+   */
+  void LocalCoordinates(const Values<Scalar>& others, const index_t& index, const Scalar epsilon,
+                        Scalar* tangent) const;
 
   /**
    * Serialize to LCM.
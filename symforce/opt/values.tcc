@@ -37,6 +37,22 @@ T Values<Scalar>::At(const index_entry_t& entry) const {
 #endif
 }
 
+template <typename Scalar>
+template <typename T>
+ValueMap<T> Values<Scalar>::MapAt(const index_entry_t& entry) const {
+  static_assert(std::is_same<Scalar, typename StorageOps<T>::Scalar>::value,
+                "Calling Values.MapAt on mismatched scalar type.");
+
+  // Check the type
+  const type_t type = StorageOps<T>::TypeEnum();
+  if (entry.type != type) {
+    throw std::runtime_error(
+        fmt::format("Mismatched types; index entry is type {}, T is {}", entry.type, type));
+  }
+
+  return ValueMap<T>(data_.data() + entry.offset);
+}
+
 template <typename Scalar>
 template <typename T>
 T Values<Scalar>::At(const Key& key) const {
@@ -30,16 +30,21 @@ void AddLinearizationWrapper(pybind11::module_ module) {
            "Accessing any of the members when this is false could result in unexpected behavior.")
       .def("set_initialized", &sym::Linearizationd::SetInitialized, py::arg("initialized") = true)
       .def("error", &sym::Linearizationd::Error)
-      .def("linear_error", &sym::Linearizationd::LinearError, py::arg("x_update"))
+      .def("linear_error",
+           static_cast<double (sym::Linearizationd::*)(const Linearizationd::VectorType&) const>(
+               &sym::Linearizationd::LinearError),
+           py::arg("x_update"))
+      .def("has_jacobian", &sym::Linearizationd::HasJacobian)
       .def(py::pickle(
           [](const sym::Linearizationd& linearization) {  //  __getstate__
             return py::make_tuple(linearization.residual, linearization.hessian_lower,
                                   linearization.jacobian, linearization.rhs,
-                                  linearization.IsInitialized());
+                                  linearization.IsInitialized(), linearization.HasJacobian());
           },
           [](py::tuple state) {  // __setstate__
-            if (state.size() != 5) {
-              throw py::value_error("Linearization.__setstate__ expected tuple of size 5.");
+            // Tuples of size 5 are from before has_jacobian was pickled
+            if (state.size() != 5 && state.size() != 6) {
+              throw py::value_error("Linearization.__setstate__ expected tuple of size 6.");
             }
             sym::Linearizationd linearization;
             linearization.residual = state[0].cast<Linearizationd::VectorType>();
@@ -47,6 +52,9 @@ void AddLinearizationWrapper(pybind11::module_ module) {
             linearization.jacobian = state[2].cast<Linearizationd::MatrixType>();
             linearization.rhs = state[3].cast<Linearizationd::VectorType>();
             linearization.SetInitialized(state[4].cast<bool>());
+            if (state.size() == 6) {
+              linearization.SetHasJacobian(state[5].cast<bool>());
+            }
             return linearization;
           }));
 }
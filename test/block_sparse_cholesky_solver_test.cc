@@ -0,0 +1,185 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+// Enable Eigen LGPL code only here, for comparison.
+#undef EIGEN_MPL2_ONLY
+
+// Required by MetisSupport
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/MetisSupport>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <sym/ops/lie_group_ops.h>
+#include <sym/ops/storage_ops.h>
+#include <symforce/opt/block_sparse_cholesky_solver.h>
+#include <symforce/opt/block_sparse_matrix.h>
+#include <symforce/opt/optimizer.h>
+
+namespace {
+
+Eigen::MatrixXd RandomMatrix(const int rows, const int cols, std::mt19937& gen) {
+  std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+  return Eigen::MatrixXd::NullaryExpr(rows, cols, [&]() { return distribution(gen); });
+}
+
+/**
+ * Make a random symmetric positive definite matrix, with blocks of the given dimensions and a few
+ * random off-diagonal blocks per block column.  Returns the lower triangle.
+ */
+Eigen::SparseMatrix<double> MakeRandomBlockSpdMatrix(const std::vector<int32_t>& block_dims,
+                                                     std::mt19937& gen) {
+  std::vector<int32_t> offsets = {0};
+  for (const int32_t dim : block_dims) {
+    offsets.push_back(offsets.back() + dim);
+  }
+  const int num_blocks = static_cast<int>(block_dims.size());
+  const int dim = offsets.back();
+
+  Eigen::MatrixXd dense = Eigen::MatrixXd::Zero(dim, dim);
+  std::uniform_int_distribution<int> block_distribution(0, num_blocks - 1);
+  for (int col = 0; col < num_blocks; ++col) {
+    for (int k = 0; k < 2; ++k) {
+      const int row = block_distribution(gen);
+      dense.block(offsets[row], offsets[col], block_dims[row], block_dims[col]) =
+          RandomMatrix(block_dims[row], block_dims[col], gen);
+    }
+  }
+  dense = (dense * dense.transpose()).eval();
+  dense.diagonal().array() += dim;
+
+  return Eigen::MatrixXd(dense.triangularView<Eigen::Lower>()).sparseView();
+}
+
+}  // namespace
+
+TEST_CASE("BlockSparseMatrix round trips through a scalar sparse matrix", "[block_sparse]") {
+  std::mt19937 gen(42);
+  const std::vector<int32_t> block_dims = {3, 6, 1, 6, 2, 3};
+  const Eigen::SparseMatrix<double> lower = MakeRandomBlockSpdMatrix(block_dims, gen);
+
+  const sym::BlockSparseMatrixd blocks = sym::BlockSparseMatrixd::FromSparse(lower, block_dims);
+  CHECK(blocks.Rows() == lower.rows());
+  CHECK(blocks.NumBlockCols() == static_cast<int32_t>(block_dims.size()));
+  CHECK(Eigen::MatrixXd(blocks.ToSparse()) == Eigen::MatrixXd(lower));
+  CHECK(blocks.Diagonal() == Eigen::VectorXd(lower.diagonal()));
+
+  for (int col = 0; col < lower.outerSize(); ++col) {
+    for (Eigen::SparseMatrix<double>::InnerIterator it(lower, col); it; ++it) {
+      CHECK(blocks.Data()[blocks.StorageOffset(it.row(), it.col())] == it.value());
+    }
+  }
+
+  const Eigen::VectorXd x = RandomMatrix(lower.rows(), 1, gen);
+  Eigen::VectorXd y;
+  blocks.SelfAdjointMultiply(x, &y);
+  const Eigen::MatrixXd full = Eigen::MatrixXd(lower).selfadjointView<Eigen::Lower>();
+  CHECK(y.isApprox(full * x, 1e-12));
+}
+
+TEST_CASE("BlockSparseCholeskySolver matches a dense solve", "[block_sparse]") {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int32_t> dim_distribution(1, 6);
+  for (const int num_blocks : {1, 2, 10, 50}) {
+    std::vector<int32_t> block_dims(num_blocks);
+    for (int32_t& dim : block_dims) {
+      dim = dim_distribution(gen);
+    }
+    const Eigen::SparseMatrix<double> lower = MakeRandomBlockSpdMatrix(block_dims, gen);
+    const sym::BlockSparseMatrixd A = sym::BlockSparseMatrixd::FromSparse(lower, block_dims);
+
+    const Eigen::MatrixXd full = Eigen::MatrixXd(lower).selfadjointView<Eigen::Lower>();
+    const Eigen::MatrixXd b = RandomMatrix(full.rows(), 3, gen);
+    const Eigen::MatrixXd x_expected = full.llt().solve(b);
+
+    for (const auto& ordering : {sym::BlockSparseCholeskySolver<double>::Ordering(
+                                     Eigen::MetisOrdering<int32_t>()),
+                                 sym::BlockSparseCholeskySolver<double>::Ordering(
+                                     Eigen::NaturalOrdering<int32_t>())}) {
+      sym::BlockSparseCholeskySolver<double> solver(ordering);
+      solver.ComputeSymbolicSparsity(A);
+      CHECK(solver.Factorize(A));
+
+      CHECK(solver.Solve(b).isApprox(x_expected, 1e-10));
+
+      // P A P^T = L L^T
+      const Eigen::MatrixXd L = solver.L();
+      const Eigen::MatrixXd PAPt =
+          solver.Permutation() * full * solver.Permutation().transpose();
+      CHECK((L * L.transpose()).isApprox(PAPt, 1e-10));
+    }
+  }
+}
+
+TEST_CASE("BlockSparseCholeskySolver reports matrices that are not positive definite",
+          "[block_sparse]") {
+  std::mt19937 gen(42);
+  const std::vector<int32_t> block_dims = {2, 3, 2};
+  Eigen::SparseMatrix<double> lower = MakeRandomBlockSpdMatrix(block_dims, gen);
+  lower.coeffRef(3, 3) = -1.0;
+  const sym::BlockSparseMatrixd A = sym::BlockSparseMatrixd::FromSparse(lower, block_dims);
+
+  sym::BlockSparseCholeskySolver<double> solver;
+  solver.ComputeSymbolicSparsity(A);
+  CHECK(!solver.Factorize(A));
+}
+
+TEST_CASE("Optimizing with a BlockSparseCholeskySolver matches the default solver",
+          "[block_sparse]") {
+  std::mt19937 gen(42);
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+  }
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, i + 2}) {
+      if (j >= num_poses) {
+        continue;
+      }
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+      values.Set<sym::Pose3d>({'T', i, j}, sym::Pose3d::FromTangent(
+                                               0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 30;
+
+  sym::Valuesd default_values = values;
+  sym::Optimizerd default_optimizer(params, factors);
+  const auto default_stats = default_optimizer.Optimize(&default_values);
+
+  using BlockOptimizer = sym::Optimizer<
+      double, sym::LevenbergMarquardtSolver<double, sym::BlockSparseCholeskySolver<double>>>;
+  sym::Valuesd block_values = values;
+  BlockOptimizer block_optimizer(params, factors);
+  const auto block_stats = block_optimizer.Optimize(&block_values);
+
+  CHECK(block_optimizer.Linearizer().BlockSparseHessian());
+  CHECK(block_stats.early_exited == default_stats.early_exited);
+  CHECK(block_stats.iterations.size() == default_stats.iterations.size());
+  CHECK(std::abs(block_stats.iterations[block_stats.best_index].new_error -
+                 default_stats.iterations[default_stats.best_index].new_error) < 1e-8);
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(sym::IsClose(block_values.At<sym::Pose3d>({'P', i}),
+                       default_values.At<sym::Pose3d>({'P', i}), 1e-6));
+  }
+}
@@ -0,0 +1,269 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+// Enable Eigen LGPL code only here, for comparison.
+#undef EIGEN_MPL2_ONLY
+
+// Required by MetisSupport
+#include <iostream>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/MetisSupport>
+#include <Eigen/OrderingMethods>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <symforce/opt/cholesky/ordering_cache.h>
+#include <symforce/opt/cholesky/orderings.h>
+#include <symforce/opt/cholesky/sparse_cholesky_solver.h>
+
+using SparseMatrix = Eigen::SparseMatrix<double>;
+using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+namespace {
+
+// Lower triangle of the laplacian of a grid, plus the identity
+SparseMatrix MakeGridMatrix(const int width, const int height) {
+  std::vector<Eigen::Triplet<double>> triplets;
+  const auto index = [width](const int x, const int y) { return y * width + x; };
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      triplets.emplace_back(index(x, y), index(x, y), 5.0);
+      if (x + 1 < width) {
+        triplets.emplace_back(index(x + 1, y), index(x, y), -1.0);
+      }
+      if (y + 1 < height) {
+        triplets.emplace_back(index(x, y + 1), index(x, y), -1.0);
+      }
+    }
+  }
+  SparseMatrix A(width * height, width * height);
+  A.setFromTriplets(triplets.begin(), triplets.end());
+  return A;
+}
+
+// Jacobian with a row for each variable and each edge of the grid, such that J^T * J has the
+// pattern of MakeGridMatrix
+SparseMatrix MakeGridJacobian(const int width, const int height) {
+  std::vector<Eigen::Triplet<double>> triplets;
+  const auto index = [width](const int x, const int y) { return y * width + x; };
+  int row = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      triplets.emplace_back(row++, index(x, y), 1.0);
+      if (x + 1 < width) {
+        triplets.emplace_back(row, index(x, y), 1.0);
+        triplets.emplace_back(row++, index(x + 1, y), -1.0);
+      }
+      if (y + 1 < height) {
+        triplets.emplace_back(row, index(x, y), 1.0);
+        triplets.emplace_back(row++, index(x, y + 1), -1.0);
+      }
+    }
+  }
+  SparseMatrix J(row, width * height);
+  J.setFromTriplets(triplets.begin(), triplets.end());
+  return J;
+}
+
+bool IsPermutation(const Solver::PermutationMatrixType& perm, const int size) {
+  std::vector<bool> seen(size, false);
+  for (int i = 0; i < perm.size(); ++i) {
+    const int index = perm.indices()[i];
+    if (index < 0 || index >= size || seen[index]) {
+      return false;
+    }
+    seen[index] = true;
+  }
+  return perm.size() == size;
+}
+
+}  // namespace
+
+TEST_CASE("Built-in orderings solve correctly and reduce fill", "[cholesky_orderings]") {
+  const SparseMatrix A = MakeGridMatrix(30, 30);
+  const SparseMatrix A_full = A.selfadjointView<Eigen::Lower>();
+  const Eigen::MatrixXd A_dense = A_full;
+  const Eigen::VectorXd b = Eigen::VectorXd::Random(A.rows());
+  const Eigen::VectorXd x_expected = A_dense.llt().solve(b);
+
+  const int64_t natural_fill =
+      sym::ComputeOrderingStats<SparseMatrix>(A, Eigen::NaturalOrdering<int>()).factor_nonzeros;
+  const int64_t eigen_amd_fill =
+      sym::ComputeOrderingStats<SparseMatrix>(A, Eigen::AMDOrdering<int>()).factor_nonzeros;
+
+  const std::vector<std::pair<std::string, Solver::Ordering>> orderings = {
+      {"amd", sym::AmdOrdering<int>()},
+      {"colamd", sym::ColamdOrdering<int>(MakeGridJacobian(30, 30))},
+      {"constrained", sym::ConstrainedOrdering<int>(std::vector<int>(A.rows(), 0))}};
+  for (const auto& name_and_ordering : orderings) {
+    INFO(name_and_ordering.first);
+
+    Solver::PermutationMatrixType perm;
+    name_and_ordering.second(A_full, perm);
+    CHECK(IsPermutation(perm, A.rows()));
+
+    Solver solver(A, name_and_ordering.second);
+    CHECK(solver.Solve(b).isApprox(x_expected, 1e-10));
+
+    const sym::OrderingStats stats = sym::ComputeOrderingStats(A, name_and_ordering.second);
+    CHECK(stats.ordering_seconds >= 0.0);
+    CHECK(stats.factor_nonzeros == solver.L().nonZeros());
+    CHECK(stats.factor_nonzeros < natural_fill);
+  }
+
+  // Our AMD should be comparable to the reference implementation
+  const int64_t amd_fill =
+      sym::ComputeOrderingStats<SparseMatrix>(A, sym::AmdOrdering<int>()).factor_nonzeros;
+  CHECK(amd_fill < eigen_amd_fill * 3 / 2);
+}
+
+TEST_CASE("ConstrainedOrdering eliminates groups in order", "[cholesky_orderings]") {
+  const SparseMatrix A = MakeGridMatrix(20, 10);
+  const SparseMatrix A_full = A.selfadjointView<Eigen::Lower>();
+
+  // Put a random half of the variables in group 2, and the rest in group -1
+  std::mt19937 gen(42);
+  std::vector<int> groups(A.rows(), -1);
+  std::bernoulli_distribution coin;
+  int num_first = 0;
+  for (int& group : groups) {
+    if (coin(gen)) {
+      group = 2;
+    } else {
+      num_first += 1;
+    }
+  }
+
+  Solver::PermutationMatrixType perm;
+  const sym::ConstrainedOrdering<int> ordering(groups);
+  ordering(A_full, perm);
+  REQUIRE(IsPermutation(perm, A.rows()));
+  for (int i = 0; i < A.rows(); ++i) {
+    CHECK(groups[perm.indices()[i]] == (i < num_first ? -1 : 2));
+  }
+}
+
+TEST_CASE("OrderingCache shares orderings between solvers and persists them",
+          "[cholesky_orderings]") {
+  const SparseMatrix A = MakeGridMatrix(15, 12);
+  const Eigen::VectorXd b = Eigen::VectorXd::Random(A.rows());
+
+  auto cache = std::make_shared<sym::OrderingCache>();
+  int num_orderings_computed = 0;
+  const auto counting_metis = [&num_orderings_computed](const SparseMatrix& mat,
+                                                        Solver::PermutationMatrixType& perm) {
+    num_orderings_computed += 1;
+    Eigen::MetisOrdering<int>()(mat, perm);
+  };
+
+  Solver solver1(A, sym::CachedOrdering<SparseMatrix>(counting_metis, "metis", cache));
+  Solver solver2(A, sym::CachedOrdering<SparseMatrix>(counting_metis, "metis", cache));
+  CHECK(num_orderings_computed == 1);
+  CHECK(cache->Size() == 1);
+  CHECK(cache->Hits() == 1);
+  CHECK(cache->Misses() == 1);
+  CHECK(solver1.Permutation().indices() == solver2.Permutation().indices());
+
+  // A different ordering of the same pattern is cached separately
+  Solver solver3(A, sym::CachedOrdering<SparseMatrix>(sym::AmdOrdering<int>(), "amd", cache));
+  CHECK(cache->Size() == 2);
+
+  // A different pattern is cached separately
+  const SparseMatrix B = MakeGridMatrix(12, 15);
+  CHECK(sym::OrderingCache::PatternHash(A) != sym::OrderingCache::PatternHash(B));
+  Solver solver4(B, sym::CachedOrdering<SparseMatrix>(counting_metis, "metis", cache));
+  CHECK(num_orderings_computed == 2);
+  CHECK(cache->Size() == 3);
+
+  // Save and load into a new cache
+  const std::string path = "/tmp/symforce_ordering_cache_test.bin";
+  cache->Save(path);
+  auto loaded_cache = std::make_shared<sym::OrderingCache>();
+  loaded_cache->Load(path);
+  CHECK(loaded_cache->Size() == 3);
+
+  Solver solver5(A, sym::CachedOrdering<SparseMatrix>(counting_metis, "metis", loaded_cache));
+  CHECK(num_orderings_computed == 2);
+  CHECK(loaded_cache->Hits() == 1);
+  CHECK(solver5.Permutation().indices() == solver1.Permutation().indices());
+  CHECK(solver5.Solve(b).isApprox(solver1.Solve(b), 1e-12));
+
+  // Invalid files are rejected, and leave the cache unchanged
+  {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "not an ordering cache";
+  }
+  CHECK_THROWS_AS(loaded_cache->Load(path), std::runtime_error);
+  CHECK(loaded_cache->Size() == 3);
+  CHECK_THROWS_AS(loaded_cache->Load("/nonexistent/ordering_cache.bin"), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST_CASE("OrderingCache discards orderings that are not permutations", "[cholesky_orderings]") {
+  const SparseMatrix A = MakeGridMatrix(6, 5);
+  const Eigen::VectorXd b = Eigen::VectorXd::Random(A.rows());
+  const SparseMatrix A_full = A.selfadjointView<Eigen::Lower>();
+  const Eigen::VectorXd x_expected = Eigen::MatrixXd(A_full).llt().solve(b);
+
+  auto cache = std::make_shared<sym::OrderingCache>();
+  int num_orderings_computed = 0;
+  const auto counting_amd = [&num_orderings_computed](const SparseMatrix& mat,
+                                                      Solver::PermutationMatrixType& perm) {
+    num_orderings_computed += 1;
+    sym::AmdOrdering<int>()(mat, perm);
+  };
+  Solver solver1(A, sym::CachedOrdering<SparseMatrix>(counting_amd, "amd", cache));
+  REQUIRE(cache->Size() == 1);
+
+  // Save the single entry, and read back its key
+  const std::string path = "/tmp/symforce_ordering_cache_permutation_test.bin";
+  cache->Save(path);
+  uint64_t key;
+  {
+    std::ifstream file(path, std::ios::binary);
+    file.seekg(16);
+    file.read(reinterpret_cast<char*>(&key), sizeof(key));
+    REQUIRE(file);
+  }
+
+  // Repeat an index in the saved ordering, which is then skipped on load
+  {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    const int64_t index = 0;
+    file.seekp(32);
+    file.write(reinterpret_cast<const char*>(&index), sizeof(index));
+    file.seekp(40);
+    file.write(reinterpret_cast<const char*>(&index), sizeof(index));
+    REQUIRE(file);
+  }
+  auto loaded_cache = std::make_shared<sym::OrderingCache>();
+  loaded_cache->Load(path);
+  CHECK(loaded_cache->Size() == 0);
+  std::remove(path.c_str());
+
+  // An invalid ordering inserted directly is recomputed on lookup, and replaced
+  CHECK(sym::OrderingCache::IsPermutation({}));
+  CHECK(sym::OrderingCache::IsPermutation({2, 0, 1}));
+  CHECK(!sym::OrderingCache::IsPermutation({0, 3, 1}));
+  CHECK(!sym::OrderingCache::IsPermutation({0, -1, 1}));
+  std::vector<int64_t> invalid(A.cols(), 0);
+  cache->Insert(key, invalid);
+  Solver solver2(A, sym::CachedOrdering<SparseMatrix>(counting_amd, "amd", cache));
+  CHECK(num_orderings_computed == 2);
+  CHECK(solver2.Permutation().indices() == solver1.Permutation().indices());
+  CHECK(solver2.Solve(b).isApprox(x_expected, 1e-10));
+
+  std::vector<int64_t> ordering;
+  REQUIRE(cache->Find(key, &ordering));
+  CHECK(sym::OrderingCache::IsPermutation(ordering));
+}
@@ -0,0 +1,263 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <sym/ops/lie_group_ops.h>
+#include <sym/ops/storage_ops.h>
+#include <symforce/opt/conjugate_gradient_solver.h>
+#include <symforce/opt/hessian_operator.h>
+#include <symforce/opt/optimizer.h>
+
+namespace {
+
+using Solver = sym::ConjugateGradientSolver<double>;
+
+Eigen::MatrixXd RandomMatrix(const int rows, const int cols, std::mt19937& gen) {
+  std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+  return Eigen::MatrixXd::NullaryExpr(rows, cols, [&]() { return distribution(gen); });
+}
+
+/**
+ * A jacobian with the structure of bundle adjustment: num_cameras blocks of dimension 6 followed
+ * by num_points blocks of dimension 3, with a 2-dimensional residual for each observation of a
+ * point by a camera, and a prior on each camera
+ */
+Eigen::SparseMatrix<double> MakeBundleAdjustmentJacobian(const int num_cameras,
+                                                         const int num_points,
+                                                         std::vector<int32_t>* const block_dims,
+                                                         std::mt19937& gen) {
+  block_dims->assign(num_cameras, 6);
+  block_dims->insert(block_dims->end(), num_points, 3);
+  const int point_offset = 6 * num_cameras;
+
+  std::vector<Eigen::Triplet<double>> triplets;
+  int row = 0;
+  for (int camera = 0; camera < num_cameras; ++camera) {
+    for (int i = 0; i < 6; ++i) {
+      triplets.emplace_back(row++, 6 * camera + i, 0.1);
+    }
+  }
+
+  std::uniform_int_distribution<int> camera_distribution(0, num_cameras - 1);
+  for (int point = 0; point < num_points; ++point) {
+    for (int k = 0; k < 3; ++k) {
+      const int camera = camera_distribution(gen);
+      const Eigen::MatrixXd camera_block = RandomMatrix(2, 6, gen);
+      const Eigen::MatrixXd point_block = RandomMatrix(2, 3, gen);
+      for (int r = 0; r < 2; ++r) {
+        for (int i = 0; i < 6; ++i) {
+          triplets.emplace_back(row + r, 6 * camera + i, camera_block(r, i));
+        }
+        for (int i = 0; i < 3; ++i) {
+          triplets.emplace_back(row + r, point_offset + 3 * point + i, point_block(r, i));
+        }
+      }
+      row += 2;
+    }
+  }
+
+  Eigen::SparseMatrix<double> jacobian(row, point_offset + 3 * num_points);
+  jacobian.setFromTriplets(triplets.begin(), triplets.end());
+  return jacobian;
+}
+
+}  // namespace
+
+TEST_CASE("HessianOperator matches the damped hessian", "[conjugate_gradient]") {
+  std::mt19937 gen(42);
+  std::vector<int32_t> block_dims;
+  const Eigen::SparseMatrix<double> jacobian =
+      MakeBundleAdjustmentJacobian(3, 8, &block_dims, gen);
+  const Eigen::VectorXd damping = RandomMatrix(jacobian.cols(), 1, gen).cwiseAbs();
+
+  const Eigen::MatrixXd J = jacobian;
+  Eigen::MatrixXd expected = J.transpose() * J;
+  expected.diagonal() += damping;
+
+  sym::HessianOperatord from_jacobian;
+  from_jacobian.SetJacobian(jacobian, block_dims);
+  sym::HessianOperatord from_hessian;
+  from_hessian.SetHessianLower(
+      Eigen::MatrixXd((J.transpose() * J).triangularView<Eigen::Lower>()).sparseView(),
+      block_dims);
+  CHECK(from_jacobian.HasJacobian());
+  CHECK(!from_hessian.HasJacobian());
+
+  const Eigen::VectorXd x = RandomMatrix(jacobian.cols(), 1, gen);
+  for (sym::HessianOperatord* const A : {&from_jacobian, &from_hessian}) {
+    A->AddToDiagonal(damping);
+    CHECK(A->Rows() == expected.rows());
+    CHECK(A->NumBlockCols() == static_cast<int32_t>(block_dims.size()));
+    CHECK(A->Diagonal().isApprox(expected.diagonal(), 1e-12));
+
+    Eigen::VectorXd y;
+    A->Multiply(x, &y);
+    CHECK(y.isApprox(expected * x, 1e-12));
+
+    for (int32_t block = 0; block < A->NumBlockCols(); ++block) {
+      CHECK(A->DiagonalBlock(block).isApprox(
+          expected.block(A->BlockOffset(block), A->BlockOffset(block), A->BlockDim(block),
+                         A->BlockDim(block)),
+          1e-12));
+    }
+
+    // Every block column adds up to the matching columns of the hessian
+    std::vector<int32_t> all_blocks(block_dims.size());
+    std::iota(all_blocks.begin(), all_blocks.end(), 0);
+    const auto jacobian_rows = A->ComputeJacobianRows();
+    CHECK(jacobian_rows.cols.size() == (A->HasJacobian() ? jacobian.nonZeros() : 0));
+    const auto columns = A->BlockColumns(all_blocks, jacobian_rows);
+    const auto adjacency = A->BlockAdjacency(jacobian_rows);
+    for (int32_t block = 0; block < A->NumBlockCols(); ++block) {
+      const auto& column = columns[block];
+      CHECK(column.row_blocks.front() == block);
+      CHECK(column.row_blocks.size() == adjacency[block].size() + 1);
+
+      Eigen::MatrixXd dense_column = Eigen::MatrixXd::Zero(A->Rows(), A->BlockDim(block));
+      for (size_t i = 0; i < column.row_blocks.size(); ++i) {
+        const int32_t row_block = column.row_blocks[i];
+        dense_column.middleRows(A->BlockOffset(row_block), A->BlockDim(row_block)) =
+            column.blocks[i];
+      }
+      CHECK(dense_column.isApprox(expected.middleCols(A->BlockOffset(block), A->BlockDim(block)),
+                                  1e-12));
+    }
+
+    // Points are only adjacent to cameras
+    for (int32_t point = 3; point < A->NumBlockCols(); ++point) {
+      for (const int32_t neighbor : adjacency[point]) {
+        CHECK(neighbor < 3);
+      }
+    }
+  }
+}
+
+TEST_CASE("ConjugateGradientSolver matches a dense solve", "[conjugate_gradient]") {
+  std::mt19937 gen(42);
+  const int num_cameras = 10;
+  const int num_points = 200;
+  std::vector<int32_t> block_dims;
+  const Eigen::SparseMatrix<double> jacobian =
+      MakeBundleAdjustmentJacobian(num_cameras, num_points, &block_dims, gen);
+
+  sym::HessianOperatord A;
+  A.SetJacobian(jacobian, block_dims);
+  A.AddToDiagonal(Eigen::VectorXd::Constant(A.Cols(), 1e-3));
+
+  const Eigen::MatrixXd J = jacobian;
+  Eigen::MatrixXd dense = J.transpose() * J;
+  dense.diagonal().array() += 1e-3;
+  const Eigen::MatrixXd b = RandomMatrix(A.Rows(), 2, gen);
+  const Eigen::MatrixXd x_expected = dense.llt().solve(b);
+
+  int block_jacobi_iterations = 0;
+  int schur_jacobi_iterations = 0;
+  for (const Solver::Preconditioner preconditioner :
+       {Solver::Preconditioner::NONE, Solver::Preconditioner::BLOCK_JACOBI,
+        Solver::Preconditioner::SCHUR_JACOBI}) {
+    Solver solver(preconditioner, 5000, 1e-12);
+    solver.ComputeSymbolicSparsity(A);
+    CHECK(solver.Factorize(A));
+
+    const Eigen::MatrixXd x = solver.Solve(b);
+    CHECK(x.isApprox(x_expected, 1e-8));
+    CHECK(solver.Iterations() > 0);
+    CHECK(solver.RelativeResidual() <= 1e-12);
+
+    if (preconditioner == Solver::Preconditioner::SCHUR_JACOBI) {
+      // Eliminates exactly the points
+      std::vector<int32_t> points(num_points);
+      std::iota(points.begin(), points.end(), num_cameras);
+      CHECK(solver.EliminatedBlocks() == points);
+      schur_jacobi_iterations = solver.Iterations();
+    } else {
+      CHECK(solver.EliminatedBlocks().empty());
+      if (preconditioner == Solver::Preconditioner::BLOCK_JACOBI) {
+        block_jacobi_iterations = solver.Iterations();
+      }
+    }
+  }
+  CHECK(schur_jacobi_iterations < block_jacobi_iterations);
+
+  // The iteration cap is respected
+  Solver capped_solver(Solver::Preconditioner::BLOCK_JACOBI, 3, 1e-12);
+  capped_solver.ComputeSymbolicSparsity(A);
+  capped_solver.Factorize(A);
+  capped_solver.Solve(b.col(0));
+  CHECK(capped_solver.Iterations() == 3);
+  CHECK(capped_solver.RelativeResidual() > 1e-12);
+}
+
+TEST_CASE("Optimizing with a ConjugateGradientSolver matches the default solver",
+          "[conjugate_gradient]") {
+  std::mt19937 gen(42);
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+  }
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, i + 2}) {
+      if (j >= num_poses) {
+        continue;
+      }
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+      values.Set<sym::Pose3d>({'T', i, j}, sym::Pose3d::FromTangent(
+                                               0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 30;
+
+  sym::Valuesd default_values = values;
+  sym::Optimizerd default_optimizer(params, factors);
+  const auto default_stats = default_optimizer.Optimize(&default_values);
+
+  for (const Solver::Preconditioner preconditioner :
+       {Solver::Preconditioner::BLOCK_JACOBI, Solver::Preconditioner::SCHUR_JACOBI}) {
+    using CgOptimizer = sym::Optimizer<double, sym::LevenbergMarquardtSolver<double, Solver>>;
+    sym::Valuesd cg_values = values;
+    CgOptimizer cg_optimizer(params, factors, sym::kDefaultEpsilond, "sym::Optimizer", {}, false,
+                             false, Solver(preconditioner, 1000, 1e-12));
+    const auto cg_stats = cg_optimizer.Optimize(&cg_values);
+
+    CHECK(std::abs(cg_stats.iterations[cg_stats.best_index].new_error -
+                   default_stats.iterations[default_stats.best_index].new_error) < 1e-8);
+    for (int i = 0; i < num_poses; ++i) {
+      CHECK(sym::IsClose(cg_values.At<sym::Pose3d>({'P', i}),
+                         default_values.At<sym::Pose3d>({'P', i}), 1e-6));
+    }
+
+    // Every iteration after the initial state reports its conjugate gradient iterations
+    for (const auto& iteration : cg_stats.iterations) {
+      if (iteration.iteration >= 0) {
+        CHECK(iteration.linear_solver_iterations > 0);
+      }
+    }
+  }
+
+  for (const auto& iteration : default_stats.iterations) {
+    CHECK(iteration.linear_solver_iterations == 0);
+  }
+}
@@ -0,0 +1,194 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <random>
+#include <vector>
+
+#include <catch2/catch_template_test_macros.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <sym/ops/lie_group_ops.h>
+#include <symforce/opt/dogleg_solver.h>
+#include <symforce/opt/optimizer.h>
+
+namespace {
+
+/**
+ * A pose graph on num_poses poses, with a prior on the first pose and noisy between factors on
+ * poses one and two apart.  The initial values are the true poses perturbed by perturbation in
+ * the tangent space.
+ */
+std::vector<sym::Factord> BuildPoseGraph(const int num_poses, const double perturbation,
+                                         std::mt19937& gen, sym::Valuesd* const values) {
+  std::vector<sym::Pose3d> poses;
+  for (int i = 0; i < num_poses; ++i) {
+    poses.push_back(sym::Random<sym::Pose3d>(gen));
+  }
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  values->Set<sym::Pose3d>({'Q', 0}, poses[0]);
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, i + 2}) {
+      if (j >= num_poses) {
+        continue;
+      }
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+      values->Set<sym::Pose3d>(
+          {'T', i, j}, poses[i].Between(poses[j]).Retract(0.01 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  for (int i = 0; i < num_poses; ++i) {
+    values->Set<sym::Pose3d>({'P', i},
+                             poses[i].Retract(perturbation * sym::Random<sym::Vector6d>(gen)));
+  }
+  values->Set<Eigen::Matrix<double, 6, 6>>('S', Eigen::Matrix<double, 6, 6>::Identity());
+  values->Set('e', sym::kDefaultEpsilond);
+  return factors;
+}
+
+}  // namespace
+
+TEMPLATE_TEST_CASE("Dogleg converges for a linear problem in one iteration", "[dogleg]", double,
+                   float) {
+  using Scalar = TestType;
+
+  constexpr const int M = 9;
+  constexpr const int N = 5;
+
+  std::mt19937 gen(12345);
+  const sym::MatrixX<Scalar> J_MN = sym::Random<Eigen::Matrix<Scalar, M, N>>(gen);
+
+  constexpr const Scalar kEpsilon = 1e-10;
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 1;
+
+  // The Gauss-Newton step is inside a large enough region, and is exact for a linear problem
+  typename sym::DoglegSolver<Scalar>::TrustRegionParams trust_region_params{};
+  trust_region_params.initial_radius = 1e6;
+  sym::DoglegSolver<Scalar> solver(params, "", kEpsilon, trust_region_params);
+
+  using StateVector = Eigen::Matrix<Scalar, N, 1>;
+
+  auto residual_func = [&](const sym::Values<Scalar>& values,
+                           sym::Linearization<Scalar>* const linearization) {
+    const auto state_vec = values.template At<StateVector>('v');
+    linearization->residual = J_MN * state_vec;
+    linearization->hessian_lower = (J_MN.transpose() * J_MN).sparseView();
+    linearization->jacobian = J_MN.sparseView();
+    linearization->rhs = J_MN.transpose() * linearization->residual;
+  };
+
+  sym::Values<Scalar> values_init{};
+  values_init.Set('v', (StateVector::Ones() * 100).eval());
+
+  solver.SetIndex(values_init.CreateIndex({'v'}));
+  solver.Reset(values_init);
+
+  sym::OptimizationStats<Scalar> stats{};
+  solver.Iterate(residual_func, &stats);
+
+  CHECK(solver.LastStepType() == sym::DoglegSolver<Scalar>::StepType::GAUSS_NEWTON);
+  CHECK(stats.iterations.back().update_accepted);
+  CHECK(stats.iterations.front().new_error > 10000.);
+  CHECK(stats.iterations.back().new_error < 1e-6);
+  CHECK(stats.iterations.back().new_error_linear < 1e-6);
+  CHECK(solver.GetBestValues().template At<StateVector>('v').norm() < 1e-4);
+
+  // With a small region the step is along the gradient, and the linear error is the prediction
+  // of the quadratic model
+  trust_region_params.initial_radius = 1e-3;
+  sym::DoglegSolver<Scalar> small_region_solver(params, "", kEpsilon, trust_region_params);
+  small_region_solver.SetIndex(values_init.CreateIndex({'v'}));
+  small_region_solver.Reset(values_init);
+
+  sym::OptimizationStats<Scalar> small_region_stats{};
+  small_region_solver.Iterate(residual_func, &small_region_stats);
+  CHECK(small_region_solver.LastStepType() ==
+        sym::DoglegSolver<Scalar>::StepType::STEEPEST_DESCENT);
+  const auto& iteration = small_region_stats.iterations.back();
+  CHECK(iteration.update_accepted);
+  CHECK(iteration.current_lambda == static_cast<float>(1e-3));
+  CHECK(std::abs(iteration.new_error_linear - iteration.new_error) <=
+        1e-4 * small_region_stats.iterations.front().new_error);
+}
+
+TEST_CASE("Dogleg only factorizes once per linearization", "[dogleg]") {
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  const std::vector<sym::Factord> factors = BuildPoseGraph(20, 1.0, gen, &values);
+
+  sym::Linearizer<double> linearizer("dogleg_test", factors);
+  const auto linearize_func = [&linearizer](const sym::Valuesd& values,
+                                            sym::Linearizationd* const linearization) {
+    linearizer.Relinearize(values, linearization);
+  };
+
+  // Start with a region much larger than the steps are valid for, so some steps are rejected
+  typename sym::DoglegSolverd::TrustRegionParams trust_region_params{};
+  trust_region_params.initial_radius = 100;
+  const sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  sym::DoglegSolverd solver(params, "", sym::kDefaultEpsilond, trust_region_params);
+  solver.SetIndex(values.CreateIndex(linearizer.Keys()));
+  solver.Reset(values);
+
+  sym::OptimizationStatsd stats{};
+  for (int i = 0; i < params.iterations; ++i) {
+    if (solver.Iterate(linearize_func, &stats)) {
+      break;
+    }
+  }
+
+  // The first iteration and every iteration after an accepted step factorize, and rejected steps
+  // only shrink the region.  stats.iterations[0] is the initial state.
+  int num_rejected = 0;
+  int expected_factorizations = 1;
+  for (size_t i = 1; i < stats.iterations.size(); ++i) {
+    if (i > 1 && stats.iterations[i - 1].update_accepted) {
+      expected_factorizations++;
+    }
+    if (!stats.iterations[i].update_accepted) {
+      num_rejected++;
+      if (i + 1 < stats.iterations.size()) {
+        CHECK(stats.iterations[i + 1].current_lambda < stats.iterations[i].current_lambda);
+      }
+    }
+  }
+  CHECK(num_rejected > 0);
+  CHECK(solver.NumFactorizations() == expected_factorizations);
+  CHECK(stats.iterations[stats.best_index].new_error < 0.1 * stats.iterations.front().new_error);
+}
+
+TEST_CASE("Optimizing with a DoglegSolver matches the default solver", "[dogleg]") {
+  std::mt19937 gen(42);
+  const int num_poses = 20;
+  sym::Valuesd values;
+  const std::vector<sym::Factord> factors = BuildPoseGraph(num_poses, 0.3, gen, &values);
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 50;
+  params.early_exit_min_reduction = 1e-10;
+
+  sym::Valuesd default_values = values;
+  sym::Optimizerd default_optimizer(params, factors);
+  const auto default_stats = default_optimizer.Optimize(&default_values);
+
+  sym::Valuesd dogleg_values = values;
+  sym::Optimizer<double, sym::DoglegSolverd> dogleg_optimizer(params, factors);
+  const auto dogleg_stats = dogleg_optimizer.Optimize(&dogleg_values);
+
+  CHECK(std::abs(dogleg_stats.iterations[dogleg_stats.best_index].new_error -
+                 default_stats.iterations[default_stats.best_index].new_error) < 1e-8);
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(sym::IsClose(dogleg_values.At<sym::Pose3d>({'P', i}),
+                       default_values.At<sym::Pose3d>({'P', i}), 1e-5));
+  }
+}
@@ -0,0 +1,105 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#pragma once
+
+/**
+ * Counts heap allocations, for tests that check a code path does not allocate.
+ *
+ * This replaces malloc and friends for the whole binary, which catches allocations made through
+ * operator new as well as Eigen's allocations, which call malloc directly.  It must therefore be
+ * included in exactly one translation unit of a test binary.  It is only supported on glibc, on
+ * other platforms AllocationCounter::IsSupported() returns false and nothing is counted.
+ *
+ * Usage:
+ *
+ *     const sym::AllocationCounter counter;
+ *     DoSomething();
+ *     CHECK(counter.Count() == 0);
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+
+namespace sym {
+namespace internal {
+
+inline std::atomic<int64_t>& NumAllocations() {
+  static std::atomic<int64_t> num_allocations{0};
+  return num_allocations;
+}
+
+}  // namespace internal
+
+class AllocationCounter {
+ public:
+  AllocationCounter() : start_(internal::NumAllocations().load()) {}
+
+  /**
+   * Number of allocations made by any thread since this counter was constructed
+   */
+  int64_t Count() const {
+    return internal::NumAllocations().load() - start_;
+  }
+
+  static constexpr bool IsSupported() {
+#ifdef __GLIBC__
+    return true;
+#else
+    return false;
+#endif
+  }
+
+ private:
+  int64_t start_;
+};
+
+}  // namespace sym
+
+#ifdef __GLIBC__
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+  ++sym::internal::NumAllocations();
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr == nullptr ? ENOMEM : 0;
+}
+
+}  // extern "C"
+
+#endif  // __GLIBC__
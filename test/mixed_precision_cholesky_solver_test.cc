@@ -0,0 +1,207 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <sym/ops/lie_group_ops.h>
+#include <symforce/opt/mixed_precision_cholesky_solver.h>
+#include <symforce/opt/optimizer.h>
+
+namespace {
+
+/**
+ * A block sparse SPD matrix with 6x6 blocks, like the hessian of a pose graph, whose eigenvalues
+ * are between roughly 1 and condition_number
+ */
+Eigen::MatrixXd MakeBlockSparseMatrix(const int num_blocks, const double condition_number,
+                                      std::mt19937& gen) {
+  constexpr int block_dim = 6;
+  const int dim = block_dim * num_blocks;
+
+  std::uniform_int_distribution<int> block_distribution(0, num_blocks - 1);
+  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(dim, dim);
+  for (int col = 0; col < num_blocks; ++col) {
+    for (const int row : {col, (col + 1) % num_blocks, block_distribution(gen)}) {
+      J.block<block_dim, block_dim>(block_dim * row, block_dim * col).setRandom();
+    }
+  }
+
+  // Scale the columns of J so the hessian spans the requested range of magnitudes
+  const Eigen::VectorXd scales = Eigen::VectorXd::LinSpaced(dim, 0, std::log10(condition_number));
+  for (int col = 0; col < dim; ++col) {
+    J.col(col) *= std::pow(10.0, 0.5 * scales[col]);
+  }
+  return J.transpose() * J + Eigen::MatrixXd::Identity(dim, dim);
+}
+
+/**
+ * A dense SPD matrix with eigenvalues log-spaced between 1 and condition_number, and random
+ * eigenvectors, so unlike MakeBlockSparseMatrix it stays ill-conditioned when its diagonal is
+ * scaled to one
+ */
+Eigen::MatrixXd MakeIllConditionedMatrix(const int dim, const double condition_number,
+                                         std::mt19937& gen) {
+  std::normal_distribution<double> distribution;
+  const Eigen::MatrixXd random =
+      Eigen::MatrixXd::NullaryExpr(dim, dim, [&]() { return distribution(gen); });
+  const Eigen::MatrixXd Q = Eigen::HouseholderQR<Eigen::MatrixXd>(random).householderQ();
+  const Eigen::VectorXd eigenvalues =
+      Eigen::VectorXd::LinSpaced(dim, 0, std::log10(condition_number)).unaryExpr([](double e) {
+        return std::pow(10.0, e);
+      });
+  return Q * eigenvalues.asDiagonal() * Q.transpose();
+}
+
+}  // namespace
+
+TEST_CASE("MixedPrecisionCholeskySolver refines a float factorization", "[mixed_precision]") {
+  std::mt19937 gen(42);
+  const Eigen::MatrixXd A_dense = MakeBlockSparseMatrix(30, 1e3, gen);
+  const Eigen::SparseMatrix<double> A =
+      Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+  const Eigen::MatrixXd b = Eigen::MatrixXd::Random(A.rows(), 3);
+  const Eigen::MatrixXd x_expected = A_dense.llt().solve(b);
+
+  sym::MixedPrecisionCholeskySolver solver;
+  solver.ComputeSymbolicSparsity(A);
+  solver.Factorize(A);
+
+  const Eigen::MatrixXd x = solver.Solve(b);
+  CHECK(!solver.UsedDoubleFactorization());
+  CHECK(solver.Iterations() > 0);
+  CHECK(solver.Iterations() <= solver.MaxRefinementSteps());
+  CHECK((A_dense * x - b).norm() <= 1e-10 * b.norm());
+  CHECK(x.isApprox(x_expected, 1e-10));
+
+  // A single float solve is not nearly as accurate
+  sym::MixedPrecisionCholeskySolver unrefined_solver(0);
+  unrefined_solver.ComputeSymbolicSparsity(A);
+  unrefined_solver.Factorize(A);
+  const Eigen::VectorXd x_unrefined = unrefined_solver.Solve(b.col(0));
+  CHECK(unrefined_solver.UsedDoubleFactorization());
+  CHECK(x_unrefined.isApprox(x_expected.col(0), 1e-10));
+
+  Eigen::MatrixXd x_in_place = b;
+  solver.SolveInPlace(&x_in_place);
+  CHECK(x_in_place.isApprox(x_expected, 1e-10));
+}
+
+TEST_CASE("MixedPrecisionCholeskySolver falls back to double for ill-conditioned matrices",
+          "[mixed_precision]") {
+  std::mt19937 gen(42);
+  const Eigen::MatrixXd A_dense = MakeIllConditionedMatrix(60, 1e12, gen);
+  const Eigen::SparseMatrix<double> A =
+      Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+  const Eigen::VectorXd b = Eigen::VectorXd::Random(A.rows());
+
+  sym::MixedPrecisionCholeskySolver solver(5);
+  solver.ComputeSymbolicSparsity(A);
+  solver.Factorize(A);
+  const Eigen::VectorXd x = solver.Solve(b);
+  CHECK(solver.UsedDoubleFactorization());
+  CHECK((A_dense * x - b).norm() <= 1e-14 * A_dense.norm() * x.norm());
+
+  // Refactorizing tries float again
+  solver.Factorize(A);
+  CHECK(!solver.UsedDoubleFactorization());
+}
+
+TEST_CASE("MixedPrecisionCholeskySolver refines damped ill-conditioned hessians in float",
+          "[mixed_precision]") {
+  std::mt19937 gen(42);
+
+  // Hessians like those damped by Levenberg-Marquardt, for a range of lambdas: one with variables
+  // on scales spanning 12 orders of magnitude, and one with condition number 1e5 independent of the
+  // scaling.  Neither allows the residual to reach a small multiple of ||b|| even in double, but
+  // refinement converges to a small backward error, so none of them should fall back to double.
+  const std::vector<Eigen::MatrixXd> hessians = {MakeBlockSparseMatrix(30, 1e12, gen),
+                                                 MakeIllConditionedMatrix(60, 1e5, gen)};
+  int num_solves = 0;
+  int num_fallbacks = 0;
+  for (const Eigen::MatrixXd& H : hessians) {
+    const Eigen::VectorXd b = Eigen::VectorXd::Random(H.rows());
+    sym::MixedPrecisionCholeskySolver solver;
+    for (const double lambda : {1e-8, 1e-6, 1e-4, 1e-2, 1.0}) {
+      const Eigen::MatrixXd A_dense = H + lambda * Eigen::MatrixXd(H.diagonal().asDiagonal());
+      const Eigen::SparseMatrix<double> A =
+          Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+      if (!solver.IsInitialized()) {
+        solver.ComputeSymbolicSparsity(A);
+      }
+      solver.Factorize(A);
+
+      const Eigen::VectorXd x = solver.Solve(b);
+      ++num_solves;
+      num_fallbacks += solver.UsedDoubleFactorization();
+      CHECK(solver.Iterations() < solver.MaxRefinementSteps());
+      CHECK((A_dense * x - b).norm() <= 1e-12 * A_dense.norm() * x.norm());
+    }
+  }
+  CHECK(num_solves == 10);
+  CHECK(num_fallbacks == 0);
+}
+
+TEST_CASE("Optimizing with a MixedPrecisionCholeskySolver matches the default solver",
+          "[mixed_precision]") {
+  std::mt19937 gen(42);
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+  }
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, i + 2}) {
+      if (j >= num_poses) {
+        continue;
+      }
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+      values.Set<sym::Pose3d>({'T', i, j}, sym::Pose3d::FromTangent(
+                                               0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 30;
+
+  sym::Valuesd default_values = values;
+  sym::Optimizerd default_optimizer(params, factors);
+  const auto default_stats = default_optimizer.Optimize(&default_values);
+
+  using MixedPrecisionOptimizer = sym::Optimizer<
+      double, sym::LevenbergMarquardtSolver<double, sym::MixedPrecisionCholeskySolver>>;
+  sym::Valuesd mixed_values = values;
+  MixedPrecisionOptimizer mixed_optimizer(params, factors);
+  const auto mixed_stats = mixed_optimizer.Optimize(&mixed_values);
+
+  CHECK(std::abs(mixed_stats.iterations[mixed_stats.best_index].new_error -
+                 default_stats.iterations[default_stats.best_index].new_error) < 1e-8);
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(sym::IsClose(mixed_values.At<sym::Pose3d>({'P', i}),
+                       default_values.At<sym::Pose3d>({'P', i}), 1e-6));
+  }
+
+  // The refinement steps are reported as the linear solver iterations
+  for (const auto& iteration : mixed_stats.iterations) {
+    if (iteration.iteration >= 0) {
+      CHECK(iteration.linear_solver_iterations > 0);
+    }
+  }
+}
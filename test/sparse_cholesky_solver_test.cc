@@ -8,6 +8,8 @@
 
 // Required by MetisSupport
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include <Eigen/Dense>
 #include <Eigen/MetisSupport>
@@ -181,3 +183,366 @@ TEST_CASE("Make sure solving in place works", "[sparse_cholesky]") {
   CHECK(x_ac.cols() == x_eigen.cols());
   CHECK(x_ac.isApprox(x_eigen, 1e-6));
 }
+
+TEST_CASE("Solving concurrently matches solving on one thread", "[sparse_cholesky]") {
+  constexpr int dim = 300;
+  std::mt19937 gen(42);
+  const SparseMatrix A = MakeRandomSymmetricSparseMatrix(dim, gen);
+
+  sym::SparseCholeskySolver<SparseMatrix> solver(A);
+  solver.Factorize(A);
+
+  constexpr int num_threads = 4;
+  std::vector<Eigen::MatrixXd> rhs;
+  std::vector<Eigen::MatrixXd> expected;
+  for (int i = 0; i < num_threads; ++i) {
+    rhs.push_back(sym::Random<Eigen::Matrix<double, dim, 3>>(gen));
+    expected.push_back(solver.Solve(rhs.back()));
+  }
+
+  // Each thread solves its own right hand side repeatedly.  SolveInPlace uses a workspace owned by
+  // the solver, so only Solve may be called concurrently
+  std::vector<Eigen::MatrixXd> results(num_threads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&, i]() {
+      for (int repeat = 0; repeat < 50; ++repeat) {
+        results[i] = solver.Solve(rhs[i]);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(results[i] == expected[i]);
+
+    Eigen::MatrixXd in_place_result = rhs[i];
+    solver.SolveInPlace(&in_place_result);
+    CHECK(in_place_result == expected[i]);
+  }
+}
+
+TEST_CASE("Supernodal factorization matches simplicial factorization", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // Set random seed
+  std::mt19937 gen(42);
+
+  for (const int dim : {1, 2, 30, 300}) {
+    const SparseMatrix A = MakeRandomSymmetricSparseMatrix(dim, gen);
+
+    Solver simplicial_solver(A);
+    Solver supernodal_solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+                             Solver::Factorization::SUPERNODAL);
+    CHECK(supernodal_solver.FactorizationMode() == Solver::Factorization::SUPERNODAL);
+
+    for (int i = 0; i < 3; ++i) {
+      // Mess with A by setting the diagonal randomly
+      SparseMatrix A_modified = A;
+      for (int inx = 0; inx < A_modified.rows(); ++inx) {
+        A_modified.coeffRef(inx, inx) = sym::Random<double>(gen);
+      }
+
+      simplicial_solver.Factorize(A_modified);
+      supernodal_solver.Factorize(A_modified);
+
+      CHECK(supernodal_solver.Permutation().indices() == simplicial_solver.Permutation().indices());
+      CHECK(supernodal_solver.L().nonZeros() == simplicial_solver.L().nonZeros());
+      CHECK(supernodal_solver.L().isApprox(simplicial_solver.L(), 1e-6));
+      CHECK(supernodal_solver.D().isApprox(simplicial_solver.D(), 1e-6));
+
+      const Eigen::MatrixXd b = Eigen::MatrixXd::Random(dim, 3);
+      CHECK(supernodal_solver.Solve(b).isApprox(simplicial_solver.Solve(b), 1e-6));
+    }
+  }
+}
+
+TEST_CASE("Supernodal factorization finds the supernodes of a block matrix", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // A block sparse SPD matrix, like the hessian of a pose graph with 6-dof poses
+  constexpr int block_dim = 6;
+  constexpr int num_blocks = 40;
+  constexpr int dim = block_dim * num_blocks;
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> block_distribution(0, num_blocks - 1);
+  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(dim, dim);
+  for (int col = 0; col < num_blocks; ++col) {
+    for (const int row : {col, (col + 1) % num_blocks, block_distribution(gen)}) {
+      J.block<block_dim, block_dim>(block_dim * row, block_dim * col).setRandom();
+    }
+  }
+  const Eigen::MatrixXd A_dense =
+      J * J.transpose() + Eigen::MatrixXd::Identity(dim, dim) * static_cast<double>(dim);
+  const SparseMatrix A = Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+
+  Solver solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+                Solver::Factorization::SUPERNODAL);
+  CHECK(solver.NumSupernodes() <= num_blocks);
+
+  const Eigen::MatrixXd b = Eigen::MatrixXd::Random(dim, 2);
+  CHECK(solver.Solve(b).isApprox(A_dense.llt().solve(b), 1e-8));
+}
+
+TEST_CASE("Parallel factorization matches serial factorization exactly", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // Set random seed
+  std::mt19937 gen(42);
+
+  // A chain with random loop closures, like the hessian of a pose graph
+  constexpr int dim = 2000;
+  std::vector<Eigen::Triplet<double>> triplets;
+  std::uniform_int_distribution<int> index_distribution(0, dim - 1);
+  for (int i = 0; i < dim; ++i) {
+    triplets.emplace_back(i, i, 10.0 + sym::Random<double>(gen));
+    if (i + 1 < dim) {
+      triplets.emplace_back(i + 1, i, sym::Random<double>(gen));
+    }
+    if (i % 10 == 0) {
+      const int j = index_distribution(gen);
+      triplets.emplace_back(std::max(i, j), std::min(i, j), sym::Random<double>(gen));
+    }
+  }
+  SparseMatrix chain(dim, dim);
+  chain.setFromTriplets(triplets.begin(), triplets.end());
+
+  for (const SparseMatrix& A : {chain, MakeRandomSymmetricSparseMatrix(300, gen)}) {
+    Solver serial_solver(A);
+    CHECK(serial_solver.NumParallelWaves() == 0);
+    const Eigen::MatrixXd b = Eigen::MatrixXd::Random(A.rows(), 2);
+    const Eigen::MatrixXd x_serial = serial_solver.Solve(b);
+
+    for (const int num_threads : {2, 4, 8}) {
+      Solver parallel_solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+                             Solver::Factorization::SIMPLICIAL, num_threads);
+      CHECK(parallel_solver.NumThreads() == num_threads);
+      CHECK(parallel_solver.NumParallelWaves() > 1);
+
+      // Factorize again to check that the helpers are reset correctly
+      parallel_solver.Factorize(A);
+
+      const SparseMatrix& L_serial = serial_solver.L();
+      const SparseMatrix& L_parallel = parallel_solver.L();
+      CHECK(L_parallel.nonZeros() == L_serial.nonZeros());
+      CHECK(std::equal(L_serial.valuePtr(), L_serial.valuePtr() + L_serial.nonZeros(),
+                       L_parallel.valuePtr()));
+      CHECK(std::equal(L_serial.innerIndexPtr(), L_serial.innerIndexPtr() + L_serial.nonZeros(),
+                       L_parallel.innerIndexPtr()));
+      CHECK(parallel_solver.D() == serial_solver.D());
+      CHECK(parallel_solver.Solve(b) == x_serial);
+    }
+  }
+}
+
+TEST_CASE("Refactorizing with the same pattern matches a new factorization", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // Set random seed
+  std::mt19937 gen(42);
+
+  for (const auto factorization :
+       {Solver::Factorization::SIMPLICIAL, Solver::Factorization::SUPERNODAL}) {
+    // Both triangles, so some of the values are outside of the triangle read by the solver
+    const SparseMatrix A = MakeRandomSymmetricSparseMatrix(200, gen);
+    Solver solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(), factorization);
+
+    for (int i = 0; i < 3; ++i) {
+      // New values with the same pattern, which only copies the values into the permuted matrix
+      SparseMatrix A_new = A;
+      for (int k = 0; k < A_new.nonZeros(); ++k) {
+        A_new.valuePtr()[k] *= 1 + 0.1 * sym::Random<double>(gen);
+      }
+      A_new = SparseMatrix(A_new.selfadjointView<Eigen::Lower>());
+      solver.Factorize(A_new);
+
+      const Solver new_solver(A_new, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+                              factorization);
+      CHECK(solver.Permutation().indices() == new_solver.Permutation().indices());
+      CHECK(solver.L().nonZeros() == new_solver.L().nonZeros());
+      CHECK(std::equal(solver.L().valuePtr(), solver.L().valuePtr() + solver.L().nonZeros(),
+                       new_solver.L().valuePtr()));
+      CHECK(solver.D() == new_solver.D());
+
+      const Eigen::MatrixXd b = Eigen::MatrixXd::Random(A.rows(), 2);
+      CHECK(solver.Solve(b) == new_solver.Solve(b));
+    }
+
+    // A pattern with fewer entries, which is twisted from scratch again
+    SparseMatrix A_lower = A.triangularView<Eigen::Lower>();
+    solver.Factorize(A_lower);
+    const Eigen::MatrixXd b = Eigen::MatrixXd::Random(A.rows(), 2);
+    CHECK(solver.Solve(b).isApprox(Eigen::MatrixXd(A).ldlt().solve(b), 1e-6));
+  }
+}
+
+TEST_CASE("Selected inverse matches the dense inverse", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // A block sparse SPD matrix, like the hessian of a pose graph with 6-dof poses
+  constexpr int block_dim = 6;
+  constexpr int num_blocks = 30;
+  constexpr int dim = block_dim * num_blocks;
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> block_distribution(0, num_blocks - 1);
+  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(dim, dim);
+  for (int col = 0; col < num_blocks; ++col) {
+    for (const int row : {col, (col + 1) % num_blocks, block_distribution(gen)}) {
+      J.block<block_dim, block_dim>(block_dim * row, block_dim * col).setRandom();
+    }
+  }
+  const Eigen::MatrixXd A_dense =
+      J * J.transpose() + Eigen::MatrixXd::Identity(dim, dim) * static_cast<double>(dim);
+  const SparseMatrix A = Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+  const Eigen::MatrixXd A_inverse = A_dense.inverse();
+
+  const std::vector<Solver> solvers = {
+      Solver(A), Solver(A, Eigen::NaturalOrdering<SparseMatrix::StorageIndex>()),
+      Solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+             Solver::Factorization::SUPERNODAL)};
+  for (const Solver& solver : solvers) {
+    SparseMatrix selected_inverse;
+    solver.ComputeSelectedInverse(&selected_inverse);
+    CHECK(selected_inverse.nonZeros() == solver.L().nonZeros() + dim);
+
+    // Every entry is the matching entry of the inverse of the permuted matrix
+    Eigen::MatrixXd permuted_inverse = A_inverse;
+    if (solver.Permutation().size() > 0) {
+      permuted_inverse = solver.Permutation() * A_inverse * solver.Permutation().transpose();
+    }
+    double max_error = 0;
+    for (int col = 0; col < dim; ++col) {
+      for (SparseMatrix::InnerIterator it(selected_inverse, col); it; ++it) {
+        max_error = std::max(max_error, std::abs(it.value() - permuted_inverse(it.row(), col)));
+      }
+    }
+    CHECK(max_error < 1e-12);
+
+    for (int block = 0; block < num_blocks; ++block) {
+      Eigen::MatrixXd inverse_block;
+      solver.SelectedInverseBlock(selected_inverse, block_dim * block, block_dim, &inverse_block);
+      CHECK(inverse_block.isApprox(A_inverse.block(block_dim * block, block_dim * block,
+                                                   block_dim, block_dim),
+                                   1e-10));
+    }
+  }
+}
+
+TEST_CASE("Selected inverse blocks outside the pattern of L are computed", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+
+  // A tridiagonal matrix, whose factor with the natural ordering is bidiagonal, so the selected
+  // inverse is missing most of the entries of any block larger than 2x2
+  constexpr int dim = 20;
+  Eigen::MatrixXd A_dense = Eigen::MatrixXd::Zero(dim, dim);
+  for (int i = 0; i < dim; ++i) {
+    A_dense(i, i) = 4;
+    if (i + 1 < dim) {
+      A_dense(i + 1, i) = A_dense(i, i + 1) = -1;
+    }
+  }
+  const SparseMatrix A = Eigen::MatrixXd(A_dense.triangularView<Eigen::Lower>()).sparseView();
+  const Eigen::MatrixXd A_inverse = A_dense.inverse();
+
+  const Solver solver(A, Eigen::NaturalOrdering<SparseMatrix::StorageIndex>());
+  SparseMatrix selected_inverse;
+  solver.ComputeSelectedInverse(&selected_inverse);
+
+  for (const int offset : {0, 7, 15}) {
+    Eigen::MatrixXd inverse_block;
+    solver.SelectedInverseBlock(selected_inverse, offset, 5, &inverse_block);
+    CHECK(inverse_block.isApprox(A_inverse.block(offset, offset, 5, 5), 1e-12));
+  }
+}
+
+TEST_CASE("Rank updates match refactorization", "[sparse_cholesky]") {
+  using Solver = sym::SparseCholeskySolver<SparseMatrix>;
+  using RowMajorMatrix = Solver::RowMajorMatrixType;
+
+  // Jacobian rows of a chain of scalar variables, with one row per pair of neighbors and a prior
+  // on each variable, like a fixed-lag smoother
+  constexpr int dim = 60;
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> distribution(-1.0, 1.0);
+  const auto make_rows = [&](const std::vector<std::pair<int, int>>& pairs) {
+    std::vector<Eigen::Triplet<double>> triplets;
+    for (size_t row = 0; row < pairs.size(); ++row) {
+      triplets.emplace_back(row, pairs[row].first, distribution(gen));
+      if (pairs[row].second != pairs[row].first) {
+        triplets.emplace_back(row, pairs[row].second, distribution(gen));
+      }
+    }
+    RowMajorMatrix rows(pairs.size(), dim);
+    rows.setFromTriplets(triplets.begin(), triplets.end());
+    return rows;
+  };
+
+  std::vector<std::pair<int, int>> pairs;
+  for (int i = 0; i < dim; ++i) {
+    pairs.emplace_back(i, i);
+    if (i + 1 < dim) {
+      pairs.emplace_back(i, i + 1);
+    }
+  }
+  const RowMajorMatrix J = make_rows(pairs);
+  const Eigen::MatrixXd H =
+      Eigen::MatrixXd(J.transpose() * J) + Eigen::MatrixXd::Identity(dim, dim);
+  const SparseMatrix A = Eigen::MatrixXd(H.triangularView<Eigen::Lower>()).sparseView();
+
+  // New factors between neighbors, and some of the existing factors removed.  The pattern of A
+  // stays the same, since there is still a factor between 5 and 6.
+  const RowMajorMatrix W_added = make_rows({{3, 4}, {5, 6}, {10, 11}, {20, 20}, {59, 58}});
+  const RowMajorMatrix W_removed = RowMajorMatrix(J.middleRows(10, 3));
+  const Eigen::MatrixXd H_new = H + Eigen::MatrixXd(W_added.transpose() * W_added) -
+                                Eigen::MatrixXd(W_removed.transpose() * W_removed);
+  const SparseMatrix A_new = Eigen::MatrixXd(H_new.triangularView<Eigen::Lower>()).sparseView();
+
+  // A factor between variables that are not neighbors changes the pattern
+  const RowMajorMatrix W_loop_closure = make_rows({{0, dim - 1}});
+  const Eigen::MatrixXd H_loop_closure =
+      H + Eigen::MatrixXd(W_loop_closure.transpose() * W_loop_closure);
+  const SparseMatrix A_loop_closure =
+      Eigen::MatrixXd(H_loop_closure.triangularView<Eigen::Lower>()).sparseView();
+
+  const Eigen::MatrixXd b = Eigen::MatrixXd::Random(dim, 2);
+
+  std::vector<Solver> solvers = {
+      Solver(A), Solver(A, Eigen::NaturalOrdering<SparseMatrix::StorageIndex>()),
+      Solver(A, Eigen::MetisOrdering<SparseMatrix::StorageIndex>(),
+             Solver::Factorization::SUPERNODAL)};
+  for (Solver& solver : solvers) {
+    Solver updated = solver;
+
+    CHECK(updated.RankUpdate(W_added));
+    CHECK(updated.RankDowndate(W_removed));
+    CHECK(updated.Solve(b).isApprox(H_new.llt().solve(b), 1e-10));
+
+    // The factor is the same as refactorizing in the same ordering
+    Solver refactorized = solver;
+    refactorized.Factorize(A_new);
+    CHECK(updated.D().isApprox(refactorized.D(), 1e-10));
+    CHECK(Eigen::MatrixXd(updated.L()).isApprox(Eigen::MatrixXd(refactorized.L()), 1e-10));
+
+    // Downdating undoes the update
+    CHECK(updated.RankUpdate(W_removed));
+    CHECK(updated.RankDowndate(W_added));
+    CHECK(updated.D().isApprox(solver.D(), 1e-10));
+
+    Solver combined = solver;
+    CHECK(combined.UpdateFactorization(A_new, W_added, W_removed));
+    CHECK(combined.Solve(b).isApprox(H_new.llt().solve(b), 1e-10));
+
+    // Falls back to refactorizing when the pattern changes, without modifying the factorization
+    // when only checking
+    Solver loop_closure = solver;
+    CHECK(!loop_closure.RankUpdate(W_loop_closure));
+    CHECK(loop_closure.D() == solver.D());
+    CHECK(
+        !loop_closure.UpdateFactorization(A_loop_closure, W_loop_closure, RowMajorMatrix(0, dim)));
+    CHECK(loop_closure.Solve(b).isApprox(H_loop_closure.llt().solve(b), 1e-10));
+  }
+}
@@ -248,3 +248,107 @@ TEMPLATE_TEST_CASE("Test Schur complement with real matrix", "[schur_solver]", f
   std::tie(landmarks_dim, A) = LoadMatrix();
   TestSchur<Scalar>(A.cast<Scalar>(), landmarks_dim);
 }
+
+TEST_CASE("Schur complement dimension is found from the structure", "[schur_solver]") {
+  int landmarks_dim;
+  Eigen::SparseMatrix<double> A;
+  std::tie(landmarks_dim, A) = BuildSmallMatrix();
+
+  using Solver = sym::SparseSchurSolver<Eigen::SparseMatrix<double>>;
+  CHECK(Solver::BlockDiagonalTailDim(A) == landmarks_dim);
+
+  // A block diagonal matrix keeps its first block in B
+  const Eigen::SparseMatrix<double> C = A.bottomRightCorner(landmarks_dim, landmarks_dim);
+  CHECK(Solver::BlockDiagonalTailDim(C) == landmarks_dim - 2);
+
+  // Damp A, as the Levenberg-Marquardt solver does
+  Eigen::SparseMatrix<double> A_damped = A;
+  for (int i = 0; i < A_damped.rows(); ++i) {
+    A_damped.coeffRef(i, i) += 1.0;
+  }
+  const Eigen::MatrixXd A_dense = Eigen::MatrixXd(A_damped).selfadjointView<Eigen::Lower>();
+
+  Solver solver;
+  solver.ComputeSymbolicSparsity(A_damped);
+  CHECK(solver.IsInitialized());
+  CHECK(solver.BDim() == A.rows() - landmarks_dim);
+  CHECK(solver.CDim() == landmarks_dim);
+
+  solver.Factorize(A_damped);
+  const Eigen::MatrixXd rhs = Eigen::MatrixXd::Random(A.rows(), 3);
+  const Eigen::MatrixXd x_expected = A_dense.ldlt().solve(rhs);
+  CHECK(solver.Solve(rhs).isApprox(x_expected, 1e-4));
+
+  Eigen::MatrixXd x = rhs;
+  solver.SolveInPlace(&x);
+  CHECK(x.isApprox(x_expected, 1e-4));
+
+  // The permutation covers all of A, and is the identity on C
+  const auto& permutation = solver.Permutation();
+  REQUIRE(permutation.size() == A.rows());
+  for (int i = solver.BDim(); i < A.rows(); ++i) {
+    CHECK(permutation.indices()[i] == i);
+  }
+  CHECK(solver.L().rows() == solver.BDim());
+}
+
+TEST_CASE("Schur complement factorization does not depend on the number of threads",
+          "[schur_solver]") {
+  // A bundle adjustment hessian, with cameras of dimension 6 and landmarks of dimensions 1, 3 and
+  // 5 (which does not have a fixed-size kernel), each observed by two of the cameras
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dist(-1, 1);
+  const int num_cameras = 4;
+  const int num_landmarks = 30;
+  const int landmark_dims[] = {1, 3, 5};
+
+  std::vector<Eigen::Triplet<double>> triplets;
+  int row = 0;
+  int landmark_offset = 6 * num_cameras;
+  for (int landmark = 0; landmark < num_landmarks; ++landmark) {
+    const int dim = landmark_dims[landmark % 3];
+    for (const int camera : {landmark % num_cameras, (landmark + 1) % num_cameras}) {
+      for (int r = 0; r < 2; ++r) {
+        for (int i = 0; i < 6; ++i) {
+          triplets.emplace_back(row + r, 6 * camera + i, dist(gen));
+        }
+        for (int i = 0; i < dim; ++i) {
+          triplets.emplace_back(row + r, landmark_offset + i, dist(gen));
+        }
+      }
+      row += 2;
+    }
+    landmark_offset += dim;
+  }
+  Eigen::SparseMatrix<double> J(row, landmark_offset);
+  J.setFromTriplets(triplets.begin(), triplets.end());
+
+  Eigen::SparseMatrix<double> identity(J.cols(), J.cols());
+  identity.setIdentity();
+  const Eigen::SparseMatrix<double> A =
+      Eigen::SparseMatrix<double>(J.transpose() * J + identity).triangularView<Eigen::Lower>();
+  const Eigen::MatrixXd A_dense = Eigen::MatrixXd(A).selfadjointView<Eigen::Lower>();
+
+  const Eigen::MatrixXd rhs = Eigen::MatrixXd::Random(A.rows(), 2);
+  const Eigen::MatrixXd x_expected = A_dense.ldlt().solve(rhs);
+
+  std::vector<Eigen::MatrixXd> solutions;
+  for (const int num_threads : {1, 4}) {
+    sym::SparseSchurSolver<Eigen::SparseMatrix<double>> solver(
+        Eigen::MetisOrdering<Eigen::SparseMatrix<double>::StorageIndex>(), num_threads);
+    CHECK(solver.NumThreads() == num_threads);
+    solver.ComputeSymbolicSparsity(A);
+    CHECK(solver.CDim() == landmark_offset - 6 * num_cameras);
+
+    // Factorize repeatedly, since later factorizations reuse the storage of the first
+    for (int i = 0; i < 3; ++i) {
+      solver.Factorize(A);
+      const Eigen::MatrixXd x = solver.Solve(rhs);
+      CHECK(x.isApprox(x_expected, 1e-10));
+      if (i == 0) {
+        solutions.push_back(x);
+      }
+    }
+  }
+  CHECK(solutions[0].isApprox(solutions[1], 1e-12));
+}
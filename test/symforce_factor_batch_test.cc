@@ -0,0 +1,152 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/factor_batch.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/util.h>
+#include <symforce/opt/values.h>
+
+namespace {
+
+/**
+ * Build a pose graph with priors and between factors, either created individually or from one
+ * FactorBatch for each functor.  The factors of the two batches are interleaved, and the number of
+ * factors in each is not a multiple of the batch width.
+ */
+std::vector<sym::Factord> BuildFactors(const int num_poses, const bool batched) {
+  sym::FactorBatchd prior_batch(sym::PriorFactorPose3<double>);
+  sym::FactorBatchd between_batch(sym::BetweenFactorPose3<double>);
+
+  std::vector<sym::Factord> factors;
+  for (int i = 0; i < num_poses; ++i) {
+    const std::vector<sym::Key> prior_keys = {{'P', i}, {'T', i, i}, 'S', 'e'};
+    if (batched) {
+      factors.push_back(prior_batch.MakeFactor(prior_keys, {{'P', i}}));
+    } else {
+      factors.push_back(
+          sym::Factord::Hessian(sym::PriorFactorPose3<double>, prior_keys, {{'P', i}}));
+    }
+
+    for (const int j : {i + 1, i + 3}) {
+      if (j >= num_poses) {
+        continue;
+      }
+
+      const std::vector<sym::Key> between_keys = {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'};
+      if (batched) {
+        factors.push_back(between_batch.MakeFactor(between_keys, {{'P', i}, {'P', j}}));
+      } else {
+        factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>, between_keys,
+                                                {{'P', i}, {'P', j}}));
+      }
+    }
+  }
+
+  return factors;
+}
+
+sym::Valuesd BuildValues(const std::vector<sym::Factord>& factors, std::mt19937& gen) {
+  sym::Valuesd values;
+  for (const auto& factor : factors) {
+    for (const auto& key : factor.AllKeys()) {
+      if ((key.Letter() == 'P' || key.Letter() == 'T') && !values.Has(key)) {
+        values.Set<sym::Pose3d>(key, sym::Random<sym::Pose3d>(gen));
+      }
+    }
+  }
+
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', 10 * Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+  return values;
+}
+
+template <typename Scalar>
+bool BitwiseEqual(const Eigen::SparseMatrix<Scalar>& a, const Eigen::SparseMatrix<Scalar>& b) {
+  return a.nonZeros() == b.nonZeros() &&
+         std::equal(a.valuePtr(), a.valuePtr() + a.nonZeros(), b.valuePtr()) &&
+         std::equal(a.innerIndexPtr(), a.innerIndexPtr() + a.nonZeros(), b.innerIndexPtr());
+}
+
+}  // namespace
+
+TEST_CASE("Factors from a FactorBatch linearize on their own", "[factor_batch]") {
+  std::mt19937 gen(42);
+  const std::vector<sym::Factord> factors = BuildFactors(5, false);
+  const std::vector<sym::Factord> batch_factors = BuildFactors(5, true);
+  const sym::Valuesd values = BuildValues(factors, gen);
+
+  REQUIRE(factors.size() == batch_factors.size());
+  for (size_t i = 0; i < factors.size(); ++i) {
+    CHECK(factors[i].BatchKernel() == nullptr);
+    CHECK(batch_factors[i].BatchKernel() != nullptr);
+    CHECK(batch_factors[i].CanLinearizeInto());
+
+    const auto linearized_factor = factors[i].Linearize(values);
+    const auto linearized_batch_factor = batch_factors[i].Linearize(values);
+    CHECK(linearized_factor.residual == linearized_batch_factor.residual);
+    CHECK(linearized_factor.jacobian == linearized_batch_factor.jacobian);
+    CHECK(linearized_factor.hessian == linearized_batch_factor.hessian);
+    CHECK(linearized_factor.rhs == linearized_batch_factor.rhs);
+  }
+}
+
+TEST_CASE("Linearizing a FactorBatch matches linearizing individual factors", "[factor_batch]") {
+  std::mt19937 gen(42);
+  const int num_poses = 37;
+  const std::vector<sym::Factord> factors = BuildFactors(num_poses, false);
+  const std::vector<sym::Factord> batch_factors = BuildFactors(num_poses, true);
+  sym::Valuesd values = BuildValues(factors, gen);
+
+  for (const int num_threads : {1, 3}) {
+    sym::Linearizer<double> linearizer("individual", factors, {}, num_threads);
+    sym::Linearizer<double> batch_linearizer("batch", batch_factors, {}, num_threads);
+
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      sym::Linearizationd linearization;
+      sym::Linearizationd batch_linearization;
+      linearizer.Relinearize(values, &linearization);
+      batch_linearizer.Relinearize(values, &batch_linearization);
+
+      CHECK(linearization.residual == batch_linearization.residual);
+      CHECK(linearization.rhs == batch_linearization.rhs);
+      CHECK(BitwiseEqual(linearization.jacobian, batch_linearization.jacobian));
+      CHECK(BitwiseEqual(linearization.hessian_lower, batch_linearization.hessian_lower));
+
+      for (int i = 0; i < num_poses; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+    }
+
+    // A Values with a different layout, which requires new index entries for the batches
+    sym::Valuesd reordered_values;
+    reordered_values.Set('e', sym::kDefaultEpsilond);
+    reordered_values.Set<Eigen::Matrix<double, 6, 6>>('S',
+                                                      values.At<Eigen::Matrix<double, 6, 6>>('S'));
+    const std::vector<sym::Key> keys = values.Keys();
+    for (auto key = keys.rbegin(); key != keys.rend(); ++key) {
+      if (key->Letter() == 'P' || key->Letter() == 'T') {
+        reordered_values.Set<sym::Pose3d>(*key, values.At<sym::Pose3d>(*key));
+      }
+    }
+
+    sym::Linearizationd linearization;
+    sym::Linearizationd batch_linearization;
+    linearizer.Relinearize(reordered_values, &linearization);
+    batch_linearizer.Relinearize(reordered_values, &batch_linearization);
+    CHECK(linearization.residual == batch_linearization.residual);
+    CHECK(BitwiseEqual(linearization.hessian_lower, batch_linearization.hessian_lower));
+  }
+}
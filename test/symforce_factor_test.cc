@@ -826,3 +826,81 @@ TEMPLATE_TEST_CASE("Test Hessian functors has minimal copies", "[factors]", doub
     CHECK(TestHessianFunctor<Scalar>::copies == 1);  // f should be copied once
   }
 }
+
+TEMPLATE_TEST_CASE("Copies of a fixed size factor hold their own functor", "[factors]", double,
+                   float) {
+  using Scalar = TestType;
+
+  const sym::Factor<Scalar> factor =
+      sym::Factor<Scalar>::Hessian(TestHessianFunctor<Scalar>(), {'x'});
+  TestHessianFunctor<Scalar>::copies = 0;
+
+  const sym::Factor<Scalar> factor_copy = factor;
+  CHECK(TestHessianFunctor<Scalar>::copies == 1);
+
+  sym::Values<Scalar> values;
+  values.Set('x', Scalar(2.0));
+  CHECK(factor_copy.Linearize(values).residual == factor.Linearize(values).residual);
+  CHECK(factor_copy.Linearize(values).hessian == factor.Linearize(values).hessian);
+}
+
+TEST_CASE("Test functors taking const references see the values", "[factors]") {
+  // A rotation that is not normalized, to check that it is not renormalized on the way in
+  const Eigen::Vector4d quaternion = 1.1 * Eigen::Vector4d(0.1, 0.2, 0.3, 0.9).normalized();
+
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>('P', sym::Pose3d(sym::Rot3d::FromYawPitchRoll(0.1, 0.2, 0.3),
+                                           Eigen::Vector3d(1.0, 2.0, 3.0)));
+  values.Set<sym::Rot3d>('R', sym::Rot3d::FromNormalizedData(quaternion));
+  values.Set('v', Eigen::Vector3d(4.0, 5.0, 6.0));
+  values.Set('m', Eigen::Matrix2d(Eigen::Vector4d(1.0, 2.0, 3.0, 4.0).data()));
+  values.Set('s', 2.0);
+
+  const sym::index_t index = values.CreateIndex({'P', 'R', 'v', 'm', 's'});
+  const auto storage = [&](const int i) { return values.Data().data() + index.entries[i].offset; };
+
+  int num_calls = 0;
+  const auto check_arguments = [&](const sym::Pose3d& pose, const sym::Rot3d& rot,
+                                   const Eigen::Ref<const Eigen::Vector3d>& vector,
+                                   const Eigen::Map<const Eigen::Matrix2d> matrix, double scalar) {
+    num_calls += 1;
+    CHECK(pose.Data() == values.At<sym::Pose3d>('P').Data());
+    CHECK(rot.Data() == quaternion);
+
+    // Ref and Map arguments point into the storage
+    CHECK(vector.data() == storage(2));
+    CHECK(matrix.data() == storage(3));
+    CHECK(vector == values.At<Eigen::Vector3d>('v'));
+    CHECK(matrix == values.At<Eigen::Matrix2d>('m'));
+    CHECK(scalar == 2.0);
+  };
+
+  const sym::Factord jacobian_factor = sym::Factord::Jacobian(
+      [&](const sym::Pose3d& pose, const sym::Rot3d& rot,
+          const Eigen::Ref<const Eigen::Vector3d>& vector,
+          const Eigen::Map<const Eigen::Matrix2d> matrix, double scalar,
+          Eigen::Matrix<double, 1, 1>* residual, Eigen::Matrix<double, 1, 1>* jacobian) {
+        check_arguments(pose, rot, vector, matrix, scalar);
+        residual->setZero();
+        jacobian->setZero();
+      },
+      {'P', 'R', 'v', 'm', 's'}, {'s'});
+  jacobian_factor.Linearize(values);
+
+  const sym::Factord hessian_factor = sym::Factord::Hessian(
+      [&](const sym::Pose3d& pose, const sym::Rot3d& rot,
+          const Eigen::Ref<const Eigen::Vector3d>& vector,
+          const Eigen::Map<const Eigen::Matrix2d> matrix, double scalar,
+          Eigen::Matrix<double, 1, 1>* residual, Eigen::Matrix<double, 1, 1>* jacobian,
+          Eigen::Matrix<double, 1, 1>* hessian, Eigen::Matrix<double, 1, 1>* rhs) {
+        check_arguments(pose, rot, vector, matrix, scalar);
+        residual->setZero();
+        jacobian->setZero();
+        hessian->setZero();
+        rhs->setZero();
+      },
+      {'P', 'R', 'v', 'm', 's'}, {'s'});
+  hessian_factor.Linearize(values);
+
+  CHECK(num_calls == 2);
+}
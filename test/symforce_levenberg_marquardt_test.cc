@@ -3,11 +3,19 @@
  * This source code is under the Apache 2.0 license found in the LICENSE file.
  * ---------------------------------------------------------------------------- */
 
+#include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <spdlog/spdlog.h>
 
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
 #include <symforce/opt/levenberg_marquardt_solver.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/optimizer.h>
+
+#include "allocation_counter.h"
 
 /**
  * Test that Gauss Newton converges to the exact result for a linear residual where the solution is
@@ -88,3 +96,157 @@ TEMPLATE_TEST_CASE("Converges for a linear problem in one iteration", "[levenber
   // Check solution is zero
   CHECK(solver.GetBestValues().template At<StateVector>('v').norm() < 1e-4);
 }
+
+TEST_CASE("Iterations after the first do not allocate", "[levenberg_marquardt]") {
+  const int num_poses = 30;
+  std::mt19937 gen(42);
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+
+  std::vector<sym::Key> optimized_keys;
+  for (int i = 0; i < num_poses; ++i) {
+    optimized_keys.emplace_back('P', i);
+  }
+
+  for (const bool defer_linearization : {false, true}) {
+    CAPTURE(defer_linearization);
+
+    sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+    params.iterations = 30;
+    params.early_exit_min_reduction = 0;
+    params.defer_linearization = defer_linearization;
+
+    sym::Linearizer<double> linearizer("linearizer", factors, optimized_keys);
+    const auto linearize_func = [&linearizer](const sym::Valuesd& values,
+                                              sym::Linearizationd* const linearization) {
+      linearizer.Relinearize(values, linearization);
+    };
+    const auto residual_func = [&linearizer](const sym::Valuesd& values,
+                                             Eigen::VectorXd* const residual) {
+      linearizer.EvaluateResidual(values, residual);
+    };
+
+    sym::LevenbergMarquardtSolverd solver(params, "solver", sym::kDefaultEpsilond);
+    solver.SetIndex(values.CreateIndex(optimized_keys));
+    solver.Reset(values);
+
+    sym::OptimizationStatsd stats;
+    stats.Reset(params.iterations);
+
+    // The first iteration sets up all the storage
+    solver.Iterate(linearize_func, residual_func, &stats);
+
+    for (int i = 1; i < params.iterations; ++i) {
+      const sym::AllocationCounter allocations;
+      solver.Iterate(linearize_func, residual_func, &stats);
+      CHECK(allocations.Count() == 0);
+    }
+
+    // Make sure both accepted and rejected steps were covered
+    const auto& iterations = stats.iterations;
+    CHECK(std::any_of(iterations.begin() + 1, iterations.end(),
+                      [](const auto& iteration) { return iteration.update_accepted; }));
+    CHECK(std::any_of(iterations.begin() + 1, iterations.end(),
+                      [](const auto& iteration) { return !iteration.update_accepted; }));
+  }
+}
+
+namespace {
+
+// A SparseCholeskySolver that reports the first num_failures factorizations as failed
+class FailingCholeskySolver : public sym::SparseCholeskySolver<Eigen::SparseMatrix<double>> {
+ public:
+  explicit FailingCholeskySolver(const int num_failures = 0) : num_failures_(num_failures) {}
+
+  bool Factorize(const MatrixType& A) {
+    sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>::Factorize(A);
+    return num_failures_-- <= 0;
+  }
+
+ private:
+  int num_failures_;
+};
+
+}  // namespace
+
+TEST_CASE("Steps that fail to factorize are rejected", "[levenberg_marquardt]") {
+  const int num_poses = 10;
+  std::mt19937 gen(42);
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+
+  sym::optimizer_params_t params = sym::DefaultOptimizerParams();
+  params.iterations = 50;
+  params.enable_bold_updates = true;
+  params.num_threads = 1;
+
+  sym::Valuesd expected_values = values;
+  sym::Optimizerd expected_optimizer(params, factors);
+  const auto expected_stats = expected_optimizer.Optimize(&expected_values);
+
+  using FailingOptimizer =
+      sym::Optimizer<double, sym::LevenbergMarquardtSolver<double, FailingCholeskySolver>>;
+  for (const int speculative_lambdas : {1, 3}) {
+    CAPTURE(speculative_lambdas);
+    params.speculative_lambdas = speculative_lambdas;
+
+    const int num_failures = 2;
+    sym::Valuesd failing_values = values;
+    FailingOptimizer failing_optimizer(params, factors, sym::kDefaultEpsilond, "sym::Optimizer",
+                                       {}, false, false, FailingCholeskySolver(num_failures));
+    const auto failing_stats = failing_optimizer.Optimize(&failing_values);
+
+    if (speculative_lambdas == 1) {
+      // The failed steps are rejected without moving, and increase lambda
+      for (int i = 1; i <= num_failures; ++i) {
+        const auto& iteration = failing_stats.iterations[i];
+        CHECK(!iteration.update_accepted);
+        CHECK(iteration.new_error == Catch::Approx(failing_stats.iterations[0].new_error));
+        CHECK(iteration.current_lambda ==
+              Catch::Approx(params.initial_lambda * std::pow(params.lambda_up_factor, i - 1)));
+      }
+      CHECK(failing_stats.iterations[num_failures + 1].current_lambda ==
+            Catch::Approx(params.initial_lambda * std::pow(params.lambda_up_factor, num_failures)));
+    } else {
+      // The failed candidates are skipped
+      CHECK(failing_stats.iterations[1].current_lambda ==
+            Catch::Approx(params.initial_lambda * std::pow(params.lambda_up_factor, num_failures)));
+    }
+
+    CHECK(failing_stats.iterations[failing_stats.best_index].new_error ==
+          Catch::Approx(expected_stats.iterations[expected_stats.best_index].new_error)
+              .margin(1e-8));
+  }
+}
@@ -0,0 +1,764 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <catch2/catch_approx.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/internal/linearized_factor_arena.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/util.h>
+#include <symforce/opt/values.h>
+
+#include "allocation_counter.h"
+
+namespace {
+
+/**
+ * Build a pose graph with a chain of between factors, some random loop closures, a prior on the
+ * first pose, and a sparse factor on every few poses, so that the linearizer sees both dense and
+ * sparse factors
+ */
+std::vector<sym::Factord> BuildPoseGraphFactors(const int num_poses, std::mt19937& gen) {
+  std::vector<sym::Factord> factors;
+
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'T', 0, 0}, 'S', 'e'}, {{'P', 0}}));
+
+  const auto add_between_factor = [&factors](const int i, const int j) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                            {{'P', i}, {'P', j}}));
+  };
+
+  for (int i = 0; i < num_poses - 1; ++i) {
+    add_between_factor(i, i + 1);
+  }
+
+  std::uniform_int_distribution<int> pose_distribution(0, num_poses - 1);
+  for (int k = 0; k < num_poses / 2; ++k) {
+    const int i = pose_distribution(gen);
+    const int j = pose_distribution(gen);
+    if (std::abs(i - j) > 1) {
+      add_between_factor(i, j);
+    }
+  }
+
+  // Sparse factor pulling the translations of two poses together
+  for (int i = 0; i + 3 < num_poses; i += 3) {
+    factors.push_back(sym::Factord::Jacobian(
+        [](const sym::Pose3d& a, const sym::Pose3d& b, Eigen::VectorXd* const res,
+           Eigen::SparseMatrix<double>* const jac) {
+          *res = a.Position() - b.Position();
+          if (jac == nullptr) {
+            return;
+          }
+          jac->resize(3, 12);
+          for (int row = 0; row < 3; ++row) {
+            jac->coeffRef(row, 3 + row) = 1.0;
+            jac->coeffRef(row, 9 + row) = -1.0;
+          }
+          jac->makeCompressed();
+        },
+        {{'P', i}, {'P', i + 3}}));
+  }
+
+  return factors;
+}
+
+sym::Valuesd BuildPoseGraphValues(const std::vector<sym::Factord>& factors, const int num_poses,
+                                  std::mt19937& gen) {
+  sym::Valuesd values;
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+  }
+
+  for (const auto& factor : factors) {
+    for (const auto& key : factor.AllKeys()) {
+      if (key.Letter() == 'T' && !values.Has(key)) {
+        values.Set<sym::Pose3d>(key, sym::Random<sym::Pose3d>(gen));
+      }
+    }
+  }
+
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', 10 * Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+  return values;
+}
+
+template <typename Scalar>
+bool BitwiseEqual(const Eigen::SparseMatrix<Scalar>& a, const Eigen::SparseMatrix<Scalar>& b) {
+  return a.nonZeros() == b.nonZeros() &&
+         std::equal(a.valuePtr(), a.valuePtr() + a.nonZeros(), b.valuePtr()) &&
+         std::equal(a.innerIndexPtr(), a.innerIndexPtr() + a.nonZeros(), b.innerIndexPtr());
+}
+
+/**
+ * Wrap a factor in a dynamic size DenseHessianFunc, which the Linearizer can't evaluate into its
+ * arena, so the result is stored in a separate LinearizedDenseFactor
+ */
+sym::Factord HeapBackedCopy(const sym::Factord& factor) {
+  return sym::Factord(
+      [factor](const sym::Valuesd& values, const std::vector<sym::index_entry_t>& /* keys */,
+               Eigen::VectorXd* const res, Eigen::MatrixXd* const jac, Eigen::MatrixXd* const hess,
+               Eigen::VectorXd* const rhs) {
+        const sym::Factord::LinearizedDenseFactor linearized_factor = factor.Linearize(values);
+        *res = linearized_factor.residual;
+        if (jac != nullptr) {
+          *jac = linearized_factor.jacobian;
+        }
+        if (hess != nullptr) {
+          *hess = linearized_factor.hessian;
+        }
+        if (rhs != nullptr) {
+          *rhs = linearized_factor.rhs;
+        }
+      },
+      factor.AllKeys(), factor.OptimizedKeys());
+}
+
+}  // namespace
+
+TEST_CASE("Parallel relinearization matches serial relinearization exactly", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 200;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  sym::Linearizer<double> serial_linearizer("serial", factors);
+  CHECK(serial_linearizer.NumThreads() == 1);
+
+  for (const int num_threads : {2, 3, 8}) {
+    sym::Linearizer<double> parallel_linearizer("parallel", factors, {}, num_threads);
+    CHECK(parallel_linearizer.NumThreads() == num_threads);
+
+    // Relinearize a few times at different points, to exercise the initialization as well as the
+    // steady state
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      sym::Linearizationd serial_linearization;
+      sym::Linearizationd parallel_linearization;
+      serial_linearizer.Relinearize(values, &serial_linearization);
+      parallel_linearizer.Relinearize(values, &parallel_linearization);
+
+      CHECK(serial_linearization.residual == parallel_linearization.residual);
+      CHECK(serial_linearization.rhs == parallel_linearization.rhs);
+      CHECK(BitwiseEqual(serial_linearization.jacobian, parallel_linearization.jacobian));
+      CHECK(BitwiseEqual(serial_linearization.hessian_lower, parallel_linearization.hessian_lower));
+
+      for (int i = 0; i < num_poses; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+    }
+  }
+}
+
+TEST_CASE("Parallel relinearization propagates factor exceptions", "[linearizer]") {
+  sym::Valuesd values;
+  std::vector<sym::Factord> factors;
+  for (int i = 0; i < 20; ++i) {
+    values.Set<double>({'x', i}, i);
+    factors.push_back(sym::Factord::Jacobian(
+        [i](const double x, Eigen::Matrix<double, 1, 1>* const res,
+            Eigen::Matrix<double, 1, 1>* const jac) {
+          if (i == 13) {
+            throw std::runtime_error("Factor failed");
+          }
+          (*res) << x;
+          (*jac) << 1;
+        },
+        {{'x', i}}));
+  }
+
+  sym::Linearizer<double> linearizer("parallel", factors, {}, 4);
+  sym::Linearizationd linearization;
+  CHECK_THROWS_AS(linearizer.Relinearize(values, &linearization), std::runtime_error);
+}
+
+TEST_CASE("Parallel scatter handles keys shared by many factors", "[linearizer]") {
+  // Every factor touches the calibration key 'c', so no two factors can be scattered at the same
+  // time, while the between factors on the poses can be
+  std::mt19937 gen(42);
+  const int num_poses = 100;
+  std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  for (int i = 0; i < num_poses; ++i) {
+    factors.push_back(sym::Factord::Jacobian(
+        [](const sym::Pose3d& pose, const double c, Eigen::Matrix<double, 3, 1>* const res,
+           Eigen::Matrix<double, 3, 7>* const jac) {
+          *res = c * pose.Position();
+          jac->setZero();
+          jac->block<3, 3>(0, 3) = c * pose.Rotation().ToRotationMatrix();
+          jac->col(6) = pose.Position();
+        },
+        {{'P', i}, 'c'}));
+  }
+
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+  values.Set<double>('c', 2.0);
+
+  sym::Linearizer<double> serial_linearizer("serial", factors);
+  sym::Linearizer<double> parallel_linearizer("parallel", factors, {}, 4);
+
+  sym::Linearizationd serial_linearization;
+  sym::Linearizationd parallel_linearization;
+  serial_linearizer.Relinearize(values, &serial_linearization);
+  parallel_linearizer.Relinearize(values, &parallel_linearization);
+
+  CHECK(serial_linearization.rhs == parallel_linearization.rhs);
+  CHECK(BitwiseEqual(serial_linearization.hessian_lower, parallel_linearization.hessian_lower));
+
+  // Check that H = J^T J and rhs = J^T r
+  const Eigen::SparseMatrix<double> jtj =
+      parallel_linearization.jacobian.transpose() * parallel_linearization.jacobian;
+  CHECK(parallel_linearization.hessian_lower.triangularView<Eigen::Lower>().toDense().isApprox(
+      jtj.triangularView<Eigen::Lower>().toDense(), 1e-10));
+  CHECK(parallel_linearization.rhs.isApprox(
+      parallel_linearization.jacobian.transpose() * parallel_linearization.residual, 1e-10));
+}
+
+TEST_CASE("Keys shared by many factors do not add scatter colors", "[linearizer]") {
+  // A pose graph where every pose also has a factor on a single landmark key 'l'
+  std::mt19937 gen(42);
+  const int num_poses = 1000;
+  const std::vector<sym::Factord> pose_graph_factors = BuildPoseGraphFactors(num_poses, gen);
+  std::vector<sym::Factord> factors = pose_graph_factors;
+  for (int i = 0; i < num_poses; ++i) {
+    factors.push_back(sym::Factord::Jacobian(
+        [](const sym::Pose3d& pose, const Eigen::Vector3d& landmark,
+           Eigen::Matrix<double, 3, 1>* const res, Eigen::Matrix<double, 3, 9>* const jac) {
+          *res = pose.Position() - landmark;
+          jac->setZero();
+          jac->block<3, 3>(0, 3) = pose.Rotation().ToRotationMatrix();
+          jac->block<3, 3>(0, 6) = -Eigen::Matrix3d::Identity();
+        },
+        {{'P', i}, 'l'}));
+  }
+
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+  values.Set<Eigen::Vector3d>('l', Eigen::Vector3d(1.0, 2.0, 3.0));
+
+  sym::Linearizer<double> pose_graph_linearizer("pose_graph", pose_graph_factors);
+  sym::Linearizer<double> serial_linearizer("serial", factors);
+  sym::Linearizer<double> parallel_linearizer("parallel", factors, {}, 3);
+
+  sym::Linearizationd pose_graph_linearization;
+  sym::Linearizationd serial_linearization;
+  sym::Linearizationd parallel_linearization;
+  pose_graph_linearizer.Relinearize(values, &pose_graph_linearization);
+  serial_linearizer.Relinearize(values, &serial_linearization);
+  parallel_linearizer.Relinearize(values, &parallel_linearization);
+
+  // The factors on 'l' all go in one serial color, instead of each taking a color of their own
+  CHECK(serial_linearizer.NumScatterColors() == pose_graph_linearizer.NumScatterColors() + 1);
+  CHECK(parallel_linearizer.NumScatterColors() == serial_linearizer.NumScatterColors());
+
+  CHECK(serial_linearization.rhs == parallel_linearization.rhs);
+  CHECK(BitwiseEqual(serial_linearization.hessian_lower, parallel_linearization.hessian_lower));
+
+  const Eigen::SparseMatrix<double> jtj =
+      parallel_linearization.jacobian.transpose() * parallel_linearization.jacobian;
+  CHECK(parallel_linearization.hessian_lower.triangularView<Eigen::Lower>().toDense().isApprox(
+      jtj.triangularView<Eigen::Lower>().toDense(), 1e-10));
+  CHECK(parallel_linearization.rhs.isApprox(
+      parallel_linearization.jacobian.transpose() * parallel_linearization.residual, 1e-10));
+}
+
+TEST_CASE("Arena-backed dense factors match heap-backed dense factors", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 50;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  std::vector<sym::Factord> heap_factors;
+  for (const sym::Factord& factor : factors) {
+    if (factor.IsSparse()) {
+      heap_factors.push_back(factor);
+    } else {
+      CHECK(factor.CanLinearizeInto());
+      heap_factors.push_back(HeapBackedCopy(factor));
+      CHECK(!heap_factors.back().CanLinearizeInto());
+    }
+  }
+
+  sym::Linearizer<double> arena_linearizer("arena", factors);
+  sym::Linearizer<double> heap_linearizer("heap", heap_factors, arena_linearizer.Keys());
+
+  for (int iteration = 0; iteration < 3; ++iteration) {
+    sym::Linearizationd arena_linearization;
+    sym::Linearizationd heap_linearization;
+    arena_linearizer.Relinearize(values, &arena_linearization);
+    heap_linearizer.Relinearize(values, &heap_linearization);
+
+    CHECK(arena_linearization.residual == heap_linearization.residual);
+    CHECK(arena_linearization.rhs == heap_linearization.rhs);
+    CHECK(BitwiseEqual(arena_linearization.jacobian, heap_linearization.jacobian));
+    CHECK(BitwiseEqual(arena_linearization.hessian_lower, heap_linearization.hessian_lower));
+
+    // The linearized factors are still available from the arena
+    const std::vector<sym::Factord::LinearizedDenseFactor> arena_dense_factors =
+        arena_linearizer.CopyLinearizedDenseFactors();
+    const std::vector<sym::Factord::LinearizedDenseFactor>& heap_dense_factors =
+        heap_linearizer.LinearizedFactors().first;
+    REQUIRE(arena_dense_factors.size() == heap_dense_factors.size());
+    CHECK(arena_linearizer.LinearizedFactors().first.size() == arena_dense_factors.size());
+    for (size_t i = 0; i < arena_dense_factors.size(); ++i) {
+      CHECK(arena_dense_factors[i].residual == heap_dense_factors[i].residual);
+      CHECK(arena_dense_factors[i].jacobian == heap_dense_factors[i].jacobian);
+      CHECK(arena_dense_factors[i].rhs == heap_dense_factors[i].rhs);
+      CHECK(arena_dense_factors[i].hessian.triangularView<Eigen::Lower>().toDenseMatrix() ==
+            heap_dense_factors[i].hessian.triangularView<Eigen::Lower>().toDenseMatrix());
+    }
+
+    for (int i = 0; i < num_poses; ++i) {
+      const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+      values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+}
+
+TEST_CASE("LinearizedFactorArena aligns each factor to a cache line", "[linearizer]") {
+  sym::internal::LinearizedFactorArena<double> arena;
+  const std::vector<std::pair<int, int>> dims = {{6, 12}, {1, 1}, {3, 6}, {7, 5}};
+  for (const auto& dim : dims) {
+    arena.Add(dim.first, dim.second);
+  }
+  CHECK(!arena.IsAllocated());
+
+  arena.Allocate();
+  CHECK(arena.IsAllocated());
+  CHECK(arena.NumFactors() == static_cast<int>(dims.size()));
+
+  for (int i = 0; i < arena.NumFactors(); ++i) {
+    const auto views = arena.Views(i);
+    CHECK(reinterpret_cast<uintptr_t>(views.residual.data()) % 64 == 0);
+    CHECK(views.residual.rows() == dims[i].first);
+    CHECK(views.jacobian.rows() == dims[i].first);
+    CHECK(views.jacobian.cols() == dims[i].second);
+    CHECK(views.hessian.rows() == dims[i].second);
+    CHECK(views.hessian.cols() == dims[i].second);
+    CHECK(views.rhs.rows() == dims[i].second);
+    CHECK(views.residual.isZero());
+    CHECK(views.rhs.isZero());
+  }
+}
+
+TEST_CASE("Relinearize does not allocate once initialized", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 30;
+  std::vector<sym::Factord> factors;
+  for (const sym::Factord& factor : BuildPoseGraphFactors(num_poses, gen)) {
+    // Sparse factors allocate when computing their hessian
+    if (!factor.IsSparse()) {
+      factors.push_back(factor);
+    }
+  }
+
+  // A dynamic size dense factor, which is stored outside of the arena
+  factors.emplace_back(
+      [](const sym::Valuesd& values, const std::vector<sym::index_entry_t>& keys,
+         Eigen::VectorXd* const res, Eigen::MatrixXd* const jac, Eigen::MatrixXd* const hess,
+         Eigen::VectorXd* const rhs) {
+        res->resize(3);
+        *res = values.At<sym::Pose3d>(keys[0]).Position();
+        if (jac != nullptr) {
+          jac->setZero(3, 6);
+          jac->rightCols<3>().setIdentity();
+        }
+        if (hess != nullptr) {
+          hess->resize(6, 6);
+          hess->noalias() = jac->transpose() * *jac;
+        }
+        if (rhs != nullptr) {
+          rhs->resize(6);
+          rhs->noalias() = jac->transpose() * *res;
+        }
+      },
+      std::vector<sym::Key>{{'P', 1}});
+
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  for (const int num_threads : {1, 3}) {
+    sym::Linearizer<double> linearizer("linearizer", factors, {}, num_threads);
+    sym::Linearizationd linearization;
+    {
+      // The first call sets up all the storage
+      const sym::AllocationCounter allocations;
+      linearizer.Relinearize(values, &linearization);
+      CHECK((allocations.Count() > 0) == sym::AllocationCounter::IsSupported());
+    }
+
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      for (int i = 0; i < num_poses; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+
+      const sym::AllocationCounter allocations;
+      linearizer.Relinearize(values, &linearization);
+      CHECK(allocations.Count() == 0);
+    }
+  }
+}
+
+TEST_CASE("Incremental relinearization with a zero threshold matches full relinearization",
+          "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 100;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  for (const int num_threads : {1, 3}) {
+    sym::Linearizer<double> linearizer("full", factors, {}, num_threads);
+    sym::Linearizer<double> incremental_linearizer("incremental", factors, {}, num_threads);
+    incremental_linearizer.SetRelinearizationThreshold(0.0);
+    CHECK(incremental_linearizer.RelinearizationThreshold() == 0.0);
+
+    for (int iteration = 0; iteration < 4; ++iteration) {
+      sym::Linearizationd linearization;
+      sym::Linearizationd incremental_linearization;
+      linearizer.Relinearize(values, &linearization);
+      incremental_linearizer.Relinearize(values, &incremental_linearization);
+
+      CHECK(linearization.residual.isApprox(incremental_linearization.residual, 1e-12));
+      CHECK(linearization.rhs.isApprox(incremental_linearization.rhs, 1e-12));
+      CHECK(linearization.jacobian.isApprox(incremental_linearization.jacobian, 1e-12));
+      CHECK(linearization.hessian_lower.isApprox(incremental_linearization.hessian_lower, 1e-12));
+
+      // Only move a few poses, so that only the factors touching them are evaluated again
+      for (int i = 10 * iteration; i < 10 * iteration + 5; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+    }
+
+    CHECK(incremental_linearizer.NumFactorsRelinearized() < static_cast<int>(factors.size()) / 2);
+  }
+}
+
+TEST_CASE("Repeated incremental relinearization matches full relinearization and does not allocate",
+          "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 60;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  // Sparse factors allocate when computing their hessian, so are left out of the allocation checks
+  std::vector<sym::Factord> dense_factors;
+  std::copy_if(factors.begin(), factors.end(), std::back_inserter(dense_factors),
+               [](const sym::Factord& factor) { return !factor.IsSparse(); });
+
+  for (const int num_threads : {1, 3}) {
+    sym::Linearizer<double> linearizer("full", factors, {}, num_threads);
+    sym::Linearizer<double> incremental_linearizer("incremental", factors, {}, num_threads);
+    sym::Linearizer<double> dense_incremental_linearizer("dense_incremental", dense_factors, {},
+                                                         num_threads);
+    incremental_linearizer.SetRelinearizationThreshold(0.0);
+    dense_incremental_linearizer.SetRelinearizationThreshold(0.0);
+
+    sym::Linearizationd linearization;
+    sym::Linearizationd incremental_linearization;
+    sym::Linearizationd dense_incremental_linearization;
+    dense_incremental_linearizer.Relinearize(values, &dense_incremental_linearization);
+
+    // Many rounds of moving a few poses, including rounds that move nothing, so that errors in
+    // updating the combined problem would accumulate
+    std::uniform_int_distribution<int> pose_distribution(0, num_poses - 1);
+    for (int iteration = 0; iteration < 20; ++iteration) {
+      const int num_moved_poses = iteration % 4;
+      for (int k = 0; k < num_moved_poses; ++k) {
+        const sym::Key key = {'P', pose_distribution(gen)};
+        const sym::Pose3d pose = values.At<sym::Pose3d>(key);
+        values.Set<sym::Pose3d>(key, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+
+      linearizer.Relinearize(values, &linearization);
+      incremental_linearizer.Relinearize(values, &incremental_linearization);
+      CHECK(linearization.residual.isApprox(incremental_linearization.residual, 1e-12));
+      CHECK(linearization.rhs.isApprox(incremental_linearization.rhs, 1e-12));
+      CHECK(linearization.jacobian.isApprox(incremental_linearization.jacobian, 1e-12));
+      CHECK(linearization.hessian_lower.isApprox(incremental_linearization.hessian_lower, 1e-12));
+
+      const sym::AllocationCounter allocations;
+      dense_incremental_linearizer.Relinearize(values, &dense_incremental_linearization);
+      CHECK(allocations.Count() == 0);
+    }
+  }
+}
+
+TEST_CASE("Incremental relinearization only relinearizes factors on keys above the threshold",
+          "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 100;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  int num_sparse_factors = 0;
+  int num_factors_on_moved_key = 0;
+  const sym::Key moved_key = {'P', 42};
+  for (const auto& factor : factors) {
+    if (factor.IsSparse()) {
+      ++num_sparse_factors;
+    } else if (std::find(factor.AllKeys().begin(), factor.AllKeys().end(), moved_key) !=
+               factor.AllKeys().end()) {
+      ++num_factors_on_moved_key;
+    }
+  }
+
+  sym::Linearizer<double> linearizer("full", factors);
+  sym::Linearizer<double> incremental_linearizer("incremental", factors);
+  incremental_linearizer.SetRelinearizationThreshold(0.1);
+
+  sym::Linearizationd initial_linearization;
+  incremental_linearizer.Relinearize(values, &initial_linearization);
+  CHECK(incremental_linearizer.NumFactorsRelinearized() == static_cast<int>(factors.size()));
+
+  // Move every pose by less than the threshold.  Only the sparse factors are evaluated again, and
+  // the residual and rhs match a full relinearization to first order
+  for (int i = 0; i < num_poses; ++i) {
+    const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+    values.Set<sym::Pose3d>({'P', i}, pose.Retract(1e-4 * sym::Random<sym::Vector6d>(gen)));
+  }
+
+  sym::Linearizationd linearization;
+  sym::Linearizationd incremental_linearization;
+  linearizer.Relinearize(values, &linearization);
+  incremental_linearizer.Relinearize(values, &incremental_linearization);
+  CHECK(incremental_linearizer.NumFactorsRelinearized() == num_sparse_factors);
+  CHECK(incremental_linearization.hessian_lower.isApprox(initial_linearization.hessian_lower));
+  CHECK(incremental_linearization.residual.isApprox(linearization.residual, 1e-6));
+  CHECK(!incremental_linearization.residual.isApprox(initial_linearization.residual, 1e-6));
+  CHECK(incremental_linearization.rhs.isApprox(linearization.rhs, 1e-3));
+
+  // Move one pose by more than the threshold, which relinearizes the factors touching it
+  const sym::Pose3d moved_pose = values.At<sym::Pose3d>(moved_key);
+  values.Set<sym::Pose3d>(moved_key, moved_pose.Retract(sym::Vector6d::Constant(0.5)));
+  incremental_linearizer.Relinearize(values, &incremental_linearization);
+  CHECK(incremental_linearizer.NumFactorsRelinearized() ==
+        num_sparse_factors + num_factors_on_moved_key);
+
+  // Any change to the structure of the values relinearizes everything
+  values.Set('z', 1.0);
+  incremental_linearizer.Relinearize(values, &incremental_linearization);
+  CHECK(incremental_linearizer.NumFactorsRelinearized() == static_cast<int>(factors.size()));
+}
+
+TEST_CASE("Sparsity pattern matches the pattern built from every scalar nonzero",
+          "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 50;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  const sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  // Order the keys backwards, so some blocks are transposed into the lower triangle
+  std::vector<sym::Key> key_order;
+  for (int i = num_poses - 1; i >= 0; --i) {
+    key_order.push_back({'P', i});
+  }
+
+  sym::Linearizer<double> linearizer("pattern", factors, key_order);
+  sym::Linearizationd linearization;
+  linearizer.Relinearize(values, &linearization);
+
+  // Reference jacobian from one triplet per nonzero, with the dense factors before the sparse ones
+  std::vector<Eigen::Triplet<double>> jacobian_triplets;
+  int residual_offset = 0;
+  for (const bool sparse : {false, true}) {
+    for (const auto& factor : factors) {
+      if (factor.IsSparse() != sparse) {
+        continue;
+      }
+
+      // Pattern of the factor jacobian, with columns in the factor's order
+      Eigen::SparseMatrix<double> factor_jacobian;
+      std::vector<sym::index_entry_t> entries;
+      if (sparse) {
+        sym::Factord::LinearizedSparseFactor linearized_factor{};
+        factor.Linearize(values, &linearized_factor);
+        factor_jacobian = linearized_factor.jacobian;
+        entries = linearized_factor.index.entries;
+      } else {
+        const auto linearized_factor = factor.Linearize(values);
+        factor_jacobian = Eigen::MatrixXd::Ones(linearized_factor.jacobian.rows(),
+                                                linearized_factor.jacobian.cols())
+                              .sparseView();
+        entries = linearized_factor.index.entries;
+      }
+
+      for (const sym::index_entry_t& entry : entries) {
+        const int combined_offset = linearizer.StateIndex().at(entry.key).offset;
+        for (int col = 0; col < entry.tangent_dim; ++col) {
+          for (Eigen::SparseMatrix<double>::InnerIterator it(factor_jacobian, entry.offset + col);
+               it; ++it) {
+            jacobian_triplets.emplace_back(residual_offset + it.row(), combined_offset + col, 1.0);
+          }
+        }
+      }
+      residual_offset += factor_jacobian.rows();
+    }
+  }
+
+  Eigen::SparseMatrix<double> jacobian(linearization.jacobian.rows(),
+                                       linearization.jacobian.cols());
+  jacobian.setFromTriplets(jacobian_triplets.begin(), jacobian_triplets.end());
+  const Eigen::SparseMatrix<double> hessian_lower =
+      Eigen::SparseMatrix<double>(jacobian.transpose() * jacobian).triangularView<Eigen::Lower>();
+
+  const auto same_pattern = [](const Eigen::SparseMatrix<double>& a,
+                               const Eigen::SparseMatrix<double>& b) {
+    return a.rows() == b.rows() && a.cols() == b.cols() && a.nonZeros() == b.nonZeros() &&
+           std::equal(a.outerIndexPtr(), a.outerIndexPtr() + a.outerSize() + 1,
+                      b.outerIndexPtr()) &&
+           std::equal(a.innerIndexPtr(), a.innerIndexPtr() + a.nonZeros(), b.innerIndexPtr());
+  };
+  CHECK(same_pattern(jacobian, linearization.jacobian));
+  CHECK(same_pattern(hessian_lower, linearization.hessian_lower));
+}
+
+TEST_CASE("Block sparse hessian matches the scalar sparse hessian", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 50;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  for (const double threshold : {-1.0, 0.0}) {
+    sym::Linearizer<double> linearizer("scalar", factors);
+    sym::Linearizer<double> block_linearizer("block", factors);
+    block_linearizer.SetBlockSparseHessian(true);
+    CHECK(block_linearizer.BlockSparseHessian());
+    if (threshold >= 0) {
+      block_linearizer.SetRelinearizationThreshold(threshold);
+    }
+
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      sym::Linearizationd linearization;
+      sym::Linearizationd block_linearization;
+      linearizer.Relinearize(values, &linearization);
+      block_linearizer.Relinearize(values, &block_linearization);
+
+      CHECK(!linearization.HasBlockSparseHessian());
+      CHECK(block_linearization.HasBlockSparseHessian());
+      CHECK(block_linearization.hessian_lower_blocks.NumBlockCols() ==
+            static_cast<int>(block_linearizer.Keys().size()));
+      CHECK(linearization.residual == block_linearization.residual);
+      CHECK(linearization.rhs == block_linearization.rhs);
+      CHECK(BitwiseEqual(linearization.jacobian, block_linearization.jacobian));
+      CHECK(Eigen::MatrixXd(linearization.hessian_lower) ==
+            Eigen::MatrixXd(block_linearization.HessianLower()));
+
+      for (int i = 0; i < num_poses; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+    }
+  }
+}
+
+TEST_CASE("EvaluateResidual matches the residual of Relinearize", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 50;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  // Fixed size factors are evaluated straight into the combined residual, so evaluating the
+  // residual of only those does not allocate
+  std::vector<sym::Factord> dense_factors;
+  std::copy_if(factors.begin(), factors.end(), std::back_inserter(dense_factors),
+               [](const sym::Factord& factor) { return !factor.IsSparse(); });
+
+  for (const int num_threads : {1, 3}) {
+    sym::Linearizer<double> linearizer("residual", factors, {}, num_threads);
+    sym::Linearizer<double> dense_linearizer("dense_residual", dense_factors, {}, num_threads);
+    sym::Linearizationd linearization;
+    sym::Linearizationd dense_linearization;
+    linearizer.Relinearize(values, &linearization);
+    dense_linearizer.Relinearize(values, &dense_linearization);
+
+    Eigen::VectorXd dense_residual(dense_linearization.residual.size());
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      for (int i = 0; i < num_poses; ++i) {
+        const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+        values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+      }
+
+      Eigen::VectorXd residual;
+      linearizer.EvaluateResidual(values, &residual);
+      linearizer.Relinearize(values, &linearization);
+      CHECK(residual == linearization.residual);
+
+      {
+        const sym::AllocationCounter allocations;
+        dense_linearizer.EvaluateResidual(values, &dense_residual);
+        CHECK(allocations.Count() == 0);
+      }
+      dense_linearizer.Relinearize(values, &dense_linearization);
+      CHECK(dense_residual == dense_linearization.residual);
+    }
+  }
+}
+
+TEST_CASE("Hessian only linearization matches the full linearization", "[linearizer]") {
+  std::mt19937 gen(42);
+  const int num_poses = 50;
+  const std::vector<sym::Factord> factors = BuildPoseGraphFactors(num_poses, gen);
+  sym::Valuesd values = BuildPoseGraphValues(factors, num_poses, gen);
+
+  for (const bool block_sparse_hessian : {false, true}) {
+    for (const double threshold : {-1.0, 0.0}) {
+      sym::Linearizer<double> linearizer("full", factors);
+      sym::Linearizer<double> hessian_only_linearizer("hessian_only", factors, {}, 3);
+      linearizer.SetBlockSparseHessian(block_sparse_hessian);
+      hessian_only_linearizer.SetBlockSparseHessian(block_sparse_hessian);
+      hessian_only_linearizer.SetHessianOnly(true);
+      CHECK(hessian_only_linearizer.HessianOnly());
+      hessian_only_linearizer.SetRelinearizationThreshold(threshold);
+
+      for (int iteration = 0; iteration < 3; ++iteration) {
+        sym::Linearizationd linearization;
+        sym::Linearizationd hessian_only_linearization;
+        linearizer.Relinearize(values, &linearization);
+        hessian_only_linearizer.Relinearize(values, &hessian_only_linearization);
+
+        CHECK(linearization.HasJacobian());
+        CHECK(!hessian_only_linearization.HasJacobian());
+        CHECK(hessian_only_linearization.jacobian.nonZeros() == 0);
+        CHECK(linearization.residual == hessian_only_linearization.residual);
+        CHECK(linearization.rhs == hessian_only_linearization.rhs);
+        CHECK(Eigen::MatrixXd(linearization.HessianLower()) ==
+              Eigen::MatrixXd(hessian_only_linearization.HessianLower()));
+
+        // The linear error from the hessian matches the linear error from the jacobian
+        const Eigen::VectorXd update = 0.1 * Eigen::VectorXd::Random(linearization.rhs.size());
+        CHECK(hessian_only_linearization.LinearError(update) ==
+              Catch::Approx(linearization.LinearError(update)).epsilon(1e-10));
+
+        // The predicted reduction is computed directly rather than as a difference of errors, so
+        // the two agree even for an update whose reduction is far below the precision of the error
+        Eigen::VectorXd workspace;
+        const Eigen::VectorXd small_update = 1e-9 * update;
+        CHECK(hessian_only_linearization.LinearErrorReduction(small_update, &workspace) ==
+              Catch::Approx(linearization.LinearErrorReduction(small_update, &workspace))
+                  .epsilon(1e-10));
+        CHECK(linearization.LinearErrorReduction(update, &workspace) ==
+              Catch::Approx(linearization.Error() - linearization.LinearError(update))
+                  .epsilon(1e-8));
+
+        for (int i = 0; i < num_poses; ++i) {
+          const sym::Pose3d pose = values.At<sym::Pose3d>({'P', i});
+          values.Set<sym::Pose3d>({'P', i}, pose.Retract(0.1 * sym::Random<sym::Vector6d>(gen)));
+        }
+      }
+    }
+  }
+}
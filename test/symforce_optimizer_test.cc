@@ -11,6 +11,8 @@
 #include <sym/factors/between_factor_rot3.h>
 #include <sym/factors/prior_factor_pose3.h>
 #include <sym/factors/prior_factor_rot3.h>
+#include <sym/ops/lie_group_ops.h>
+#include <symforce/opt/batch_optimizer.h>
 #include <symforce/opt/optimizer.h>
 
 sym::optimizer_params_t DefaultLmParams() {
@@ -366,4 +368,458 @@ TEST_CASE("Check that we can change linear solvers", "[optimizer]") {
       DefaultLmParams(), {}, 1e-10, "sym::Optimizer", {}, false, false,
       sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>(
           Eigen::NaturalOrdering<Eigen::SparseMatrix<double>::StorageIndex>()));
+
+  sym::Optimizerd optimizer3(
+      DefaultLmParams(), {}, 1e-10, "sym::Optimizer", {}, false, false,
+      sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>(
+          Eigen::MetisOrdering<Eigen::SparseMatrix<double>::StorageIndex>(),
+          sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>::Factorization::SUPERNODAL));
+}
+
+/**
+ * Test that optimizing with a SparseSchurSolver matches the default solver, on a problem where a
+ * set of "landmark" poses are each only coupled to two of a chain of "camera" poses
+ */
+TEST_CASE("Optimizing with a SparseSchurSolver matches the default solver", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_cameras = 6;
+  const int num_landmarks = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_cameras - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+  for (int j = 0; j < num_landmarks; ++j) {
+    for (const int i : {j % num_cameras, (j + 1) % num_cameras}) {
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'L', j}, {'M', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'L', j}}));
+    }
+  }
+
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_cameras; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+  }
+  for (int j = 0; j < num_landmarks; ++j) {
+    values.Set<sym::Pose3d>({'L', j}, sym::Random<sym::Pose3d>(gen));
+    for (int i = 0; i < num_cameras; ++i) {
+      values.Set<sym::Pose3d>({'M', i, j},
+                              sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', epsilon);
+
+  const sym::optimizer_params_t params = DefaultLmParams();
+
+  sym::Valuesd default_values = values;
+  sym::Optimizerd default_optimizer(params, factors, epsilon);
+  const auto default_stats = default_optimizer.Optimize(&default_values);
+
+  using SchurSolver = sym::SparseSchurSolver<Eigen::SparseMatrix<double>>;
+  sym::Valuesd schur_values = values;
+  sym::Optimizer<double, sym::LevenbergMarquardtSolver<double, SchurSolver>> schur_optimizer(
+      params, factors, epsilon);
+  const auto schur_stats = schur_optimizer.Optimize(&schur_values);
+
+  // The landmarks are moved after the cameras, although they sort first
+  const std::vector<sym::Key>& keys = schur_optimizer.Keys();
+  REQUIRE(keys.size() == static_cast<size_t>(num_cameras + num_landmarks));
+  for (int i = 0; i < num_cameras; ++i) {
+    CHECK(keys[i] == sym::Key('P', i));
+  }
+  for (int j = 0; j < num_landmarks; ++j) {
+    CHECK(keys[num_cameras + j] == sym::Key('L', j));
+  }
+
+  CHECK(schur_stats.iterations.size() == default_stats.iterations.size());
+  CHECK(schur_stats.iterations[schur_stats.best_index].new_error ==
+        Catch::Approx(default_stats.iterations[default_stats.best_index].new_error)
+            .epsilon(1e-8));
+  for (const sym::Key& key : keys) {
+    CHECK(sym::IsClose(schur_values.At<sym::Pose3d>(key), default_values.At<sym::Pose3d>(key),
+                       1e-6));
+  }
+}
+
+TEST_CASE("ComputeAllCovariances matches the inverse of the hessian", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, (i + 5) % num_poses}) {
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+    }
+  }
+
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    for (int j = 0; j < num_poses; ++j) {
+      values.Set<sym::Pose3d>({'T', i, j},
+                              sym::Pose3d::FromTangent(0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', epsilon);
+
+  // Counts the orderings computed, to check that the covariances are computed with the ordering
+  // of the optimizer's linear solver, and when they reuse the symbolic factorization
+  using LinearSolver = sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>;
+  const auto num_orderings = std::make_shared<int>(0);
+  const LinearSolver::Ordering counting_ordering =
+      [num_orderings](const Eigen::SparseMatrix<double>& A,
+                      LinearSolver::PermutationMatrixType& permutation) {
+        ++*num_orderings;
+        Eigen::MetisOrdering<int>()(A, permutation);
+      };
+
+  sym::Optimizerd optimizer(DefaultLmParams(), factors, epsilon, "sym::Optimize", {},
+                            /* debug_stats */ false, /* check_derivatives */ false,
+                            LinearSolver(counting_ordering));
+  optimizer.Optimize(&values);
+  const int num_optimize_orderings = *num_orderings;
+
+  const sym::Linearizationd linearization = optimizer.Linearize(values);
+  std::unordered_map<sym::Key, Eigen::MatrixXd> covariances_by_key;
+  optimizer.ComputeAllCovariances(linearization, &covariances_by_key);
+  REQUIRE(covariances_by_key.size() == static_cast<size_t>(num_poses));
+  CHECK(*num_orderings == num_optimize_orderings + 1);
+
+  Eigen::MatrixXd hessian =
+      Eigen::MatrixXd(linearization.hessian_lower).selfadjointView<Eigen::Lower>();
+  hessian.diagonal().array() += epsilon;
+  const Eigen::MatrixXd covariance = hessian.inverse();
+
+  // The keys are in order in the state vector, each with dimension 6
+  const std::vector<sym::Key>& keys = optimizer.Keys();
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    CHECK(covariances_by_key.at(keys[i]).isApprox(covariance.block<6, 6>(6 * i, 6 * i), 1e-8));
+  }
+
+  // Calling again reuses the symbolic factorization
+  optimizer.ComputeAllCovariances(linearization, &covariances_by_key);
+  CHECK(covariances_by_key.at(keys[0]).isApprox(covariance.block<6, 6>(0, 0), 1e-8));
+  CHECK(*num_orderings == num_optimize_orderings + 1);
+
+  // A hessian with a different sparsity pattern, here with a new entry coupling the first and
+  // eleventh poses, is analyzed again
+  sym::Linearizationd coupled_linearization = linearization;
+  coupled_linearization.hessian_lower.coeffRef(60, 0) += 1e-3;
+  coupled_linearization.hessian_lower.makeCompressed();
+  optimizer.ComputeAllCovariances(coupled_linearization, &covariances_by_key);
+  CHECK(*num_orderings == num_optimize_orderings + 2);
+
+  Eigen::MatrixXd coupled_hessian =
+      Eigen::MatrixXd(coupled_linearization.hessian_lower).selfadjointView<Eigen::Lower>();
+  coupled_hessian.diagonal().array() += epsilon;
+  const Eigen::MatrixXd coupled_covariance = coupled_hessian.inverse();
+  for (int i = 0; i < static_cast<int>(keys.size()); ++i) {
+    CHECK(covariances_by_key.at(keys[i]).isApprox(coupled_covariance.block<6, 6>(6 * i, 6 * i),
+                                                  1e-8));
+  }
+}
+
+TEST_CASE("Deferred linearization matches full linearization of every step", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    for (const int j : {i + 1, (i + 5) % num_poses}) {
+      factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                              {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'},
+                                              {{'P', i}, {'P', j}}));
+    }
+  }
+
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    for (int j = 0; j < num_poses; ++j) {
+      values.Set<sym::Pose3d>({'T', i, j},
+                              sym::Pose3d::FromTangent(0.1 * sym::Random<sym::Vector6d>(gen)));
+    }
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', epsilon);
+
+  // A small initial lambda, so that some steps are rejected
+  sym::optimizer_params_t params = DefaultLmParams();
+  params.initial_lambda = 1e-6;
+
+  sym::Valuesd full_values = values;
+  sym::Optimizerd full_optimizer(params, factors, epsilon);
+  const auto full_stats = full_optimizer.Optimize(&full_values, -1, true);
+
+  params.defer_linearization = true;
+  sym::Valuesd deferred_values = values;
+  sym::Optimizerd deferred_optimizer(params, factors, epsilon);
+  const auto deferred_stats = deferred_optimizer.Optimize(&deferred_values, -1, true);
+
+  // Every step is the same, but rejected steps are only evaluated residual-only
+  REQUIRE(deferred_stats.iterations.size() == full_stats.iterations.size());
+  int num_rejected = 0;
+  for (size_t i = 0; i < full_stats.iterations.size(); ++i) {
+    const auto& full_iteration = full_stats.iterations[i];
+    const auto& deferred_iteration = deferred_stats.iterations[i];
+    CHECK(deferred_iteration.new_error == full_iteration.new_error);
+    CHECK(deferred_iteration.update_accepted == full_iteration.update_accepted);
+    CHECK(full_iteration.linearized);
+    if (deferred_iteration.iteration >= 0 && !deferred_iteration.update_accepted) {
+      CHECK(!deferred_iteration.linearized);
+      ++num_rejected;
+    } else {
+      CHECK(deferred_iteration.linearized);
+    }
+  }
+  CHECK(num_rejected > 0);
+
+  CHECK(deferred_stats.best_index == full_stats.best_index);
+  CHECK(deferred_stats.best_linearization->residual == full_stats.best_linearization->residual);
+  CHECK(deferred_stats.best_linearization->rhs == full_stats.best_linearization->rhs);
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(deferred_values.At<sym::Pose3d>({'P', i}).Data() ==
+          full_values.At<sym::Pose3d>({'P', i}).Data());
+  }
+
+  // The debug stats need every jacobian, so every step is linearized
+  sym::Valuesd debug_values = values;
+  sym::Optimizerd debug_optimizer(params, factors, epsilon, "sym::Optimize", {},
+                                  /* debug_stats */ true);
+  const auto debug_stats = debug_optimizer.Optimize(&debug_values);
+  for (const auto& iteration : debug_stats.iterations) {
+    CHECK(iteration.linearized);
+  }
+}
+
+TEST_CASE("Hessian only linearization matches the full linearization", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', epsilon);
+
+  sym::optimizer_params_t params = DefaultLmParams();
+
+  sym::Valuesd full_values = values;
+  sym::Optimizerd full_optimizer(params, factors, epsilon);
+  const auto full_stats = full_optimizer.Optimize(&full_values, -1, true);
+
+  params.hessian_only_linearization = true;
+  sym::Valuesd hessian_only_values = values;
+  sym::Optimizerd hessian_only_optimizer(params, factors, epsilon);
+  const auto hessian_only_stats = hessian_only_optimizer.Optimize(&hessian_only_values, -1, true);
+
+  CHECK(full_stats.best_linearization->HasJacobian());
+  CHECK(!hessian_only_stats.best_linearization->HasJacobian());
+
+  REQUIRE(hessian_only_stats.iterations.size() == full_stats.iterations.size());
+  for (size_t i = 0; i < full_stats.iterations.size(); ++i) {
+    CHECK(hessian_only_stats.iterations[i].new_error == full_stats.iterations[i].new_error);
+    CHECK(hessian_only_stats.iterations[i].new_error_linear ==
+          Catch::Approx(full_stats.iterations[i].new_error_linear).epsilon(1e-4));
+  }
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(hessian_only_values.At<sym::Pose3d>({'P', i}).Data() ==
+          full_values.At<sym::Pose3d>({'P', i}).Data());
+  }
+}
+
+TEST_CASE("BatchOptimizer matches optimizing each problem separately", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_poses = 5;
+  const int num_problems = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+
+  // Problems with the same structure and different initial values and measurements
+  std::mt19937 gen(42);
+  std::vector<sym::Valuesd> problems(num_problems);
+  for (sym::Valuesd& values : problems) {
+    values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+    for (int i = 0; i < num_poses; ++i) {
+      values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+      values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+    }
+    values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+    values.Set('e', epsilon);
+  }
+
+  sym::optimizer_params_t params = DefaultLmParams();
+  params.verbose = false;
+
+  std::vector<sym::Valuesd> expected_values = problems;
+  std::vector<sym::OptimizationStatsd> expected_stats;
+  for (sym::Valuesd& values : expected_values) {
+    sym::Optimizerd optimizer(params, factors, epsilon);
+    expected_stats.push_back(optimizer.Optimize(&values));
+  }
+
+  const auto check_matches = [&](const std::vector<sym::Valuesd>& values,
+                                 const std::vector<sym::OptimizationStatsd>& stats) {
+    REQUIRE(values.size() == expected_values.size());
+    REQUIRE(stats.size() == expected_stats.size());
+    for (int problem = 0; problem < num_problems; ++problem) {
+      CHECK(stats[problem].iterations.size() == expected_stats[problem].iterations.size());
+      CHECK(stats[problem].best_index == expected_stats[problem].best_index);
+      CHECK(stats[problem].iterations.back().new_error ==
+            expected_stats[problem].iterations.back().new_error);
+      for (int i = 0; i < num_poses; ++i) {
+        CHECK(values[problem].At<sym::Pose3d>({'P', i}).Data() ==
+              expected_values[problem].At<sym::Pose3d>({'P', i}).Data());
+      }
+    }
+  };
+
+  for (const int num_threads : {1, 4}) {
+    params.num_threads = num_threads;
+    sym::BatchOptimizerd batch_optimizer(params, factors, epsilon);
+    CHECK(batch_optimizer.NumThreads() == num_threads);
+
+    // Optimize twice, so that the second batch reuses the setup of the first
+    for (int batch = 0; batch < 2; ++batch) {
+      std::vector<sym::Valuesd> values = problems;
+      const std::vector<sym::OptimizationStatsd> stats = batch_optimizer.Optimize(&values);
+      check_matches(values, stats);
+    }
+
+    // The ordering is computed once, and looked up by every other problem
+    CHECK(batch_optimizer.OrderingCache()->Size() == 1);
+    CHECK(batch_optimizer.OrderingCache()->Misses() == 1);
+  }
+}
+
+TEST_CASE("Speculative lambdas take the steps of standard LM in fewer iterations", "[optimizer]") {
+  const double epsilon = 1e-10;
+  const int num_poses = 20;
+
+  std::vector<sym::Factord> factors;
+  factors.push_back(sym::Factord::Hessian(sym::PriorFactorPose3<double>,
+                                          {{'P', 0}, {'Q', 0}, 'S', 'e'}, {{'P', 0}}));
+  for (int i = 0; i < num_poses - 1; ++i) {
+    factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                            {{'P', i}, {'P', i + 1}, {'T', i}, 'S', 'e'},
+                                            {{'P', i}, {'P', i + 1}}));
+  }
+
+  std::mt19937 gen(42);
+  sym::Valuesd values;
+  values.Set<sym::Pose3d>({'Q', 0}, sym::Pose3d());
+  for (int i = 0; i < num_poses; ++i) {
+    values.Set<sym::Pose3d>({'P', i}, sym::Random<sym::Pose3d>(gen));
+    values.Set<sym::Pose3d>({'T', i}, sym::Pose3d::FromTangent(sym::Random<sym::Vector6d>(gen)));
+  }
+  values.Set<sym::Matrix66d>('S', sym::Matrix66d::Identity());
+  values.Set('e', epsilon);
+
+  // A small initial lambda, so that standard LM rejects steps while lambda increases
+  sym::optimizer_params_t params = DefaultLmParams();
+  params.verbose = false;
+  params.initial_lambda = 1e-6;
+
+  sym::Valuesd standard_values = values;
+  sym::Optimizerd standard_optimizer(params, factors, epsilon);
+  const auto standard_stats = standard_optimizer.Optimize(&standard_values);
+
+  params.speculative_lambdas = 4;
+  std::vector<sym::OptimizationStatsd> speculative_stats;
+  std::vector<sym::Valuesd> speculative_values;
+  for (const int num_threads : {1, 4}) {
+    params.num_threads = num_threads;
+    speculative_values.push_back(values);
+    sym::Optimizerd speculative_optimizer(params, factors, epsilon);
+    speculative_stats.push_back(speculative_optimizer.Optimize(&speculative_values.back()));
+  }
+
+  // A multithreaded linear solver, whose copies share its threads
+  {
+    using LinearSolver = sym::SparseCholeskySolver<Eigen::SparseMatrix<double>>;
+    speculative_values.push_back(values);
+    sym::Optimizerd speculative_optimizer(
+        params, factors, epsilon, "sym::Optimize", {}, /* debug_stats */ false,
+        /* check_derivatives */ false,
+        LinearSolver(Eigen::MetisOrdering<int>(), LinearSolver::Factorization::SIMPLICIAL, 4));
+    speculative_stats.push_back(speculative_optimizer.Optimize(&speculative_values.back()));
+  }
+
+  const auto accepted_iterations = [](const sym::OptimizationStatsd& stats) {
+    std::vector<sym::optimization_iteration_t> accepted;
+    std::copy_if(stats.iterations.begin() + 1, stats.iterations.end(),
+                 std::back_inserter(accepted),
+                 [](const sym::optimization_iteration_t& iteration) {
+                   return iteration.update_accepted;
+                 });
+    return accepted;
+  };
+
+  // The accepted steps are the same, without most of the rejected iterations
+  const auto& stats = speculative_stats.front();
+  CHECK(stats.iterations.size() < standard_stats.iterations.size());
+  const auto standard_accepted = accepted_iterations(standard_stats);
+  const auto speculative_accepted = accepted_iterations(stats);
+  REQUIRE(speculative_accepted.size() == standard_accepted.size());
+  for (size_t i = 0; i < standard_accepted.size(); ++i) {
+    CHECK(speculative_accepted[i].new_error == standard_accepted[i].new_error);
+    CHECK(speculative_accepted[i].current_lambda == standard_accepted[i].current_lambda);
+  }
+  for (int i = 0; i < num_poses; ++i) {
+    CHECK(speculative_values.front().At<sym::Pose3d>({'P', i}).Data() ==
+          standard_values.At<sym::Pose3d>({'P', i}).Data());
+  }
+
+  // The result does not depend on the number of threads
+  for (size_t run = 1; run < speculative_stats.size(); ++run) {
+    const auto& threaded_stats = speculative_stats[run];
+    REQUIRE(threaded_stats.iterations.size() == stats.iterations.size());
+    for (size_t i = 0; i < stats.iterations.size(); ++i) {
+      CHECK(threaded_stats.iterations[i].new_error == stats.iterations[i].new_error);
+    }
+    for (int i = 0; i < num_poses; ++i) {
+      CHECK(speculative_values[run].At<sym::Pose3d>({'P', i}).Data() ==
+            speculative_values.front().At<sym::Pose3d>({'P', i}).Data());
+    }
+  }
 }
@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------------
+ * SymForce - Copyright 2022, Skydio, Inc.
+ * This source code is under the Apache 2.0 license found in the LICENSE file.
+ * ---------------------------------------------------------------------------- */
+
+#include <random>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Sparse>
+#include <catch2/catch_test_macros.hpp>
+
+#include <sym/factors/between_factor_pose3.h>
+#include <sym/factors/prior_factor_pose3.h>
+#include <symforce/opt/factor.h>
+#include <symforce/opt/linearizer.h>
+#include <symforce/opt/optimizer.h>
+#include <symforce/opt/static_factor_graph.h>
+#include <symforce/opt/util.h>
+#include <symforce/opt/values.h>
+
+namespace {
+
+using PriorFunctor = SYM_FUNCTION_FUNCTOR(sym::PriorFactorPose3<double>);
+using BetweenFunctor = SYM_FUNCTION_FUNCTOR(sym::BetweenFactorPose3<double>);
+using PoseGraph = sym::StaticFactorGraph<double, PriorFunctor, BetweenFunctor>;
+
+/**
+ * Build a pose graph with priors and between factors, both as a StaticFactorGraph and as
+ * individual factors in the same order
+ */
+PoseGraph BuildPoseGraph(const int num_poses, std::vector<sym::Factord>* const factors) {
+  PoseGraph graph;
+  std::vector<sym::Factord> prior_factors;
+  std::vector<sym::Factord> between_factors;
+
+  for (int i = 0; i < num_poses; ++i) {
+    const std::vector<sym::Key> prior_keys = {{'P', i}, {'T', i, i}, 'S', 'e'};
+    graph.Add<PriorFunctor>(prior_keys, {{'P', i}});
+    prior_factors.push_back(
+        sym::Factord::Hessian(sym::PriorFactorPose3<double>, prior_keys, {{'P', i}}));
+
+    for (const int j : {i + 1, i + 4}) {
+      if (j < num_poses) {
+        const std::vector<sym::Key> between_keys = {{'P', i}, {'P', j}, {'T', i, j}, 'S', 'e'};
+        graph.Add<1>(between_keys, {{'P', i}, {'P', j}});
+        between_factors.push_back(sym::Factord::Hessian(sym::BetweenFactorPose3<double>,
+                                                        between_keys, {{'P', i}, {'P', j}}));
+      }
+    }
+  }
+
+  factors->clear();
+  factors->insert(factors->end(), prior_factors.begin(), prior_factors.end());
+  factors->insert(factors->end(), between_factors.begin(), between_factors.end());
+  return graph;
+}
+
+sym::Valuesd BuildValues(const std::vector<sym::Factord>& factors, std::mt19937& gen) {
+  sym::Valuesd values;
+  for (const auto& factor : factors) {
+    for (const auto& key : factor.AllKeys()) {
+      if ((key.Letter() == 'P' || key.Letter() == 'T') && !values.Has(key)) {
+        values.Set<sym::Pose3d>(key, sym::Random<sym::Pose3d>(gen));
+      }
+    }
+  }
+
+  values.Set<Eigen::Matrix<double, 6, 6>>('S', Eigen::Matrix<double, 6, 6>::Identity());
+  values.Set('e', sym::kDefaultEpsilond);
+  return values;
+}
+
+}  // namespace
+
+TEST_CASE("StaticFactorGraph stores factors grouped by type", "[static_factor_graph]") {
+  std::vector<sym::Factord> factors;
+  const PoseGraph graph = BuildPoseGraph(10, &factors);
+
+  CHECK(PoseGraph::kNumFactorTypes == 2);
+  CHECK(graph.NumFactors<0>() == 10);
+  CHECK(graph.NumFactors<1>() == 9 + 6);
+  CHECK(graph.NumFactors() == static_cast<int>(factors.size()));
+
+  const std::vector<sym::Factord> graph_factors = graph.Factors();
+  REQUIRE(graph_factors.size() == factors.size());
+  for (size_t i = 0; i < factors.size(); ++i) {
+    CHECK(graph_factors[i].AllKeys() == factors[i].AllKeys());
+    CHECK(graph_factors[i].OptimizedKeys() == factors[i].OptimizedKeys());
+    CHECK(graph_factors[i].BatchKernel() != nullptr);
+  }
+
+  // One kernel per factor type
+  CHECK(graph_factors.front().BatchKernel() == graph_factors[9].BatchKernel());
+  CHECK(graph_factors[9].BatchKernel() != graph_factors[10].BatchKernel());
+  CHECK(graph_factors[10].BatchKernel() == graph_factors.back().BatchKernel());
+}
+
+TEST_CASE("StaticFactorGraph matches dynamically dispatched factors", "[static_factor_graph]") {
+  std::mt19937 gen(42);
+  std::vector<sym::Factord> factors;
+  const PoseGraph graph = BuildPoseGraph(25, &factors);
+  const sym::Valuesd values = BuildValues(factors, gen);
+
+  sym::Linearizer<double> linearizer("dynamic", factors);
+  const std::vector<sym::Factord> graph_factors = graph.Factors();
+  sym::Linearizer<double> graph_linearizer("static", graph_factors);
+  sym::Linearizationd linearization;
+  sym::Linearizationd graph_linearization;
+  linearizer.Relinearize(values, &linearization);
+  graph_linearizer.Relinearize(values, &graph_linearization);
+
+  CHECK(linearization.residual == graph_linearization.residual);
+  CHECK(linearization.rhs == graph_linearization.rhs);
+  CHECK(Eigen::MatrixXd(linearization.hessian_lower) ==
+        Eigen::MatrixXd(graph_linearization.hessian_lower));
+
+  // Optimize both to the same result
+  sym::Valuesd optimized_values = values;
+  sym::Valuesd graph_optimized_values = values;
+  sym::Optimizerd optimizer(sym::DefaultOptimizerParams(), factors);
+  sym::Optimizerd graph_optimizer(sym::DefaultOptimizerParams(), graph_factors);
+  optimizer.Optimize(&optimized_values);
+  graph_optimizer.Optimize(&graph_optimized_values);
+
+  for (const sym::Key& key : optimizer.Keys()) {
+    CHECK(optimized_values.At<sym::Pose3d>(key).Data() ==
+          graph_optimized_values.At<sym::Pose3d>(key).Data());
+  }
+}
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include <catch2/catch_approx.hpp>
 #include <catch2/catch_template_test_macros.hpp>
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/ostream.h>
@@ -388,3 +389,57 @@ TEST_CASE("Test Set with Eigen expressions", "[values]") {
   CHECK(values.At<Eigen::Vector3d>('b') == Eigen::Vector3d::Constant(2));
   CHECK(values.At<Eigen::Vector3d>('a') == Eigen::Vector3d::Zero());
 }
+
+TEST_CASE("Test MapAt", "[values]") {
+  sym::Valuesd values;
+  values.Set<double>('s', 1.5);
+  values.Set<sym::Rot3d>('R', sym::Rot3d::FromYawPitchRoll(0.1, 0.2, 0.3));
+  values.Set<double>('t', 2.5);
+  values.Set<sym::Rot3d>('Q', sym::Rot3d::FromYawPitchRoll(0.3, 0.2, 0.1));
+  values.Set<sym::Pose3d>('P', sym::Pose3d(sym::Rot3d::FromYawPitchRoll(0.2, 0.1, 0.3),
+                                           Eigen::Vector3d(1.0, 2.0, 3.0)));
+  values.Set('v', Eigen::Vector3d(4.0, 5.0, 6.0));
+  values.Set('m', Eigen::Matrix2d::Identity());
+
+  const sym::index_t index = values.CreateIndex({'s', 'R', 't', 'Q', 'P', 'v', 'm'});
+  const auto storage = [&values](const sym::index_entry_t& entry) {
+    return values.Data().data() + entry.offset;
+  };
+
+  // Scalars and geo types are views that hold a value equal to At() and convert to a const
+  // reference
+  const sym::ValueView<double> s = values.MapAt<double>(index.entries[0]);
+  CHECK(*s == 1.5);
+
+  for (const int i : {1, 3}) {
+    const sym::ValueView<sym::Rot3d> rot = values.MapAt<sym::Rot3d>(index.entries[i]);
+    CHECK(rot->Data() == Eigen::Map<const Eigen::Vector4d>(storage(index.entries[i])));
+
+    // Copies hold their own value
+    const sym::ValueView<sym::Rot3d> rot_copy = rot;
+    CHECK(rot_copy->Data() == rot->Data());
+    CHECK(&rot_copy.Get() != &rot.Get());
+  }
+
+  const sym::ValueView<sym::Pose3d> pose = values.MapAt<sym::Pose3d>(index.entries[4]);
+  const sym::Pose3d& pose_reference = pose;
+  CHECK(pose_reference.Data() == values.At<sym::Pose3d>('P').Data());
+
+  // Matrices are Eigen::Maps
+  const Eigen::Map<const Eigen::Vector3d> v = values.MapAt<Eigen::Vector3d>(index.entries[5]);
+  CHECK(v.data() == storage(index.entries[5]));
+  CHECK(v == Eigen::Vector3d(4.0, 5.0, 6.0));
+
+  const Eigen::Map<const Eigen::Matrix2d> m = values.MapAt<Eigen::Matrix2d>(index.entries[6]);
+  CHECK(m.data() == storage(index.entries[6]));
+  CHECK(m == Eigen::Matrix2d::Identity());
+
+  // Type mismatches are caught
+  CHECK_THROWS_AS(values.MapAt<sym::Pose3d>(index.entries[1]), std::runtime_error);
+
+  // Rotations are copied as stored, while At() normalizes them
+  const Eigen::Vector4d unnormalized = 1.1 * Eigen::Vector4d(0.1, 0.2, 0.3, 0.9).normalized();
+  values.Set<sym::Rot3d>('R', sym::Rot3d::FromNormalizedData(unnormalized));
+  CHECK(values.MapAt<sym::Rot3d>(index.entries[1])->Data() == unnormalized);
+  CHECK(values.At<sym::Rot3d>(index.entries[1]).Data().norm() == Catch::Approx(1.0));
+}